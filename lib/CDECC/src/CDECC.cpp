@@ -0,0 +1,183 @@
+/*
+ * CD-ROM sector EDC and ECC generation suitable for embedded systems.
+ *
+ *  Copyright (c) 2024 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Refer to ECMA-130 Annex A (EDC) and Annex A/B (RSPC, P and Q parity).
+//
+// EDC is a CRC32 with polynomial (x^16 + x^15 + x^2 + 1)(x^16 + x^2 + x + 1),
+// computed LSB first. It is processed 32 bits at a time using four lookup tables.
+//
+// The P and Q parity are Reed-Solomon codes over GF(2^8) with polynomial
+// x^8 + x^4 + x^3 + x^2 + 1. The sector data is treated as 16-bit words, so each
+// parity column has one byte for the LSB and one for the MSB. Four columns
+// are computed at once by packing them into a 32-bit word, where multiplication
+// by the primitive element can be done for all bytes in parallel.
+
+#include "CDECC.h"
+#include <string.h>
+
+static uint32_t g_edc_table[4][256];
+static uint8_t g_ecc_div3_table[256];
+static bool g_tables_initialized;
+
+// Multiply each byte of the word by 2 in GF(2^8)
+static inline uint32_t gf_mul2x4(uint32_t v)
+{
+    return ((v & 0x7F7F7F7F) << 1) ^ (((v >> 7) & 0x01010101) * 0x1D);
+}
+
+static void init_tables()
+{
+    for (int i = 0; i < 256; i++)
+    {
+        uint32_t edc = i;
+        for (int j = 0; j < 8; j++)
+        {
+            edc = (edc >> 1) ^ ((edc & 1) ? 0xD8018001 : 0);
+        }
+        g_edc_table[0][i] = edc;
+
+        // Division by 3 (= 2 + 1) is used for the final step of parity calculation
+        uint8_t mul3 = (uint8_t)(gf_mul2x4(i) ^ i);
+        g_ecc_div3_table[mul3] = i;
+    }
+
+    for (int i = 0; i < 256; i++)
+    {
+        for (int k = 1; k < 4; k++)
+        {
+            uint32_t prev = g_edc_table[k - 1][i];
+            g_edc_table[k][i] = (prev >> 8) ^ g_edc_table[0][prev & 0xFF];
+        }
+    }
+
+    g_tables_initialized = true;
+}
+
+uint32_t cdecc_edc(const uint8_t *data, uint32_t len, uint32_t edc)
+{
+    if (!g_tables_initialized) init_tables();
+
+    while (len >= 4)
+    {
+        edc ^= (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+               ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+        edc = g_edc_table[3][edc & 0xFF] ^
+              g_edc_table[2][(edc >> 8) & 0xFF] ^
+              g_edc_table[1][(edc >> 16) & 0xFF] ^
+              g_edc_table[0][edc >> 24];
+        data += 4;
+        len -= 4;
+    }
+
+    while (len > 0)
+    {
+        edc = (edc >> 8) ^ g_edc_table[0][(edc ^ *data++) & 0xFF];
+        len--;
+    }
+
+    return edc;
+}
+
+// Compute parity for major_count columns of minor_count bytes.
+// Column 2*k starts at byte k * major_mult, and column 2*k+1 on the next byte.
+// Consecutive bytes in a column are minor_inc bytes apart, wrapping at end of data.
+static void ecc_compute_block(const uint8_t *src, uint32_t major_count, uint32_t minor_count,
+                              uint32_t major_mult, uint32_t minor_inc, uint8_t *dest)
+{
+    uint32_t size = major_count * minor_count;
+    uint32_t pairs = major_count / 2;
+
+    for (uint32_t k = 0; k < pairs; k += 2)
+    {
+        bool two = (k + 1 < pairs);
+        uint32_t idx1 = k * major_mult;
+        uint32_t idx2 = idx1 + major_mult;
+        uint32_t a = 0;
+        uint32_t b = 0;
+
+        for (uint32_t minor = 0; minor < minor_count; minor++)
+        {
+            uint32_t w = (uint32_t)src[idx1] | ((uint32_t)src[idx1 + 1] << 8);
+            if (two)
+            {
+                w |= ((uint32_t)src[idx2] << 16) | ((uint32_t)src[idx2 + 1] << 24);
+            }
+
+            idx1 += minor_inc;
+            if (idx1 >= size) idx1 -= size;
+            idx2 += minor_inc;
+            if (idx2 >= size) idx2 -= size;
+
+            a = gf_mul2x4(a ^ w);
+            b ^= w;
+        }
+
+        a = gf_mul2x4(a) ^ b;
+
+        int lanes = two ? 4 : 2;
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            uint32_t major = 2 * k + lane;
+            uint8_t p = g_ecc_div3_table[(a >> (lane * 8)) & 0xFF];
+            dest[major] = p;
+            dest[major + major_count] = p ^ (uint8_t)(b >> (lane * 8));
+        }
+    }
+}
+
+void cdecc_generate_pq(uint8_t *sector)
+{
+    if (!g_tables_initialized) init_tables();
+
+    ecc_compute_block(sector + CDECC_HEADER_OFFSET, 86, 24, 2, 86, sector + CDECC_P_OFFSET);
+    ecc_compute_block(sector + CDECC_HEADER_OFFSET, 52, 43, 86, 88, sector + CDECC_Q_OFFSET);
+}
+
+static void put_edc(uint8_t *dest, uint32_t edc)
+{
+    dest[0] = (uint8_t)(edc >> 0);
+    dest[1] = (uint8_t)(edc >> 8);
+    dest[2] = (uint8_t)(edc >> 16);
+    dest[3] = (uint8_t)(edc >> 24);
+}
+
+void cdecc_generate_mode1(uint8_t *sector)
+{
+    put_edc(sector + CDECC_EDC_OFFSET, cdecc_edc(sector, CDECC_EDC_OFFSET));
+    memset(sector + CDECC_EDC_OFFSET + 4, 0, 8);
+    cdecc_generate_pq(sector);
+}
+
+void cdecc_generate_mode2_form1(uint8_t *sector)
+{
+    put_edc(sector + CDECC_FORM1_EDC_OFFSET,
+            cdecc_edc(sector + CDECC_SUBHEADER_OFFSET, CDECC_FORM1_EDC_OFFSET - CDECC_SUBHEADER_OFFSET));
+
+    uint8_t header[4];
+    memcpy(header, sector + CDECC_HEADER_OFFSET, 4);
+    memset(sector + CDECC_HEADER_OFFSET, 0, 4);
+    cdecc_generate_pq(sector);
+    memcpy(sector + CDECC_HEADER_OFFSET, header, 4);
+}
+
+void cdecc_generate_mode2_form2(uint8_t *sector)
+{
+    put_edc(sector + CDECC_FORM2_EDC_OFFSET,
+            cdecc_edc(sector + CDECC_SUBHEADER_OFFSET, CDECC_FORM2_EDC_OFFSET - CDECC_SUBHEADER_OFFSET));
+}
@@ -0,0 +1,57 @@
+/*
+ * CD-ROM sector EDC and ECC generation suitable for embedded systems.
+ *
+ *  Copyright (c) 2024 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Layout of a raw 2352 byte Mode 1 sector, refer to ECMA-130 section 14
+#define CDECC_SECTOR_SIZE   2352
+#define CDECC_HEADER_OFFSET 12
+#define CDECC_DATA_OFFSET   16
+#define CDECC_EDC_OFFSET    2064
+#define CDECC_P_OFFSET      2076
+#define CDECC_Q_OFFSET      2248
+
+// Mode 2 sectors have an 8 byte subheader in place of the Mode 1 user data start.
+// Form 1 has 2048 bytes of user data and the same P and Q parity as Mode 1,
+// Form 2 has 2324 bytes of user data and only the EDC.
+#define CDECC_SUBHEADER_OFFSET  16
+#define CDECC_FORM1_EDC_OFFSET  2072
+#define CDECC_FORM2_EDC_OFFSET  2348
+
+// Compute the 32-bit error detection code over len bytes.
+// The previous value can be given to continue computation over multiple blocks.
+uint32_t cdecc_edc(const uint8_t *data, uint32_t len, uint32_t edc = 0);
+
+// Fill in the EDC, the intermediate zero bytes and the P and Q parity
+// of a Mode 1 sector. Sync pattern, header and user data must already
+// be in place.
+void cdecc_generate_mode1(uint8_t *sector);
+
+// Fill in the EDC and the P and Q parity of a Mode 2 Form 1 sector.
+// Subheader and user data must already be in place. The parity is computed
+// as if the header was zero, as specified in ECMA-130 section 14.5.
+void cdecc_generate_mode2_form1(uint8_t *sector);
+
+// Fill in the EDC of a Mode 2 Form 2 sector.
+void cdecc_generate_mode2_form2(uint8_t *sector);
+
+// Compute the P and Q parity of a sector from bytes 12 to 2075.
+void cdecc_generate_pq(uint8_t *sector);
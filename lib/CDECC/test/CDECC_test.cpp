@@ -0,0 +1,244 @@
+#include "CDECC.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Unit test helpers */
+#define COMMENT(x) printf("\n----" x "----\n");
+#define TEST(x) \
+    if (!(x)) { \
+        fprintf(stderr, "\033[31;1mFAILED:\033[22;39m %s:%d %s\n", __FILE__, __LINE__, #x); \
+        status = false; \
+    } else { \
+        printf("\033[32;1mOK:\033[22;39m %s\n", #x); \
+    }
+
+/* Straightforward reference implementations, processing one bit or byte at a time */
+static uint32_t ref_edc(const uint8_t *data, uint32_t len)
+{
+    uint32_t edc = 0;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        edc ^= data[i];
+        for (int j = 0; j < 8; j++)
+        {
+            edc = (edc >> 1) ^ ((edc & 1) ? 0xD8018001 : 0);
+        }
+    }
+    return edc;
+}
+
+static uint8_t gf_mul2(uint8_t v)
+{
+    return (uint8_t)((v << 1) ^ ((v & 0x80) ? 0x1D : 0));
+}
+
+static void ref_ecc_block(const uint8_t *src, uint32_t major_count, uint32_t minor_count,
+                          uint32_t major_mult, uint32_t minor_inc, uint8_t *dest)
+{
+    uint32_t size = major_count * minor_count;
+    for (uint32_t major = 0; major < major_count; major++)
+    {
+        uint32_t index = (major >> 1) * major_mult + (major & 1);
+        uint8_t a = 0, b = 0;
+        for (uint32_t minor = 0; minor < minor_count; minor++)
+        {
+            uint8_t temp = src[index];
+            index += minor_inc;
+            if (index >= size) index -= size;
+            a = gf_mul2(a ^ temp);
+            b ^= temp;
+        }
+
+        // Solve p from 3 * p = 2 * a + b
+        uint8_t target = gf_mul2(a) ^ b;
+        uint8_t p = 0;
+        while ((uint8_t)(gf_mul2(p) ^ p) != target) p++;
+        dest[major] = p;
+        dest[major + major_count] = p ^ b;
+    }
+}
+
+static void ref_mode1(uint8_t *sector)
+{
+    uint32_t edc = ref_edc(sector, 2064);
+    for (int i = 0; i < 4; i++) sector[2064 + i] = (uint8_t)(edc >> (i * 8));
+    memset(sector + 2068, 0, 8);
+    ref_ecc_block(sector + 12, 86, 24, 2, 86, sector + 2076);
+    ref_ecc_block(sector + 12, 52, 43, 86, 88, sector + 2248);
+}
+
+// Check that a parity column forms a valid Reed-Solomon codeword with zero syndromes
+static bool check_syndromes(const uint8_t *src, uint32_t major_count, uint32_t minor_count,
+                            uint32_t major_mult, uint32_t minor_inc, const uint8_t *parity)
+{
+    uint32_t size = major_count * minor_count;
+    for (uint32_t major = 0; major < major_count; major++)
+    {
+        uint32_t index = (major >> 1) * major_mult + (major & 1);
+        uint8_t s0 = 0, s1 = 0;
+        for (uint32_t minor = 0; minor < minor_count; minor++)
+        {
+            s0 ^= src[index];
+            s1 = gf_mul2(s1) ^ src[index];
+            index += minor_inc;
+            if (index >= size) index -= size;
+        }
+        uint8_t p0 = parity[major];
+        uint8_t p1 = parity[major + major_count];
+        s0 ^= p0 ^ p1;
+        s1 = gf_mul2(gf_mul2(s1) ^ p0) ^ p1;
+        if (s0 != 0 || s1 != 0) return false;
+    }
+    return true;
+}
+
+static void make_sector(uint8_t *sector, uint32_t lba, unsigned seed)
+{
+    srand(seed);
+    sector[0] = 0;
+    memset(sector + 1, 0xFF, 10);
+    sector[11] = 0;
+    uint32_t msf = lba + 150;
+    uint8_t m = msf / (60 * 75), s = (msf / 75) % 60, f = msf % 75;
+    sector[12] = (uint8_t)(((m / 10) << 4) | (m % 10));
+    sector[13] = (uint8_t)(((s / 10) << 4) | (s % 10));
+    sector[14] = (uint8_t)(((f / 10) << 4) | (f % 10));
+    sector[15] = 1;
+    for (int i = 16; i < 2064; i++) sector[i] = (uint8_t)rand();
+}
+
+bool test_edc()
+{
+    bool status = true;
+    COMMENT("test_edc()");
+
+    uint8_t data[2064];
+    for (int i = 0; i < (int)sizeof(data); i++) data[i] = (uint8_t)(i * 7 + 3);
+
+    TEST(cdecc_edc(data, 0) == 0);
+    TEST(cdecc_edc(data, 1) == ref_edc(data, 1));
+    TEST(cdecc_edc(data, 7) == ref_edc(data, 7));
+    TEST(cdecc_edc(data, sizeof(data)) == ref_edc(data, sizeof(data)));
+
+    COMMENT("EDC continued over multiple blocks");
+    uint32_t edc = cdecc_edc(data, 1001);
+    edc = cdecc_edc(data + 1001, sizeof(data) - 1001, edc);
+    TEST(edc == ref_edc(data, sizeof(data)));
+
+    return status;
+}
+
+bool test_mode1()
+{
+    bool status = true;
+    COMMENT("test_mode1()");
+
+    uint8_t sector[2352], expected[2352];
+    for (unsigned seed = 1; seed <= 16; seed++)
+    {
+        make_sector(sector, seed * 1234, seed);
+        memset(sector + 2064, 0xAA, 2352 - 2064);
+        memcpy(expected, sector, sizeof(sector));
+        cdecc_generate_mode1(sector);
+        ref_mode1(expected);
+        if (memcmp(sector, expected, sizeof(sector)) != 0)
+        {
+            TEST(memcmp(sector, expected, sizeof(sector)) == 0);
+            return status;
+        }
+    }
+    TEST(memcmp(sector, expected, sizeof(sector)) == 0);
+
+    COMMENT("P and Q parity are valid codewords");
+    TEST(check_syndromes(sector + 12, 86, 24, 2, 86, sector + 2076));
+    TEST(check_syndromes(sector + 12, 52, 43, 86, 88, sector + 2248));
+
+    COMMENT("Single byte error is detected");
+    sector[100] ^= 0x01;
+    TEST(!check_syndromes(sector + 12, 86, 24, 2, 86, sector + 2076));
+    TEST(cdecc_edc(sector, 2068) != 0);
+    sector[100] ^= 0x01;
+    TEST(cdecc_edc(sector, 2068) == 0);
+
+    COMMENT("All-zero sector has zero EDC and parity");
+    memset(sector, 0, sizeof(sector));
+    cdecc_generate_mode1(sector);
+    bool allzero = true;
+    for (int i = 0; i < 2352; i++) allzero = allzero && (sector[i] == 0);
+    TEST(allzero);
+
+    return status;
+}
+
+bool test_mode2()
+{
+    bool status = true;
+    COMMENT("test_mode2()");
+
+    uint8_t sector[2352], expected[2352];
+    make_sector(sector, 4321, 99);
+    sector[15] = 2;
+    memset(sector + 2072, 0xAA, 2352 - 2072);
+    memcpy(expected, sector, sizeof(sector));
+
+    COMMENT("Form 1 parity is computed with zero header");
+    cdecc_generate_mode2_form1(sector);
+    uint32_t edc = ref_edc(expected + 16, 2056);
+    for (int i = 0; i < 4; i++) expected[2072 + i] = (uint8_t)(edc >> (i * 8));
+    memset(expected + 12, 0, 4);
+    ref_ecc_block(expected + 12, 86, 24, 2, 86, expected + 2076);
+    ref_ecc_block(expected + 12, 52, 43, 86, 88, expected + 2248);
+    memcpy(expected + 12, sector + 12, 4);
+    TEST(memcmp(sector, expected, sizeof(sector)) == 0);
+    TEST(sector[15] == 2);
+    TEST(cdecc_edc(sector + 16, 2060) == 0);
+
+    COMMENT("Form 2 has only EDC over subheader and data");
+    memset(sector + 2072, 0x55, 2352 - 2072);
+    memcpy(expected, sector, sizeof(sector));
+    cdecc_generate_mode2_form2(sector);
+    TEST(memcmp(sector, expected, 2348) == 0);
+    TEST(cdecc_edc(sector + 16, 2336) == 0);
+
+    return status;
+}
+
+bool benchmark()
+{
+    bool status = true;
+    COMMENT("benchmark()");
+
+    const int count = 20000;
+    static uint8_t sector[2352];
+    make_sector(sector, 0, 1);
+
+    clock_t start = clock();
+    for (int i = 0; i < count; i++)
+    {
+        sector[16] = (uint8_t)i;
+        cdecc_generate_mode1(sector);
+    }
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (secs <= 0) secs = 1e-6;
+
+    double per_second = count / secs;
+    printf("Generated %d Mode 1 sectors in %.3f s: %.0f sectors/s, %.1f MB/s, %.0fx CD speed\n",
+           count, secs, per_second, per_second * 2352 / 1e6, per_second / 75);
+    TEST(per_second > 75);
+    return status;
+}
+
+int main()
+{
+    if (test_edc() && test_mode1() && test_mode2() && benchmark())
+    {
+        return 0;
+    }
+    else
+    {
+        printf("Some tests failed\n");
+        return 1;
+    }
+}
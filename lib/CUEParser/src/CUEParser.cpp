@@ -29,6 +29,9 @@
 //   TRACK 03 AUDIO
 //     INDEX 00 07:55:58
 //     INDEX 01 07:55:65
+//
+// Multi-session images (e.g. CD-Extra) mark the start of each session with
+// a "REM SESSION nn" line before the first track of that session.
 
 
 #include "CUEParser.h"
@@ -52,6 +55,7 @@ void CUEParser::restart()
 {
     m_parse_pos = m_cue_sheet;
     memset(&m_track_info, 0, sizeof(m_track_info));
+    m_track_info.session_number = 1;
 }
 
 const CUETrackInfo *CUEParser::next_track()
@@ -88,6 +92,11 @@ const CUETrackInfo *CUEParser::next_track()
             got_data = false;
             got_pause = false;
         }
+        else if (strncasecmp(m_parse_pos, "REM SESSION ", 12) == 0)
+        {
+            const char *session_num = skip_space(m_parse_pos + 12);
+            m_track_info.session_number = strtoul(session_num, NULL, 10);
+        }
         else if (strncasecmp(m_parse_pos, "PREGAP ", 7) == 0)
         {
             const char *time_str = skip_space(m_parse_pos + 7);
@@ -275,6 +284,11 @@ uint32_t CUEParser::get_sector_length(CUEFileMode filemode, CUETrackMode trackmo
             default:                    return 2048;
         }
     }
+    else if ((filemode == CUEFile_WAVE || filemode == CUEFile_AIFF) && trackmode == CUETrack_AUDIO)
+    {
+        // Audio files are accessed as decoded samples, same as raw audio tracks
+        return 2352;
+    }
     else
     {
         return 0;
@@ -72,6 +72,9 @@ struct CUETrackInfo
     // LBA for the beginning of the track, which will be INDEX 00 if that is present.
     // Otherwise this will be INDEX 01 matching data_start above.
     uint32_t track_start;
+
+    // Session number from REM SESSION, 1 for single-session cue sheets.
+    int session_number;
 };
 
 class CUEParser
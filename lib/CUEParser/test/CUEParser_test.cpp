@@ -92,7 +92,7 @@ FILE "Sound.wav" WAVE
         TEST(track->file_offset == 0);
         TEST(track->track_number == 11);
         TEST(track->track_mode == CUETrack_AUDIO);
-        TEST(track->sector_length == 0);
+        TEST(track->sector_length == 2352);
         TEST(track->track_start == 0);
         TEST(track->data_start == 2 * 75);
     }
@@ -177,10 +177,73 @@ TRACK 03 MODE1/2352
     return status;
 }
 
+bool test_sessions()
+{
+    bool status = true;
+    const char *cue_sheet = R"(
+FILE "CD Extra.bin" BINARY
+  REM SESSION 01
+  TRACK 01 AUDIO
+    INDEX 01 00:00:00
+  TRACK 02 AUDIO
+    INDEX 00 03:10:00
+    INDEX 01 03:12:00
+  REM LEAD-OUT 01:30:00
+  REM SESSION 02
+  REM LEAD-IN 01:00:00
+  TRACK 03 MODE2/2352
+    INDEX 01 06:20:00
+    )";
+
+    CUEParser parser(cue_sheet);
+
+    COMMENT("test_sessions()");
+    COMMENT("Test TRACK 01 (session 1)");
+    const CUETrackInfo *track = parser.next_track();
+    TEST(track != NULL);
+    if (track)
+    {
+        TEST(track->track_number == 1);
+        TEST(track->session_number == 1);
+    }
+
+    COMMENT("Test TRACK 02 (session 1)");
+    track = parser.next_track();
+    TEST(track != NULL);
+    if (track)
+    {
+        TEST(track->track_number == 2);
+        TEST(track->session_number == 1);
+        TEST(track->track_start == (3 * 60 + 10) * 75);
+    }
+
+    COMMENT("Test TRACK 03 (session 2)");
+    track = parser.next_track();
+    TEST(track != NULL);
+    if (track)
+    {
+        TEST(track->track_number == 3);
+        TEST(track->session_number == 2);
+        TEST(track->track_mode == CUETrack_MODE2_2352);
+        TEST(track->sector_length == 2352);
+        TEST(track->file_offset == 2352 * (6 * 60 + 20) * 75);
+        TEST(track->data_start == (6 * 60 + 20) * 75);
+    }
+
+    track = parser.next_track();
+    TEST(track == NULL);
+
+    COMMENT("Test restart resets session");
+    parser.restart();
+    track = parser.next_track();
+    TEST(track != NULL && track->session_number == 1);
+
+    return status;
+}
 
 int main()
 {
-    if (test_basics() && test_datatracks())
+    if (test_basics() && test_datatracks() && test_sessions())
     {
         return 0;
     }
@@ -0,0 +1,697 @@
+/*
+ * Streaming FLAC decoder for CD audio tracks, suitable for embedded systems.
+ *
+ *  Copyright (c) 2024 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// The decoder avoids storing a whole channel of 32-bit samples. Each sample
+// is written to its place in the interleaved 16-bit output as soon as it is
+// decoded, and the predictor reads previous samples from a small window.
+// The side channel of stereo decorrelation is 17 bits wide, its top bit is
+// kept in a separate bitmap until the channels are combined.
+
+#include "FLACDecoder.h"
+#include <string.h>
+
+#define FLAC_HEADER_MAX_LEN 16
+#define FLAC_MAX_LPC_ORDER 32
+#define FLAC_NO_CRC 0xFFFFFFFF
+
+// Channel assignments in frame header
+#define FLAC_CH_INDEPENDENT_STEREO 1
+#define FLAC_CH_LEFT_SIDE 8
+#define FLAC_CH_SIDE_RIGHT 9
+#define FLAC_CH_MID_SIDE 10
+
+static uint16_t g_crc16_table[256];
+static bool g_tables_initialized;
+
+static void init_tables()
+{
+    for (int i = 0; i < 256; i++)
+    {
+        uint16_t crc = i << 8;
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc << 1) ^ ((crc & 0x8000) ? 0x8005 : 0);
+        }
+        g_crc16_table[i] = crc;
+    }
+
+    g_tables_initialized = true;
+}
+
+// CRC-8 with polynomial x^8 + x^2 + x + 1, used only for the short frame header
+static uint8_t crc8(const uint8_t *data, uint32_t len)
+{
+    uint8_t crc = 0;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc << 1) ^ ((crc & 0x80) ? 0x07 : 0);
+        }
+    }
+    return crc;
+}
+
+static void crc16_update(flac_decoder_t *dec, uint32_t end)
+{
+    uint16_t crc = dec->crc16;
+    for (uint32_t i = dec->crc_pos; i < end; i++)
+    {
+        crc = (crc << 8) ^ g_crc16_table[(crc >> 8) ^ dec->buf[i]];
+    }
+    dec->crc16 = crc;
+    dec->crc_pos = end;
+}
+
+/*************************/
+/* Input buffer handling */
+/*************************/
+
+// Move unconsumed data to start of buffer and read more.
+// Returns false if no new data was available.
+static bool fill(flac_decoder_t *dec)
+{
+    if (dec->crc_pos != FLAC_NO_CRC)
+    {
+        crc16_update(dec, dec->buf_pos);
+        dec->crc_pos = 0;
+    }
+
+    uint32_t keep = dec->buf_len - dec->buf_pos;
+    memmove(dec->buf, dec->buf + dec->buf_pos, keep);
+    dec->buf_offset += dec->buf_pos;
+    dec->buf_pos = 0;
+    dec->buf_len = keep;
+
+    while (dec->buf_len < sizeof(dec->buf))
+    {
+        int status = dec->read(dec->ctx, dec->buf + dec->buf_len, sizeof(dec->buf) - dec->buf_len);
+        if (status <= 0) break;
+        dec->buf_len += status;
+    }
+
+    return dec->buf_len > keep;
+}
+
+// Make at least count bytes available in buffer, if not at end of file
+static uint32_t ensure(flac_decoder_t *dec, uint32_t count)
+{
+    if (dec->buf_len - dec->buf_pos < count)
+    {
+        fill(dec);
+    }
+    return dec->buf_len - dec->buf_pos;
+}
+
+bool flac_skip(flac_decoder_t *dec, uint32_t count)
+{
+    uint32_t avail = dec->buf_len - dec->buf_pos;
+    if (count <= avail)
+    {
+        dec->buf_pos += count;
+        return true;
+    }
+
+    return flac_seek(dec, flac_position(dec) + count);
+}
+
+/***************/
+/* Bit reading */
+/***************/
+
+// The bit cache is refilled one byte at a time and only as far as needed,
+// so that at a byte boundary it is empty and the CRC covers exactly the
+// consumed bytes.
+
+static inline uint32_t next_byte(flac_decoder_t *dec)
+{
+    if (dec->buf_pos >= dec->buf_len && !fill(dec))
+    {
+        dec->error = true;
+        return 0;
+    }
+    return dec->buf[dec->buf_pos++];
+}
+
+// Read 1 to 24 bits
+static inline uint32_t get_bits(flac_decoder_t *dec, uint32_t n)
+{
+    while (dec->bit_count < n)
+    {
+        dec->bits |= next_byte(dec) << (24 - dec->bit_count);
+        dec->bit_count += 8;
+    }
+
+    uint32_t result = dec->bits >> (32 - n);
+    dec->bits <<= n;
+    dec->bit_count -= n;
+    return result;
+}
+
+// Read 0 to 32 bits
+static inline uint32_t get_bits_long(flac_decoder_t *dec, uint32_t n)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+    else if (n <= 24)
+    {
+        return get_bits(dec, n);
+    }
+    else
+    {
+        uint32_t high = get_bits(dec, n - 16);
+        return (high << 16) | get_bits(dec, 16);
+    }
+}
+
+// Read 1 to 32 bit two's complement number
+static inline int32_t get_signed(flac_decoder_t *dec, uint32_t n)
+{
+    uint32_t v = get_bits_long(dec, n);
+    uint32_t sign = 1U << (n - 1);
+    return (int32_t)((v ^ sign) - sign);
+}
+
+// Count zero bits up to the next one bit, and consume all of them
+static inline uint32_t get_unary(flac_decoder_t *dec)
+{
+    uint32_t zeros = 0;
+    while (dec->bits == 0)
+    {
+        zeros += dec->bit_count;
+        dec->bits = next_byte(dec) << 24;
+        dec->bit_count = 8;
+        if (dec->error) return 0;
+    }
+
+    uint32_t lz = __builtin_clz(dec->bits);
+    dec->bits <<= lz + 1;
+    dec->bit_count -= lz + 1;
+    return zeros + lz;
+}
+
+/****************/
+/* Frame header */
+/****************/
+
+static const uint32_t g_sample_rates[12] = {
+    0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000
+};
+
+// Parse frame header at p and check that it matches the supported format.
+// Returns length of the header including CRC-8, or 0 if it is not valid.
+static uint32_t parse_header(const flac_streaminfo_t *info, const uint8_t *p, uint32_t avail,
+                             flac_frame_t *frame, uint32_t *channels)
+{
+    if (avail < 6 || p[0] != 0xFF || (p[1] & 0xFE) != 0xF8 || (p[3] & 1) != 0)
+    {
+        return 0;
+    }
+
+    bool variable_blocksize = (p[1] & 1);
+    uint32_t blocksize_code = p[2] >> 4;
+    uint32_t rate_code = p[2] & 0x0F;
+    uint32_t depth_code = (p[3] >> 1) & 7;
+    *channels = p[3] >> 4;
+
+    if (depth_code != 0 && depth_code != 4) return 0;
+    if (*channels != FLAC_CH_INDEPENDENT_STEREO && *channels != FLAC_CH_LEFT_SIDE &&
+        *channels != FLAC_CH_SIDE_RIGHT && *channels != FLAC_CH_MID_SIDE) return 0;
+    if (blocksize_code == 0 || rate_code == 15) return 0;
+
+    // Frame or sample number, coded like UTF-8 with up to 36 bits
+    uint32_t len = 4;
+    uint32_t first = p[len++];
+    uint32_t ones = 0;
+    while (ones < 8 && (first & (0x80 >> ones))) ones++;
+    if (ones == 1 || ones == 8) return 0;
+
+    uint32_t extra = (ones > 0) ? ones - 1 : 0;
+    if (avail < len + extra + 5) return 0;
+
+    uint64_t number = first & (0xFF >> (ones + 1));
+    for (uint32_t i = 0; i < extra; i++)
+    {
+        uint8_t b = p[len++];
+        if ((b & 0xC0) != 0x80) return 0;
+        number = (number << 6) | (b & 0x3F);
+    }
+
+    uint32_t blocksize;
+    if (blocksize_code == 1) blocksize = 192;
+    else if (blocksize_code <= 5) blocksize = 576 << (blocksize_code - 2);
+    else if (blocksize_code == 6) blocksize = p[len++] + 1;
+    else if (blocksize_code == 7) { blocksize = ((p[len] << 8) | p[len + 1]) + 1; len += 2; }
+    else blocksize = 256 << (blocksize_code - 8);
+
+    uint32_t rate;
+    if (rate_code < 12) rate = g_sample_rates[rate_code];
+    else if (rate_code == 12) rate = p[len++] * 1000;
+    else if (rate_code == 13) { rate = (p[len] << 8) | p[len + 1]; len += 2; }
+    else { rate = ((p[len] << 8) | p[len + 1]) * 10; len += 2; }
+
+    if (crc8(p, len) != p[len]) return 0;
+    len++;
+
+    if (rate != 0 && rate != info->sample_rate) return 0;
+    if (blocksize > FLAC_MAX_BLOCKSIZE || blocksize > info->max_blocksize) return 0;
+
+    frame->blocksize = blocksize;
+    frame->first_sample = variable_blocksize ? number : number * info->max_blocksize;
+    if (info->total_samples != 0 && frame->first_sample >= info->total_samples) return 0;
+
+    return len;
+}
+
+/*************/
+/* Subframes */
+/*************/
+
+struct flac_subframe_t
+{
+    int16_t *out;
+    bool side;
+    uint32_t wasted;
+    uint32_t order;
+    int32_t shift;
+    bool wide;
+    int32_t coefs[FLAC_MAX_LPC_ORDER];
+
+    // Each sample is stored twice, so that the previous FLAC_MAX_LPC_ORDER
+    // samples are always contiguous in memory.
+    int32_t window[FLAC_MAX_LPC_ORDER * 2];
+};
+
+static inline void put_sample(flac_decoder_t *dec, flac_subframe_t *sub, uint32_t i, int32_t v)
+{
+    uint32_t w = i & (FLAC_MAX_LPC_ORDER - 1);
+    sub->window[w] = v;
+    sub->window[w + FLAC_MAX_LPC_ORDER] = v;
+
+    int32_t s = (int32_t)((uint32_t)v << sub->wasted);
+    sub->out[i * 2] = (int16_t)s;
+    if (sub->side)
+    {
+        dec->side_high[i >> 3] |= ((s >> 16) & 1) << (i & 7);
+    }
+}
+
+static inline int32_t predict(const flac_subframe_t *sub, uint32_t i)
+{
+    const int32_t *prev = &sub->window[(i & (FLAC_MAX_LPC_ORDER - 1)) + FLAC_MAX_LPC_ORDER - 1];
+    const int32_t *coefs = sub->coefs;
+    uint32_t order = sub->order;
+
+    if (sub->wide)
+    {
+        int64_t sum = 0;
+        for (uint32_t j = 0; j < order; j++)
+        {
+            sum += (int64_t)coefs[j] * prev[-(int32_t)j];
+        }
+        return (int32_t)(sum >> sub->shift);
+    }
+    else
+    {
+        int32_t sum = 0;
+        for (uint32_t j = 0; j < order; j++)
+        {
+            sum += coefs[j] * prev[-(int32_t)j];
+        }
+        return sum >> sub->shift;
+    }
+}
+
+// Decode Rice coded residual and add it to prediction from previous samples
+static bool decode_residual(flac_decoder_t *dec, flac_subframe_t *sub, uint32_t blocksize)
+{
+    uint32_t method = get_bits(dec, 2);
+    if (method > 1) return false;
+
+    uint32_t param_bits = (method == 0) ? 4 : 5;
+    uint32_t escape = (1 << param_bits) - 1;
+    uint32_t partition_order = get_bits(dec, 4);
+    uint32_t partition_size = blocksize >> partition_order;
+    if ((partition_size << partition_order) != blocksize || partition_size < sub->order)
+    {
+        return false;
+    }
+
+    uint32_t i = sub->order;
+    for (uint32_t end = partition_size; end <= blocksize; end += partition_size)
+    {
+        uint32_t k = get_bits(dec, param_bits);
+        if (k == escape)
+        {
+            uint32_t n = get_bits(dec, 5);
+            for (; i < end; i++)
+            {
+                int32_t residual = n ? get_signed(dec, n) : 0;
+                put_sample(dec, sub, i, residual + predict(sub, i));
+            }
+        }
+        else
+        {
+            for (; i < end; i++)
+            {
+                uint32_t u = (get_unary(dec) << k) | get_bits_long(dec, k);
+                int32_t residual = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+                put_sample(dec, sub, i, residual + predict(sub, i));
+            }
+        }
+
+        if (dec->error) return false;
+    }
+
+    return true;
+}
+
+// Fixed predictors expressed as LPC coefficients with zero shift
+static const int32_t g_fixed_coefs[5][4] = {
+    {0, 0, 0, 0},
+    {1, 0, 0, 0},
+    {2, -1, 0, 0},
+    {3, -3, 1, 0},
+    {4, -6, 4, -1}
+};
+
+static uint32_t ilog2(uint32_t v)
+{
+    uint32_t result = 0;
+    while (v >>= 1) result++;
+    return result;
+}
+
+// Decode one channel to every other sample of out.
+// For the side channel, bps is 17 and the top bit goes to dec->side_high.
+static bool decode_subframe(flac_decoder_t *dec, uint32_t blocksize, uint32_t bps, int16_t *out, bool side)
+{
+    flac_subframe_t sub;
+    sub.out = out;
+    sub.side = side;
+    sub.wasted = 0;
+    sub.shift = 0;
+    sub.wide = false;
+
+    if (get_bits(dec, 1) != 0) return false;
+    uint32_t type = get_bits(dec, 6);
+
+    if (get_bits(dec, 1))
+    {
+        sub.wasted = get_unary(dec) + 1;
+        if (sub.wasted >= bps) return false;
+        bps -= sub.wasted;
+    }
+
+    if (type == 0)
+    {
+        // CONSTANT
+        int32_t v = get_signed(dec, bps);
+        for (uint32_t i = 0; i < blocksize; i++)
+        {
+            put_sample(dec, &sub, i, v);
+        }
+        return !dec->error;
+    }
+    else if (type == 1)
+    {
+        // VERBATIM
+        for (uint32_t i = 0; i < blocksize; i++)
+        {
+            put_sample(dec, &sub, i, get_signed(dec, bps));
+        }
+        return !dec->error;
+    }
+    else if (type >= 8 && type <= 12)
+    {
+        // FIXED
+        sub.order = type - 8;
+        memcpy(sub.coefs, g_fixed_coefs[sub.order], sizeof(g_fixed_coefs[0]));
+    }
+    else if (type >= 32)
+    {
+        // LPC
+        sub.order = type - 31;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (sub.order > blocksize) return false;
+
+    for (uint32_t i = 0; i < sub.order; i++)
+    {
+        put_sample(dec, &sub, i, get_signed(dec, bps));
+    }
+
+    if (type >= 32)
+    {
+        uint32_t precision = get_bits(dec, 4) + 1;
+        if (precision == 16) return false;
+
+        sub.shift = get_signed(dec, 5);
+        if (sub.shift < 0) return false;
+
+        for (uint32_t j = 0; j < sub.order; j++)
+        {
+            sub.coefs[j] = get_signed(dec, precision);
+        }
+
+        // The sum fits in 32 bits unless the coefficients are unusually precise
+        sub.wide = (bps + precision + ilog2(sub.order) > 32);
+    }
+
+    return decode_residual(dec, &sub, blocksize);
+}
+
+// Full value of a side channel sample
+static inline int32_t get_side(const flac_decoder_t *dec, const int16_t *pcm, uint32_t i)
+{
+    uint32_t low = (uint16_t)pcm[i * 2];
+    bool high = (dec->side_high[i >> 3] >> (i & 7)) & 1;
+    return (int32_t)(low | (high ? 0xFFFF0000 : 0));
+}
+
+static void decorrelate(const flac_decoder_t *dec, int16_t *pcm, uint32_t blocksize, uint32_t channels)
+{
+    if (channels == FLAC_CH_LEFT_SIDE)
+    {
+        for (uint32_t i = 0; i < blocksize; i++)
+        {
+            pcm[i * 2 + 1] = (int16_t)(pcm[i * 2] - get_side(dec, pcm + 1, i));
+        }
+    }
+    else if (channels == FLAC_CH_SIDE_RIGHT)
+    {
+        for (uint32_t i = 0; i < blocksize; i++)
+        {
+            pcm[i * 2] = (int16_t)(pcm[i * 2 + 1] + get_side(dec, pcm, i));
+        }
+    }
+    else if (channels == FLAC_CH_MID_SIDE)
+    {
+        for (uint32_t i = 0; i < blocksize; i++)
+        {
+            int32_t side = get_side(dec, pcm + 1, i);
+            int32_t mid = ((int32_t)pcm[i * 2] * 2) | (side & 1);
+            pcm[i * 2] = (int16_t)((mid + side) >> 1);
+            pcm[i * 2 + 1] = (int16_t)((mid - side) >> 1);
+        }
+    }
+}
+
+/***********************/
+/* Public functions    */
+/***********************/
+
+void flac_init(flac_decoder_t *dec, flac_read_t read, flac_seek_t seek, void *ctx)
+{
+    if (!g_tables_initialized) init_tables();
+
+    memset(&dec->info, 0, sizeof(dec->info));
+    dec->read = read;
+    dec->seek = seek;
+    dec->ctx = ctx;
+    flac_seek(dec, 0);
+}
+
+bool flac_seek(flac_decoder_t *dec, uint32_t pos)
+{
+    dec->buf_offset = pos;
+    dec->buf_pos = 0;
+    dec->buf_len = 0;
+    dec->bits = 0;
+    dec->bit_count = 0;
+    dec->crc_pos = FLAC_NO_CRC;
+    dec->error = false;
+    return dec->seek(dec->ctx, pos);
+}
+
+uint32_t flac_position(const flac_decoder_t *dec)
+{
+    return dec->buf_offset + dec->buf_pos - dec->bit_count / 8;
+}
+
+bool flac_read_streaminfo(flac_decoder_t *dec)
+{
+    const uint8_t *p;
+
+    // ID3v2 tag with syncsafe size, optionally followed by a footer
+    if (ensure(dec, 10) >= 10 && memcmp(dec->buf + dec->buf_pos, "ID3", 3) == 0)
+    {
+        p = dec->buf + dec->buf_pos;
+        uint32_t size = ((p[6] & 0x7F) << 21) | ((p[7] & 0x7F) << 14) |
+                        ((p[8] & 0x7F) << 7) | (p[9] & 0x7F);
+        size += (p[5] & 0x10) ? 20 : 10;
+        if (!flac_skip(dec, size)) return false;
+    }
+
+    if (ensure(dec, 4) < 4 || memcmp(dec->buf + dec->buf_pos, "fLaC", 4) != 0)
+    {
+        return false;
+    }
+    dec->buf_pos += 4;
+
+    bool have_streaminfo = false;
+    bool last = false;
+    while (!last)
+    {
+        if (ensure(dec, 4) < 4) return false;
+        p = dec->buf + dec->buf_pos;
+        last = (p[0] & 0x80);
+        uint32_t type = p[0] & 0x7F;
+        uint32_t len = (p[1] << 16) | (p[2] << 8) | p[3];
+        dec->buf_pos += 4;
+
+        if (type == 0 && len >= 34 && ensure(dec, 34) >= 34)
+        {
+            p = dec->buf + dec->buf_pos;
+            flac_streaminfo_t *info = &dec->info;
+            info->min_blocksize = (p[0] << 8) | p[1];
+            info->max_blocksize = (p[2] << 8) | p[3];
+            info->sample_rate = (p[10] << 12) | (p[11] << 4) | (p[12] >> 4);
+            info->channels = ((p[12] >> 1) & 7) + 1;
+            info->bits_per_sample = (((p[12] & 1) << 4) | (p[13] >> 4)) + 1;
+            info->total_samples = ((uint64_t)(p[13] & 0x0F) << 32) |
+                                  ((uint32_t)p[14] << 24) | (p[15] << 16) | (p[16] << 8) | p[17];
+            have_streaminfo = true;
+        }
+
+        if (!flac_skip(dec, len)) return false;
+    }
+
+    dec->info.first_frame = flac_position(dec);
+    return have_streaminfo;
+}
+
+bool flac_is_supported(const flac_streaminfo_t *info)
+{
+    return info->channels == 2 &&
+           info->bits_per_sample == 16 &&
+           info->sample_rate == 44100 &&
+           info->min_blocksize >= 16 &&
+           info->max_blocksize <= FLAC_MAX_BLOCKSIZE;
+}
+
+bool flac_find_frame(flac_decoder_t *dec, uint32_t max_bytes, flac_frame_t *frame)
+{
+    dec->bits = 0;
+    dec->bit_count = 0;
+    dec->crc_pos = FLAC_NO_CRC;
+
+    uint32_t channels;
+    uint32_t end = flac_position(dec) + max_bytes;
+    while (flac_position(dec) <= end)
+    {
+        uint32_t avail = ensure(dec, FLAC_HEADER_MAX_LEN);
+        if (avail < 6) return false;
+
+        const uint8_t *p = dec->buf + dec->buf_pos;
+        const uint8_t *sync = (const uint8_t*)memchr(p, 0xFF, avail - 1);
+        if (!sync)
+        {
+            dec->buf_pos += avail - 1;
+            continue;
+        }
+
+        dec->buf_pos += sync - p;
+        avail = ensure(dec, FLAC_HEADER_MAX_LEN);
+        if (flac_position(dec) <= end &&
+            parse_header(&dec->info, dec->buf + dec->buf_pos, avail, frame, &channels))
+        {
+            frame->offset = flac_position(dec);
+            return true;
+        }
+
+        dec->buf_pos++;
+    }
+
+    return false;
+}
+
+bool flac_decode_frame(flac_decoder_t *dec, int16_t *pcm, flac_frame_t *frame)
+{
+    dec->bits = 0;
+    dec->bit_count = 0;
+    dec->error = false;
+
+    uint32_t channels;
+    uint32_t avail = ensure(dec, FLAC_HEADER_MAX_LEN);
+    uint32_t len = parse_header(&dec->info, dec->buf + dec->buf_pos, avail, frame, &channels);
+    if (len == 0) return false;
+
+    frame->offset = flac_position(dec);
+    uint32_t blocksize = frame->blocksize;
+
+    dec->crc16 = 0;
+    dec->crc_pos = dec->buf_pos;
+    dec->buf_pos += len;
+
+    if (channels != FLAC_CH_INDEPENDENT_STEREO)
+    {
+        memset(dec->side_high, 0, (blocksize + 7) / 8);
+    }
+
+    bool ok = decode_subframe(dec, blocksize, (channels == FLAC_CH_SIDE_RIGHT) ? 17 : 16,
+                              pcm, channels == FLAC_CH_SIDE_RIGHT) &&
+              decode_subframe(dec, blocksize, (channels == FLAC_CH_LEFT_SIDE || channels == FLAC_CH_MID_SIDE) ? 17 : 16,
+                              pcm + 1, channels == FLAC_CH_LEFT_SIDE || channels == FLAC_CH_MID_SIDE);
+
+    // Skip padding to byte boundary and check CRC-16 of the whole frame
+    dec->bits = 0;
+    dec->bit_count = 0;
+    if (!ok || ensure(dec, 2) < 2)
+    {
+        dec->crc_pos = FLAC_NO_CRC;
+        return false;
+    }
+
+    crc16_update(dec, dec->buf_pos);
+    dec->crc_pos = FLAC_NO_CRC;
+    uint16_t crc = (dec->buf[dec->buf_pos] << 8) | dec->buf[dec->buf_pos + 1];
+    dec->buf_pos += 2;
+    if (crc != dec->crc16) return false;
+
+    decorrelate(dec, pcm, blocksize, channels);
+    return true;
+}
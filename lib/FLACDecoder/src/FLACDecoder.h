@@ -0,0 +1,110 @@
+/*
+ * Streaming FLAC decoder for CD audio tracks, suitable for embedded systems.
+ *
+ *  Copyright (c) 2024 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Decodes FLAC streams as specified in RFC 9639, limited to the format
+// of CD audio: 2 channels of 16-bit samples. The output is interleaved
+// little-endian samples, same as a raw audio track in a .bin file.
+//
+// Input is read through a callback into a small buffer, so the decoder
+// needs no memory beyond the decoder state and the caller's PCM buffer.
+// Frames are decoded one at a time. To seek, the caller positions the input
+// near the target and uses flac_find_frame() to scan for the next frame header.
+
+#pragma once
+
+#include <stdint.h>
+
+// Largest block size allowed by the FLAC streamable subset at 44.1 kHz
+#define FLAC_MAX_BLOCKSIZE 4608
+
+#define FLAC_INPUT_BUFFER_SIZE 512
+
+// Read up to len bytes of input.
+// Returns number of bytes read, 0 at end of file or negative on error.
+typedef int (*flac_read_t)(void *ctx, uint8_t *buf, uint32_t len);
+
+// Move input to file offset pos, returns false on error
+typedef bool (*flac_seek_t)(void *ctx, uint32_t pos);
+
+struct flac_streaminfo_t
+{
+    uint32_t sample_rate;
+    uint16_t min_blocksize;
+    uint16_t max_blocksize;
+    uint8_t channels;
+    uint8_t bits_per_sample;
+    uint64_t total_samples;   // Per channel, 0 if unknown
+    uint32_t first_frame;     // File offset of the first audio frame
+};
+
+struct flac_frame_t
+{
+    uint64_t first_sample;
+    uint32_t blocksize;
+    uint32_t offset;          // File offset of the frame header
+};
+
+struct flac_decoder_t
+{
+    flac_read_t read;
+    flac_seek_t seek;
+    void *ctx;
+    flac_streaminfo_t info;
+
+    uint32_t buf_offset;      // File offset of buf[0]
+    uint32_t buf_pos;
+    uint32_t buf_len;
+    uint32_t bits;            // Unconsumed bits, MSB aligned
+    uint32_t bit_count;
+    uint32_t crc_pos;         // Start of bytes in buf not yet included in crc16
+    uint16_t crc16;
+    bool error;
+
+    uint8_t side_high[FLAC_MAX_BLOCKSIZE / 8]; // Bit 16 of the side channel
+    uint8_t buf[FLAC_INPUT_BUFFER_SIZE];
+};
+
+// Set the input callbacks and start reading from beginning of file
+void flac_init(flac_decoder_t *dec, flac_read_t read, flac_seek_t seek, void *ctx);
+
+// Continue reading input from file offset pos. Keeps the stream info.
+bool flac_seek(flac_decoder_t *dec, uint32_t pos);
+
+// Skip bytes in input, seeking if they are not already in buffer
+bool flac_skip(flac_decoder_t *dec, uint32_t count);
+
+// Parse the "fLaC" marker and metadata blocks at start of file, skipping
+// an ID3v2 tag if present. On success the input is positioned at the first frame.
+bool flac_read_streaminfo(flac_decoder_t *dec);
+
+// Check that the stream is 2 channel 16-bit audio that this decoder supports
+bool flac_is_supported(const flac_streaminfo_t *info);
+
+// Find the next valid frame header, scanning at most max_bytes forward.
+// The frame is left unconsumed, so flac_decode_frame() can be called next.
+bool flac_find_frame(flac_decoder_t *dec, uint32_t max_bytes, flac_frame_t *frame);
+
+// Decode the frame at current position into interleaved stereo samples.
+// pcm must have room for 2 * FLAC_MAX_BLOCKSIZE samples.
+// Returns false if the frame is invalid or unsupported, or the CRC does not match.
+bool flac_decode_frame(flac_decoder_t *dec, int16_t *pcm, flac_frame_t *frame);
+
+// File offset of the next unread byte, such as the start of the next frame
+// after flac_decode_frame().
+uint32_t flac_position(const flac_decoder_t *dec);
@@ -0,0 +1,556 @@
+#include "FLACDecoder.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+/* Unit test helpers */
+#define COMMENT(x) printf("\n----" x "----\n");
+#define TEST(x) \
+    if (!(x)) { \
+        fprintf(stderr, "\033[31;1mFAILED:\033[22;39m %s:%d %s\n", __FILE__, __LINE__, #x); \
+        status = false; \
+    } else { \
+        printf("\033[32;1mOK:\033[22;39m %s\n", #x); \
+    }
+
+/*******************************************/
+/* Minimal encoder for generating testdata */
+/*******************************************/
+
+struct BitWriter
+{
+    std::vector<uint8_t> data;
+    uint32_t bitpos = 0;
+
+    void put(uint64_t v, uint32_t n)
+    {
+        for (int i = n - 1; i >= 0; i--)
+        {
+            if (bitpos % 8 == 0) data.push_back(0);
+            if ((v >> i) & 1) data.back() |= 0x80 >> (bitpos % 8);
+            bitpos++;
+        }
+    }
+
+    void put_signed(int64_t v, uint32_t n) { put((uint64_t)v & ((1ULL << n) - 1), n); }
+    void put_unary(uint32_t q) { for (uint32_t i = 0; i < q; i++) put(0, 1); put(1, 1); }
+    void align() { bitpos = (bitpos + 7) & ~7; }
+};
+
+static uint8_t ref_crc8(const uint8_t *p, size_t len)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= p[i];
+        for (int j = 0; j < 8; j++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    }
+    return crc;
+}
+
+static uint16_t ref_crc16(const uint8_t *p, size_t len)
+{
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= p[i] << 8;
+        for (int j = 0; j < 8; j++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+    }
+    return crc;
+}
+
+enum SubType { SUB_CONSTANT, SUB_VERBATIM, SUB_FIXED, SUB_LPC };
+
+struct SubOptions
+{
+    SubType type = SUB_FIXED;
+    uint32_t order = 2;
+    uint32_t precision = 12;
+    int shift = 10;
+    int32_t coefs[32] = {};
+    uint32_t partition_order = 2;
+    uint32_t method = 0;
+    bool escape = false;
+    bool use_wasted = true;
+};
+
+struct FrameOptions
+{
+    uint32_t channels = 1; // Channel assignment code
+    bool variable = false;
+    bool explicit_depth = true;
+    SubOptions sub[2];
+};
+
+static const int32_t fixed_coefs[5][4] = {{0}, {1}, {2, -1}, {3, -3, 1}, {4, -6, 4, -1}};
+
+static void encode_subframe(BitWriter &bw, std::vector<int32_t> x, uint32_t bps, const SubOptions &opt)
+{
+    uint32_t n = x.size();
+    uint32_t wasted = 0;
+    if (opt.use_wasted && opt.type != SUB_CONSTANT)
+    {
+        int32_t all = 0;
+        for (int32_t v : x) all |= v;
+        while (all != 0 && !(all & (1 << wasted)) && wasted < bps - 1) wasted++;
+        for (int32_t &v : x) v >>= wasted;
+    }
+    uint32_t sbps = bps - wasted;
+
+    uint32_t typecode = 0;
+    if (opt.type == SUB_CONSTANT) typecode = 0;
+    if (opt.type == SUB_VERBATIM) typecode = 1;
+    if (opt.type == SUB_FIXED) typecode = 8 + opt.order;
+    if (opt.type == SUB_LPC) typecode = 31 + opt.order;
+
+    bw.put(0, 1);
+    bw.put(typecode, 6);
+    if (wasted) { bw.put(1, 1); bw.put_unary(wasted - 1); } else { bw.put(0, 1); }
+
+    if (opt.type == SUB_CONSTANT) { bw.put_signed(x[0], sbps); return; }
+    if (opt.type == SUB_VERBATIM) { for (int32_t v : x) bw.put_signed(v, sbps); return; }
+
+    const int32_t *coefs = (opt.type == SUB_FIXED) ? fixed_coefs[opt.order] : opt.coefs;
+    int shift = (opt.type == SUB_FIXED) ? 0 : opt.shift;
+
+    for (uint32_t i = 0; i < opt.order; i++) bw.put_signed(x[i], sbps);
+
+    if (opt.type == SUB_LPC)
+    {
+        bw.put(opt.precision - 1, 4);
+        bw.put_signed(shift, 5);
+        for (uint32_t j = 0; j < opt.order; j++) bw.put_signed(coefs[j], opt.precision);
+    }
+
+    std::vector<int64_t> res(n, 0);
+    for (uint32_t i = opt.order; i < n; i++)
+    {
+        int64_t sum = 0;
+        for (uint32_t j = 0; j < opt.order; j++) sum += (int64_t)coefs[j] * x[i - 1 - j];
+        res[i] = x[i] - (sum >> shift);
+    }
+
+    // Partitions must divide the block evenly
+    uint32_t porder = opt.partition_order;
+    while (porder > 0 && ((n & ((1U << porder) - 1)) != 0 || (n >> porder) < opt.order)) porder--;
+
+    bw.put(opt.method, 2);
+    bw.put(porder, 4);
+    uint32_t psize = n >> porder;
+    uint32_t max_param = opt.method ? 30 : 14;
+    for (uint32_t p = 0; p < (1U << porder); p++)
+    {
+        uint32_t start = (p == 0) ? opt.order : p * psize;
+        uint32_t end = (p + 1) * psize;
+
+        if (opt.escape)
+        {
+            uint32_t bits = 0;
+            for (uint32_t i = start; i < end; i++)
+                while (res[i] < -(1LL << bits) / 2 || res[i] >= (1LL << bits) / 2 || (bits == 0 && res[i] != 0)) bits++;
+            bw.put(opt.method ? 31 : 15, opt.method ? 5 : 4);
+            bw.put(bits, 5);
+            if (bits) for (uint32_t i = start; i < end; i++) bw.put_signed(res[i], bits);
+            continue;
+        }
+
+        uint32_t best_k = 0;
+        uint64_t best_cost = UINT64_MAX;
+        for (uint32_t k = 0; k <= max_param; k++)
+        {
+            uint64_t cost = 0;
+            for (uint32_t i = start; i < end; i++)
+            {
+                uint64_t u = (res[i] >= 0) ? (uint64_t)res[i] * 2 : (uint64_t)(-res[i]) * 2 - 1;
+                cost += (u >> k) + 1 + k;
+            }
+            if (cost < best_cost) { best_cost = cost; best_k = k; }
+        }
+
+        bw.put(best_k, opt.method ? 5 : 4);
+        for (uint32_t i = start; i < end; i++)
+        {
+            uint64_t u = (res[i] >= 0) ? (uint64_t)res[i] * 2 : (uint64_t)(-res[i]) * 2 - 1;
+            bw.put_unary(u >> best_k);
+            if (best_k) bw.put(u & ((1ULL << best_k) - 1), best_k);
+        }
+    }
+}
+
+static void put_coded_number(BitWriter &bw, uint64_t v)
+{
+    if (v < 0x80) { bw.put(v, 8); return; }
+    uint32_t n = 2;
+    while (v >= (1ULL << ((7 - n) + 6 * (n - 1)))) n++;
+    bw.put(((1 << n) - 1) << 1, n + 1);
+    if (n < 7) bw.put(v >> (6 * (n - 1)), 7 - n);
+    for (int i = n - 2; i >= 0; i--) bw.put(0x80 | ((v >> (6 * i)) & 0x3F), 8);
+}
+
+static std::vector<uint8_t> encode_frame(const int16_t *pcm, uint32_t blocksize, uint64_t number, const FrameOptions &opt)
+{
+    BitWriter bw;
+    bw.put(0xFFF8 | (opt.variable ? 1 : 0), 16);
+    uint32_t bscode = (blocksize == 4096) ? 12 : (blocksize <= 256) ? 6 : 7;
+    bw.put(bscode, 4);
+    bw.put(9, 4);
+    bw.put(opt.channels, 4);
+    bw.put(opt.explicit_depth ? 4 : 0, 3);
+    bw.put(0, 1);
+    put_coded_number(bw, number);
+    if (bscode == 6) bw.put(blocksize - 1, 8);
+    if (bscode == 7) bw.put(blocksize - 1, 16);
+    bw.put(ref_crc8(bw.data.data(), bw.data.size()), 8);
+
+    std::vector<int32_t> ch[2];
+    for (uint32_t i = 0; i < blocksize; i++)
+    {
+        int32_t l = pcm[i * 2], r = pcm[i * 2 + 1];
+        switch (opt.channels)
+        {
+            case 8: ch[0].push_back(l); ch[1].push_back(l - r); break;
+            case 9: ch[0].push_back(l - r); ch[1].push_back(r); break;
+            case 10: ch[0].push_back((l + r) >> 1); ch[1].push_back(l - r); break;
+            default: ch[0].push_back(l); ch[1].push_back(r); break;
+        }
+    }
+
+    uint32_t bps0 = (opt.channels == 9) ? 17 : 16;
+    uint32_t bps1 = (opt.channels == 8 || opt.channels == 10) ? 17 : 16;
+    encode_subframe(bw, ch[0], bps0, opt.sub[0]);
+    encode_subframe(bw, ch[1], bps1, opt.sub[1]);
+    bw.align();
+    bw.put(ref_crc16(bw.data.data(), bw.data.size()), 16);
+    return bw.data;
+}
+
+static void put_be(std::vector<uint8_t> &out, uint64_t v, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static std::vector<uint8_t> make_header(uint32_t blocksize, uint64_t total_samples, bool id3)
+{
+    std::vector<uint8_t> out;
+    if (id3)
+    {
+        const uint8_t tag[10] = {'I', 'D', '3', 4, 0, 0, 0, 0, 2, 0x10}; // 256 + 16 bytes
+        out.insert(out.end(), tag, tag + 10);
+        out.resize(out.size() + 272, 0x55);
+    }
+
+    out.insert(out.end(), {'f', 'L', 'a', 'C'});
+    out.push_back(0x00); put_be(out, 34, 3);
+    put_be(out, blocksize, 2);
+    put_be(out, blocksize, 2);
+    put_be(out, 0, 3);
+    put_be(out, 0, 3);
+    // 20 bits rate, 3 bits channels-1, 5 bits bps-1, 36 bits total
+    uint64_t packed = ((uint64_t)44100 << 44) | ((uint64_t)1 << 41) | ((uint64_t)15 << 36) | total_samples;
+    put_be(out, packed, 8);
+    out.resize(out.size() + 16, 0); // MD5
+
+    // Padding block that is larger than the input buffer
+    out.push_back(0x81); put_be(out, 3000, 3);
+    out.resize(out.size() + 3000, 0xFF);
+    return out;
+}
+
+/***********************/
+/* Memory input source */
+/***********************/
+
+struct MemInput
+{
+    const std::vector<uint8_t> *data;
+    uint32_t pos;
+    bool random_chunks;
+};
+
+static int mem_read(void *ctx, uint8_t *buf, uint32_t len)
+{
+    MemInput *in = (MemInput*)ctx;
+    if (in->random_chunks && len > 1) len = 1 + rand() % len;
+    uint32_t avail = in->data->size() - in->pos;
+    if (len > avail) len = avail;
+    memcpy(buf, in->data->data() + in->pos, len);
+    in->pos += len;
+    return len;
+}
+
+static bool mem_seek(void *ctx, uint32_t pos)
+{
+    MemInput *in = (MemInput*)ctx;
+    if (pos > in->data->size()) return false;
+    in->pos = pos;
+    return true;
+}
+
+/*********/
+/* Tests */
+/*********/
+
+static void make_audio(int16_t *pcm, uint32_t samples, unsigned seed)
+{
+    srand(seed);
+    double f1 = 200 + rand() % 300, f2 = 700 + rand() % 500;
+    for (uint32_t i = 0; i < samples; i++)
+    {
+        double t = i / 44100.0;
+        for (int ch = 0; ch < 2; ch++)
+        {
+            double v = 12000 * sin(2 * M_PI * f1 * t + ch) + 6000 * sin(2 * M_PI * f2 * t) + (rand() % 512 - 256);
+            pcm[i * 2 + ch] = (int16_t)v;
+        }
+    }
+}
+
+static flac_decoder_t g_dec;
+static int16_t g_pcm[FLAC_MAX_BLOCKSIZE * 2];
+
+// Build a file from frames, each with blocksize samples of pcm
+struct TestFile
+{
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> frame_offsets;
+};
+
+static TestFile build_file(const int16_t *pcm, uint32_t samples, uint32_t blocksize,
+                           const std::vector<FrameOptions> &options, bool id3)
+{
+    TestFile file;
+    file.data = make_header(blocksize, samples, id3);
+    for (uint32_t f = 0; f * blocksize < samples; f++)
+    {
+        uint32_t count = samples - f * blocksize;
+        if (count > blocksize) count = blocksize;
+        const FrameOptions &opt = options[f % options.size()];
+        uint64_t number = opt.variable ? (uint64_t)f * blocksize : f;
+        std::vector<uint8_t> frame = encode_frame(pcm + f * blocksize * 2, count, number, opt);
+        file.frame_offsets.push_back(file.data.size());
+        file.data.insert(file.data.end(), frame.begin(), frame.end());
+    }
+    return file;
+}
+
+static bool decode_file(const TestFile &file, const int16_t *expected, uint32_t samples, bool random_chunks)
+{
+    MemInput in = {&file.data, 0, random_chunks};
+    flac_init(&g_dec, mem_read, mem_seek, &in);
+    if (!flac_read_streaminfo(&g_dec) || !flac_is_supported(&g_dec.info)) return false;
+    if (g_dec.info.first_frame != file.frame_offsets[0]) return false;
+
+    uint64_t pos = 0;
+    flac_frame_t frame;
+    while (pos < samples)
+    {
+        if (!flac_decode_frame(&g_dec, g_pcm, &frame)) return false;
+        if (frame.first_sample != pos) return false;
+        if (memcmp(g_pcm, expected + pos * 2, frame.blocksize * 4) != 0)
+        {
+            for (uint32_t i = 0; i < frame.blocksize * 2; i++)
+            {
+                if (g_pcm[i] != expected[pos * 2 + i])
+                {
+                    fprintf(stderr, "Mismatch at sample %d channel %d: %d vs %d\n",
+                        (int)(pos + i / 2), (int)(i & 1), g_pcm[i], expected[pos * 2 + i]);
+                    break;
+                }
+            }
+            return false;
+        }
+        pos += frame.blocksize;
+    }
+
+    return pos == samples && flac_position(&g_dec) == file.data.size();
+}
+
+bool test_subframe_types()
+{
+    bool status = true;
+    COMMENT("test_subframe_types()");
+
+    const uint32_t bs = 1152;
+    const uint32_t samples = bs * 12 + 100;
+    std::vector<int16_t> pcm(samples * 2);
+    make_audio(pcm.data(), samples, 1);
+
+    // Silent frame for CONSTANT subframes, and a frame with wasted low bits
+    for (uint32_t i = bs * 2; i < bs * 3; i++) { pcm[i * 2] = 0; pcm[i * 2 + 1] = -5; }
+    for (uint32_t i = bs * 3; i < bs * 4; i++) { pcm[i * 2] &= ~7; pcm[i * 2 + 1] &= ~3; }
+
+    std::vector<FrameOptions> opts(12);
+    opts[0].sub[0].type = SUB_VERBATIM; opts[0].sub[1].type = SUB_VERBATIM;
+    opts[1].sub[0].order = 0; opts[1].sub[1].order = 1;
+    opts[2].sub[0].type = SUB_CONSTANT; opts[2].sub[1].type = SUB_CONSTANT;
+    opts[3].sub[0].order = 3; opts[3].sub[1].order = 4;
+    for (int f = 4; f < 12; f++)
+    {
+        for (int ch = 0; ch < 2; ch++)
+        {
+            SubOptions &s = opts[f].sub[ch];
+            s.type = SUB_LPC;
+            s.order = (f == 11) ? 32 : 2 + f;
+            s.precision = (f == 10) ? 15 : 12;
+            s.shift = 10;
+            s.coefs[0] = 1950; s.coefs[1] = -940;
+            s.coefs[s.order - 1] = 3;
+            s.partition_order = f % 4;
+            s.method = f & 1;
+        }
+    }
+    opts[5].sub[0].escape = true;
+    opts[6].sub[1].escape = true;
+    opts[7].variable = true;
+    opts[8].explicit_depth = false;
+    opts[9].sub[0].partition_order = 0;
+
+    TestFile file = build_file(pcm.data(), samples, bs, opts, false);
+    TEST(decode_file(file, pcm.data(), samples, false));
+    TEST(decode_file(file, pcm.data(), samples, true));
+
+    return status;
+}
+
+bool test_stereo_modes()
+{
+    bool status = true;
+    COMMENT("test_stereo_modes()");
+
+    const uint32_t bs = 576;
+    const uint32_t samples = bs * 8;
+    std::vector<int16_t> pcm(samples * 2);
+    make_audio(pcm.data(), samples, 2);
+
+    // Extremes where the side channel needs all 17 bits
+    for (uint32_t i = 0; i < samples; i += 7)
+    {
+        pcm[i * 2] = (i & 8) ? 32767 : -32768;
+        pcm[i * 2 + 1] = (i & 8) ? -32768 : 32767;
+    }
+
+    std::vector<FrameOptions> opts(8);
+    for (int f = 0; f < 8; f++)
+    {
+        opts[f].channels = (f % 4 == 0) ? 1 : 7 + f % 4;
+        opts[f].sub[0].type = opts[f].sub[1].type = (f < 4) ? SUB_FIXED : SUB_VERBATIM;
+        opts[f].sub[0].order = opts[f].sub[1].order = f % 5;
+    }
+
+    TestFile file = build_file(pcm.data(), samples, bs, opts, true);
+    TEST(decode_file(file, pcm.data(), samples, true));
+
+    return status;
+}
+
+bool test_errors_and_seek()
+{
+    bool status = true;
+    COMMENT("test_errors_and_seek()");
+
+    const uint32_t bs = 4096;
+    const uint32_t samples = bs * 10 + 1000;
+    std::vector<int16_t> pcm(samples * 2);
+    make_audio(pcm.data(), samples, 3);
+
+    std::vector<FrameOptions> opts(1);
+    opts[0].channels = 10;
+    opts[0].sub[0].order = opts[0].sub[1].order = 2;
+    TestFile file = build_file(pcm.data(), samples, bs, opts, false);
+    TEST(decode_file(file, pcm.data(), samples, false));
+
+    // Find frame from middle of the previous one and decode it
+    MemInput in = {&file.data, 0, false};
+    flac_init(&g_dec, mem_read, mem_seek, &in);
+    TEST(flac_read_streaminfo(&g_dec));
+    flac_frame_t frame;
+    TEST(flac_seek(&g_dec, file.frame_offsets[4] + 100));
+    TEST(flac_find_frame(&g_dec, 65536, &frame));
+    TEST(frame.offset == file.frame_offsets[5] && frame.first_sample == bs * 5);
+    TEST(flac_decode_frame(&g_dec, g_pcm, &frame));
+    TEST(memcmp(g_pcm, pcm.data() + bs * 5 * 2, bs * 4) == 0);
+    TEST(flac_position(&g_dec) == file.frame_offsets[6]);
+
+    // Scan limit
+    TEST(flac_seek(&g_dec, file.frame_offsets[4] + 100));
+    TEST(!flac_find_frame(&g_dec, 1000, &frame));
+
+    // Last frame is shorter than the block size
+    TEST(flac_seek(&g_dec, file.frame_offsets[10]));
+    TEST(flac_decode_frame(&g_dec, g_pcm, &frame) && frame.blocksize == 1000);
+
+    // Corrupted data is detected by CRC
+    std::vector<uint8_t> bad = file.data;
+    bad[file.frame_offsets[2] + 1000] ^= 0x10;
+    in.data = &bad;
+    TEST(flac_seek(&g_dec, file.frame_offsets[2]));
+    TEST(!flac_decode_frame(&g_dec, g_pcm, &frame));
+
+    // Truncated file
+    bad = file.data;
+    bad.resize(file.frame_offsets[3] - 10);
+    TEST(flac_seek(&g_dec, file.frame_offsets[2]));
+    TEST(!flac_decode_frame(&g_dec, g_pcm, &frame));
+
+    // Unsupported stream format
+    bad = file.data;
+    bad[4 + 4 + 12] = 0x40; // Low bits of sample rate, 1 channel
+    flac_init(&g_dec, mem_read, mem_seek, &in);
+    TEST(flac_read_streaminfo(&g_dec) && !flac_is_supported(&g_dec.info));
+
+    return status;
+}
+
+// Compare decoding speed to real time playback
+bool test_benchmark()
+{
+    bool status = true;
+    COMMENT("test_benchmark()");
+
+    const uint32_t bs = 4096;
+    const uint32_t samples = 44100 * 60;
+    std::vector<int16_t> pcm(samples * 2);
+    make_audio(pcm.data(), samples, 4);
+
+    std::vector<FrameOptions> opts(1);
+    opts[0].channels = 10;
+    for (int ch = 0; ch < 2; ch++)
+    {
+        SubOptions &s = opts[0].sub[ch];
+        s.type = SUB_LPC;
+        s.order = 8;
+        s.precision = 12;
+        s.shift = 10;
+        s.coefs[0] = 1900; s.coefs[1] = -900;
+        s.partition_order = 4;
+    }
+    TestFile file = build_file(pcm.data(), samples, bs, opts, false);
+
+    clock_t start = clock();
+    TEST(decode_file(file, pcm.data(), samples, false));
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("Decoded 60 s of LPC order 8 audio in %.3f s, %.0fx real time, %.1f MB/s compressed input\n",
+           elapsed, 60.0 / elapsed, file.data.size() / elapsed / 1e6);
+
+    return status;
+}
+
+int main()
+{
+    if (test_subframe_types() &&
+        test_stereo_modes() &&
+        test_errors_and_seek() &&
+        test_benchmark())
+    {
+        printf("All tests passed\n");
+        return 0;
+    }
+    else
+    {
+        printf("Some tests failed\n");
+        return 1;
+    }
+}
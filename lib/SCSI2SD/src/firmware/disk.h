@@ -55,5 +55,6 @@ void scsiDiskReset(void);
 void scsiDiskPoll(void);
 int scsiDiskCommand(void);
 int doTestUnitReady();
+int scsiDiskPendingImageCommand(void);
 
 #endif
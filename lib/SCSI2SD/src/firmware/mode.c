@@ -24,6 +24,7 @@
 #include "inquiry.h"
 #include "ZuluSCSI_mode.h"
 #include "toolbox.h"
+#include "tape.h"
 
 #include <string.h>
 
@@ -239,6 +240,17 @@ static const uint8_t SequentialDeviceConfigPage[] =
 0x00 // reserved
 };
 
+static const uint8_t SequentialDataCompressionPage[] =
+{
+0x0F, // page code
+0x0E, // Page length
+0x00, // DCE, DCC
+0x00, // DDE, RED
+0x00,0x00,0x00,0x00, // Compression algorithm
+0x00,0x00,0x00,0x00, // Decompression algorithm
+0x00,0x00,0x00,0x00 // reserved
+};
+
 // Allow Apple 68k Drive Setup to format this drive.
 // Code
 static const uint8_t AppleVendorPage[] =
@@ -330,7 +342,8 @@ static void doModeSense(
 	case S2S_CFG_SEQUENTIAL:
 		mediumType = 0; // reserved
 		deviceSpecificParam =
-			(blockDev.state & DISK_WP) ? 0x80 : 0;
+			((blockDev.state & DISK_WP) ? 0x80 : 0) |
+			(scsiTapeBufferedMode() << 4);
 		density = 0x13; // DAT Data Storage, X3B5/88-185A 
 		break;
 
@@ -545,6 +558,34 @@ static void doModeSense(
 		idx += sizeof(IomegaZip100VendorPage);
 	}
 
+	if ((scsiDev.target->cfg->deviceType == S2S_CFG_SEQUENTIAL) &&
+		(pageCode == 0x0F || pageCode == 0x3F))
+	{
+		pageFound = 1;
+		pageIn(
+			pc,
+			idx,
+			SequentialDataCompressionPage,
+			sizeof(SequentialDataCompressionPage));
+
+		// Compression can be enabled only on tape container images
+		if (scsiTapeCompressionSupported())
+		{
+			if (pc == 0x01)
+			{
+				scsiDev.data[idx+2] = 0x80; // DCE is changeable
+			}
+			else
+			{
+				scsiDev.data[idx+2] = (scsiTapeCompression() ? 0x80 : 0) | 0x40;
+				scsiDev.data[idx+3] = 0x80; // Compressed records are decompressed
+				scsiDev.data[idx+7] = 0x01; // Default algorithm
+				scsiDev.data[idx+11] = 0x01;
+			}
+		}
+		idx += sizeof(SequentialDataCompressionPage);
+	}
+
 	if ((scsiDev.target->cfg->deviceType == S2S_CFG_SEQUENTIAL) &&
 		(pageCode == 0x10 || pageCode == 0x3F))
 	{
@@ -554,6 +595,10 @@ static void doModeSense(
 			idx,
 			SequentialDeviceConfigPage,
 			sizeof(SequentialDeviceConfigPage));
+		if (pc != 0x01 && scsiTapeCompression())
+		{
+			scsiDev.data[idx+14] = 0x01; // Default compression algorithm
+		}
 		idx += sizeof(SequentialDeviceConfigPage);
 	}
 
@@ -647,6 +692,14 @@ static void doModeSelect(void)
 			idx = 4;
 		}
 
+		if (scsiDev.target->cfg->deviceType == S2S_CFG_SEQUENTIAL)
+		{
+			// Buffered mode in device-specific parameter
+			uint8_t deviceSpecificParam =
+				scsiDev.data[(scsiDev.cdb[0] == 0x55) ? 3 : 2];
+			scsiTapeSetBufferedMode((deviceSpecificParam >> 4) & 7);
+		}
+
 		// The unwritten rule.  Blocksizes are normally set using the
 		// block descriptor value, not by changing page 0x03.
 		if (blockDescLen >= 8)
@@ -713,6 +766,13 @@ static void doModeSelect(void)
 				if (!modeSelectCDAudioControlPage(pageLen, idx)) goto bad;
 			}
 			break;
+			case 0x0F: // Data compression page
+			{
+				if (scsiDev.target->cfg->deviceType != S2S_CFG_SEQUENTIAL) break;
+				if (pageLen != 0x0E) goto bad;
+				if (!scsiTapeSetCompression(scsiDev.data[idx+2] >> 7)) goto bad;
+			}
+			break;
 			//default:
 
 				// Easiest to just ignore for now. We'll get here when changing
@@ -358,6 +358,12 @@ static void process_Command()
 	scsiDev.cmdCount++;
 	const S2S_TargetCfg* cfg = scsiDev.target->cfg;
 
+	if (command != 0x03)
+	{
+		// Tape sense bits only apply to the command that set them
+		scsiDev.target->sense.flags = 0;
+	}
+
 	if (unlikely(scsiDev.resetFlag))
 	{
 		// Don't log bogus commands
@@ -534,13 +540,19 @@ static void process_Command()
 			if (allocLength == 0) allocLength = 4;
 
 			memset(scsiDev.data, 0, 256); // Max possible alloc length
-			scsiDev.data[0] = 0xF0;
-			scsiDev.data[2] = scsiDev.target->sense.code & 0x0F;
+			scsiDev.data[0] = (scsiDev.target->sense.flags & SENSE_DEFERRED) ? 0xF1 : 0xF0;
+			scsiDev.data[2] = (scsiDev.target->sense.code & 0x0F) |
+				(scsiDev.target->sense.flags & (SENSE_FILEMARK | SENSE_EOM | SENSE_ILI));
 
-			scsiDev.data[3] = transfer.lba >> 24;
-			scsiDev.data[4] = transfer.lba >> 16;
-			scsiDev.data[5] = transfer.lba >> 8;
-			scsiDev.data[6] = transfer.lba;
+			uint32_t info = transfer.lba;
+			if (scsiDev.target->sense.flags & SENSE_INFO_VALID)
+			{
+				info = scsiDev.target->sense.info;
+			}
+			scsiDev.data[3] = info >> 24;
+			scsiDev.data[4] = info >> 16;
+			scsiDev.data[5] = info >> 8;
+			scsiDev.data[6] = info;
 
 			// Additional bytes if there are errors to report
 			scsiDev.data[7] = 10; // additional length
@@ -560,6 +572,7 @@ static void process_Command()
 		// This is a good time to clear out old sense information.
 		scsiDev.target->sense.code = NO_SENSE;
 		scsiDev.target->sense.asc = NO_ADDITIONAL_SENSE_INFORMATION;
+		scsiDev.target->sense.flags = 0;
 	}
 	// Some old SCSI drivers do NOT properly support
 	// unitAttention. eg. the Mac Plus would trigger a SCSI reset
@@ -599,6 +612,11 @@ static void process_Command()
 	{
 		enter_Status(CONFLICT);
 	}
+	// Image file is still being opened in the background
+	else if (unlikely(scsiDiskPendingImageCommand()))
+	{
+		// Status and sense codes already set
+	}
 	// Handle Toolbox commands, overriding other vendor commands if enabled
 	else if (scsiToolboxEnabled() && scsiToolboxCommand())
 	{
@@ -753,6 +771,7 @@ static void scsiReset()
 		scsiDev.target->reserverId = -1;
 		scsiDev.target->sense.code = NO_SENSE;
 		scsiDev.target->sense.asc = NO_ADDITIONAL_SENSE_INFORMATION;
+		scsiDev.target->sense.flags = 0;
 	}
 	scsiDev.target = NULL;
 
@@ -1341,6 +1360,7 @@ void scsiInit()
 		}
 		scsiDev.targets[i].sense.code = NO_SENSE;
 		scsiDev.targets[i].sense.asc = NO_ADDITIONAL_SENSE_INFORMATION;
+		scsiDev.targets[i].sense.flags = 0;
 
 		scsiDev.targets[i].syncOffset = 0;
 		scsiDev.targets[i].syncPeriod = 0;
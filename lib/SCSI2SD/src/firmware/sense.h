@@ -45,6 +45,7 @@ typedef enum
 {
 	ADDRESS_MARK_NOT_FOUND_FOR_DATA_FIELD                  = 0x1300,
 	ADDRESS_MARK_NOT_FOUND_FOR_ID_FIELD                    = 0x1200,
+	BEGINNING_OF_PARTITION_MEDIUM_DETECTED                 = 0x0004,
 	CANNOT_READ_MEDIUM_INCOMPATIBLE_FORMAT                 = 0x3002,
 	CANNOT_READ_MEDIUM_UNKNOWN_FORMAT                      = 0x3001,
 	CHANGED_OPERATING_DEFINITION                           = 0x3F02,
@@ -61,8 +62,11 @@ typedef enum
 	DEFECT_LIST_NOT_AVAILABLE                              = 0x1901,
 	DEFECT_LIST_NOT_FOUND                                  = 0x1C00,
 	DEFECT_LIST_UPDATE_FAILURE                             = 0x3201,
+	END_OF_DATA_DETECTED                                   = 0x0005,
+	END_OF_PARTITION_MEDIUM_DETECTED                       = 0x0002,
 	ERROR_LOG_OVERFLOW                                     = 0x0A00,
 	ERROR_TOO_LONG_TO_CORRECT                              = 0x1102,
+	FILEMARK_DETECTED                                      = 0x0001,
 	FORMAT_COMMAND_FAILED                                  = 0x3101,
 	GROWN_DEFECT_LIST_NOT_FOUND                            = 0x1C02,
 	IO_PROCESS_TERMINATED                                  = 0x0006,
@@ -169,10 +173,21 @@ typedef enum
 	WRITE_PROTECTED                                        = 0x2700
 } SCSI_ASC_ASCQ;
 
+// Sequential-access device bits in byte 2 of sense data
+#define SENSE_FILEMARK 0x80
+#define SENSE_EOM 0x40
+#define SENSE_ILI 0x20
+// Information field is set in ScsiSense.info
+#define SENSE_INFO_VALID 0x01
+// Error of an earlier command, such as buffered tape write
+#define SENSE_DEFERRED 0x02
+
 typedef struct
 {
 	uint8_t code;
 	uint16_t asc;
+	uint8_t flags; // SENSE_* bits, cleared at start of next command
+	uint32_t info;
 } ScsiSense;
 
 #endif
@@ -19,4 +19,13 @@
 
 int scsiTapeCommand(void);
 
+// Buffered mode field of MODE SENSE / MODE SELECT header
+int scsiTapeBufferedMode(void);
+void scsiTapeSetBufferedMode(int mode);
+
+// Data compression page, returns 0 if compression is not supported
+int scsiTapeCompressionSupported(void);
+int scsiTapeCompression(void);
+int scsiTapeSetCompression(int enable);
+
 #endif
@@ -0,0 +1,258 @@
+/*
+ * Compressed CD image format suitable for embedded systems.
+ *
+ *  Copyright (c) 2024 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Decoders for the compressed CD image hunks.
+// These run on the target when reading the image, so they are written for speed
+// on 32-bit microcontrollers, with all lengths checked against the buffers.
+
+#include "ZCD.h"
+#include <string.h>
+
+// Number of stereo frames in each PCM partition, one CD sector
+#define PCM_PARTITION 588
+
+// Residuals with longer unary prefix are stored as raw PCM_ESCAPE_BITS
+#define PCM_ESCAPE 24
+#define PCM_ESCAPE_BITS 20
+
+bool zcd_check_header(const zcd_header_t *header)
+{
+    return memcmp(header->magic, ZCD_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == ZCD_VERSION &&
+           header->hunk_bytes > 0 && (header->hunk_bytes % 4) == 0 &&
+           (uint64_t)header->hunk_count * header->hunk_bytes >= header->logical_size;
+}
+
+static bool lz_decompress(const uint8_t *ip, uint32_t srclen, uint8_t *op, uint32_t dstlen, bool inplace)
+{
+    const uint8_t *iend = ip + srclen;
+    uint8_t *ostart = op;
+    uint8_t *oend = op + dstlen;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+
+        uint32_t litlen = token >> 4;
+        if (litlen == 15)
+        {
+            uint8_t b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                litlen += b;
+            } while (b == 255);
+        }
+
+        if (litlen > (uint32_t)(iend - ip) || litlen > (uint32_t)(oend - op)) return false;
+        memmove(op, ip, litlen);
+        op += litlen;
+        ip += litlen;
+
+        if (ip >= iend) break; // Last sequence has only literals
+        if (iend - ip < 2) return false;
+        uint32_t offset = ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+
+        uint32_t matchlen = (token & 15) + 4;
+        if ((token & 15) == 15)
+        {
+            uint8_t b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                matchlen += b;
+            } while (b == 255);
+        }
+
+        if (offset == 0 || offset > (uint32_t)(op - ostart) || matchlen > (uint32_t)(oend - op)) return false;
+
+        // Output must not overwrite compressed data that has not been read yet
+        if (inplace && op + matchlen > ip) return false;
+
+        const uint8_t *match = op - offset;
+        if (offset >= matchlen)
+        {
+            memcpy(op, match, matchlen);
+            op += matchlen;
+        }
+        else
+        {
+            while (matchlen--) *op++ = *match++;
+        }
+    }
+
+    return op == oend;
+}
+
+// Reads bits MSB first, keeping up to 32 bits in a buffer
+struct zcd_bitreader_t
+{
+    const uint8_t *ptr;
+    const uint8_t *end;
+    uint32_t buf;
+    int bits;
+
+    void refill()
+    {
+        while (bits <= 24 && ptr < end)
+        {
+            buf |= (uint32_t)(*ptr++) << (24 - bits);
+            bits += 8;
+        }
+    }
+
+    // Read up to 24 bits
+    uint32_t get(int count)
+    {
+        if (count == 0) return 0;
+        if (bits < count) refill();
+        uint32_t result = buf >> (32 - count);
+        buf <<= count;
+        bits -= count;
+        return result;
+    }
+
+    // Read a Rice coded value
+    uint32_t get_rice(int k)
+    {
+        if (bits < 24) refill();
+
+        uint32_t zeros;
+        if (buf != 0)
+        {
+            zeros = __builtin_clz(buf);
+        }
+        else
+        {
+            zeros = 32;
+        }
+
+        if (zeros >= PCM_ESCAPE || (int)zeros >= bits)
+        {
+            // Long prefix, count zeros bit by bit
+            zeros = 0;
+            while (zeros < PCM_ESCAPE && get(1) == 0) zeros++;
+            if (zeros == PCM_ESCAPE) return get(PCM_ESCAPE_BITS);
+        }
+        else
+        {
+            buf <<= zeros + 1;
+            bits -= zeros + 1;
+        }
+
+        return (zeros << k) | get(k);
+    }
+
+    bool overrun() const
+    {
+        return bits < 0;
+    }
+};
+
+static inline int32_t pcm_predict(int order, int32_t x1, int32_t x2, int32_t x3)
+{
+    switch (order)
+    {
+        case 0: return 0;
+        case 1: return x1;
+        case 2: return 2 * x1 - x2;
+        default: return 3 * x1 - 3 * x2 + x3;
+    }
+}
+
+static bool pcm_decompress(const uint8_t *src, uint32_t srclen, uint8_t *op, uint32_t dstlen, bool inplace)
+{
+    if (dstlen % 4 != 0) return false;
+
+    zcd_bitreader_t br = {src, src + srclen, 0, 0};
+    int order[2];
+    order[0] = br.get(2);
+    order[1] = br.get(2);
+
+    int32_t hist[2][3] = {{0, 0, 0}, {0, 0, 0}};
+    uint32_t frames = dstlen / 4;
+    uint32_t frame = 0;
+    while (frame < frames)
+    {
+        int k[2];
+        k[0] = br.get(5);
+        k[1] = br.get(5);
+        if (k[0] > PCM_ESCAPE_BITS || k[1] > PCM_ESCAPE_BITS) return false;
+
+        uint32_t end = frame + PCM_PARTITION;
+        if (end > frames) end = frames;
+        for (; frame < end; frame++)
+        {
+            for (int ch = 0; ch < 2; ch++)
+            {
+                int32_t x;
+                int32_t *h = hist[ch];
+                if (frame < (uint32_t)order[ch])
+                {
+                    x = (int16_t)br.get(16);
+                }
+                else
+                {
+                    uint32_t u = br.get_rice(k[ch]);
+                    int32_t r = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+                    x = pcm_predict(order[ch], h[0], h[1], h[2]) + r;
+                }
+
+                h[2] = h[1];
+                h[1] = h[0];
+                h[0] = x;
+            }
+
+            if (br.overrun()) return false;
+            if (inplace && op + 4 > br.ptr) return false;
+
+            *op++ = (uint8_t)hist[0][0];
+            *op++ = (uint8_t)(hist[0][0] >> 8);
+            *op++ = (uint8_t)hist[1][0];
+            *op++ = (uint8_t)(hist[1][0] >> 8);
+        }
+    }
+
+    return true;
+}
+
+bool zcd_decompress(uint8_t codec, const uint8_t *src, uint32_t srclen, uint8_t *dst, uint32_t dstlen)
+{
+    bool inplace = (src >= dst && src < dst + dstlen + ZCD_INPLACE_MARGIN);
+
+    if (codec == ZCD_CODEC_STORE)
+    {
+        if (srclen != dstlen) return false;
+        memmove(dst, src, dstlen);
+        return true;
+    }
+    else if (codec == ZCD_CODEC_LZ)
+    {
+        return lz_decompress(src, srclen, dst, dstlen, inplace);
+    }
+    else if (codec == ZCD_CODEC_PCM)
+    {
+        return pcm_decompress(src, srclen, dst, dstlen, inplace);
+    }
+    else
+    {
+        return false;
+    }
+}
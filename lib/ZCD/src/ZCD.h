@@ -0,0 +1,104 @@
+/*
+ * Compressed CD image format suitable for embedded systems.
+ *
+ *  Copyright (c) 2024 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// The .zcd file stores a disc image, such as the .bin of a BIN/CUE pair,
+// split into fixed size hunks that are compressed independently.
+//
+// File layout, all values little-endian:
+//   zcd_header_t          at offset 0
+//   compressed hunks      each starting at a multiple of 4 bytes
+//   hunk map              hunk_count entries of zcd_map_entry_t at map_offset
+//
+// Each hunk is compressed with the codec that gives the smallest result:
+//   ZCD_CODEC_STORE  uncompressed data
+//   ZCD_CODEC_LZ     byte oriented LZ77 for data tracks
+//   ZCD_CODEC_PCM    fixed linear prediction and Rice coding of 16-bit
+//                    stereo samples, for audio tracks
+//
+// The decoders support decompressing in place, with the compressed data
+// placed at the end of a buffer of hunk_bytes + ZCD_INPLACE_MARGIN bytes.
+// The encoder only selects a codec if the result can be decoded this way.
+
+#pragma once
+
+#include <stdint.h>
+
+#define ZCD_MAGIC "ZuluCD\r\n"
+#define ZCD_VERSION 1
+
+// Extra buffer space needed for in-place decompression
+#define ZCD_INPLACE_MARGIN 256
+
+enum zcd_codec_t
+{
+    ZCD_CODEC_STORE = 0,
+    ZCD_CODEC_LZ = 1,
+    ZCD_CODEC_PCM = 2,
+    ZCD_CODEC_COUNT
+};
+
+struct zcd_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t hunk_bytes;     // Uncompressed size of each hunk, multiple of 4
+    uint64_t logical_size;   // Size of the uncompressed image
+    uint64_t map_offset;     // Position of hunk map in file
+    uint32_t hunk_count;
+    uint32_t reserved[7];
+};
+
+struct zcd_map_entry_t
+{
+    uint32_t offset;       // Position of the hunk in file, divided by 4
+    uint32_t length_codec; // Compressed length in low 24 bits, codec in high 8 bits
+};
+
+// Check that header is valid and supported
+bool zcd_check_header(const zcd_header_t *header);
+
+// Decompress a hunk.
+// Source may be at the end of the destination buffer, as described above.
+// Returns false if the data is invalid.
+bool zcd_decompress(uint8_t codec, const uint8_t *src, uint32_t srclen, uint8_t *dst, uint32_t dstlen);
+
+// Compress a hunk with the given codec.
+// The dst buffer must have space for len bytes. Returns the compressed length,
+// or 0 if the result would not be smaller than the input.
+uint32_t zcd_compress(uint8_t codec, const uint8_t *src, uint32_t len, uint8_t *dst);
+
+// Compress a hunk with the codec that gives the smallest result that can
+// be decompressed in place. The dst buffer must have space for len bytes.
+// Returns the compressed length and stores the selected codec.
+uint32_t zcd_compress_best(const uint8_t *src, uint32_t len, uint8_t *dst, uint8_t *codec);
+
+// Size of the hash table used by zcd_compress_fast()
+#define ZCD_FAST_HASH_BITS 12
+#define ZCD_FAST_HASH_SIZE (1 << ZCD_FAST_HASH_BITS)
+
+// Longest input supported by zcd_compress_fast()
+#define ZCD_FAST_MAX_LEN 65535
+
+// Compress data with ZCD_CODEC_LZ fast enough for use on the target.
+// Takes a single match candidate per position from the hash table given by
+// the caller, and skips ahead faster in data that doesn't compress.
+// The result is decompressed with zcd_decompress(), but not always in place.
+// The dst buffer must have space for len bytes. Returns the compressed length,
+// or 0 if the result would not be smaller than the input.
+uint32_t zcd_compress_fast(const uint8_t *src, uint32_t len, uint8_t *dst, uint16_t *hashtable);
@@ -0,0 +1,377 @@
+/*
+ * Compressed CD image format suitable for embedded systems.
+ *
+ *  Copyright (c) 2024 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Encoders for the compressed CD image hunks.
+// These are used by the image conversion tool on a PC, so they favor
+// compression ratio over speed.
+
+#include "ZCD.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define PCM_PARTITION 588
+#define PCM_ESCAPE 24
+#define PCM_ESCAPE_BITS 20
+#define PCM_MAX_K 18
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 15
+#define LZ_MAX_CHAIN 256
+#define LZ_NICE_MATCH 1024
+
+/******************/
+/* LZ compression */
+/******************/
+
+struct lz_writer_t
+{
+    uint8_t *ptr;
+    uint8_t *end;
+
+    bool put(uint8_t b)
+    {
+        if (ptr >= end) return false;
+        *ptr++ = b;
+        return true;
+    }
+
+    bool put_length(uint32_t len)
+    {
+        while (len >= 255)
+        {
+            if (!put(255)) return false;
+            len -= 255;
+        }
+        return put(len);
+    }
+
+    // Write sequence of literals, followed by match unless matchlen is 0
+    bool sequence(const uint8_t *lit, uint32_t litlen, uint32_t offset, uint32_t matchlen)
+    {
+        uint32_t mcode = matchlen ? matchlen - LZ_MIN_MATCH : 0;
+        uint8_t token = ((litlen >= 15 ? 15 : litlen) << 4) | (mcode >= 15 ? 15 : mcode);
+        if (!put(token)) return false;
+        if (litlen >= 15 && !put_length(litlen - 15)) return false;
+        if (litlen > (uint32_t)(end - ptr)) return false;
+        memcpy(ptr, lit, litlen);
+        ptr += litlen;
+
+        if (matchlen)
+        {
+            if (!put(offset & 0xFF) || !put(offset >> 8)) return false;
+            if (mcode >= 15 && !put_length(mcode - 15)) return false;
+        }
+        return true;
+    }
+};
+
+static inline uint32_t lz_hash(const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline void lz_insert(int32_t *head, int32_t *prev, const uint8_t *src, uint32_t pos)
+{
+    uint32_t h = lz_hash(src + pos);
+    prev[pos] = head[h];
+    head[h] = pos;
+}
+
+static uint32_t lz_compress(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+    int32_t *head = (int32_t*)malloc(sizeof(int32_t) << LZ_HASH_BITS);
+    int32_t *prev = (int32_t*)malloc(sizeof(int32_t) * (len + 1));
+    if (!head || !prev)
+    {
+        free(head);
+        free(prev);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < (1u << LZ_HASH_BITS); i++) head[i] = -1;
+
+    lz_writer_t out = {dst, dst + len - 1};
+    uint32_t anchor = 0;
+    uint32_t pos = 0;
+    bool ok = true;
+
+    while (ok && pos + LZ_MIN_MATCH <= len)
+    {
+        // Find longest match from hash chain
+        uint32_t h = lz_hash(src + pos);
+        uint32_t best_len = 0, best_offset = 0;
+        int32_t cand = head[h];
+        for (int chain = 0; cand >= 0 && chain < LZ_MAX_CHAIN; chain++)
+        {
+            uint32_t offset = pos - cand;
+            if (offset > LZ_MAX_OFFSET) break;
+
+            uint32_t mlen = 0;
+            while (pos + mlen < len && src[cand + mlen] == src[pos + mlen]) mlen++;
+            if (mlen > best_len)
+            {
+                best_len = mlen;
+                best_offset = offset;
+                if (pos + mlen == len || mlen >= LZ_NICE_MATCH) break;
+            }
+            cand = prev[cand];
+        }
+
+        if (best_len >= LZ_MIN_MATCH)
+        {
+            ok = out.sequence(src + anchor, pos - anchor, best_offset, best_len);
+
+            // Add the positions covered by the match to the hash chains
+            uint32_t end = pos + best_len;
+            for (; pos < end; pos++)
+            {
+                if (pos + LZ_MIN_MATCH <= len) lz_insert(head, prev, src, pos);
+            }
+            anchor = pos;
+        }
+        else
+        {
+            lz_insert(head, prev, src, pos);
+            pos++;
+        }
+    }
+
+    if (ok && anchor < len)
+    {
+        ok = out.sequence(src + anchor, len - anchor, 0, 0);
+    }
+
+    free(head);
+    free(prev);
+    return ok ? (uint32_t)(out.ptr - dst) : 0;
+}
+
+/*******************/
+/* PCM compression */
+/*******************/
+
+struct pcm_writer_t
+{
+    uint8_t *ptr;
+    uint8_t *end;
+    uint32_t buf;
+    int bits;
+    bool ok;
+
+    // Write up to 24 bits
+    void put(uint32_t value, int count)
+    {
+        for (int i = count - 1; i >= 0; i--)
+        {
+            buf = (buf << 1) | ((value >> i) & 1);
+            if (++bits == 8)
+            {
+                if (ptr >= end) { ok = false; return; }
+                *ptr++ = (uint8_t)buf;
+                buf = 0;
+                bits = 0;
+            }
+        }
+    }
+
+    void put_rice(uint32_t u, int k)
+    {
+        uint32_t q = u >> k;
+        if (q >= PCM_ESCAPE)
+        {
+            put(0, PCM_ESCAPE);
+            put(u, PCM_ESCAPE_BITS);
+        }
+        else
+        {
+            put(1, q + 1);
+            put(u & ((1u << k) - 1), k);
+        }
+    }
+
+    void flush()
+    {
+        if (bits > 0) put(0, 8 - bits);
+    }
+};
+
+static inline int32_t pcm_sample(const uint8_t *src, uint32_t frame, int ch)
+{
+    const uint8_t *p = src + frame * 4 + ch * 2;
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+static inline int32_t pcm_residual(const uint8_t *src, uint32_t frame, int ch, int order)
+{
+    int32_t x0 = pcm_sample(src, frame, ch);
+    int32_t x1 = (order >= 1) ? pcm_sample(src, frame - 1, ch) : 0;
+    int32_t x2 = (order >= 2) ? pcm_sample(src, frame - 2, ch) : 0;
+    int32_t x3 = (order >= 3) ? pcm_sample(src, frame - 3, ch) : 0;
+    switch (order)
+    {
+        case 0: return x0;
+        case 1: return x0 - x1;
+        case 2: return x0 - 2 * x1 + x2;
+        default: return x0 - 3 * x1 + 3 * x2 - x3;
+    }
+}
+
+static inline uint32_t pcm_zigzag(int32_t r)
+{
+    return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+static uint32_t pcm_compress(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+    if (len % 4 != 0 || len < 16) return 0;
+    uint32_t frames = len / 4;
+
+    // Select the predictor with smallest total residual for each channel
+    int order[2];
+    for (int ch = 0; ch < 2; ch++)
+    {
+        uint64_t best = UINT64_MAX;
+        for (int o = 0; o < 4; o++)
+        {
+            uint64_t sum = 0;
+            for (uint32_t f = 3; f < frames; f++)
+            {
+                int32_t r = pcm_residual(src, f, ch, o);
+                sum += (r < 0) ? -r : r;
+            }
+            if (sum < best)
+            {
+                best = sum;
+                order[ch] = o;
+            }
+        }
+    }
+
+    pcm_writer_t out = {dst, dst + len - 1, 0, 0, true};
+    out.put(order[0], 2);
+    out.put(order[1], 2);
+
+    for (uint32_t start = 0; start < frames && out.ok; start += PCM_PARTITION)
+    {
+        uint32_t end = start + PCM_PARTITION;
+        if (end > frames) end = frames;
+
+        // Select Rice parameter that gives the smallest partition
+        int k[2];
+        for (int ch = 0; ch < 2; ch++)
+        {
+            uint64_t best = UINT64_MAX;
+            for (int kk = 0; kk <= PCM_MAX_K; kk++)
+            {
+                uint64_t bits = 0;
+                for (uint32_t f = start; f < end; f++)
+                {
+                    if (f < (uint32_t)order[ch]) continue;
+                    uint32_t q = pcm_zigzag(pcm_residual(src, f, ch, order[ch])) >> kk;
+                    bits += (q >= PCM_ESCAPE) ? (PCM_ESCAPE + PCM_ESCAPE_BITS) : (q + 1 + kk);
+                }
+                if (bits < best)
+                {
+                    best = bits;
+                    k[ch] = kk;
+                }
+            }
+        }
+
+        out.put(k[0], 5);
+        out.put(k[1], 5);
+
+        for (uint32_t f = start; f < end; f++)
+        {
+            for (int ch = 0; ch < 2; ch++)
+            {
+                if (f < (uint32_t)order[ch])
+                {
+                    out.put((uint16_t)pcm_sample(src, f, ch), 16);
+                }
+                else
+                {
+                    out.put_rice(pcm_zigzag(pcm_residual(src, f, ch, order[ch])), k[ch]);
+                }
+            }
+        }
+    }
+
+    out.flush();
+    return out.ok ? (uint32_t)(out.ptr - dst) : 0;
+}
+
+/**************************/
+/* Codec selection        */
+/**************************/
+
+uint32_t zcd_compress(uint8_t codec, const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+    if (codec == ZCD_CODEC_STORE)
+    {
+        memcpy(dst, src, len);
+        return len;
+    }
+    else if (codec == ZCD_CODEC_LZ)
+    {
+        return lz_compress(src, len, dst);
+    }
+    else if (codec == ZCD_CODEC_PCM)
+    {
+        return pcm_compress(src, len, dst);
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+uint32_t zcd_compress_best(const uint8_t *src, uint32_t len, uint8_t *dst, uint8_t *codec)
+{
+    uint8_t *tmp = (uint8_t*)malloc(len);
+    uint8_t *check = (uint8_t*)malloc(len + ZCD_INPLACE_MARGIN);
+
+    *codec = ZCD_CODEC_STORE;
+    memcpy(dst, src, len);
+    uint32_t best = len;
+
+    for (uint8_t c = ZCD_CODEC_STORE + 1; tmp && check && c < ZCD_CODEC_COUNT; c++)
+    {
+        uint32_t clen = zcd_compress(c, src, len, tmp);
+        if (clen == 0 || clen >= best) continue;
+
+        // Verify the result by decompressing it the same way as the firmware does
+        uint8_t *inplace = check + len + ZCD_INPLACE_MARGIN - clen;
+        memcpy(inplace, tmp, clen);
+        if (!zcd_decompress(c, inplace, clen, check, len) || memcmp(check, src, len) != 0)
+        {
+            continue;
+        }
+
+        *codec = c;
+        best = clen;
+        memcpy(dst, tmp, clen);
+    }
+
+    free(tmp);
+    free(check);
+    return best;
+}
@@ -0,0 +1,146 @@
+/*
+ * Compressed CD image format suitable for embedded systems.
+ *
+ *  Copyright (c) 2024 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Fast LZ encoder for compressing data on the target while it is written,
+// such as tape records. Produces the same format as the encoder used by the
+// image conversion tool, trading compression ratio for speed and memory.
+
+#include "ZCD.h"
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+
+// Number of failed match attempts before the step size grows by one
+#define LZ_SKIP_SHIFT 5
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    // Bytewise for processors without unaligned access
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t lz_fast_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - ZCD_FAST_HASH_BITS);
+}
+
+// Write a length continuation as 255 bytes and the remainder
+static inline uint8_t *lz_put_length(uint8_t *op, uint32_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// Write sequence of literals followed by a match, or only literals if matchlen is 0.
+// Returns NULL if the output would reach oend.
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, uint32_t litlen,
+                                uint32_t offset, uint32_t matchlen)
+{
+    // Worst case size: token, length bytes, literals, offset and match length bytes
+    uint32_t mcode = matchlen ? matchlen - LZ_MIN_MATCH : 0;
+    if ((uint32_t)(oend - op) <= 1 + litlen / 255 + 1 + litlen + 2 + mcode / 255 + 1)
+    {
+        return NULL;
+    }
+
+    uint8_t *token = op++;
+    *token = ((litlen >= 15 ? 15 : litlen) << 4) | (mcode >= 15 ? 15 : mcode);
+    if (litlen >= 15) op = lz_put_length(op, litlen - 15);
+    memcpy(op, lit, litlen);
+    op += litlen;
+
+    if (matchlen)
+    {
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        if (mcode >= 15) op = lz_put_length(op, mcode - 15);
+    }
+
+    return op;
+}
+
+uint32_t zcd_compress_fast(const uint8_t *src, uint32_t len, uint8_t *dst, uint16_t *hashtable)
+{
+    if (len > ZCD_FAST_MAX_LEN || len <= LZ_MIN_MATCH)
+    {
+        return 0;
+    }
+
+    memset(hashtable, 0, sizeof(uint16_t) * ZCD_FAST_HASH_SIZE);
+
+    uint8_t *op = dst;
+    uint8_t *oend = dst + len;
+    uint32_t anchor = 0;
+    uint32_t pos = 1;
+    uint32_t misses = 0;
+    uint32_t limit = len - LZ_MIN_MATCH;
+
+    while (pos <= limit)
+    {
+        uint32_t v = lz_read32(src + pos);
+        uint32_t h = lz_fast_hash(v);
+        uint32_t cand = hashtable[h];
+        hashtable[h] = pos;
+
+        if (cand >= pos || lz_read32(src + cand) != v)
+        {
+            pos += 1 + (misses++ >> LZ_SKIP_SHIFT);
+            continue;
+        }
+
+        // Extend match backwards over literals and forwards to the end
+        while (pos > anchor && cand > 0 && src[pos - 1] == src[cand - 1])
+        {
+            pos--;
+            cand--;
+        }
+
+        uint32_t matchlen = LZ_MIN_MATCH;
+        while (pos + matchlen < len && src[cand + matchlen] == src[pos + matchlen])
+        {
+            matchlen++;
+        }
+
+        op = lz_put_sequence(op, oend, src + anchor, pos - anchor, pos - cand, matchlen);
+        if (!op) return 0;
+
+        pos += matchlen;
+        anchor = pos;
+        misses = 0;
+
+        // Position just before the end of match helps to find the next one
+        if (pos - 2 <= limit)
+        {
+            hashtable[lz_fast_hash(lz_read32(src + pos - 2))] = pos - 2;
+        }
+    }
+
+    if (anchor < len)
+    {
+        op = lz_put_sequence(op, oend, src + anchor, len - anchor, 0, 0);
+        if (!op) return 0;
+    }
+
+    return op - dst;
+}
@@ -0,0 +1,272 @@
+#include "ZCD.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+/* Unit test helpers */
+#define COMMENT(x) printf("\n----" x "----\n");
+#define TEST(x) \
+    if (!(x)) { \
+        fprintf(stderr, "\033[31;1mFAILED:\033[22;39m %s:%d %s\n", __FILE__, __LINE__, #x); \
+        status = false; \
+    } else { \
+        printf("\033[32;1mOK:\033[22;39m %s\n", #x); \
+    }
+
+#define HUNK_BYTES (8 * 2352)
+
+// Data track like content: text, repeated structures and zero padding
+static void make_data(uint8_t *buf, uint32_t len, unsigned seed)
+{
+    srand(seed);
+    const char *words[] = {"SYSTEM", "FOLDER", "Finder", "resource", "0000", "data", " ", "\r\n"};
+    uint32_t pos = 0;
+    while (pos < len)
+    {
+        int choice = rand() % 10;
+        if (choice < 7)
+        {
+            const char *w = words[rand() % 8];
+            while (*w && pos < len) buf[pos++] = *w++;
+        }
+        else if (choice < 9)
+        {
+            buf[pos++] = (uint8_t)rand();
+        }
+        else
+        {
+            uint32_t zeros = rand() % 200;
+            while (zeros-- && pos < len) buf[pos++] = 0;
+        }
+    }
+}
+
+// Audio track like content: mix of tones and some noise, 16-bit stereo
+static void make_audio(uint8_t *buf, uint32_t len, unsigned seed)
+{
+    srand(seed);
+    double f1 = 220.0 + rand() % 200, f2 = 550.0 + rand() % 300;
+    for (uint32_t i = 0; i < len / 4; i++)
+    {
+        double t = (seed * 100000 + i) / 44100.0;
+        for (int ch = 0; ch < 2; ch++)
+        {
+            double v = 9000 * sin(2 * M_PI * f1 * t + ch) + 5000 * sin(2 * M_PI * f2 * t)
+                     + (rand() % 256 - 128);
+            int16_t s = (int16_t)v;
+            buf[i * 4 + ch * 2] = (uint8_t)s;
+            buf[i * 4 + ch * 2 + 1] = (uint8_t)(s >> 8);
+        }
+    }
+}
+
+static bool roundtrip(uint8_t codec, const uint8_t *src, uint32_t len, uint32_t *clen_out)
+{
+    static uint8_t comp[HUNK_BYTES];
+    static uint8_t out[HUNK_BYTES + ZCD_INPLACE_MARGIN];
+    uint32_t clen = zcd_compress(codec, src, len, comp);
+    if (clen_out) *clen_out = clen;
+    if (clen == 0) return false;
+    memset(out, 0xAA, sizeof(out));
+    return zcd_decompress(codec, comp, clen, out, len) && memcmp(out, src, len) == 0;
+}
+
+bool test_codecs()
+{
+    bool status = true;
+    COMMENT("test_codecs()");
+
+    static uint8_t data[HUNK_BYTES], audio[HUNK_BYTES];
+    make_data(data, sizeof(data), 1);
+    make_audio(audio, sizeof(audio), 1);
+
+    uint32_t clen;
+    TEST(roundtrip(ZCD_CODEC_STORE, data, sizeof(data), &clen) && clen == sizeof(data));
+    TEST(roundtrip(ZCD_CODEC_LZ, data, sizeof(data), &clen) && clen < sizeof(data) / 2);
+    TEST(roundtrip(ZCD_CODEC_PCM, audio, sizeof(audio), &clen) && clen < sizeof(audio) * 3 / 4);
+
+    COMMENT("Short and odd length hunks");
+    TEST(roundtrip(ZCD_CODEC_LZ, data, 1000, NULL));
+    TEST(roundtrip(ZCD_CODEC_PCM, audio, 2352 + 4, NULL));
+
+    COMMENT("All zero hunk");
+    static uint8_t zeros[HUNK_BYTES];
+    TEST(roundtrip(ZCD_CODEC_LZ, zeros, sizeof(zeros), &clen) && clen < 100);
+    TEST(roundtrip(ZCD_CODEC_PCM, zeros, sizeof(zeros), &clen) && clen < 5000);
+
+    COMMENT("Random data is not compressible");
+    static uint8_t noise[HUNK_BYTES];
+    srand(5);
+    for (uint32_t i = 0; i < sizeof(noise); i++) noise[i] = (uint8_t)rand();
+    uint8_t codec = 0xFF;
+    static uint8_t comp[HUNK_BYTES];
+    TEST(zcd_compress_best(noise, sizeof(noise), comp, &codec) == sizeof(noise) && codec == ZCD_CODEC_STORE);
+
+    return status;
+}
+
+bool test_inplace()
+{
+    bool status = true;
+    COMMENT("test_inplace()");
+
+    static uint8_t src[HUNK_BYTES], comp[HUNK_BYTES];
+    static uint8_t buf[HUNK_BYTES + ZCD_INPLACE_MARGIN];
+    int compressed_ok = 0;
+    for (unsigned seed = 1; seed <= 8; seed++)
+    {
+        if (seed & 1) make_data(src, sizeof(src), seed); else make_audio(src, sizeof(src), seed);
+
+        uint8_t codec;
+        uint32_t clen = zcd_compress_best(src, sizeof(src), comp, &codec);
+        uint8_t *inplace = buf + sizeof(buf) - clen;
+        memcpy(inplace, comp, clen);
+        bool ok = zcd_decompress(codec, inplace, clen, buf, sizeof(src)) && memcmp(buf, src, sizeof(src)) == 0;
+        if (ok && codec != ZCD_CODEC_STORE) compressed_ok++;
+    }
+    TEST(compressed_ok == 8);
+
+    COMMENT("Corrupted data is rejected without overrunning buffer");
+    make_data(src, sizeof(src), 3);
+    uint32_t clen = zcd_compress(ZCD_CODEC_LZ, src, sizeof(src), comp);
+    int rejected = 0;
+    for (int i = 0; i < 200; i++)
+    {
+        uint8_t saved = comp[i * 7 % clen];
+        comp[i * 7 % clen] ^= 0x5A;
+        if (!zcd_decompress(ZCD_CODEC_LZ, comp, clen, buf, sizeof(src))) rejected++;
+        comp[i * 7 % clen] = saved;
+    }
+    printf("Rejected %d of 200 corrupted LZ hunks\n", rejected);
+    TEST(!zcd_decompress(ZCD_CODEC_LZ, comp, clen / 2, buf, sizeof(src)));
+    TEST(!zcd_decompress(ZCD_CODEC_PCM, comp, clen / 2, buf, sizeof(src)));
+    TEST(!zcd_decompress(ZCD_CODEC_COUNT, comp, clen, buf, sizeof(src)));
+
+    COMMENT("Header check");
+    zcd_header_t hdr = {};
+    memcpy(hdr.magic, ZCD_MAGIC, sizeof(hdr.magic));
+    hdr.version = ZCD_VERSION;
+    hdr.hunk_bytes = HUNK_BYTES;
+    hdr.hunk_count = 10;
+    hdr.logical_size = 10 * HUNK_BYTES - 100;
+    TEST(zcd_check_header(&hdr));
+    hdr.logical_size = 10 * HUNK_BYTES + 100;
+    TEST(!zcd_check_header(&hdr));
+    hdr.logical_size = 0;
+    hdr.version = ZCD_VERSION + 1;
+    TEST(!zcd_check_header(&hdr));
+
+    return status;
+}
+
+bool test_fast()
+{
+    bool status = true;
+    COMMENT("test_fast()");
+
+    static uint8_t src[32768], comp[32768], out[32768];
+    static uint16_t hashtable[ZCD_FAST_HASH_SIZE];
+    uint32_t clen;
+
+    make_data(src, sizeof(src), 11);
+    clen = zcd_compress_fast(src, sizeof(src), comp, hashtable);
+    printf("Data: %u -> %u bytes\n", (unsigned)sizeof(src), (unsigned)clen);
+    TEST(clen > 0 && clen < sizeof(src) * 3 / 4);
+    TEST(zcd_decompress(ZCD_CODEC_LZ, comp, clen, out, sizeof(src)) && memcmp(out, src, sizeof(src)) == 0);
+
+    memset(src, 0, sizeof(src));
+    clen = zcd_compress_fast(src, sizeof(src), comp, hashtable);
+    TEST(clen > 0 && clen < 256);
+    TEST(zcd_decompress(ZCD_CODEC_LZ, comp, clen, out, sizeof(src)) && memcmp(out, src, sizeof(src)) == 0);
+
+    // Short inputs and inputs ending in a match
+    static const uint8_t text[] = "abcdabcdabcdabcdabcdxyz abcdabcdabcdabcdabcd";
+    clen = zcd_compress_fast(text, sizeof(text) - 1, comp, hashtable);
+    TEST(clen > 0 && zcd_decompress(ZCD_CODEC_LZ, comp, clen, out, sizeof(text) - 1) && memcmp(out, text, sizeof(text) - 1) == 0);
+    TEST(zcd_compress_fast(text, 4, comp, hashtable) == 0);
+
+    // Incompressible data must not overflow the output buffer
+    srand(12);
+    for (uint32_t i = 0; i < sizeof(src); i++) src[i] = (uint8_t)rand();
+    memset(comp, 0x55, sizeof(comp));
+    TEST(zcd_compress_fast(src, sizeof(src) - 100, comp, hashtable) == 0);
+    TEST(comp[sizeof(src) - 100] == 0x55);
+
+    // Longest supported input
+    static uint8_t big[ZCD_FAST_MAX_LEN], bigcomp[ZCD_FAST_MAX_LEN], bigout[ZCD_FAST_MAX_LEN];
+    make_data(big, sizeof(big), 13);
+    clen = zcd_compress_fast(big, sizeof(big), bigcomp, hashtable);
+    TEST(clen > 0 && zcd_decompress(ZCD_CODEC_LZ, bigcomp, clen, bigout, sizeof(big)) && memcmp(bigout, big, sizeof(big)) == 0);
+    TEST(zcd_compress_fast(big, ZCD_FAST_MAX_LEN + 1, bigcomp, hashtable) == 0);
+
+    return status;
+}
+
+// Decompression speed per codec, compared against the rate needed for
+// 16x speed data reads (2457600 B/s) and 1x audio playback (176400 B/s).
+static double benchmark_codec(uint8_t codec, const uint8_t *src, uint32_t len)
+{
+    static uint8_t comp[HUNK_BYTES], out[HUNK_BYTES];
+    uint32_t clen = zcd_compress(codec, src, len, comp);
+    const int count = 2000;
+    clock_t start = clock();
+    for (int i = 0; i < count; i++)
+    {
+        zcd_decompress(codec, comp, clen, out, len);
+    }
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (secs <= 0) secs = 1e-6;
+    double rate = (double)len * count / secs;
+    printf("Codec %d: ratio %.2f, decompression %.1f MB/s\n", codec, (double)clen / len, rate / 1e6);
+    return rate;
+}
+
+bool benchmark()
+{
+    bool status = true;
+    COMMENT("benchmark()");
+
+    static uint8_t data[HUNK_BYTES], audio[HUNK_BYTES];
+    make_data(data, sizeof(data), 7);
+    make_audio(audio, sizeof(audio), 7);
+
+    double lz = benchmark_codec(ZCD_CODEC_LZ, data, sizeof(data));
+    double pcm = benchmark_codec(ZCD_CODEC_PCM, audio, sizeof(audio));
+    printf("LZ is %.0fx 16x CD data rate, PCM is %.0fx 1x CD audio rate on this host\n",
+           lz / 2457600, pcm / 176400);
+    TEST(lz > 2457600);
+    TEST(pcm > 176400);
+
+    // Fast encoder is used for tape writes, compare against the
+    // 10 MB/s SCSI transfer rate of the fastest targets.
+    static uint16_t hashtable[ZCD_FAST_HASH_SIZE];
+    static uint8_t comp[HUNK_BYTES];
+    const int count = 2000;
+    uint32_t clen = 0;
+    clock_t start = clock();
+    for (int i = 0; i < count; i++)
+    {
+        clen = zcd_compress_fast(data, sizeof(data), comp, hashtable);
+    }
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (secs <= 0) secs = 1e-6;
+    double fast = (double)sizeof(data) * count / secs;
+    printf("Fast LZ: ratio %.2f, compression %.1f MB/s\n", (double)clen / sizeof(data), fast / 1e6);
+    TEST(fast > 10e6);
+    return status;
+}
+
+int main()
+{
+    if (test_codecs() && test_inplace() && test_fast() && benchmark())
+    {
+        return 0;
+    }
+    else
+    {
+        printf("Some tests failed\n");
+        return 1;
+    }
+}
@@ -57,6 +57,10 @@ extern const char *g_platform_name;
 
 #include "platform_hw_config.h"
 
+// Smaller image directory catalog to save RAM
+#define PLATFORM_IMAGE_CATALOG_SIZE 128
+#define PLATFORM_IMAGE_CATALOG_COUNT 1
+
 enum ZuluSCSIVersion_t
 {
     ZSVersion_unknown,
@@ -79,6 +83,7 @@ void platform_log(const char *s);
 // Minimal millis() implementation as GD32F205 does not
 // have an Arduino core yet.
 unsigned long millis(void);
+unsigned long micros(void);
 void delay(unsigned long ms);
 
 // Precise nanosecond delays
@@ -25,6 +25,7 @@
 #include "ZuluSCSI_audio.h"
 #include "ZuluSCSI_v1_1_gpio.h"
 #include "ZuluSCSI_log.h"
+#include <scsi.h>
 
 extern "C" 
 {
@@ -33,25 +34,34 @@ extern "C"
     #include "gd32f20x_misc.h"
 }
 
+
 bool g_audio_enabled = false;
 bool g_audio_stopped = true;
 
-// some chonky buffers to store audio samples
-static uint8_t sample_circ_buf[AUDIO_BUFFER_SIZE] __attribute__((aligned(4)));
-
-// tracking for the state for the circular buffer, A first half and B second half
-enum bufstate { STALE, FILLING, READY };
-static volatile bufstate sbufst_a = STALE;
-static volatile bufstate sbufst_b = STALE;
+// ring of buffers to store audio samples
+// The I2S DMA plays the whole ring circularly and its interrupt counts the
+// wraps, so the buffer being played is known from the DMA transfer count.
+// audio_poll() fills the buffers ahead of it and increments sbuf_written.
+static uint8_t sample_buf[AUDIO_BUFFER_COUNT][AUDIO_BUFFER_SIZE] __attribute__((aligned(4)));
+static uint32_t sbuf_written = 0;
+static volatile uint32_t sbuf_wraps = 0;
 static uint8_t sbufswap = 0;
 
+// number of 16-bit DMA transfers to play the whole ring
+#define AUDIO_RING_TRANSFERS (AUDIO_BUFFER_COUNT * AUDIO_BUFFER_SIZE / 2)
+
+// playback statistics, reset when playback starts
+static uint32_t audio_underruns = 0;
+static uint32_t audio_min_level = 0;
+
 // tracking for audio playback
 static uint8_t audio_owner; // SCSI ID or 0xFF when idle
 static volatile bool audio_paused = false;
 static ImageBackingStore* audio_file;
-static volatile uint64_t fpos;
-static volatile uint32_t fleft;
-extern bool g_audio_stopped;
+static bool audio_decoded; // file is decoded while reading, such as FLAC
+static uint64_t fpos;
+static uint64_t fend;
+static uint32_t fleft;
 
 
 // historical playback status information
@@ -84,8 +94,9 @@ static void audio_start_dma()
         dma_channel_disable(ODE_DMA, ODE_DMA_CH);
         dma_interrupt_flag_clear(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_HTF);
         dma_interrupt_flag_clear(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_FTF);
-        dma_interrupt_enable(ODE_DMA, ODE_DMA_CH, DMA_INT_HTF | DMA_INT_FTF);
-        dma_transfer_number_config(ODE_DMA, ODE_DMA_CH, AUDIO_BUFFER_SIZE / 2); // convert to 16bit transfer count
+        sbuf_wraps = 0;
+        dma_interrupt_enable(ODE_DMA, ODE_DMA_CH, DMA_INT_FTF);
+        dma_transfer_number_config(ODE_DMA, ODE_DMA_CH, AUDIO_RING_TRANSFERS);
         spi_enable(ODE_I2S_SPI);
         dma_channel_enable(ODE_DMA, ODE_DMA_CH);
 
@@ -94,19 +105,33 @@ extern "C"
 {
     void ODE_IRQHandler() 
     {
-        if ( SET == dma_interrupt_flag_get(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_HTF))
-        {
-            dma_interrupt_flag_clear(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_HTF);
-            sbufst_a = STALE;
-        }
         if (SET == dma_interrupt_flag_get(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_FTF))
         {
             dma_interrupt_flag_clear(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_FTF);
-            sbufst_b = STALE;
+            sbuf_wraps = sbuf_wraps + 1;
         } 
     }
 }
 
+// Index of the buffer that the DMA is currently playing, counted from the
+// start of playback. The buffers before it are free to be refilled.
+static uint32_t snd_played()
+{
+    __disable_irq();
+    uint32_t wraps = sbuf_wraps;
+    uint32_t remaining = dma_transfer_number_get(ODE_DMA, ODE_DMA_CH);
+    if (SET == dma_interrupt_flag_get(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_FTF))
+    {
+        // wrapped around but the interrupt has not been handled yet
+        wraps++;
+        remaining = dma_transfer_number_get(ODE_DMA, ODE_DMA_CH);
+    }
+    __enable_irq();
+
+    uint32_t transfers = AUDIO_RING_TRANSFERS - remaining;
+    return wraps * AUDIO_BUFFER_COUNT + transfers / (AUDIO_BUFFER_SIZE / 2);
+}
+
 void audio_setup() 
 {
     // Setup clocks  
@@ -122,12 +147,12 @@ void audio_setup()
 
     dma_deinit(ODE_DMA, ODE_DMA_CH);
     dma_init_struct.periph_addr  = (uint32_t)&SPI_DATA(ODE_I2S_SPI);
-    dma_init_struct.memory_addr  = (uint32_t)sample_circ_buf;
+    dma_init_struct.memory_addr  = (uint32_t)sample_buf;
     dma_init_struct.direction    = DMA_MEMORY_TO_PERIPHERAL;
     dma_init_struct.memory_width = DMA_MEMORY_WIDTH_16BIT;
     dma_init_struct.periph_width = DMA_PERIPHERAL_WIDTH_16BIT;
     dma_init_struct.priority     = DMA_PRIORITY_LOW;
-    dma_init_struct.number       = AUDIO_BUFFER_SIZE / 2; // 8 bit to 16 bit conversion length
+    dma_init_struct.number       = AUDIO_RING_TRANSFERS; // 8 bit to 16 bit conversion length
     dma_init_struct.periph_inc   = DMA_PERIPH_INCREASE_DISABLE;
     dma_init_struct.memory_inc   = DMA_MEMORY_INCREASE_ENABLE;
     dma_init(ODE_DMA, ODE_DMA_CH, &dma_init_struct);
@@ -146,11 +171,14 @@ void audio_setup()
 }
 
 /*
- * Takes in a buffer with interleaved 16bit samples and adjusts their volume
+ * Takes in a buffer with interleaved 16bit samples and adjusts their volume.
+ * Each 32-bit word holds the sample pair of both channels, so they are loaded,
+ * byte swapped and stored together. Cortex-M3 has no packed multiply, so the
+ * two halves are scaled with separate multiplies while in registers.
 */
-static void audio_adjust(uint8_t owner, int16_t* buffer, size_t length)
+static void audio_adjust(uint8_t owner, uint32_t* buffer, size_t words)
 {
-    uint8_t volume[2]; 
+    int32_t volume[2]; 
     uint16_t packed_volume = volumes[owner & 7];
     volume[0] = packed_volume >> 8;
     volume[1] = packed_volume & 0xFF;
@@ -168,12 +196,72 @@ static void audio_adjust(uint8_t owner, int16_t* buffer, size_t length)
         volume[1] = 0;
     }
 
-    for (int i = 0; i < length; i++)
+    if (volume[0] == 0 && volume[1] == 0)
+    {
+        memset(buffer, 0, words * 4);
+        return;
+    }
+
+    uint32_t swap = sbufswap ? 8 : 0;
+    for (size_t i = 0; i < words; i++)
     {
+        uint32_t pair = buffer[i];
+
+        // swaps bytes of both samples when swap is 8, no-op when 0
+        pair = ((pair & 0x00FF00FF) << swap) | ((pair >> swap) & (0x00FF00FF << (8 - swap)));
+
         // linear volume
-        buffer[i] = (int16_t)(( ((int32_t)buffer[i]) * volume[i & 0x1]) >> 8); 
+        int32_t first = ((int32_t)(int16_t)pair * volume[0]) >> 8;
+        int32_t second = (((int32_t)pair >> 16) * volume[1]) >> 8;
+        buffer[i] = ((uint32_t)first & 0xFFFF) | ((uint32_t)second << 16);
+    }
+}
+
+// Reads samples from the file to the free buffers of the ring, up to
+// the end of the ring array. Large reads keep the SD card overhead low.
+// Returns false if the file could not be read.
+static bool snd_fill(uint32_t played)
+{
+    uint32_t first = sbuf_written % AUDIO_BUFFER_COUNT;
+    uint32_t count = played + AUDIO_BUFFER_COUNT - sbuf_written;
+    if (first + count > AUDIO_BUFFER_COUNT) count = AUDIO_BUFFER_COUNT - first;
+
+    // decoding takes time, one buffer per call keeps the delay to SCSI
+    // commands at most a couple of FLAC frames
+    if (audio_decoded && count > 1) count = 1;
+
+    uint32_t toRead = count * AUDIO_BUFFER_SIZE;
+    if (fleft < toRead) {
+        // last buffer is padded with silence
+        toRead = fleft;
+        count = (toRead + AUDIO_BUFFER_SIZE - 1) / AUDIO_BUFFER_SIZE;
+        memset(sample_buf[first] + toRead, 0, count * AUDIO_BUFFER_SIZE - toRead);
+    }
+    if (count == 0) return true;
+
+    platform_set_sd_callback(NULL, NULL);
+    if (audio_file->position() != fpos) {
+        // happens when data is read from the same image during playback
+        dbgmsg("------ Audio seek required on ", audio_owner);
+        if (!audio_file->seek(fpos)) {
+            logmsg("Audio error, unable to seek to ", fpos, ", ID:", audio_owner);
+        }
+    }
+
+    bool ok = true;
+    ssize_t got = audio_file->read(sample_buf[first], toRead);
+    if (got != (ssize_t)toRead) {
+        if (got < 0) got = 0;
+        memset(sample_buf[first] + got, 0, toRead - got);
+        ok = false;
     }
+    audio_adjust(audio_owner, (uint32_t*)sample_buf[first], count * AUDIO_BUFFER_SIZE / 4);
 
+    // position includes the padding so that the buffered amount is exact
+    fpos += count * AUDIO_BUFFER_SIZE;
+    fleft -= toRead;
+    sbuf_written += count;
+    return ok;
 }
 
 void audio_poll() 
@@ -187,11 +275,31 @@ void audio_poll()
     }
     if (!audio_is_active()) return;
     if (audio_paused) return;
-    if (fleft == 0 && sbufst_a == STALE && sbufst_b == STALE) {
-        // out of data and ready to stop
-        audio_stop(audio_owner);
-        return;
-    } else if (fleft == 0) {
+
+    uint32_t played = snd_played();
+    if (played >= sbuf_written)
+    {
+        if (fleft == 0)
+        {
+            // out of data and ready to stop
+            audio_stop(audio_owner);
+            return;
+        }
+
+        // DMA has caught up with the filled buffers and is playing old
+        // samples. Silence the ring and refill after the buffer now playing.
+        audio_underruns++;
+        memset(sample_buf, 0, sizeof(sample_buf));
+        sbuf_written = played + 1;
+    }
+
+    uint32_t level = sbuf_written - played;
+    if ((level - 1) * AUDIO_BUFFER_SIZE < audio_min_level)
+    {
+        audio_min_level = (level - 1) * AUDIO_BUFFER_SIZE;
+    }
+
+    if (fleft == 0) {
         // out of data to read but still working on remainder
         return;
     } else if (!audio_file->isOpen()) {
@@ -201,57 +309,20 @@ void audio_poll()
         return;
     }
 
-    if ( STALE  == sbufst_a || STALE == sbufst_b )
+    // This is called between SD card transfers of SCSI commands and from
+    // the idle loop. While a command is in progress, the ring is refilled
+    // only when it runs low so that the SCSI transfer is not held up.
+    // On an idle bus, waiting until half of the ring is free makes the reads
+    // larger. Decoded files are read a buffer at a time and kept nearly full.
+    uint32_t threshold;
+    if (scsiDev.phase != BUS_FREE) threshold = AUDIO_BUFFER_COUNT / 3;
+    else if (audio_decoded) threshold = AUDIO_BUFFER_COUNT - 1;
+    else threshold = AUDIO_BUFFER_COUNT / 2;
+    if (level > threshold) return;
+
+    if (!snd_fill(played))
     {
-        uint8_t* audiobuf;
-        if (sbufst_a == STALE) {
-            sbufst_a = FILLING;
-            audiobuf = sample_circ_buf;
-        } 
-        
-        if (sbufst_b == STALE) {
-            sbufst_b = FILLING;
-            audiobuf = sample_circ_buf + AUDIO_BUFFER_HALF_SIZE;
-        }
-
-        platform_set_sd_callback(NULL, NULL);
- 
-        uint16_t toRead = AUDIO_BUFFER_HALF_SIZE;
-        if (fleft < toRead) toRead = fleft;
-        if (audio_file->position() != fpos) {
-            // should be uncommon due to SCSI command restrictions on devices
-            // playing audio; if this is showing up in logs a different approach
-            // will be needed to avoid seek performance issues on FAT32 vols
-            dbgmsg("------ Audio seek required on ", audio_owner);
-            if (!audio_file->seek(fpos)) {
-                logmsg("Audio error, unable to seek to ", fpos, ", ID:", audio_owner);
-            }
-        }
-        ssize_t read_length = audio_file->read(audiobuf, AUDIO_BUFFER_HALF_SIZE);
-        
-        if ( read_length < AUDIO_BUFFER_HALF_SIZE )
-        {
-            if ( read_length < 0)
-            {
-                logmsg("Playback file half buffer size read error: ", read_length);    
-                return;
-            }
-            else
-            {
-                // pad buffer with zeros
-                memset(audiobuf + read_length, 0, AUDIO_BUFFER_HALF_SIZE - read_length);
-            }
-        }
-        audio_adjust(audio_owner, (int16_t*) audiobuf, AUDIO_BUFFER_HALF_SIZE / 2);
-    
-        fpos += toRead;
-        fleft -= toRead;
-
-        if (sbufst_a == FILLING) {
-            sbufst_a = READY;
-        } else if (sbufst_b == FILLING) {
-            sbufst_b = READY;
-        }
+        logmsg("Audio sample data read failed at ", fpos, ", ID:", audio_owner);
     }
 }
 
@@ -272,7 +343,9 @@ bool audio_play(uint8_t owner, ImageBackingStore* img, uint64_t start, uint64_t
         return false;
     }
 
+    platform_set_sd_callback(NULL, NULL);
     audio_file = img;
+    audio_decoded = img->isCompressed();
     if (!audio_file->isOpen()) {
         logmsg("File not open for audio playback, ", owner);
         return false;
@@ -290,43 +363,38 @@ bool audio_play(uint8_t owner, ImageBackingStore* img, uint64_t start, uint64_t
         dbgmsg("------ Truncate audio play request end ", end, " to file size ", len);
         end = len;
     }
-    fleft = end - start;
-    if (fleft <= AUDIO_BUFFER_SIZE)
+    if (end - start <= 2 * AUDIO_BUFFER_SIZE)
     {
         logmsg("File playback request (", start, ":", end, ") too short");
         return false;
     }
 
-    // read in initial sample buffers
+    // read in initial sample buffers, the whole ring is free as DMA is stopped
     if (!audio_file->seek(start))
     {
         logmsg("Sample file failed start seek to ", start);
         return false;
     }
-    ssize_t read_length = audio_file->read(sample_circ_buf, AUDIO_BUFFER_SIZE);
-    if ( read_length < AUDIO_BUFFER_SIZE)
+    fpos = start;
+    fend = end;
+    fleft = end - start;
+    sbuf_written = 0;
+    sbufswap = swap;
+    audio_owner = owner & 7;
+    while (fleft > 0 && sbuf_written < AUDIO_BUFFER_COUNT)
     {
-        if ( read_length < 0)
+        if (!snd_fill(0))
         {
-            logmsg("Playback file read error: ", read_length);    
+            logmsg("File playback start returned fewer bytes than allowed");
+            fleft = 0;
+            audio_owner = 0xFF;
             return false;
         }
-        else
-        {
-            // pad buffer with zeros
-            memset(sample_circ_buf + read_length, 0, AUDIO_BUFFER_SIZE - read_length);
-        }
-
     }
-    audio_adjust(owner, (int16_t*)sample_circ_buf, AUDIO_BUFFER_SIZE / 2);
  
     // prepare initial tracking state
-    fpos = audio_file->position();
-    fleft -= AUDIO_BUFFER_SIZE;
-    sbufswap = swap;
-    sbufst_a = READY;
-    sbufst_b = READY;
-    audio_owner = owner & 7;
+    audio_underruns = 0;
+    audio_min_level = AUDIO_BUFFER_COUNT * AUDIO_BUFFER_SIZE;
     audio_last_status[audio_owner] = ASC_PLAYING;
     audio_paused = false;
     g_audio_stopped = false;
@@ -345,26 +413,20 @@ bool audio_set_paused(uint8_t id, bool paused)
 
     if (paused) 
     {
-        // Turn off interrupts to stop flagging new audio samples to load
-        dma_interrupt_disable(ODE_DMA, ODE_DMA_CH, DMA_INT_FTF | DMA_INT_HTF);
-        dma_interrupt_flag_clear(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_HTF);
-        dma_interrupt_flag_clear(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_FTF);
-        // Set status for both left and right channel to stop audio polling
-        // from loading new samples
-        sbufst_a = READY;
-        sbufst_b = READY;
-        // Let the DMA continue to run but set audio out to 0s
-        memset(sample_circ_buf, 0, AUDIO_BUFFER_SIZE);
+        // Rewind to the buffer being played, its samples are read again
+        // when resuming. Let the DMA continue to run but set audio out to 0s
+        fpos = audio_get_file_position();
+        fleft = fend - fpos;
+        audio_paused = true;
+        sbuf_written = snd_played();
+        memset(sample_buf, 0, sizeof(sample_buf));
         audio_last_status[audio_owner] = ASC_PAUSED;
     } 
     else
     {
-        // Enable audio polling and DMA interrupts to load and play new samples
-        sbufst_a = STALE;
-        sbufst_b = STALE;
-        dma_interrupt_flag_clear(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_HTF);
-        dma_interrupt_flag_clear(ODE_DMA, ODE_DMA_CH, DMA_INT_FLAG_FTF);
-        dma_interrupt_enable(ODE_DMA, ODE_DMA_CH, DMA_INT_FTF | DMA_INT_HTF);
+        // Refill starting after the silent buffer now being played
+        sbuf_written = snd_played() + 1;
+        audio_paused = false;
         audio_last_status[audio_owner] = ASC_PLAYING;
     }
     return true;
@@ -374,8 +436,20 @@ void audio_stop(uint8_t id)
 {
     if (audio_owner != (id & 7)) return;
 
+    // remember the position of the last played sample
+    fpos = audio_get_file_position();
+    fleft = 0;
+
     spi_disable(ODE_I2S_SPI);
     dma_channel_disable(ODE_DMA, ODE_DMA_CH);
+    dma_interrupt_disable(ODE_DMA, ODE_DMA_CH, DMA_INT_FTF);
+
+    if (audio_underruns > 0) {
+        logmsg("Audio playback had ", (int)audio_underruns, " sample data underruns, minimum buffer level ",
+            (int)audio_min_level, " bytes");
+    } else {
+        dbgmsg("------ Audio playback minimum buffer level ", (int)audio_min_level, " bytes");
+    }
 
     // idle the subsystem
     audio_last_status[audio_owner] = ASC_COMPLETED;
@@ -413,7 +487,23 @@ void audio_set_channel(uint8_t id, uint16_t chn) {
 
 uint64_t audio_get_file_position()
 {
-    return fpos;
+    if (!audio_is_active()) return fpos;
+
+    // samples still in the ring have not been played yet
+    uint32_t played = snd_played();
+    uint64_t pos = fpos;
+    if (sbuf_written > played)
+    {
+        pos -= (uint64_t)(sbuf_written - played) * AUDIO_BUFFER_SIZE;
+    }
+    if (pos > fend) pos = fend;
+    return pos;
+}
+
+void audio_get_stats(uint32_t *underruns, uint32_t *min_level)
+{
+    *underruns = audio_underruns;
+    *min_level = audio_min_level;
 }
 
 void audio_set_file_position(uint32_t lba)
@@ -421,4 +511,4 @@ void audio_set_file_position(uint32_t lba)
     fpos = 2352 * (uint64_t)lba;
 }
 
-#endif // ENABLE_AUDIO_OUTPUT
\ No newline at end of file
+#endif // ENABLE_AUDIO_OUTPUT
@@ -24,15 +24,19 @@
 #pragma once
 #ifdef ENABLE_AUDIO_OUTPUT
 
+#include <stdint.h>
+
 extern bool g_audio_enabled;
 extern bool g_ode_audio_stopped;
 
-// size of the a circular audio sample buffer, in bytes
+// size of each audio sample buffer in the ring, in bytes
 // these must be divisible by 1024
-#define AUDIO_BUFFER_SIZE 16384
-// #define AUDIO_BUFFER_SIZE 8192 // ~46.44ms 
-// # define AUDIO_BUFFER_SIZE 4096 // reduce memory usage
-#define AUDIO_BUFFER_HALF_SIZE AUDIO_BUFFER_SIZE / 2
+#define AUDIO_BUFFER_SIZE 2048 // ~11.6ms
+
+// number of sample buffers in the ring, ~139ms in total allows riding
+// through long SD card writes and SCSI transfers. The I2S DMA plays the
+// whole ring circularly, so the total must stay below 128kB.
+#define AUDIO_BUFFER_COUNT 12
 
 /**
  * Handler for I2S DMA interrupts
@@ -58,4 +62,12 @@ void audio_setup();
  * Called from platform_poll() to fill sample buffer(s) if needed.
  */
 void audio_poll();
+
+/**
+ * Provides statistics for the current or last playback.
+ *
+ * \param underruns  Number of times the sample buffers ran empty.
+ * \param min_level  Lowest amount of buffered sample data, in bytes.
+ */
+void audio_get_stats(uint32_t *underruns, uint32_t *min_level);
 #endif //ENABLE_AUDIO_OUTPUT
\ No newline at end of file
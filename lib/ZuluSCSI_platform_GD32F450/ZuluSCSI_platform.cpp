@@ -54,6 +54,20 @@ unsigned long millis()
     return g_millisecond_counter;
 }
 
+// Microsecond time from millisecond counter and the SysTick down-counter
+unsigned long micros()
+{
+    uint32_t ms, val;
+    do
+    {
+        ms = g_millisecond_counter;
+        val = SysTick->VAL;
+    } while (ms != g_millisecond_counter);
+
+    uint32_t load = SysTick->LOAD + 1;
+    return ms * 1000 + (uint64_t)(load - 1 - val) * 1000 / load;
+}
+
 void delay(unsigned long ms)
 {
     uint32_t start = g_millisecond_counter;
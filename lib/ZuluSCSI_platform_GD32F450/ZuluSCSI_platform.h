@@ -59,6 +59,7 @@ void platform_log(const char *s);
 // Minimal millis() implementation as GD32F205 does not
 // have an Arduino core yet.
 unsigned long millis(void);
+unsigned long micros(void);
 void delay(unsigned long ms);
 
 // Precise nanosecond delays
@@ -124,6 +125,9 @@ void platform_set_sd_callback(sd_callback_t func, const uint8_t *buffer);
 // The total number of skips is kept track of to keep the correct time on average.
 void SysTick_Handle_PreEmptively();
 
+// Compressed CD images are decompressed to a hunk cache in RAM
+#define PLATFORM_HAS_COMPRESSED_IMAGES 1
+
 // Reprogram firmware in main program area.
 #define PLATFORM_BOOTLOADER_SIZE 32768
 #define PLATFORM_FLASH_TOTAL_SIZE (512 * 1024)
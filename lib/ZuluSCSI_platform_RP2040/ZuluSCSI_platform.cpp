@@ -25,6 +25,7 @@
 #include <SdFat.h>
 #include <scsi.h>
 #include <assert.h>
+#include <string.h>
 #include <hardware/gpio.h>
 #include <hardware/pio.h>
 #include <hardware/uart.h>
@@ -746,29 +747,64 @@ uint8_t platform_get_buttons()
 
 
 /************************************/
-/* ROM drive in extra flash space   */
+/* ROM drive and settings in flash  */
 /************************************/
 
-#ifdef PLATFORM_HAS_ROM_DRIVE
+#if defined(PLATFORM_HAS_ROM_DRIVE) || defined(PLATFORM_HAS_SETTINGS_FLASH)
 
 # ifndef ROMDRIVE_OFFSET
     // Reserve up to 352 kB for firmware by default.
     #define ROMDRIVE_OFFSET (352 * 1024)
 # endif
 
-uint32_t platform_get_romdrive_maxsize()
+static uint32_t platform_get_flash_chip_size()
 {
     if (g_flash_chip_size >= ROMDRIVE_OFFSET)
     {
-        return g_flash_chip_size - ROMDRIVE_OFFSET;
+        return g_flash_chip_size;
     }
     else
     {
         // Failed to read flash chip size, default to 2 MB
-        return 2048 * 1024 - ROMDRIVE_OFFSET;
+        return 2048 * 1024;
     }
 }
 
+// Erase and program flash area outside of the firmware
+static bool platform_program_flash(uint32_t offset, uint32_t erase_count, const uint8_t *data, uint32_t count)
+{
+    assert(offset >= ROMDRIVE_OFFSET);
+    assert(offset + erase_count <= platform_get_flash_chip_size());
+
+#ifdef ENABLE_AUDIO_OUTPUT
+    // Core1 runs the audio handler from flash
+    audio_core1_lockout_start();
+#endif
+
+    __disable_irq();
+    flash_range_erase(offset, erase_count);
+    flash_range_program(offset, data, count);
+    __enable_irq();
+
+#ifdef ENABLE_AUDIO_OUTPUT
+    audio_core1_lockout_end();
+#endif
+    return true;
+}
+
+#endif
+
+#ifdef PLATFORM_HAS_ROM_DRIVE
+
+uint32_t platform_get_romdrive_maxsize()
+{
+    uint32_t maxsize = platform_get_flash_chip_size() - ROMDRIVE_OFFSET;
+#ifdef PLATFORM_HAS_SETTINGS_FLASH
+    maxsize -= PLATFORM_SETTINGS_FLASH_SIZE;
+#endif
+    return maxsize;
+}
+
 bool platform_read_romdrive(uint8_t *dest, uint32_t start, uint32_t count)
 {
     xip_ctrl_hw->stream_ctr = 0;
@@ -782,7 +818,7 @@ bool platform_read_romdrive(uint8_t *dest, uint32_t start, uint32_t count)
     xip_ctrl_hw->stream_ctr = count / 4;
 
     // Transfer happens in multiples of 4 bytes
-    assert(start < platform_get_romdrive_maxsize());
+    assert(start + ROMDRIVE_OFFSET < platform_get_flash_chip_size());
     assert((count & 3) == 0);
     assert((((uint32_t)dest) & 3) == 0);
 
@@ -805,15 +841,31 @@ bool platform_write_romdrive(const uint8_t *data, uint32_t start, uint32_t count
     assert(start < platform_get_romdrive_maxsize());
     assert((count % PLATFORM_ROMDRIVE_PAGE_SIZE) == 0);
 
-    __disable_irq();
-    flash_range_erase(start + ROMDRIVE_OFFSET, count);
-    flash_range_program(start + ROMDRIVE_OFFSET, data, count);
-    __enable_irq();
-    return true;
+    return platform_program_flash(start + ROMDRIVE_OFFSET, count, data, count);
 }
 
 #endif // PLATFORM_HAS_ROM_DRIVE
 
+#ifdef PLATFORM_HAS_SETTINGS_FLASH
+
+bool platform_read_settings_flash(uint8_t *dest, uint32_t count)
+{
+    assert(count <= PLATFORM_SETTINGS_FLASH_SIZE);
+    uint32_t offset = platform_get_flash_chip_size() - PLATFORM_SETTINGS_FLASH_SIZE;
+    memcpy(dest, (const uint8_t*)(XIP_NOCACHE_NOALLOC_BASE + offset), count);
+    return true;
+}
+
+bool platform_write_settings_flash(const uint8_t *data, uint32_t count)
+{
+    assert(count <= PLATFORM_SETTINGS_FLASH_SIZE);
+    assert((count % FLASH_PAGE_SIZE) == 0);
+    uint32_t offset = platform_get_flash_chip_size() - PLATFORM_SETTINGS_FLASH_SIZE;
+    return platform_program_flash(offset, PLATFORM_SETTINGS_FLASH_SIZE, data, count);
+}
+
+#endif // PLATFORM_HAS_SETTINGS_FLASH
+
 /**********************************************/
 /* Mapping from data bytes to GPIO BOP values */
 /**********************************************/
@@ -138,6 +138,18 @@ uint8_t platform_get_buttons();
 typedef void (*sd_callback_t)(uint32_t bytes_complete);
 void platform_set_sd_callback(sd_callback_t func, const uint8_t *buffer);
 
+#ifdef SD_USE_SDIO
+// Hand off data read from SD card directly to SCSI DMA from the SD DMA interrupt.
+// Completed data from the buffer given to platform_set_sd_callback() is queued
+// for SCSI transfer in multiples of unit bytes, starting after bytes_queued.
+// The SCSI write must already have been started by the application.
+// Stopping returns the number of bytes queued so far, and the handoff is
+// also stopped by platform_set_sd_callback().
+#define PLATFORM_HAS_SD_SCSI_HANDOFF 1
+void platform_start_sd_scsi_handoff(uint32_t unit, uint32_t bytes_queued);
+uint32_t platform_stop_sd_scsi_handoff();
+#endif
+
 // Reprogram firmware in main program area.
 #ifndef RP2040_DISABLE_BOOTLOADER
 #define PLATFORM_BOOTLOADER_SIZE (128 * 1024)
@@ -161,6 +173,19 @@ bool platform_read_romdrive(uint8_t *dest, uint32_t start, uint32_t count);
 bool platform_write_romdrive(const uint8_t *data, uint32_t start, uint32_t count);
 #endif
 
+// Settings snapshot in the last page of the external flash
+#ifndef RP2040_DISABLE_SETTINGS_FLASH
+#define PLATFORM_HAS_SETTINGS_FLASH 1
+#define PLATFORM_SETTINGS_FLASH_SIZE 4096
+bool platform_read_settings_flash(uint8_t *dest, uint32_t count);
+
+// Count must be a multiple of 256 bytes
+bool platform_write_settings_flash(const uint8_t *data, uint32_t count);
+#endif
+
+// Compressed CD images are decompressed to a hunk cache in RAM
+#define PLATFORM_HAS_COMPRESSED_IMAGES 1
+
 // Parity lookup tables for write and read from SCSI bus.
 // These are used by macros below and the code in scsi_accel_rp2040.cpp
 extern const uint16_t g_scsi_parity_lookup[256];
@@ -22,6 +22,7 @@
 #include <hardware/dma.h>
 #include <hardware/irq.h>
 #include <hardware/spi.h>
+#include <hardware/sync.h>
 #include <pico/multicore.h>
 #include "audio.h"
 #include "ZuluSCSI_audio.h"
@@ -111,19 +112,21 @@ const uint16_t z_preamble = 0xE8CC;
 static dma_channel_config snd_dma_a_cfg;
 static dma_channel_config snd_dma_b_cfg;
 
-// some chonky buffers to store audio samples
-static uint8_t sample_buf_a[AUDIO_BUFFER_SIZE];
-static uint8_t sample_buf_b[AUDIO_BUFFER_SIZE];
-
-// tracking for the state of the above buffers
-enum bufstate { STALE, FILLING, READY };
-static volatile bufstate sbufst_a = STALE;
-static volatile bufstate sbufst_b = STALE;
-enum bufselect { A, B };
-static bufselect sbufsel = A;
-static uint16_t sbufpos = 0;
+// ring of buffers to store audio samples
+// Core0 fills buffers in audio_poll() and increments sbuf_written, core1
+// encodes them in chunks and increments sbuf_played. The difference is the
+// number of buffers holding samples that have not been played yet.
+static uint8_t sample_buf[AUDIO_BUFFER_COUNT][AUDIO_BUFFER_SIZE];
+static volatile uint32_t sbuf_written = 0;
+static volatile uint32_t sbuf_played = 0;
+static volatile uint16_t sbufpos = 0;
 static uint8_t sbufswap = 0;
 
+// playback statistics, reset when playback starts
+static volatile uint32_t audio_underruns = 0;
+static volatile uint32_t audio_min_level = 0;
+static bool audio_underrun_active = false;
+
 // buffers for storing biphase patterns
 #define SAMPLE_CHUNK_SIZE 1024 // ~5.8ms
 #define WIRE_BUFFER_SIZE (SAMPLE_CHUNK_SIZE * 2)
@@ -134,8 +137,9 @@ static uint16_t wire_buf_b[WIRE_BUFFER_SIZE];
 static uint8_t audio_owner; // SCSI ID or 0xFF when idle
 static volatile bool audio_paused = false;
 static ImageBackingStore* audio_file;
+static bool audio_decoded; // file is decoded while reading, such as FLAC
 static uint64_t fpos;
-static uint32_t fleft;
+static volatile uint32_t fleft;
 
 // historical playback status information
 static audio_status_code audio_last_status[8] = {ASC_NO_STATUS, ASC_NO_STATUS, ASC_NO_STATUS, ASC_NO_STATUS,
@@ -248,61 +252,85 @@ static void snd_encode(uint8_t* samples, uint16_t* wire_patterns, uint16_t len,
     }
 }
 
-// functions for passing to Core1
-static void snd_process_a() {
-    if (sbufsel == A) {
-        if (sbufst_a == READY) {
-            snd_encode(sample_buf_a + sbufpos, wire_buf_a, SAMPLE_CHUNK_SIZE, sbufswap);
-            sbufpos += SAMPLE_CHUNK_SIZE;
-            if (sbufpos >= AUDIO_BUFFER_SIZE) {
-                sbufsel = B;
-                sbufpos = 0;
-                sbufst_a = STALE;
-            }
-        } else {
-            snd_encode(NULL, wire_buf_a, SAMPLE_CHUNK_SIZE, sbufswap);
+// Encodes the next chunk of samples from the ring, or silence if there
+// is nothing to play. Runs on Core1.
+static void snd_process(uint16_t* wire_patterns) {
+    uint32_t level = sbuf_written - sbuf_played;
+    __dmb();
+
+    if (audio_paused || audio_stopping || level == 0) {
+        if (level == 0 && fleft > 0 && !audio_paused && !audio_stopping && !audio_underrun_active) {
+            audio_underruns = audio_underruns + 1;
+            audio_underrun_active = true;
         }
+        snd_encode(NULL, wire_patterns, SAMPLE_CHUNK_SIZE, sbufswap);
+        return;
+    }
+
+    uint32_t bytes = level * AUDIO_BUFFER_SIZE - sbufpos;
+    if (bytes < audio_min_level) audio_min_level = bytes;
+    audio_underrun_active = false;
+
+    snd_encode(sample_buf[sbuf_played % AUDIO_BUFFER_COUNT] + sbufpos, wire_patterns, SAMPLE_CHUNK_SIZE, sbufswap);
+    if (sbufpos + SAMPLE_CHUNK_SIZE >= AUDIO_BUFFER_SIZE) {
+        sbufpos = 0;
+        sbuf_played = sbuf_played + 1;
     } else {
-        if (sbufst_b == READY) {
-            snd_encode(sample_buf_b + sbufpos, wire_buf_a, SAMPLE_CHUNK_SIZE, sbufswap);
-            sbufpos += SAMPLE_CHUNK_SIZE;
-            if (sbufpos >= AUDIO_BUFFER_SIZE) {
-                sbufsel = A;
-                sbufpos = 0;
-                sbufst_b = STALE;
-            }
-        } else {
-            snd_encode(NULL, wire_buf_a, SAMPLE_CHUNK_SIZE, sbufswap);
-        }
+        sbufpos = sbufpos + SAMPLE_CHUNK_SIZE;
     }
 }
+
+// functions for passing to Core1
+static void snd_process_a() {
+    snd_process(wire_buf_a);
+}
 static void snd_process_b() {
-    // clone of above for the other wire buffer
-    if (sbufsel == A) {
-        if (sbufst_a == READY) {
-            snd_encode(sample_buf_a + sbufpos, wire_buf_b, SAMPLE_CHUNK_SIZE, sbufswap);
-            sbufpos += SAMPLE_CHUNK_SIZE;
-            if (sbufpos >= AUDIO_BUFFER_SIZE) {
-                sbufsel = B;
-                sbufpos = 0;
-                sbufst_a = STALE;
-            }
-        } else {
-            snd_encode(NULL, wire_buf_b, SAMPLE_CHUNK_SIZE, sbufswap);
-        }
-    } else {
-        if (sbufst_b == READY) {
-            snd_encode(sample_buf_b + sbufpos, wire_buf_b, SAMPLE_CHUNK_SIZE, sbufswap);
-            sbufpos += SAMPLE_CHUNK_SIZE;
-            if (sbufpos >= AUDIO_BUFFER_SIZE) {
-                sbufsel = A;
-                sbufpos = 0;
-                sbufst_b = STALE;
-            }
-        } else {
-            snd_encode(NULL, wire_buf_b, SAMPLE_CHUNK_SIZE, sbufswap);
+    snd_process(wire_buf_b);
+}
+
+// Reads samples from the file to the free buffers of the ring, up to
+// the end of the ring array. Large reads keep the SD card overhead low.
+// Returns false if the file could not be read.
+static bool snd_fill() {
+    uint32_t first = sbuf_written % AUDIO_BUFFER_COUNT;
+    uint32_t count = AUDIO_BUFFER_COUNT - (sbuf_written - sbuf_played);
+    if (first + count > AUDIO_BUFFER_COUNT) count = AUDIO_BUFFER_COUNT - first;
+
+    // decoding is done on this core, one buffer per call keeps the time
+    // spent here to at most a couple of FLAC frames
+    if (audio_decoded && count > 1) count = 1;
+
+    uint32_t toRead = count * AUDIO_BUFFER_SIZE;
+    if (fleft < toRead) {
+        // last buffer is padded with silence
+        toRead = fleft;
+        count = (toRead + AUDIO_BUFFER_SIZE - 1) / AUDIO_BUFFER_SIZE;
+        memset(sample_buf[first] + toRead, 0, count * AUDIO_BUFFER_SIZE - toRead);
+    }
+    if (count == 0) return true;
+
+    platform_set_sd_callback(NULL, NULL);
+    if (audio_file->position() != fpos) {
+        // happens when data is read from the same image during playback
+        dbgmsg("------ Audio seek required on ", audio_owner);
+        if (!audio_file->seek(fpos)) {
+            logmsg("Audio error, unable to seek to ", fpos, ", ID:", audio_owner);
         }
     }
+
+    bool ok = true;
+    ssize_t got = audio_file->read(sample_buf[first], toRead);
+    if (got != (ssize_t)toRead) {
+        if (got < 0) got = 0;
+        memset(sample_buf[first] + got, 0, toRead - got);
+        ok = false;
+    }
+
+    fpos += toRead;
+    fleft = fleft - toRead;
+    __dmb();
+    sbuf_written = sbuf_written + count;
+    return ok;
 }
 
 // Allows execution on Core1 via function pointers. Each function can take
@@ -314,6 +342,22 @@ static void core1_handler() {
     }
 }
 
+// Flash lockout state: 0 = running, 1 = requested, 2 = core1 parked in RAM
+static volatile uint8_t core1_lockout = 0;
+static bool core1_started = false;
+
+// Runs on Core1 from RAM while Core0 erases or programs flash. The SDK's
+// multicore_lockout cannot be used, as its FIFO interrupt handler would
+// consume the function pointers sent by audio_dma_irq().
+__attribute__((section(".time_critical.core1_lockout_handler")))
+static void core1_lockout_handler() {
+    core1_lockout = 2;
+    __sev();
+    while (core1_lockout != 0) {
+        __wfe();
+    }
+}
+
 /* ------------------------------------------------------------------------ */
 /* ---------- VISIBLE FUNCTIONS ------------------------------------------- */
 /* ------------------------------------------------------------------------ */
@@ -368,12 +412,28 @@ void audio_setup() {
 
     logmsg("Starting Core1 for audio");
     multicore_launch_core1(core1_handler);
+    core1_started = true;
+}
+
+void audio_core1_lockout_start() {
+    if (!core1_started) return;
+    core1_lockout = 1;
+    multicore_fifo_push_blocking((uintptr_t) &core1_lockout_handler);
+    while (core1_lockout != 2) {
+        __wfe();
+    }
+}
+
+void audio_core1_lockout_end() {
+    if (!core1_started) return;
+    core1_lockout = 0;
+    __sev();
 }
 
 void audio_poll() {
     if (!audio_is_active()) return;
-    if (audio_paused) return;
-    if (fleft == 0 && sbufst_a == STALE && sbufst_b == STALE) {
+    uint32_t level = sbuf_written - sbuf_played;
+    if (fleft == 0 && level == 0) {
         // out of data and ready to stop
         audio_stop(audio_owner);
         return;
@@ -387,41 +447,15 @@ void audio_poll() {
         return;
     }
 
-    // are new audio samples needed from the memory card?
-    uint8_t* audiobuf;
-    if (sbufst_a == STALE) {
-        sbufst_a = FILLING;
-        audiobuf = sample_buf_a;
-    } else if (sbufst_b == STALE) {
-        sbufst_b = FILLING;
-        audiobuf = sample_buf_b;
-    } else {
-        // no data needed this time
-        return;
-    }
-
-    platform_set_sd_callback(NULL, NULL);
-    uint16_t toRead = AUDIO_BUFFER_SIZE;
-    if (fleft < toRead) toRead = fleft;
-    if (audio_file->position() != fpos) {
-        // should be uncommon due to SCSI command restrictions on devices
-        // playing audio; if this is showing up in logs a different approach
-        // will be needed to avoid seek performance issues on FAT32 vols
-        dbgmsg("------ Audio seek required on ", audio_owner);
-        if (!audio_file->seek(fpos)) {
-            logmsg("Audio error, unable to seek to ", fpos, ", ID:", audio_owner);
-        }
-    }
-    if (audio_file->read(audiobuf, toRead) != toRead) {
-        logmsg("Audio sample data underrun");
-    }
-    fpos += toRead;
-    fleft -= toRead;
+    // This is called between SD card transfers of SCSI commands and from
+    // the idle loop, so audio is refilled before any read prefetch is done.
+    // Waiting until half of the ring is free makes the reads larger.
+    // Decoded files are read a buffer at a time and kept nearly full instead.
+    uint32_t threshold = audio_decoded ? AUDIO_BUFFER_COUNT - 1 : AUDIO_BUFFER_COUNT / 2;
+    if (level > threshold) return;
 
-    if (sbufst_a == FILLING) {
-        sbufst_a = READY;
-    } else if (sbufst_b == FILLING) {
-        sbufst_b = READY;
+    if (!snd_fill()) {
+        logmsg("Audio sample data read failed at ", fpos, ", ID:", audio_owner);
     }
 }
 
@@ -442,6 +476,7 @@ bool audio_play(uint8_t owner, ImageBackingStore* img, uint64_t start, uint64_t
     }
     platform_set_sd_callback(NULL, NULL);
     audio_file = img;
+    audio_decoded = img->isCompressed();
     if (!audio_file->isOpen()) {
         logmsg("File not open for audio playback, ", owner);
         return false;
@@ -457,34 +492,32 @@ bool audio_play(uint8_t owner, ImageBackingStore* img, uint64_t start, uint64_t
         dbgmsg("------ Truncate audio play request end ", end, " to file size ", len);
         end = len;
     }
-    fleft = end - start;
-    if (fleft <= 2 * AUDIO_BUFFER_SIZE) {
+    if (end - start <= 2 * AUDIO_BUFFER_SIZE) {
         logmsg("File playback request (", start, ":", end, ") too short");
         return false;
     }
 
-    // read in initial sample buffers
+    // read in initial sample buffers, the ring is empty as playback is stopped
     if (!audio_file->seek(start)) {
         logmsg("Sample file failed start seek to ", start);
         return false;
     }
-    if (audio_file->read(sample_buf_a, AUDIO_BUFFER_SIZE) != AUDIO_BUFFER_SIZE) {
-        logmsg("File playback start returned fewer bytes than allowed");
-        return false;
-    }
-    if (audio_file->read(sample_buf_b, AUDIO_BUFFER_SIZE) != AUDIO_BUFFER_SIZE) {
+    fpos = start;
+    fleft = end - start;
+    sbuf_written = 0;
+    sbuf_played = 0;
+    sbufpos = 0;
+    if (!snd_fill()) {
         logmsg("File playback start returned fewer bytes than allowed");
+        fleft = 0;
         return false;
     }
 
     // prepare initial tracking state
-    fpos = audio_file->position();
-    fleft -= AUDIO_BUFFER_SIZE * 2;
-    sbufsel = A;
-    sbufpos = 0;
     sbufswap = swap;
-    sbufst_a = READY;
-    sbufst_b = READY;
+    audio_underruns = 0;
+    audio_min_level = AUDIO_BUFFER_COUNT * AUDIO_BUFFER_SIZE;
+    audio_underrun_active = false;
     audio_owner = owner & 7;
     audio_last_status[audio_owner] = ASC_PLAYING;
     audio_paused = false;
@@ -541,13 +574,13 @@ bool audio_set_paused(uint8_t id, bool paused) {
 void audio_stop(uint8_t id) {
     if (audio_owner != (id & 7)) return;
 
-    // to help mute external hardware, send a bunch of '0' samples prior to
-    // halting the datastream; easiest way to do this is invalidating the
-    // sample buffers, same as if there was a sample data underrun
-    sbufst_a = STALE;
-    sbufst_b = STALE;
+    // remember the position of the last played sample
+    fpos = audio_get_file_position();
+    fleft = 0;
 
-    // then indicate that the streams should no longer chain to one another
+    // to help mute external hardware, send a bunch of '0' samples prior to
+    // halting the datastream; Core1 encodes silence while stopping.
+    // Then indicate that the streams should no longer chain to one another
     // and wait for them to shut down naturally
     audio_stopping = true;
     while (dma_channel_is_busy(SOUND_DMA_CHA)) tight_loop_contents();
@@ -555,6 +588,13 @@ void audio_stop(uint8_t id) {
     while (spi_is_busy(AUDIO_SPI)) tight_loop_contents();
     audio_stopping = false;
 
+    if (audio_underruns > 0) {
+        logmsg("Audio playback had ", (int)audio_underruns, " sample data underruns, minimum buffer level ",
+            (int)audio_min_level, " bytes");
+    } else {
+        dbgmsg("------ Audio playback minimum buffer level ", (int)audio_min_level, " bytes");
+    }
+
     // idle the subsystem
     audio_last_status[audio_owner] = ASC_COMPLETED;
     audio_paused = false;
@@ -587,7 +627,17 @@ void audio_set_channel(uint8_t id, uint16_t chn) {
 
 uint64_t audio_get_file_position()
 {
-    return fpos;
+    if (!audio_is_active()) return fpos;
+
+    // samples still in the ring have not been played yet
+    uint32_t buffered = (sbuf_written - sbuf_played) * AUDIO_BUFFER_SIZE - sbufpos;
+    return fpos - buffered;
+}
+
+void audio_get_stats(uint32_t *underruns, uint32_t *min_level)
+{
+    *underruns = audio_underruns;
+    *min_level = audio_min_level;
 }
 
 void audio_set_file_position(uint32_t lba)
@@ -24,10 +24,13 @@
 #define SOUND_DMA_CHA 6
 #define SOUND_DMA_CHB 7
 
-// size of the two audio sample buffers, in bytes
+// size of each audio sample buffer in the ring, in bytes
 // these must be divisible by 1024
-// #define AUDIO_BUFFER_SIZE 8192 // ~46.44ms
-#define AUDIO_BUFFER_SIZE 4096 // reduce memory usage
+#define AUDIO_BUFFER_SIZE 2048 // ~11.6ms
+
+// number of sample buffers in the ring, ~139ms in total allows riding
+// through long SD card writes and SCSI transfers on other targets
+#define AUDIO_BUFFER_COUNT 12
 
 /**
  * Handler for DMA interrupts
@@ -55,9 +58,22 @@ bool audio_is_active();
  */
 void audio_setup();
 
+// Parks Core1 in RAM so that Core0 can erase or program flash. Must be
+// called with interrupts enabled, as Core1 may be waiting on a FIFO push.
+void audio_core1_lockout_start();
+void audio_core1_lockout_end();
+
 /**
  * Called from platform_poll() to fill sample buffer(s) if needed.
  */
 void audio_poll();
 
+/**
+ * Provides statistics for the current or last playback.
+ *
+ * \param underruns  Number of times the sample buffers ran empty.
+ * \param min_level  Lowest amount of buffered sample data, in bytes.
+ */
+void audio_get_stats(uint32_t *underruns, uint32_t *min_level);
+
 #endif // ENABLE_AUDIO_OUTPUT
@@ -358,6 +358,50 @@ void scsi_accel_rp2040_startWrite(const uint8_t* data, uint32_t count, volatile
     start_dma_write();
 }
 
+bool scsi_accel_rp2040_appendWrite(const uint8_t* data, uint32_t count)
+{
+    bool status = false;
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (g_scsi_dma_state == SCSIDMA_WRITE)
+    {
+        if (!g_scsi_dma.next_app_buf && data == g_scsi_dma.app_buf + g_scsi_dma.app_bytes)
+        {
+            // Combine with currently running request
+            g_scsi_dma.app_bytes += count;
+            status = true;
+        }
+        else if (g_scsi_dma.next_app_buf && data == g_scsi_dma.next_app_buf + g_scsi_dma.next_app_bytes)
+        {
+            // Combine with queued request
+            g_scsi_dma.next_app_bytes += count;
+            status = true;
+        }
+        else if (!g_scsi_dma.next_app_buf)
+        {
+            // Add as queued request
+            g_scsi_dma.next_app_buf = (uint8_t*)data;
+            g_scsi_dma.next_app_bytes = count;
+            status = true;
+        }
+    }
+    else if (g_scsi_dma_state == SCSIDMA_WRITE_DONE)
+    {
+        // Previous data has been sent, but bus has not been released yet.
+        // Restart DMA from the new buffer.
+        g_scsi_dma_state = SCSIDMA_WRITE;
+        g_scsi_dma.app_buf = (uint8_t*)data;
+        g_scsi_dma.app_bytes = count;
+        g_scsi_dma.dma_bytes = 0;
+        g_scsi_dma.next_app_buf = 0;
+        g_scsi_dma.next_app_bytes = 0;
+        start_dma_write();
+        status = true;
+    }
+    restore_interrupts(saved_irq);
+
+    return status;
+}
+
 bool scsi_accel_rp2040_isWriteFinished(const uint8_t* data)
 {
     // Check if everything has completed
@@ -41,6 +41,12 @@ bool scsi_accel_rp2040_setSyncMode(int syncOffset, int syncPeriod);
 // If there are too many queued requests, this function will block until previous request finishes.
 void scsi_accel_rp2040_startWrite(const uint8_t* data, uint32_t count, volatile int *resetFlag);
 
+// Append data to an already started write request without blocking.
+// The data is combined with the current or queued request, or restarts the DMA if
+// the previous data has already been sent. Safe to call from interrupt context.
+// Returns false if the data could not be queued, caller should retry later.
+bool scsi_accel_rp2040_appendWrite(const uint8_t* data, uint32_t count);
+
 // Query whether the data at pointer has already been read, i.e. buffer can be reused.
 // If data is NULL, checks if all writes have completed.
 bool scsi_accel_rp2040_isWriteFinished(const uint8_t* data);
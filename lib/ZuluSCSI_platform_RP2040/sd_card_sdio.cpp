@@ -27,6 +27,7 @@
 
 #include "ZuluSCSI_log.h"
 #include "sdio.h"
+#include "scsi_accel_target.h"
 #include <hardware/gpio.h>
 #include <SdFat.h>
 #include <SdCard/SdCardInfo.h>
@@ -54,14 +55,48 @@ static const uint8_t *m_stream_buffer;
 static uint32_t m_stream_count;
 static uint32_t m_stream_count_start;
 
+// Direct handoff of received data to SCSI DMA from the SDIO DMA interrupt
+static volatile bool m_handoff_enabled;
+static uint32_t m_handoff_unit;
+static uint32_t m_handoff_bytes;
+
 void platform_set_sd_callback(sd_callback_t func, const uint8_t *buffer)
 {
+    m_handoff_enabled = false;
     m_stream_callback = func;
     m_stream_buffer = buffer;
     m_stream_count = 0;
     m_stream_count_start = 0;
 }
 
+void platform_start_sd_scsi_handoff(uint32_t unit, uint32_t bytes_queued)
+{
+    m_handoff_unit = unit;
+    m_handoff_bytes = bytes_queued;
+    m_handoff_enabled = true;
+}
+
+uint32_t platform_stop_sd_scsi_handoff()
+{
+    m_handoff_enabled = false;
+    return m_handoff_bytes;
+}
+
+// Called from DMA interrupt when SD card blocks have been received.
+// Queues the completed data for SCSI transfer without waiting for the main loop.
+static void sd_scsi_handoff_irq(uint32_t bytes_done)
+{
+    if (!m_handoff_enabled) return;
+
+    uint32_t ready = m_stream_count_start + bytes_done;
+    ready -= ready % m_handoff_unit;
+    if (ready > m_handoff_bytes &&
+        scsi_accel_rp2040_appendWrite(m_stream_buffer + m_handoff_bytes, ready - m_handoff_bytes))
+    {
+        m_handoff_bytes = ready;
+    }
+}
+
 static sd_callback_t get_stream_callback(const uint8_t *buf, uint32_t count, const char *accesstype, uint32_t sector)
 {
     m_stream_count_start = m_stream_count;
@@ -440,6 +475,7 @@ bool SdioCard::readSector(uint32_t sector, uint8_t* dst)
     }
 
     sd_callback_t callback = get_stream_callback(dst, 512, "readSector", sector);
+    rp2040_sdio_rx_set_irq_callback((callback && dst == real_dst) ? sd_scsi_handoff_irq : NULL);
 
     // Cards up to 2GB use byte addressing, SDHC cards use sector addressing
     uint32_t address = (type() == SD_CARD_TYPE_SDHC) ? sector : (sector * 512);
@@ -491,6 +527,7 @@ bool SdioCard::readSectors(uint32_t sector, uint8_t* dst, size_t n)
     }
 
     sd_callback_t callback = get_stream_callback(dst, n * 512, "readSectors", sector);
+    rp2040_sdio_rx_set_irq_callback(callback ? sd_scsi_handoff_irq : NULL);
 
     // Cards up to 2GB use byte addressing, SDHC cards use sector addressing
     uint32_t address = (type() == SD_CARD_TYPE_SDHC) ? sector : (sector * 512);
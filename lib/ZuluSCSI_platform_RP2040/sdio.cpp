@@ -66,7 +66,9 @@ static struct {
     uint32_t blocks_done; // Number of blocks transferred so far
     uint32_t total_blocks; // Total number of blocks to transfer
     uint32_t blocks_checksumed; // Number of blocks that have had CRC calculated
+    uint32_t blocks_verified; // Number of blocks before first checksum error
     uint32_t checksum_errors; // Number of checksum errors detected
+    void (*rx_irq_callback)(uint32_t bytes_complete); // Called from IRQ as blocks are received and verified
 
     // Variables for block writes
     uint64_t next_wr_block_checksum;
@@ -374,6 +376,23 @@ sdio_status_t rp2040_sdio_command_R3(uint8_t command, uint32_t arg, uint32_t *re
  * Data reception from SD card
  *******************************************************/
 
+void rp2040_sdio_rx_set_irq_callback(void (*func)(uint32_t bytes_complete))
+{
+    g_sdio.rx_irq_callback = func;
+}
+
+// Number of complete blocks received in current transfer
+static uint32_t sdio_rx_blocks_done()
+{
+    // Check how many DMA control blocks have been consumed
+    uint32_t dma_ctrl_block_count = (dma_hw->ch[SDIO_DMA_CHB].read_addr - (uint32_t)&g_sdio.dma_blocks);
+    dma_ctrl_block_count /= sizeof(g_sdio.dma_blocks[0]);
+
+    // Compute how many complete 512 byte SDIO blocks have been transferred
+    // When transfer ends, dma_ctrl_block_count == g_sdio.total_blocks * 2 + 1
+    return (dma_ctrl_block_count - 1) / 2;
+}
+
 sdio_status_t rp2040_sdio_rx_start(uint8_t *buffer, uint32_t num_blocks)
 {
     // Buffer must be aligned
@@ -385,6 +404,7 @@ sdio_status_t rp2040_sdio_rx_start(uint8_t *buffer, uint32_t num_blocks)
     g_sdio.blocks_done = 0;
     g_sdio.total_blocks = num_blocks;
     g_sdio.blocks_checksumed = 0;
+    g_sdio.blocks_verified = 0;
     g_sdio.checksum_errors = 0;
 
     // Create DMA block descriptors to store each block of 512 bytes of data to buffer
@@ -431,6 +451,11 @@ sdio_status_t rp2040_sdio_rx_start(uint8_t *buffer, uint32_t num_blocks)
     // This gives more leeway for the DMA block switching
     SDIO_PIO->sm[SDIO_DATA_SM].shiftctrl |= PIO_SM0_SHIFTCTRL_FJOIN_RX_BITS;
 
+    // Interrupt on every DMA control block load if application wants to know
+    // about received blocks immediately.
+    dma_hw->ints1 = 1 << SDIO_DMA_CHB;
+    dma_set_irq1_channel_mask_enabled(1 << SDIO_DMA_CHB, g_sdio.rx_irq_callback != NULL);
+
     // Start PIO and DMA
     dma_channel_start(SDIO_DMA_CHB);
     pio_sm_set_enabled(SDIO_PIO, SDIO_DATA_SM, true);
@@ -439,9 +464,9 @@ sdio_status_t rp2040_sdio_rx_start(uint8_t *buffer, uint32_t num_blocks)
 }
 
 // Check checksums for received blocks
-static void sdio_verify_rx_checksums(uint32_t maxcount)
+static void sdio_verify_rx_checksums(uint32_t blocks_done, uint32_t maxcount)
 {
-    while (g_sdio.blocks_checksumed < g_sdio.blocks_done && maxcount-- > 0)
+    while (g_sdio.blocks_checksumed < blocks_done && maxcount-- > 0)
     {
         // Calculate checksum from received data
         int blockidx = g_sdio.blocks_checksumed++;
@@ -462,6 +487,10 @@ static void sdio_verify_rx_checksums(uint32_t maxcount)
                       " calculated ", checksum, " expected ", expected);
             }
         }
+        else if (g_sdio.checksum_errors == 0)
+        {
+            g_sdio.blocks_verified = g_sdio.blocks_checksumed;
+        }
     }
 }
 
@@ -474,16 +503,14 @@ sdio_status_t rp2040_sdio_rx_poll(uint32_t *bytes_complete)
     }
     else
     {
-        // Use the idle time to calculate checksums
-        sdio_verify_rx_checksums(4);
-
-        // Check how many DMA control blocks have been consumed
-        uint32_t dma_ctrl_block_count = (dma_hw->ch[SDIO_DMA_CHB].read_addr - (uint32_t)&g_sdio.dma_blocks);
-        dma_ctrl_block_count /= sizeof(g_sdio.dma_blocks[0]);
+        // Use the idle time to calculate checksums.
+        // With IRQ callback, the interrupt handler verifies blocks as they arrive.
+        if (!g_sdio.rx_irq_callback)
+        {
+            sdio_verify_rx_checksums(g_sdio.blocks_done, 4);
+        }
 
-        // Compute how many complete 512 byte SDIO blocks have been transferred
-        // When transfer ends, dma_ctrl_block_count == g_sdio.total_blocks * 2 + 1
-        g_sdio.blocks_done = (dma_ctrl_block_count - 1) / 2;
+        g_sdio.blocks_done = sdio_rx_blocks_done();
 
         // NOTE: When all blocks are done, rx_poll() still returns SDIO_BUSY once.
         // This provides a chance to start the SCSI transfer before the last checksums
@@ -491,16 +518,24 @@ sdio_status_t rp2040_sdio_rx_poll(uint32_t *bytes_complete)
         // the data transfer has finished.
     }
 
+    if (g_sdio.transfer_state == SDIO_IDLE)
+    {
+        // Verify all remaining checksums.
+        // The DMA interrupt is no longer needed, and disabling it avoids
+        // concurrent access to the checksum counters.
+        dma_set_irq1_channel_mask_enabled(1 << SDIO_DMA_CHB, 0);
+        sdio_verify_rx_checksums(g_sdio.total_blocks, g_sdio.total_blocks);
+    }
+
     if (bytes_complete)
     {
-        *bytes_complete = g_sdio.blocks_done * SDIO_BLOCK_SIZE;
+        // With IRQ callback, data is passed on only after verification
+        uint32_t blocks = g_sdio.rx_irq_callback ? g_sdio.blocks_verified : g_sdio.blocks_done;
+        *bytes_complete = blocks * SDIO_BLOCK_SIZE;
     }
 
     if (g_sdio.transfer_state == SDIO_IDLE)
     {
-        // Verify all remaining checksums.
-        sdio_verify_rx_checksums(g_sdio.total_blocks);
-
         if (g_sdio.checksum_errors == 0)
             return SDIO_OK;
         else
@@ -645,11 +680,29 @@ sdio_status_t check_sdio_write_response(uint32_t card_response)
     }
 }
 
-// When a block finishes, this IRQ handler starts the next one
-static void rp2040_sdio_tx_irq()
+// When a block finishes, this IRQ handler starts the next one in transmission
+// or reports the received data in reception.
+void rp2040_sdio_dma_irq()
 {
     dma_hw->ints1 = 1 << SDIO_DMA_CHB;
 
+    if (g_sdio.transfer_state == SDIO_RX)
+    {
+        // The interrupt comes at start of both the data and checksum part of a block.
+        // When a checksum has been received, verify the block before reporting it,
+        // so that only correct data gets passed on to the application.
+        uint32_t blocks_done = sdio_rx_blocks_done();
+        if (g_sdio.rx_irq_callback && blocks_done > g_sdio.blocks_checksumed)
+        {
+            sdio_verify_rx_checksums(blocks_done, blocks_done);
+            if (g_sdio.checksum_errors == 0)
+            {
+                g_sdio.rx_irq_callback(g_sdio.blocks_verified * SDIO_BLOCK_SIZE);
+            }
+        }
+        return;
+    }
+
     if (g_sdio.transfer_state == SDIO_TX)
     {
         if (!dma_channel_is_busy(SDIO_DMA_CH) && !dma_channel_is_busy(SDIO_DMA_CHB))
@@ -715,7 +768,7 @@ sdio_status_t rp2040_sdio_tx_poll(uint32_t *bytes_complete)
     if (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk)
     {
         // Verify that IRQ handler gets called even if we are in hardfault handler
-        rp2040_sdio_tx_irq();
+        rp2040_sdio_dma_irq();
     }
 
     if (bytes_complete)
@@ -828,15 +881,15 @@ void rp2040_sdio_init(int clock_divider)
     gpio_set_function(SDIO_D3, GPIO_FUNC_PIO1);
 
     // Set up IRQ handler when DMA completes.
-    irq_set_exclusive_handler(DMA_IRQ_1, rp2040_sdio_tx_irq);
+    irq_set_exclusive_handler(DMA_IRQ_1, rp2040_sdio_dma_irq);
     irq_set_enabled(DMA_IRQ_1, true);
 #if 0
 #ifndef ENABLE_AUDIO_OUTPUT
-    irq_set_exclusive_handler(DMA_IRQ_1, rp2040_sdio_tx_irq);
+    irq_set_exclusive_handler(DMA_IRQ_1, rp2040_sdio_dma_irq);
 #else
     // seem to hit assertion in _exclusive_handler call due to DMA_IRQ_0 being shared?
     // slightly less efficient to do it this way, so investigate further at some point
-    irq_add_shared_handler(DMA_IRQ_1, rp2040_sdio_tx_irq, 0xFF);
+    irq_add_shared_handler(DMA_IRQ_1, rp2040_sdio_dma_irq, 0xFF);
 #endif
     irq_set_enabled(DMA_IRQ_1, true);
 #endif
@@ -56,6 +56,12 @@ sdio_status_t rp2040_sdio_command_R3(uint8_t command, uint32_t arg, uint32_t *re
 // Transfer block size is always 512 bytes.
 sdio_status_t rp2040_sdio_rx_start(uint8_t *buffer, uint32_t num_blocks);
 
+// Set function that is called from DMA interrupt whenever new blocks have been
+// received and their checksums verified. The argument is number of bytes
+// complete in the current transfer. It is not called after a checksum error.
+// Takes effect on next rx_start(). Pass NULL to disable.
+void rp2040_sdio_rx_set_irq_callback(void (*func)(uint32_t bytes_complete));
+
 // Check if reception is complete
 // Returns SDIO_BUSY while transferring, SDIO_OK when done and error on failure.
 sdio_status_t rp2040_sdio_rx_poll(uint32_t *bytes_complete = nullptr);
@@ -11,3 +11,6 @@ bool ini_close(INI_FILETYPE *fp);
 bool ini_read(char *buffer, int size, INI_FILETYPE *fp);
 void ini_tell(INI_FILETYPE *fp, INI_FILEPOS *pos);
 void ini_seek(INI_FILETYPE *fp, INI_FILEPOS *pos);
+
+#define INI_KEYINDEX 1
+int ini_findkey(INI_FILETYPE *fp, const char *Section, const char *Key);
@@ -1,9 +1,17 @@
 // Custom .ini file access caching layer for minIni.
 // This reduces boot delay by only reading the ini file once
 // after boot or SD-card removal.
+//
+// The file is also indexed by section and key name, so that lookups
+// go directly to the line of the key instead of scanning the file.
+// This works also for files that are too large for the cache.
 
 #include <minGlue.h>
+#include <minIni.h>
 #include <SdFat.h>
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
 
 // This can be overridden in platformio.ini
 // Set to 0 to disable the cache.
@@ -11,6 +19,17 @@
 #define INI_CACHE_SIZE 4096
 #endif
 
+// Number of slots in the key index, must be a power of two.
+// Up to 3/4 of the slots are used, files with more keys are scanned.
+// Set to 0 to disable the index.
+#ifndef INI_INDEX_SIZE
+#define INI_INDEX_SIZE 256
+#endif
+
+#if (INI_INDEX_SIZE & (INI_INDEX_SIZE - 1)) != 0
+#error INI_INDEX_SIZE must be a power of two
+#endif
+
 // Use the SdFs instance from main program
 extern SdFs SD;
 
@@ -26,18 +45,42 @@ static struct {
 #endif
 } g_ini_cache;
 
+#if INI_INDEX_SIZE > 0
+#define INI_INDEX_NONE 0xFFFFFFFF
+
+struct ini_index_entry_t {
+    uint32_t hash;        // Hash of section and key name, 0 for unused slot
+    uint32_t key_pos;     // File position of the key line
+    uint32_t section_pos; // File position of the section header or INI_INDEX_NONE
+};
+
+static struct {
+    bool valid;
+    const char *filename;
+    INI_FILETYPE *fp;
+    uint32_t count;
+    ini_index_entry_t entries[INI_INDEX_SIZE];
+} g_ini_index;
+
+static void build_ini_index(const char *filename);
+#endif
+
 // Invalidate any cached file contents
 void invalidate_ini_cache()
 {
     g_ini_cache.valid = false;
     g_ini_cache.fp = NULL;
+
+#if INI_INDEX_SIZE > 0
+    g_ini_index.valid = false;
+    g_ini_index.fp = NULL;
+#endif
 }
 
 // Read the config file into RAM
 void reload_ini_cache(const char *filename)
 {
-    g_ini_cache.valid = false;
-    g_ini_cache.fp = NULL;
+    invalidate_ini_cache();
 
 #if INI_CACHE_SIZE > 0
     g_ini_cache.filename = filename;
@@ -52,11 +95,23 @@ void reload_ini_cache(const char *filename)
     }
     config.close();
 #endif
+
+#if INI_INDEX_SIZE > 0
+    build_ini_index(filename);
+#endif
 }
 
 // Open .ini file either from cache or from SD card
 bool ini_openread(const char *filename, INI_FILETYPE *fp)
 {
+#if INI_INDEX_SIZE > 0
+    if (g_ini_index.valid &&
+        (filename == g_ini_index.filename || strcmp(filename, g_ini_index.filename) == 0))
+    {
+        g_ini_index.fp = fp;
+    }
+#endif
+
 #if INI_CACHE_SIZE > 0
     if (g_ini_cache.valid &&
         (filename == g_ini_cache.filename || strcmp(filename, g_ini_cache.filename) == 0))
@@ -74,6 +129,13 @@ bool ini_openread(const char *filename, INI_FILETYPE *fp)
 // Close previously opened file
 bool ini_close(INI_FILETYPE *fp)
 {
+#if INI_INDEX_SIZE > 0
+    if (g_ini_index.fp == fp)
+    {
+        g_ini_index.fp = NULL;
+    }
+#endif
+
 #if INI_CACHE_SIZE > 0
     if (g_ini_cache.fp == fp)
     {
@@ -145,3 +207,230 @@ void ini_seek(INI_FILETYPE *fp, INI_FILEPOS *pos)
         fp->fsetpos(pos);
     }
 }
+
+#if INI_INDEX_SIZE > 0
+
+// Whitespace handling is the same as in minIni.cpp
+static char *index_skipleading(char *str)
+{
+    while ('\0' < *str && *str <= ' ')
+        str++;
+    return str;
+}
+
+static char *index_skiptrailing(char *str, char *base)
+{
+    while (str > base && '\0' < *(str-1) && *(str-1) <= ' ')
+        str--;
+    return str;
+}
+
+// Find the name of the section header on the line.
+// Returns false if the line is not a section header.
+static bool index_parse_section(char *line, char **name, int *len)
+{
+    char *sp = index_skipleading(line);
+    char *ep = strrchr(sp, ']');
+    if (*sp != '[' || ep == NULL) return false;
+    sp = index_skipleading(sp + 1);
+    ep = index_skiptrailing(ep, sp);
+    *name = sp;
+    *len = (int)(ep - sp);
+    return true;
+}
+
+// Find the name of the key on the line.
+// Returns false if the line is not a key.
+static bool index_parse_key(char *line, char **name, int *len)
+{
+    char *sp = index_skipleading(line);
+    if (*sp == ';' || *sp == '#' || *sp == '[') return false;
+    char *ep = strchr(sp, '=');
+    if (ep == NULL) ep = strchr(sp, ':');
+    if (ep == NULL) return false;
+    *name = sp;
+    *len = (int)(index_skiptrailing(ep, sp) - sp);
+    return *len > 0;
+}
+
+// Case-insensitive FNV-1a hash
+static uint32_t index_hash(uint32_t hash, const char *str, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        hash = (hash ^ (uint8_t)tolower((uint8_t)str[i])) * 16777619UL;
+    }
+    return hash;
+}
+
+static uint32_t index_keyhash(const char *section, int seclen, const char *key, int keylen)
+{
+    uint32_t hash = index_hash(2166136261UL, section, seclen);
+    hash = (hash ^ 0x100) * 16777619UL;
+    hash = index_hash(hash, key, keylen);
+    return (hash != 0) ? hash : 1;
+}
+
+static void index_seek(INI_FILETYPE *fp, uint32_t position)
+{
+#if INI_CACHE_SIZE > 0
+    if (g_ini_cache.fp == fp)
+    {
+        g_ini_cache.current_pos.position = position;
+    }
+    else
+#endif
+    {
+        fp->seekSet(position);
+    }
+}
+
+// Add entry, returns false if the index is full or the hash is already used.
+// Sections are stored with an empty key name to detect duplicates.
+static bool index_insert(uint32_t hash, uint32_t key_pos, uint32_t section_pos)
+{
+    if (g_ini_index.count >= INI_INDEX_SIZE * 3 / 4)
+    {
+        return false;
+    }
+
+    uint32_t slot = hash & (INI_INDEX_SIZE - 1);
+    while (g_ini_index.entries[slot].hash != 0)
+    {
+        if (g_ini_index.entries[slot].hash == hash)
+        {
+            return false;
+        }
+        slot = (slot + 1) & (INI_INDEX_SIZE - 1);
+    }
+
+    g_ini_index.entries[slot].hash = hash;
+    g_ini_index.entries[slot].key_pos = key_pos;
+    g_ini_index.entries[slot].section_pos = section_pos;
+    g_ini_index.count++;
+    return true;
+}
+
+// Record the position of every key that getkeystring() in minIni.cpp can find.
+// It uses the first section with a given name and the first key within it.
+// The index is left invalid for files that have duplicates or hash collisions,
+// so that they are scanned like before.
+static void build_ini_index(const char *filename)
+{
+    memset(g_ini_index.entries, 0, sizeof(g_ini_index.entries));
+    g_ini_index.count = 0;
+    g_ini_index.filename = filename;
+
+    INI_FILETYPE fp;
+    if (!ini_openread(filename, &fp))
+    {
+        return;
+    }
+
+    char line[INI_BUFFERSIZE];
+    char section[INI_BUFFERSIZE];
+    int seclen = 0;
+    uint32_t section_pos = INI_INDEX_NONE;
+    bool in_section = true; // Keys before first section are found with empty section name
+    bool ok = true;
+
+    INI_FILEPOS pos;
+    ini_tell(&fp, &pos);
+    while (ok && ini_read(line, sizeof(line), &fp))
+    {
+        uint32_t line_pos = (uint32_t)pos.position;
+        ini_tell(&fp, &pos);
+
+        char *name;
+        int len;
+        if (*index_skipleading(line) == '[')
+        {
+            // Lookups never continue past a line starting with '['
+            in_section = index_parse_section(line, &name, &len) && len > 0;
+            if (in_section)
+            {
+                memcpy(section, name, len);
+                seclen = len;
+                section_pos = line_pos;
+                ok = index_insert(index_keyhash(section, seclen, "", 0), line_pos, line_pos);
+            }
+        }
+        else if (in_section && index_parse_key(line, &name, &len))
+        {
+            ok = index_insert(index_keyhash(section, seclen, name, len), line_pos, section_pos);
+        }
+    }
+
+    ini_close(&fp);
+    g_ini_index.valid = ok;
+}
+
+// Check that the names on the lines of the index entry match
+static bool index_verify(INI_FILETYPE *fp, const ini_index_entry_t &entry,
+                         const char *Section, int seclen, const char *Key, int keylen)
+{
+    char line[INI_BUFFERSIZE];
+    char *name;
+    int len;
+
+    if (entry.section_pos == INI_INDEX_NONE)
+    {
+        if (seclen != 0) return false;
+    }
+    else
+    {
+        index_seek(fp, entry.section_pos);
+        if (!ini_read(line, sizeof(line), fp) ||
+            !index_parse_section(line, &name, &len) ||
+            len != seclen || strncasecmp(name, Section, len) != 0)
+        {
+            return false;
+        }
+    }
+
+    index_seek(fp, entry.key_pos);
+    return ini_read(line, sizeof(line), fp) &&
+           index_parse_key(line, &name, &len) &&
+           len == keylen && strncasecmp(name, Key, len) == 0;
+}
+
+// Look up the key in the index of the file opened with ini_openread().
+// Returns 1 and moves to the line of the key if it was found,
+// 0 if the file does not have the key and -1 if the file is not indexed.
+int ini_findkey(INI_FILETYPE *fp, const char *Section, const char *Key)
+{
+    if (!g_ini_index.valid || g_ini_index.fp != fp || Key == NULL || Key[0] == '\0')
+    {
+        return -1;
+    }
+
+    if (Section == NULL) Section = "";
+    int seclen = strlen(Section);
+    int keylen = strlen(Key);
+    uint32_t hash = index_keyhash(Section, seclen, Key, keylen);
+    uint32_t slot = hash & (INI_INDEX_SIZE - 1);
+    while (g_ini_index.entries[slot].hash != 0)
+    {
+        const ini_index_entry_t &entry = g_ini_index.entries[slot];
+        if (entry.hash == hash && index_verify(fp, entry, Section, seclen, Key, keylen))
+        {
+            index_seek(fp, entry.key_pos);
+            return 1;
+        }
+        slot = (slot + 1) & (INI_INDEX_SIZE - 1);
+    }
+
+    return 0;
+}
+
+#else
+
+int ini_findkey(INI_FILETYPE *fp, const char *Section, const char *Key)
+{
+    (void)fp;
+    (void)Section;
+    (void)Key;
+    return -1;
+}
+
+#endif
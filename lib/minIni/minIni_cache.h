@@ -6,5 +6,6 @@
 
 void invalidate_ini_cache();
 
+// Read the file into the cache and index the positions of its keys.
 // Note: filename must be statically allocated, pointer is stored.
 void reload_ini_cache(const char *filename);
\ No newline at end of file
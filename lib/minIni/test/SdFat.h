@@ -0,0 +1,102 @@
+// Minimal stand-in for the SdFat API used by minIni_cache.cpp,
+// backed by stdio files so that the tests can run on Linux.
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef O_RDONLY
+#define O_RDONLY 0
+#endif
+
+typedef struct {
+  uint64_t position;
+  uint32_t cluster;
+} fspos_t;
+
+class FsVolume {};
+
+class FsFile
+{
+public:
+    FsFile(): m_fp(NULL) {}
+    FsFile(FsFile &&other): m_fp(other.m_fp) { other.m_fp = NULL; }
+    ~FsFile() { close(); }
+
+    bool open(FsVolume *vol, const char *path, int oflag)
+    {
+        (void)vol;
+        (void)oflag;
+        close();
+        m_fp = fopen(path, "rb");
+        g_open_count++;
+        return m_fp != NULL;
+    }
+
+    bool close()
+    {
+        if (m_fp) fclose(m_fp);
+        m_fp = NULL;
+        return true;
+    }
+
+    bool isOpen() const { return m_fp != NULL; }
+
+    uint64_t fileSize()
+    {
+        if (!m_fp) return 0;
+        long pos = ftell(m_fp);
+        fseek(m_fp, 0, SEEK_END);
+        long size = ftell(m_fp);
+        fseek(m_fp, pos, SEEK_SET);
+        return size;
+    }
+
+    int read(void *buf, size_t count)
+    {
+        return m_fp ? (int)fread(buf, 1, count, m_fp) : -1;
+    }
+
+    int fgets(char *str, int num)
+    {
+        if (!m_fp || !::fgets(str, num, m_fp)) return 0;
+        return strlen(str);
+    }
+
+    void fgetpos(fspos_t *pos) const
+    {
+        pos->position = m_fp ? ftell(m_fp) : 0;
+        pos->cluster = 0;
+    }
+
+    void fsetpos(const fspos_t *pos) { seekSet(pos->position); }
+
+    bool seekSet(uint64_t pos)
+    {
+        return m_fp && fseek(m_fp, pos, SEEK_SET) == 0;
+    }
+
+    // Number of times a file has been opened, for checking cache use
+    static int g_open_count;
+
+private:
+    FILE *m_fp;
+};
+
+class SdFs
+{
+public:
+    FsVolume *vol() { return &m_vol; }
+
+    FsFile open(const char *path, int oflag)
+    {
+        FsFile file;
+        file.open(&m_vol, path, oflag);
+        return file;
+    }
+
+private:
+    FsVolume m_vol;
+};
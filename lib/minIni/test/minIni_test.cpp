@@ -0,0 +1,258 @@
+#include "minIni.h"
+#include "minIni_cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Unit test helpers */
+#define COMMENT(x) printf("\n----" x "----\n");
+#define TEST(x) \
+    if (!(x)) { \
+        fprintf(stderr, "\033[31;1mFAILED:\033[22;39m %s:%d %s\n", __FILE__, __LINE__, #x); \
+        status = false; \
+    } else { \
+        printf("\033[32;1mOK:\033[22;39m %s\n", #x); \
+    }
+
+SdFs SD;
+int FsFile::g_open_count;
+
+// Loaded into the cache and index. The same file opened through
+// REFERENCE_FILE is not indexed, so it is scanned like before.
+#define CONFIG_FILE "test_config.ini"
+#define REFERENCE_FILE "./test_config.ini"
+
+static void write_file(const char *filename, const char *contents)
+{
+    FILE *f = fopen(filename, "wb");
+    fputs(contents, f);
+    fclose(f);
+}
+
+// Compare the results of lookups through the index and by scanning the file
+static bool compare_lookups(const char *sections[], const char *keys[])
+{
+    bool ok = true;
+    for (int i = 0; sections[i]; i++)
+    {
+        for (int j = 0; keys[j]; j++)
+        {
+            char value[128], expected[128];
+            ini_gets(sections[i], keys[j], "default", value, sizeof(value), CONFIG_FILE);
+            ini_gets(sections[i], keys[j], "default", expected, sizeof(expected), REFERENCE_FILE);
+            if (strcmp(value, expected) != 0 ||
+                ini_haskey(sections[i], keys[j], CONFIG_FILE) != ini_haskey(sections[i], keys[j], REFERENCE_FILE))
+            {
+                printf("Mismatch for [%s] %s: '%s' != '%s'\n", sections[i], keys[j], value, expected);
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+bool test_lookups()
+{
+    bool status = true;
+    COMMENT("test_lookups()");
+
+    write_file(CONFIG_FILE,
+        "TopKey = top\n"
+        "[SCSI]\n"
+        "Quirks = 1\n"
+        "  Vendor  =  \"QUANTUM \" ; comment\n"
+        "product:P1\n"
+        "#Serial = commented\n"
+        "; Version = commented\n"
+        "EmptyValue =\n"
+        "[ SCSI1 ]   \n"
+        "Vendor=SEAGATE\n"
+        "Quirks = 2 # comment\n"
+        "[SCSI2\n"
+        "Vendor = unreachable\n"
+        "[SCSI3]\r\n"
+        "vendor = CRLF\r\n"
+        "Type = 2\r\n"
+        "[]\n"
+        "Vendor = empty section\n");
+    reload_ini_cache(CONFIG_FILE);
+
+    const char *sections[] = {"", "SCSI", "scsi", "SCSI1", "SCSI2", "SCSI3", "SCSI4", NULL};
+    const char *keys[] = {"TopKey", "Quirks", "Vendor", "VENDOR", "Product", "Serial", "Version",
+                          "EmptyValue", "Type", "Missing", NULL};
+    TEST(compare_lookups(sections, keys));
+    TEST(ini_getl(NULL, "Missing", 5, CONFIG_FILE) == 5);
+    TEST(ini_haskey(NULL, "TopKey", CONFIG_FILE) == 1);
+
+    char value[64];
+    ini_gets("SCSI", "Vendor", "", value, sizeof(value), CONFIG_FILE);
+    TEST(strcmp(value, "QUANTUM ") == 0);
+    ini_gets("scsi1", "vendor", "", value, sizeof(value), CONFIG_FILE);
+    TEST(strcmp(value, "SEAGATE") == 0);
+    ini_gets("SCSI3", "Vendor", "", value, sizeof(value), CONFIG_FILE);
+    TEST(strcmp(value, "CRLF") == 0);
+    ini_gets("", "TopKey", "", value, sizeof(value), CONFIG_FILE);
+    TEST(strcmp(value, "top") == 0);
+    TEST(ini_getl("SCSI1", "Quirks", 0, CONFIG_FILE) == 2);
+    TEST(ini_haskey("SCSI2", "Vendor", CONFIG_FILE) == 0);
+
+    // The cached file is not read again
+    FsFile::g_open_count = 0;
+    ini_getl("SCSI", "Quirks", 0, CONFIG_FILE);
+    TEST(FsFile::g_open_count == 0);
+
+    return status;
+}
+
+// Files with duplicate names fall back to scanning, where the first one is used
+bool test_duplicates()
+{
+    bool status = true;
+    COMMENT("test_duplicates()");
+
+    write_file(CONFIG_FILE,
+        "[SCSI]\n"
+        "Vendor = first\n"
+        "vendor = second\n"
+        "[SCSI0]\n"
+        "Quirks = 1\n"
+        "[scsi]\n"
+        "Product = hidden\n");
+    reload_ini_cache(CONFIG_FILE);
+
+    const char *sections[] = {"SCSI", "SCSI0", NULL};
+    const char *keys[] = {"Vendor", "Quirks", "Product", NULL};
+    TEST(compare_lookups(sections, keys));
+
+    char value[64];
+    ini_gets("SCSI", "Vendor", "", value, sizeof(value), CONFIG_FILE);
+    TEST(strcmp(value, "first") == 0);
+    TEST(ini_haskey("SCSI", "Product", CONFIG_FILE) == 0);
+
+    return status;
+}
+
+static const char *g_device_keys[] = {
+    "Vendor", "Product", "Version", "Serial", "Type", "TypeModifier", "SectorsPerTrack",
+    "HeadsPerCylinder", "PrefetchBytes", "RightAlignStrings", "ReinsertCDOnInquiry",
+    "ReinsertAfterEject", "EjectButton", "CDAVolume", "DisableMacSanityCheck", "SectorSDBegin",
+    "SectorSDEnd", "VendorExtensions", "BlockSize", "NameFromImage", "Quirks", "Device",
+    "SelectionDelay", "MaxSyncSpeed", "InitPreDelay", "InitPostDelay", "PhyMode",
+    "EnableUnitAttention", "EnableSCSI2", "EnableSelLatch", "MapLunsToIDs", "EnableParity",
+    "UseFATAllocSize", "EnableCDAudio", "EnableUSBMassStorage", "ImgDir", "IMG0", "IMG1",
+    NULL
+};
+
+static const char *g_device_sections[] = {
+    "SCSI", "SCSI0", "SCSI1", "SCSI2", "SCSI3", "SCSI4", "SCSI5", "SCSI6", "SCSI7", NULL
+};
+
+// Config with a commented header like zuluscsi.ini and a few keys in every section.
+// The large one does not fit in the cache.
+static void write_config(bool large)
+{
+    FILE *f = fopen(CONFIG_FILE, "wb");
+    for (int i = 0; i < (large ? 60 : 10); i++)
+    {
+        fprintf(f, "# Example setting %d, uncomment to change the default value of the setting\n", i);
+    }
+    for (int i = 0; g_device_sections[i]; i++)
+    {
+        fprintf(f, "\n[%s]\n", g_device_sections[i]);
+        for (int j = 0; g_device_keys[j]; j++)
+        {
+            if ((i + j) % 3 == 0)
+            {
+                fprintf(f, "%s = %d%s\n", g_device_keys[j], i * 100 + j, large ? " # setting" : "");
+            }
+            else if (large && (i + j) % 3 == 1)
+            {
+                fprintf(f, "#%s = 0\n", g_device_keys[j]);
+            }
+        }
+    }
+    fclose(f);
+}
+
+bool test_large()
+{
+    bool status = true;
+    COMMENT("test_large()");
+
+    write_config(true);
+    reload_ini_cache(CONFIG_FILE);
+
+    TEST(compare_lookups(g_device_sections, g_device_keys));
+    TEST(ini_getl("SCSI2", "Vendor", 0, CONFIG_FILE) == 300);
+    TEST(ini_getl("SCSI7", "Vendor", -1, CONFIG_FILE) == -1);
+
+    return status;
+}
+
+// Time to read the settings of all devices, like ZuluSCSI_settings.cpp does
+static double config_load_us(const char *filename)
+{
+    const int count = 200;
+    char value[64];
+    clock_t start = clock();
+    for (int n = 0; n < count; n++)
+    {
+        for (int i = 0; g_device_sections[i]; i++)
+        {
+            for (int j = 0; g_device_keys[j]; j++)
+            {
+                ini_gets(g_device_sections[i], g_device_keys[j], "", value, sizeof(value), filename);
+            }
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC * 1e6 / count;
+}
+
+bool benchmark()
+{
+    bool status = true;
+    COMMENT("benchmark()");
+
+    int lookups = 0;
+    for (int i = 0; g_device_sections[i]; i++)
+        for (int j = 0; g_device_keys[j]; j++)
+            lookups++;
+
+    for (int large = 0; large < 2; large++)
+    {
+        write_config(large);
+        reload_ini_cache(CONFIG_FILE);
+
+        FILE *f = fopen(CONFIG_FILE, "rb");
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fclose(f);
+
+        double loaded = config_load_us(CONFIG_FILE);
+        double scanned = config_load_us(REFERENCE_FILE);
+        printf("%ld byte config, %d lookups: %.0f us, scanning file without cache: %.0f us\n",
+               size, lookups, loaded, scanned);
+#ifndef INI_INDEX_SIZE
+        TEST(loaded < scanned);
+#endif
+    }
+
+    return status;
+}
+
+int main()
+{
+    bool ok = test_lookups() && test_duplicates() && test_large() && benchmark();
+    remove(CONFIG_FILE);
+
+    if (ok)
+    {
+        return 0;
+    }
+    else
+    {
+        printf("Some tests failed\n");
+        return 1;
+    }
+}
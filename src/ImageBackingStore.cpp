@@ -27,12 +27,202 @@
 #include "ZuluSCSI_config.h"
 #include "ZuluSCSI_settings.h"
 #include <minIni.h>
+#include <CDECC.h>
 #include <strings.h>
 #include <string.h>
 #include <assert.h>
 
 extern bool g_rawdrive_active;
 
+#ifdef PLATFORM_HAS_COMPRESSED_IMAGES
+
+// Compressed images are decompressed one hunk at a time to a cache shared
+// by all images. The compressed data is read to the end of the cache slot
+// and decompressed in place, so that no separate buffer is needed.
+// The first hunk slot is reserved for compressed images, the others share
+// memory with the FLAC decode buffer below.
+#ifndef PLATFORM_ZCD_MAX_HUNK_BYTES
+#define PLATFORM_ZCD_MAX_HUNK_BYTES (8 * 2352)
+#endif
+
+#ifndef PLATFORM_ZCD_HUNK_CACHE_SIZE
+#define PLATFORM_ZCD_HUNK_CACHE_SIZE 2
+#endif
+
+static uint32_t g_zcd_image_counter;
+static uint32_t g_zcd_use_counter;
+
+// ECM images consist of records of either literal bytes or runs of CD sectors,
+// which have the sync, header, EDC and ECC fields removed. Each record starts
+// with a variable length header giving the type and count.
+// The index stores record positions at regular intervals so that a
+// position can be found without scanning through the whole file.
+#ifndef PLATFORM_ECM_INDEX_SIZE
+#define PLATFORM_ECM_INDEX_SIZE 1024
+#endif
+
+#ifndef PLATFORM_ECM_INDEX_COUNT
+#define PLATFORM_ECM_INDEX_COUNT 2
+#endif
+
+enum ecm_type_t { ECM_LITERAL = 0, ECM_MODE1 = 1, ECM_MODE2_FORM1 = 2, ECM_MODE2_FORM2 = 3, ECM_END = 4 };
+
+// Size of a sector record in ECM file and after decoding
+static const uint32_t g_ecm_in_size[4] = {1, 0x803, 0x804, 0x918};
+static const uint32_t g_ecm_out_size[4] = {1, 2352, 2336, 2336};
+
+static struct {
+    uint32_t image_id; // 0 if slot is unused
+    uint32_t last_used;
+    uint32_t stride; // Minimum distance between entries in decoded bytes
+    uint32_t count;
+    struct {
+        uint32_t out_pos;
+        uint32_t in_pos;
+    } entries[PLATFORM_ECM_INDEX_SIZE];
+} g_ecm_index[PLATFORM_ECM_INDEX_COUNT];
+
+static uint32_t g_ecm_image_counter;
+static uint32_t g_ecm_use_counter;
+
+// FLAC files are decoded one frame at a time to a buffer shared by all images.
+// The index stores frame positions at regular intervals in the file. It is
+// built on first access, because the CUE sheet parser opens every track file.
+// Frames between index entries are found by scanning for frame headers.
+#ifndef PLATFORM_FLAC_INDEX_SIZE
+#define PLATFORM_FLAC_INDEX_SIZE 256
+#endif
+
+#ifndef PLATFORM_FLAC_INDEX_COUNT
+#define PLATFORM_FLAC_INDEX_COUNT 2
+#endif
+
+// Limit for scanning to the next frame header, larger than any valid frame
+#define FLAC_MAX_SCAN_BYTES 65536
+
+static struct {
+    uint32_t image_id; // 0 if slot is unused
+    uint32_t last_used;
+    uint32_t count;
+    struct {
+        uint32_t sample;
+        uint32_t offset;
+    } entries[PLATFORM_FLAC_INDEX_SIZE];
+} g_flac_index[PLATFORM_FLAC_INDEX_COUNT];
+
+static flac_decoder_t g_flac_decoder;
+static uint32_t g_flac_image_counter;
+static uint32_t g_flac_use_counter;
+static uint32_t g_flac_max_decode_ms;
+
+// Hunk slot of the compressed image cache
+typedef struct {
+    uint32_t image_id; // 0 if slot is unused
+    uint32_t hunk;
+    uint32_t last_used;
+    uint8_t data[PLATFORM_ZCD_MAX_HUNK_BYTES + ZCD_INPLACE_MARGIN];
+} zcd_hunk_slot_t;
+
+#if PLATFORM_ZCD_HUNK_CACHE_SIZE < 2
+#error "PLATFORM_ZCD_HUNK_CACHE_SIZE must be at least 2"
+#endif
+
+// Used only by compressed images
+static struct {
+    zcd_hunk_slot_t hunk;
+
+    // The hunk map is read one SD card sector at a time
+    struct {
+        uint32_t image_id;
+        uint32_t first;
+        zcd_map_entry_t entries[SD_SECTOR_SIZE / sizeof(zcd_map_entry_t)];
+    } map;
+} g_zcd_cache;
+
+// Last decoded ECM sector, used when the request doesn't cover whole sectors
+static struct {
+    uint32_t image_id;
+    uint32_t in_pos;
+    uint8_t data[2352];
+} g_ecm_sector;
+
+// The other hunk slots and the FLAC frame are rarely needed at the same time,
+// so they share memory. FLAC playback always gets the buffer, compressed
+// images get it back only after no FLAC audio has been read for a while, so
+// that reads from another target don't flush a playing track.
+#define FLAC_DECODE_HOLD_MS 1000
+
+enum decode_owner_t { DECODE_NONE, DECODE_ZCD, DECODE_FLAC };
+
+static decode_owner_t g_decode_owner;
+static uint32_t g_flac_last_read;
+
+static union {
+    zcd_hunk_slot_t hunk[PLATFORM_ZCD_HUNK_CACHE_SIZE - 1];
+
+    struct {
+        uint32_t image_id;
+        uint32_t first_sample;
+        uint32_t samples;
+        uint32_t next_offset; // File position of the following frame
+        int16_t pcm[FLAC_MAX_BLOCKSIZE * 2];
+    } flac_frame;
+} g_decode;
+
+// Returns false if the shared buffer is in use by FLAC playback
+static bool claimDecodeBuffer(decode_owner_t owner)
+{
+    if (g_decode_owner == owner) return true;
+
+    if (owner == DECODE_ZCD)
+    {
+        if (g_decode_owner == DECODE_FLAC &&
+            (uint32_t)(millis() - g_flac_last_read) < FLAC_DECODE_HOLD_MS)
+        {
+            return false;
+        }
+
+        for (auto &entry : g_decode.hunk)
+        {
+            entry.image_id = 0;
+            entry.last_used = 0;
+        }
+    }
+    else if (owner == DECODE_FLAC)
+    {
+        g_decode.flac_frame.image_id = 0;
+        g_decode.flac_frame.first_sample = 0;
+        g_decode.flac_frame.samples = 0;
+    }
+
+    g_decode_owner = owner;
+    return true;
+}
+
+static zcd_hunk_slot_t *zcdHunkSlot(uint32_t idx)
+{
+    return (idx == 0) ? &g_zcd_cache.hunk : &g_decode.hunk[idx - 1];
+}
+
+static int flac_read_file(void *ctx, uint8_t *buf, uint32_t len)
+{
+    return ((FsFile*)ctx)->read(buf, len);
+}
+
+static bool flac_seek_file(void *ctx, uint32_t pos)
+{
+    return ((FsFile*)ctx)->seek(pos);
+}
+
+#endif
+
+static bool hasExtension(const char *filename, const char *ext)
+{
+    size_t len = strlen(filename);
+    size_t extlen = strlen(ext);
+    return len > extlen && strcasecmp(filename + len - extlen, ext) == 0;
+}
+
 ImageBackingStore::ImageBackingStore()
 {
     m_iscontiguous = false;
@@ -40,8 +230,29 @@ ImageBackingStore::ImageBackingStore()
     g_rawdrive_active = m_israw;
     m_isrom = false;
     m_isreadonly_attr = false;
+    m_istape = false;
     m_blockdev = nullptr;
     m_bgnsector = m_endsector = m_cursector = 0;
+    m_rangecached = false;
+    m_rangecheckpos = 0;
+    memset(&m_catalogkey, 0, sizeof(m_catalogkey));
+    m_iscompressed = false;
+    m_zcdid = 0;
+    m_zcdpos = 0;
+    m_isecm = false;
+    m_ecmid = 0;
+    m_ecmsize = 0;
+    m_ecmpos = 0;
+    memset(&m_ecmrec, 0, sizeof(m_ecmrec));
+    m_ispcm = false;
+    m_pcmswap = false;
+    m_pcmoffset = 0;
+    m_pcmsize = 0;
+    m_isflac = false;
+    m_flacid = 0;
+    m_flacsize = 0;
+    m_flacpos = 0;
+    memset(&m_flacinfo, 0, sizeof(m_flacinfo));
 }
 
 ImageBackingStore::ImageBackingStore(const char *filename, uint32_t scsi_block_size): ImageBackingStore()
@@ -87,6 +298,108 @@ ImageBackingStore::ImageBackingStore(const char *filename, uint32_t scsi_block_s
             m_isrom = true;
         }
     }
+#ifdef PLATFORM_HAS_COMPRESSED_IMAGES
+    else if (hasExtension(filename, ".zcd"))
+    {
+        m_isreadonly_attr = true;
+        m_fsfile = SD.open(filename, O_RDONLY);
+        if (m_fsfile.read(&m_zcdhdr, sizeof(m_zcdhdr)) != sizeof(m_zcdhdr) ||
+            !zcd_check_header(&m_zcdhdr) ||
+            m_zcdhdr.hunk_bytes > PLATFORM_ZCD_MAX_HUNK_BYTES)
+        {
+            logmsg("---- Unsupported compressed image format in ", filename);
+            m_fsfile.close();
+            return;
+        }
+
+        m_iscompressed = true;
+        m_zcdid = ++g_zcd_image_counter;
+        logmsg("---- Compressed image with ", (int)m_zcdhdr.hunk_count, " hunks of ", (int)m_zcdhdr.hunk_bytes, " bytes");
+    }
+    else if (hasExtension(filename, ".ecm"))
+    {
+        m_isreadonly_attr = true;
+        m_fsfile = SD.open(filename, O_RDONLY);
+
+        char magic[4];
+        if (m_fsfile.read(magic, 4) != 4 || memcmp(magic, "ECM\0", 4) != 0)
+        {
+            logmsg("---- Unsupported ECM image format in ", filename);
+            m_fsfile.close();
+            return;
+        }
+
+        // Index is built into least recently used slot
+        uint32_t slot = 0;
+        for (uint32_t i = 1; i < PLATFORM_ECM_INDEX_COUNT; i++)
+        {
+            if (g_ecm_index[i].last_used < g_ecm_index[slot].last_used) slot = i;
+        }
+
+        uint32_t start = millis();
+        m_isecm = true;
+        m_ecmid = ++g_ecm_image_counter;
+        if (!ecmBuildIndex(slot))
+        {
+            logmsg("---- Failed to parse ECM image ", filename);
+            m_isecm = false;
+            m_fsfile.close();
+            return;
+        }
+
+        logmsg("---- ECM image, decoded size ", (int)m_ecmsize, " bytes, indexed in ", (int)(millis() - start), " ms");
+    }
+    else if (hasExtension(filename, ".flac"))
+    {
+        m_isreadonly_attr = true;
+        m_fsfile = SD.open(filename, O_RDONLY);
+
+        flac_init(&g_flac_decoder, flac_read_file, flac_seek_file, &m_fsfile);
+        const flac_streaminfo_t &info = g_flac_decoder.info;
+        if (!flac_read_streaminfo(&g_flac_decoder) || !flac_is_supported(&info) ||
+            info.total_samples == 0 || info.total_samples >= 0x40000000)
+        {
+            logmsg("---- Unsupported FLAC format in ", filename, ", must be 44.1 kHz 16-bit stereo");
+            m_fsfile.close();
+            return;
+        }
+
+        m_isflac = true;
+        m_flacid = ++g_flac_image_counter;
+        m_flacinfo = info;
+        m_flacsize = (uint32_t)info.total_samples * 4;
+        logmsg("---- FLAC audio, decoded size ", (int)m_flacsize, " bytes, block size ", (int)info.max_blocksize);
+    }
+#endif
+    else if (hasExtension(filename, ".wav") || hasExtension(filename, ".aif") || hasExtension(filename, ".aiff"))
+    {
+        m_isreadonly_attr = true;
+        m_fsfile = SD.open(filename, O_RDONLY);
+        if (!pcmParseHeader())
+        {
+            logmsg("---- Unsupported audio format in ", filename, ", must be 44.1 kHz 16-bit stereo");
+            m_fsfile.close();
+            return;
+        }
+
+        m_ispcm = true;
+        m_fsfile.seek(m_pcmoffset);
+        logmsg("---- ", m_pcmswap ? "AIFF" : "WAVE", " audio, ", (int)m_pcmsize, " bytes of samples");
+    }
+    else if (hasExtension(filename, ".tap"))
+    {
+        m_istape = true;
+        m_isreadonly_attr = !!(FS_ATTRIB_READ_ONLY & SD.attrib(filename));
+        if (m_isreadonly_attr)
+        {
+            m_fsfile = SD.open(filename, O_RDONLY);
+            logmsg("---- Image file is read-only, writes disabled");
+        }
+        else
+        {
+            m_fsfile = SD.open(filename, O_RDWR);
+        }
+    }
     else
     {
         m_isreadonly_attr = !!(FS_ATTRIB_READ_ONLY & SD.attrib(filename));
@@ -102,7 +415,20 @@ ImageBackingStore::ImageBackingStore(const char *filename, uint32_t scsi_block_s
 
         uint32_t sectorcount = m_fsfile.size() / SD_SECTOR_SIZE;
         uint32_t begin = 0, end = 0;
-        if (m_fsfile.contiguousRange(&begin, &end) && end >= begin + sectorcount
+        bool contiguous;
+        bool has_key = bootCatalogMakeKey(m_fsfile, filename, &m_catalogkey);
+        if (has_key && bootCatalogLookup(m_catalogkey, &contiguous, &begin, &end))
+        {
+            // Cluster chain is checked later, when the SCSI bus is idle
+            m_rangecached = true;
+        }
+        else
+        {
+            contiguous = m_fsfile.contiguousRange(&begin, &end);
+            if (has_key) bootCatalogStore(m_catalogkey, contiguous, begin, end);
+        }
+
+        if (contiguous && end >= begin + sectorcount
             && (scsi_block_size % SD_SECTOR_SIZE) == 0)
         {
             // Convert to raw mapping, this avoids some unnecessary
@@ -158,11 +484,128 @@ bool ImageBackingStore::isRom()
 }
 
 
+// Number of clusters checked per call to revalidateRange().
+// One FAT sector holds 128 or 256 entries.
+#define RANGE_CHECK_CLUSTERS_PER_CALL 1024
+
+// Cluster chain of the image being checked is followed with a copy of its
+// file handle, so that the position of the image file is not disturbed.
+static struct {
+    const ImageBackingStore *owner;
+    FsFile file;
+    uint32_t first_cluster;
+} g_range_check;
+
+bool ImageBackingStore::revalidateRange()
+{
+    if (!m_rangecached) return false;
+
+    uint32_t begin = 0, end = 0;
+    if (SD.fatType() == FAT_TYPE_EXFAT)
+    {
+        // exFAT stores contiguity in the directory entry, nothing to walk
+        bool contiguous = m_fsfile.contiguousRange(&begin, &end);
+        finishRangeCheck(contiguous, begin, end);
+        return true;
+    }
+
+    if (g_range_check.owner != this || m_rangecheckpos == 0)
+    {
+        // Copy must not have unsaved directory changes, as closing it
+        // would write them.
+        m_fsfile.flush();
+        g_range_check.owner = this;
+        g_range_check.file = m_fsfile;
+        m_rangecheckpos = 0;
+    }
+
+    uint32_t cluster_bytes = SD.bytesPerCluster();
+    uint64_t filesize = g_range_check.file.size();
+    uint32_t last = (filesize > 0) ? (filesize - 1) / cluster_bytes : 0;
+    for (uint32_t i = 0; i < RANGE_CHECK_CLUSTERS_PER_CALL; i++)
+    {
+        // Seeking one byte past the cluster start follows the chain to it
+        uint32_t index = m_rangecheckpos;
+        if (!g_range_check.file.seek((uint64_t)index * cluster_bytes + 1))
+        {
+            finishRangeCheck(false, 0, 0);
+            return true;
+        }
+
+        uint32_t cluster = g_range_check.file.curCluster();
+        if (index == 0)
+        {
+            g_range_check.first_cluster = cluster;
+        }
+        else if (cluster != g_range_check.first_cluster + index)
+        {
+            finishRangeCheck(false, 0, 0);
+            return true;
+        }
+
+        if (index >= last)
+        {
+            // Contiguous up to end of file. The stored range may also cover
+            // clusters allocated past the end, those are checked with a full
+            // walk only if the image uses them.
+            begin = g_range_check.file.firstSector();
+            end = begin + (last + 1) * SD.sectorsPerCluster() - 1;
+            uint32_t stored_begin, stored_end;
+            bool stored_contiguous;
+            if (bootCatalogLookup(m_catalogkey, &stored_contiguous, &stored_begin, &stored_end) &&
+                stored_contiguous && stored_begin == begin && stored_end >= end &&
+                !(m_iscontiguous && m_endsector > end))
+            {
+                finishRangeCheck(true, stored_begin, stored_end);
+            }
+            else
+            {
+                bool contiguous = m_fsfile.contiguousRange(&begin, &end);
+                finishRangeCheck(contiguous, begin, end);
+            }
+            return true;
+        }
+
+        m_rangecheckpos++;
+    }
+
+    return true;
+}
+
+void ImageBackingStore::finishRangeCheck(bool contiguous, uint32_t begin, uint32_t end)
+{
+    m_rangecached = false;
+    m_rangecheckpos = 0;
+    if (g_range_check.owner == this)
+    {
+        g_range_check.owner = nullptr;
+        g_range_check.file = FsFile();
+    }
+
+    bootCatalogStore(m_catalogkey, contiguous, begin, end);
+
+    if (m_iscontiguous && (!contiguous || begin != m_bgnsector || end < m_endsector))
+    {
+        logmsg("WARNING: Stored sector range of image file was out of date, using slower file access");
+        m_iscontiguous = false;
+    }
+}
+
 bool ImageBackingStore::isContiguous()
 {
     return m_iscontiguous;
 }
 
+bool ImageBackingStore::isCompressed()
+{
+    return m_iscompressed || m_isecm || m_isflac || m_ispcm;
+}
+
+bool ImageBackingStore::isTape()
+{
+    return m_istape;
+}
+
 bool ImageBackingStore::close()
 {
     if (m_iscontiguous)
@@ -191,6 +634,22 @@ uint64_t ImageBackingStore::size()
     {
         return m_romhdr.imagesize;
     }
+    else if (m_iscompressed)
+    {
+        return m_zcdhdr.logical_size;
+    }
+    else if (m_isecm)
+    {
+        return m_ecmsize;
+    }
+    else if (m_isflac)
+    {
+        return m_flacsize;
+    }
+    else if (m_ispcm)
+    {
+        return m_pcmsize;
+    }
     else
     {
         return m_fsfile.size();
@@ -211,6 +670,10 @@ bool ImageBackingStore::contiguousRange(uint32_t* bgnSector, uint32_t* endSector
         *endSector = 0;
         return true;
     }
+    else if (isCompressed())
+    {
+        return false;
+    }
     else
     {
         return m_fsfile.contiguousRange(bgnSector, endSector);
@@ -239,6 +702,25 @@ bool ImageBackingStore::seek(uint64_t pos)
         m_cursector = sectornum;
         return m_cursector * SD_SECTOR_SIZE < m_romhdr.imagesize;
     }
+    else if (m_iscompressed)
+    {
+        m_zcdpos = pos;
+        return pos <= m_zcdhdr.logical_size;
+    }
+    else if (m_isecm)
+    {
+        m_ecmpos = pos;
+        return pos <= m_ecmsize;
+    }
+    else if (m_isflac)
+    {
+        m_flacpos = pos;
+        return pos <= m_flacsize;
+    }
+    else if (m_ispcm)
+    {
+        return pos <= m_pcmsize && m_fsfile.seek(m_pcmoffset + pos);
+    }
     else
     {
         return m_fsfile.seek(pos);
@@ -281,6 +763,22 @@ ssize_t ImageBackingStore::read(void* buf, size_t count)
             return -1;
         }
     }
+    else if (m_iscompressed)
+    {
+        return readCompressed((uint8_t*)buf, count);
+    }
+    else if (m_isecm)
+    {
+        return readEcm((uint8_t*)buf, count);
+    }
+    else if (m_isflac)
+    {
+        return readFlac((uint8_t*)buf, count);
+    }
+    else if (m_ispcm)
+    {
+        return readPcm((uint8_t*)buf, count);
+    }
     else
     {
         return m_fsfile.read(buf, count);
@@ -289,6 +787,20 @@ ssize_t ImageBackingStore::read(void* buf, size_t count)
 
 ssize_t ImageBackingStore::write(const void* buf, size_t count)
 {
+    if (m_rangecached && m_iscontiguous)
+    {
+        // Writing to raw sectors that no longer belong to the image would
+        // corrupt the filesystem, so finish the check first.
+        uint32_t begin = 0, end = 0;
+        bool contiguous = m_fsfile.contiguousRange(&begin, &end);
+        finishRangeCheck(contiguous, begin, end);
+
+        if (!m_iscontiguous && !m_fsfile.seek((uint64_t)(m_cursector - m_bgnsector) * SD_SECTOR_SIZE))
+        {
+            return 0;
+        }
+    }
+
     uint32_t sectorcount = count / SD_SECTOR_SIZE;
     if (m_iscontiguous && (uint64_t)sectorcount * SD_SECTOR_SIZE != count)
     {
@@ -332,9 +844,35 @@ void ImageBackingStore::flush()
     }
 }
 
+bool ImageBackingStore::truncate(uint64_t size)
+{
+    if (!m_istape || m_isreadonly_attr)
+    {
+        return false;
+    }
+
+    return m_fsfile.truncate(size);
+}
+
 uint64_t ImageBackingStore::position()
 {
-    if (!m_iscontiguous && !m_isrom)
+    if (m_iscompressed)
+    {
+        return m_zcdpos;
+    }
+    else if (m_isecm)
+    {
+        return m_ecmpos;
+    }
+    else if (m_isflac)
+    {
+        return m_flacpos;
+    }
+    else if (m_ispcm)
+    {
+        return m_fsfile.curPosition() - m_pcmoffset;
+    }
+    else if (!m_iscontiguous && !m_isrom)
     {
         return m_fsfile.curPosition();
     }
@@ -356,3 +894,694 @@ size_t ImageBackingStore::getFilename(char* buf, size_t buflen)
     }
     return 0;
 }
+
+static uint32_t get_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint32_t get_be32(const uint8_t *p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static uint16_t get_le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint16_t get_be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+bool ImageBackingStore::pcmParseHeader()
+{
+    uint8_t hdr[12];
+    if (!m_fsfile.seek(0) || m_fsfile.read(hdr, sizeof(hdr)) != sizeof(hdr))
+    {
+        return false;
+    }
+
+    bool aiff;
+    if (memcmp(hdr, "RIFF", 4) == 0 && memcmp(hdr + 8, "WAVE", 4) == 0)
+        aiff = false;
+    else if (memcmp(hdr, "FORM", 4) == 0 && memcmp(hdr + 8, "AIFF", 4) == 0)
+        aiff = true;
+    else
+        return false;
+
+    // 44100 as 80-bit extended precision float in AIFF COMM chunk
+    static const uint8_t aiff_rate_44100[10] = {0x40, 0x0E, 0xAC, 0x44, 0, 0, 0, 0, 0, 0};
+
+    // Chunks can be in any order, each is padded to even length
+    bool format_ok = false;
+    uint64_t file_size = m_fsfile.size();
+    uint64_t pos = sizeof(hdr);
+    while (pos + 8 <= file_size)
+    {
+        uint8_t chunk[8 + 18];
+        int len = (m_fsfile.seek(pos) ? m_fsfile.read(chunk, sizeof(chunk)) : -1);
+        if (len < 8) return false;
+
+        const uint8_t *data = chunk + 8;
+        uint32_t size = aiff ? get_be32(chunk + 4) : get_le32(chunk + 4);
+        if (!aiff && memcmp(chunk, "fmt ", 4) == 0 && len >= 8 + 16)
+        {
+            uint16_t tag = get_le16(data);
+            format_ok = (tag == 1 || tag == 0xFFFE) &&
+                        get_le16(data + 2) == 2 &&
+                        get_le32(data + 4) == 44100 &&
+                        get_le16(data + 14) == 16;
+        }
+        else if (!aiff && memcmp(chunk, "data", 4) == 0)
+        {
+            m_pcmoffset = pos + 8;
+            m_pcmsize = size;
+        }
+        else if (aiff && memcmp(chunk, "COMM", 4) == 0 && len >= 8 + 18)
+        {
+            format_ok = get_be16(data) == 2 &&
+                        get_be16(data + 6) == 16 &&
+                        memcmp(data + 8, aiff_rate_44100, 10) == 0;
+        }
+        else if (aiff && memcmp(chunk, "SSND", 4) == 0 && len >= 8 + 8)
+        {
+            uint32_t offset = get_be32(data);
+            if (size < 8 + offset) return false;
+            m_pcmoffset = pos + 16 + offset;
+            m_pcmsize = size - 8 - offset;
+        }
+
+        pos += 8 + (uint64_t)size + (size & 1);
+    }
+
+    if (!format_ok || m_pcmoffset == 0 || m_pcmoffset > file_size)
+    {
+        return false;
+    }
+
+    // Limit to whole samples in the file, the data size can be missing in streamed files
+    if (m_pcmsize > file_size - m_pcmoffset) m_pcmsize = file_size - m_pcmoffset;
+    m_pcmsize &= ~3;
+    m_pcmswap = aiff;
+    return true;
+}
+
+ssize_t ImageBackingStore::readPcm(uint8_t *buf, size_t count)
+{
+    uint32_t pos = m_fsfile.curPosition() - m_pcmoffset;
+    if (pos >= m_pcmsize) return 0;
+    if (count > m_pcmsize - pos) count = m_pcmsize - pos;
+    if (!m_pcmswap) return m_fsfile.read(buf, count);
+
+    // Big-endian samples are swapped in pairs of bytes, reading the other
+    // half of the first and last sample if the request starts or ends in the middle.
+    size_t done = 0;
+    uint8_t pair[2];
+    if (pos & 1)
+    {
+        if (!m_fsfile.seek(m_pcmoffset + pos - 1) || m_fsfile.read(pair, 2) != 2) return -1;
+        buf[done++] = pair[0];
+    }
+
+    size_t len = (count - done) & ~1;
+    if (len > 0)
+    {
+        if (m_fsfile.read(buf + done, len) != (int)len) return -1;
+        for (size_t i = done; i < done + len; i += 2)
+        {
+            uint8_t tmp = buf[i];
+            buf[i] = buf[i + 1];
+            buf[i + 1] = tmp;
+        }
+        done += len;
+    }
+
+    if (done < count)
+    {
+        uint32_t end = m_fsfile.curPosition();
+        if (m_fsfile.read(pair, 2) != 2 || !m_fsfile.seek(end + 1)) return -1;
+        buf[done++] = pair[1];
+    }
+
+    return done;
+}
+
+#ifdef PLATFORM_HAS_COMPRESSED_IMAGES
+
+const uint8_t *ImageBackingStore::getCompressedHunk(uint32_t hunk)
+{
+    uint32_t slots = claimDecodeBuffer(DECODE_ZCD) ? PLATFORM_ZCD_HUNK_CACHE_SIZE : 1;
+
+    zcd_hunk_slot_t *slot = zcdHunkSlot(0);
+    for (uint32_t i = 0; i < slots; i++)
+    {
+        zcd_hunk_slot_t *entry = zcdHunkSlot(i);
+        if (entry->image_id == m_zcdid && entry->hunk == hunk)
+        {
+            entry->last_used = ++g_zcd_use_counter;
+            return entry->data;
+        }
+
+        if (entry->last_used < slot->last_used)
+        {
+            slot = entry;
+        }
+    }
+
+    const uint32_t per_sector = sizeof(g_zcd_cache.map.entries) / sizeof(zcd_map_entry_t);
+    uint32_t first = hunk - hunk % per_sector;
+    if (g_zcd_cache.map.image_id != m_zcdid || g_zcd_cache.map.first != first)
+    {
+        uint32_t count = m_zcdhdr.hunk_count - first;
+        if (count > per_sector) count = per_sector;
+        uint32_t len = count * sizeof(zcd_map_entry_t);
+
+        g_zcd_cache.map.image_id = 0;
+        if (!m_fsfile.seek(m_zcdhdr.map_offset + (uint64_t)first * sizeof(zcd_map_entry_t)) ||
+            m_fsfile.read(g_zcd_cache.map.entries, len) != (int)len)
+        {
+            logmsg("Failed to read compressed image hunk map at ", (int)hunk);
+            return nullptr;
+        }
+
+        g_zcd_cache.map.image_id = m_zcdid;
+        g_zcd_cache.map.first = first;
+    }
+
+    const zcd_map_entry_t &entry = g_zcd_cache.map.entries[hunk - first];
+    uint32_t len = entry.length_codec & 0xFFFFFF;
+    uint8_t codec = entry.length_codec >> 24;
+    if (len > m_zcdhdr.hunk_bytes)
+    {
+        logmsg("Invalid compressed image hunk ", (int)hunk, " length ", (int)len);
+        return nullptr;
+    }
+
+    // Compressed data goes to end of the slot, leaving the margin needed for
+    // in-place decompression after the hunk.
+    slot->image_id = 0;
+    uint8_t *src = slot->data + m_zcdhdr.hunk_bytes + ZCD_INPLACE_MARGIN - len;
+    if (!m_fsfile.seek((uint64_t)entry.offset * 4) ||
+        m_fsfile.read(src, len) != (int)len ||
+        !zcd_decompress(codec, src, len, slot->data, m_zcdhdr.hunk_bytes))
+    {
+        logmsg("Failed to read compressed image hunk ", (int)hunk);
+        return nullptr;
+    }
+
+    slot->image_id = m_zcdid;
+    slot->hunk = hunk;
+    slot->last_used = ++g_zcd_use_counter;
+    return slot->data;
+}
+
+ssize_t ImageBackingStore::readCompressed(uint8_t *buf, size_t count)
+{
+    size_t done = 0;
+    while (done < count && m_zcdpos < m_zcdhdr.logical_size)
+    {
+        uint32_t hunk = m_zcdpos / m_zcdhdr.hunk_bytes;
+        uint32_t offset = m_zcdpos % m_zcdhdr.hunk_bytes;
+        const uint8_t *data = getCompressedHunk(hunk);
+        if (!data)
+        {
+            return -1;
+        }
+
+        uint32_t len = m_zcdhdr.hunk_bytes - offset;
+        if (len > count - done) len = count - done;
+        if (len > m_zcdhdr.logical_size - m_zcdpos) len = m_zcdhdr.logical_size - m_zcdpos;
+        memcpy(buf + done, data + offset, len);
+        done += len;
+        m_zcdpos += len;
+    }
+
+    return done;
+}
+
+bool ImageBackingStore::ecmParseRecord(uint32_t in_pos, uint32_t out_pos, ecm_record_t *rec)
+{
+    uint8_t hdr[5];
+    if (!m_fsfile.seek(in_pos) || m_fsfile.read(hdr, 1) != 1)
+    {
+        return false;
+    }
+
+    // Count is stored minus one, 5 bits in first byte and 7 bits in the following ones
+    uint8_t type = hdr[0] & 3;
+    uint32_t num = (hdr[0] >> 2) & 0x1F;
+    uint32_t len = 1;
+    int bits = 5;
+    while (hdr[len - 1] & 0x80)
+    {
+        if (len >= sizeof(hdr) || m_fsfile.read(&hdr[len], 1) != 1)
+        {
+            return false;
+        }
+
+        num |= (uint32_t)(hdr[len] & 0x7F) << bits;
+        bits += 7;
+        len++;
+    }
+
+    rec->out_start = out_pos;
+    rec->in_data = in_pos + len;
+    if (num == 0xFFFFFFFF)
+    {
+        rec->type = ECM_END;
+        rec->out_end = out_pos;
+        rec->in_next = rec->in_data;
+        return true;
+    }
+
+    uint64_t in_len = (uint64_t)(num + 1) * g_ecm_in_size[type];
+    uint64_t out_end = out_pos + (uint64_t)(num + 1) * g_ecm_out_size[type];
+    if (num >= 0x7FFFFFFF || rec->in_data + in_len > m_fsfile.size() || out_end > 0xFFFFFFFF)
+    {
+        return false;
+    }
+
+    rec->type = type;
+    rec->out_end = (uint32_t)out_end;
+    rec->in_next = rec->in_data + (uint32_t)in_len;
+    return true;
+}
+
+bool ImageBackingStore::ecmBuildIndex(uint32_t slot)
+{
+    auto &index = g_ecm_index[slot];
+    index.image_id = 0;
+    index.last_used = ++g_ecm_use_counter;
+    index.stride = 2352;
+    index.count = 0;
+
+    ecm_record_t rec = {};
+    uint32_t in_pos = 4;
+    uint32_t out_pos = 0;
+    while (ecmParseRecord(in_pos, out_pos, &rec) && rec.type != ECM_END)
+    {
+        // When the index gets full, double the spacing and drop entries that are too close
+        while (index.count == PLATFORM_ECM_INDEX_SIZE)
+        {
+            index.stride *= 2;
+            uint32_t kept = 1;
+            for (uint32_t i = 1; i < index.count; i++)
+            {
+                if (index.entries[i].out_pos - index.entries[kept - 1].out_pos >= index.stride)
+                {
+                    index.entries[kept++] = index.entries[i];
+                }
+            }
+            index.count = kept;
+        }
+
+        if (index.count == 0 || out_pos - index.entries[index.count - 1].out_pos >= index.stride)
+        {
+            index.entries[index.count].out_pos = out_pos;
+            index.entries[index.count].in_pos = in_pos;
+            index.count++;
+        }
+
+        in_pos = rec.in_next;
+        out_pos = rec.out_end;
+    }
+
+    if (rec.type != ECM_END || index.count == 0 || (m_ecmsize != 0 && m_ecmsize != out_pos))
+    {
+        return false;
+    }
+
+    m_ecmsize = out_pos;
+    m_ecmrec = rec;
+    index.image_id = m_ecmid;
+    return true;
+}
+
+bool ImageBackingStore::ecmLocate(uint32_t pos)
+{
+    if (pos >= m_ecmrec.out_start && pos < m_ecmrec.out_end)
+    {
+        return true;
+    }
+
+    uint32_t slot = 0;
+    for (uint32_t i = 0; i < PLATFORM_ECM_INDEX_COUNT; i++)
+    {
+        if (g_ecm_index[i].image_id == m_ecmid)
+        {
+            slot = i;
+            break;
+        }
+        else if (g_ecm_index[i].last_used < g_ecm_index[slot].last_used)
+        {
+            slot = i;
+        }
+    }
+
+    auto &index = g_ecm_index[slot];
+    if (index.image_id != m_ecmid)
+    {
+        dbgmsg("---- Rebuilding index for ECM image");
+        if (!ecmBuildIndex(slot)) return false;
+    }
+    index.last_used = ++g_ecm_use_counter;
+
+    // Find last index entry before the position
+    uint32_t low = 0, high = index.count;
+    while (high - low > 1)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (index.entries[mid].out_pos <= pos) low = mid; else high = mid;
+    }
+
+    // Sequential access continues from the current record if it is closer
+    ecm_record_t rec = m_ecmrec;
+    if (pos < rec.out_start || rec.out_start < index.entries[low].out_pos || rec.type == ECM_END)
+    {
+        if (!ecmParseRecord(index.entries[low].in_pos, index.entries[low].out_pos, &rec)) return false;
+    }
+
+    while (pos >= rec.out_end)
+    {
+        if (rec.type == ECM_END || !ecmParseRecord(rec.in_next, rec.out_end, &rec)) return false;
+    }
+
+    m_ecmrec = rec;
+    return true;
+}
+
+// Regenerate the fields that ECM has removed from a sector.
+// The stored data must be at the position it was taken from.
+static void ecm_decode_sector(uint8_t type, uint8_t *sector)
+{
+    if (type == ECM_MODE1)
+    {
+        // Address is followed by the user data, with the mode byte removed
+        memmove(sector + 16, sector + 15, 2048);
+        sector[0] = 0;
+        memset(sector + 1, 0xFF, 10);
+        sector[11] = 0;
+        sector[15] = 1;
+        cdecc_generate_mode1(sector);
+    }
+    else
+    {
+        // Subheader is stored only once and the header is not stored at all
+        memcpy(sector + 16, sector + 20, 4);
+        memset(sector + 12, 0, 4);
+        if (type == ECM_MODE2_FORM1)
+            cdecc_generate_mode2_form1(sector);
+        else
+            cdecc_generate_mode2_form2(sector);
+    }
+}
+
+ssize_t ImageBackingStore::readEcm(uint8_t *buf, size_t count)
+{
+    size_t done = 0;
+    while (done < count && m_ecmpos < m_ecmsize)
+    {
+        if (!ecmLocate(m_ecmpos))
+        {
+            logmsg("Failed to parse ECM image at position ", (int)m_ecmpos);
+            return -1;
+        }
+
+        uint32_t offset = m_ecmpos - m_ecmrec.out_start;
+        uint32_t len = m_ecmrec.out_end - m_ecmpos;
+        if (len > count - done) len = count - done;
+
+        if (m_ecmrec.type == ECM_LITERAL)
+        {
+            if (!m_fsfile.seek(m_ecmrec.in_data + offset) ||
+                m_fsfile.read(buf + done, len) != (int)len)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            uint8_t type = m_ecmrec.type;
+            uint32_t in_size = g_ecm_in_size[type];
+            uint32_t out_size = g_ecm_out_size[type];
+            uint32_t in_offset = (type == ECM_MODE1) ? 12 : 20;
+            uint32_t out_offset = 2352 - out_size;
+            uint32_t sector = offset / out_size;
+            uint32_t skip = offset % out_size;
+            uint32_t in_pos = m_ecmrec.in_data + sector * in_size;
+
+            if (skip == 0 && len >= out_size)
+            {
+                // Read the stored data for whole sectors to end of the destination buffer
+                // and decode them in order. Decoded data is larger, so it never overwrites
+                // the stored data of the following sectors.
+                uint32_t sectors = len / out_size;
+                len = sectors * out_size;
+                uint8_t *src = buf + done + len - sectors * in_size;
+                if (!m_fsfile.seek(in_pos) ||
+                    m_fsfile.read(src, sectors * in_size) != (int)(sectors * in_size))
+                {
+                    return -1;
+                }
+
+                g_ecm_sector.image_id = 0;
+                for (uint32_t i = 0; i < sectors; i++)
+                {
+                    memcpy(g_ecm_sector.data + in_offset, src + i * in_size, in_size);
+                    ecm_decode_sector(type, g_ecm_sector.data);
+                    memcpy(buf + done + i * out_size, g_ecm_sector.data + out_offset, out_size);
+                }
+            }
+            else
+            {
+                if (g_ecm_sector.image_id != m_ecmid || g_ecm_sector.in_pos != in_pos)
+                {
+                    g_ecm_sector.image_id = 0;
+                    if (!m_fsfile.seek(in_pos) ||
+                        m_fsfile.read(g_ecm_sector.data + in_offset, in_size) != (int)in_size)
+                    {
+                        return -1;
+                    }
+
+                    ecm_decode_sector(type, g_ecm_sector.data);
+                    g_ecm_sector.image_id = m_ecmid;
+                    g_ecm_sector.in_pos = in_pos;
+                }
+
+                if (len > out_size - skip) len = out_size - skip;
+                memcpy(buf + done, g_ecm_sector.data + out_offset + skip, len);
+            }
+        }
+
+        done += len;
+        m_ecmpos += len;
+    }
+
+    return done;
+}
+
+bool ImageBackingStore::flacBuildIndex(uint32_t slot)
+{
+    auto &index = g_flac_index[slot];
+    index.image_id = 0;
+    index.last_used = ++g_flac_use_counter;
+    index.count = 1;
+    index.entries[0].sample = 0;
+    index.entries[0].offset = m_flacinfo.first_frame;
+
+    flac_decoder_t *dec = &g_flac_decoder;
+    flac_init(dec, flac_read_file, flac_seek_file, &m_fsfile);
+    dec->info = m_flacinfo;
+
+    // Probe at evenly spaced file positions. Frames have the nominal block
+    // size except the last one, which helps to reject false sync codes.
+    uint32_t first = m_flacinfo.first_frame;
+    uint32_t span = m_fsfile.size() - first;
+    for (uint32_t i = 1; i < PLATFORM_FLAC_INDEX_SIZE; i++)
+    {
+        uint32_t probe = first + (uint64_t)span * i / PLATFORM_FLAC_INDEX_SIZE;
+        auto &prev = index.entries[index.count - 1];
+        if (probe <= prev.offset) continue;
+
+        flac_frame_t frame;
+        if (!flac_seek(dec, probe) || !flac_find_frame(dec, FLAC_MAX_SCAN_BYTES, &frame))
+        {
+            break;
+        }
+
+        if (frame.first_sample > prev.sample &&
+            (frame.blocksize == m_flacinfo.max_blocksize ||
+             frame.first_sample + frame.blocksize == m_flacinfo.total_samples))
+        {
+            index.entries[index.count].sample = frame.first_sample;
+            index.entries[index.count].offset = frame.offset;
+            index.count++;
+        }
+    }
+
+    index.image_id = m_flacid;
+    return true;
+}
+
+bool ImageBackingStore::flacDecodeFrame(uint32_t sample)
+{
+    uint32_t slot = 0;
+    for (uint32_t i = 0; i < PLATFORM_FLAC_INDEX_COUNT; i++)
+    {
+        if (g_flac_index[i].image_id == m_flacid)
+        {
+            slot = i;
+            break;
+        }
+        else if (g_flac_index[i].last_used < g_flac_index[slot].last_used)
+        {
+            slot = i;
+        }
+    }
+
+    auto &index = g_flac_index[slot];
+    if (index.image_id != m_flacid)
+    {
+        uint32_t start = millis();
+        if (!flacBuildIndex(slot)) return false;
+        dbgmsg("---- Built FLAC index with ", (int)index.count, " entries in ", (int)(millis() - start), " ms");
+    }
+    index.last_used = ++g_flac_use_counter;
+
+    // Find last index entry before the sample
+    uint32_t low = 0, high = index.count;
+    while (high - low > 1)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (index.entries[mid].sample <= sample) low = mid; else high = mid;
+    }
+
+    uint32_t expected = index.entries[low].sample;
+    uint32_t offset = index.entries[low].offset;
+
+    // Sequential access continues from the previous frame if it is closer
+    uint32_t next_sample = g_decode.flac_frame.first_sample + g_decode.flac_frame.samples;
+    if (g_decode.flac_frame.image_id == m_flacid && sample >= next_sample && next_sample > expected)
+    {
+        expected = next_sample;
+        offset = g_decode.flac_frame.next_offset;
+    }
+
+    flac_decoder_t *dec = &g_flac_decoder;
+    flac_init(dec, flac_read_file, flac_seek_file, &m_fsfile);
+    dec->info = m_flacinfo;
+    if (!flac_seek(dec, offset)) return false;
+
+    // Skip frames by scanning for headers, only the frame containing the
+    // sample needs to be decoded. Sync codes inside frame data are
+    // recognized by the sample number not following the previous frame.
+    flac_frame_t frame;
+    while (true)
+    {
+        if (!flac_find_frame(dec, FLAC_MAX_SCAN_BYTES, &frame)) return false;
+
+        if (frame.first_sample != expected)
+        {
+            flac_skip(dec, 1);
+        }
+        else if (sample >= expected + frame.blocksize)
+        {
+            expected += frame.blocksize;
+            flac_skip(dec, 2);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    uint32_t start = millis();
+    g_decode.flac_frame.image_id = 0;
+    if (!flac_decode_frame(dec, g_decode.flac_frame.pcm, &frame)) return false;
+
+    // Audio playback decodes in the main loop, so a frame must take clearly
+    // less time to decode than to play.
+    uint32_t elapsed = millis() - start;
+    if (elapsed > g_flac_max_decode_ms)
+    {
+        g_flac_max_decode_ms = elapsed;
+        uint32_t duration = frame.blocksize * 1000 / 44100;
+        if (elapsed > duration / 2)
+        {
+            logmsg("WARNING: FLAC frame of ", (int)duration, " ms took ", (int)elapsed, " ms to decode");
+        }
+    }
+
+    g_decode.flac_frame.image_id = m_flacid;
+    g_decode.flac_frame.first_sample = frame.first_sample;
+    g_decode.flac_frame.samples = frame.blocksize;
+    g_decode.flac_frame.next_offset = flac_position(dec);
+    return true;
+}
+
+ssize_t ImageBackingStore::readFlac(uint8_t *buf, size_t count)
+{
+    claimDecodeBuffer(DECODE_FLAC);
+    g_flac_last_read = millis();
+
+    size_t done = 0;
+    while (done < count && m_flacpos < m_flacsize)
+    {
+        uint32_t sample = m_flacpos / 4;
+        if (g_decode.flac_frame.image_id != m_flacid ||
+            sample < g_decode.flac_frame.first_sample ||
+            sample >= g_decode.flac_frame.first_sample + g_decode.flac_frame.samples)
+        {
+            if (!flacDecodeFrame(sample))
+            {
+                logmsg("Failed to decode FLAC audio at sample ", (int)sample);
+                return -1;
+            }
+        }
+
+        uint32_t offset = m_flacpos - g_decode.flac_frame.first_sample * 4;
+        uint32_t len = g_decode.flac_frame.samples * 4 - offset;
+        if (len > count - done) len = count - done;
+        memcpy(buf + done, (const uint8_t*)g_decode.flac_frame.pcm + offset, len);
+        done += len;
+        m_flacpos += len;
+    }
+
+    return done;
+}
+
+#else
+
+const uint8_t *ImageBackingStore::getCompressedHunk(uint32_t hunk)
+{
+    return nullptr;
+}
+
+ssize_t ImageBackingStore::readCompressed(uint8_t *buf, size_t count)
+{
+    return -1;
+}
+
+bool ImageBackingStore::ecmParseRecord(uint32_t in_pos, uint32_t out_pos, ecm_record_t *rec)
+{
+    return false;
+}
+
+bool ImageBackingStore::ecmBuildIndex(uint32_t slot)
+{
+    return false;
+}
+
+bool ImageBackingStore::ecmLocate(uint32_t pos)
+{
+    return false;
+}
+
+ssize_t ImageBackingStore::readEcm(uint8_t *buf, size_t count)
+{
+    return -1;
+}
+
+bool ImageBackingStore::flacBuildIndex(uint32_t slot)
+{
+    return false;
+}
+
+bool ImageBackingStore::flacDecodeFrame(uint32_t sample)
+{
+    return false;
+}
+
+ssize_t ImageBackingStore::readFlac(uint8_t *buf, size_t count)
+{
+    return -1;
+}
+
+#endif
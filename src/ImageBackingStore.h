@@ -33,6 +33,9 @@
 #include <unistd.h>
 #include <SdFat.h>
 #include "ROMDrive.h"
+#include "ZuluSCSI_bootcatalog.h"
+#include <ZCD.h>
+#include <FLACDecoder.h>
 
 extern "C" {
 #include <scsi.h>
@@ -42,6 +45,16 @@ extern "C" {
 extern SdFs SD;
 #define SD_SECTOR_SIZE 512
 
+// Run of data with the same encoding in ECM image.
+// Positions are in bytes, out_* in the decoded image and in_* in the ECM file.
+typedef struct {
+    uint32_t out_start;
+    uint32_t out_end;
+    uint32_t in_data;
+    uint32_t in_next;
+    uint8_t type;
+} ecm_record_t;
+
 // This class wraps SdFat library FsFile to allow access
 // through either FAT filesystem or as a raw sector range.
 //
@@ -50,6 +63,18 @@ extern SdFs SD;
 //
 // If the platform supports a ROM drive, it is activated by using
 // filename "ROM:".
+//
+// If the platform supports compressed images, files with .zcd extension
+// are accessed read-only through a cache of decompressed hunks.
+// Files with .ecm extension have the sync, header, EDC and ECC fields
+// regenerated on the fly. Files with .flac extension are decoded to
+// raw audio samples.
+//
+// Audio files with .wav, .aif or .aiff extension are accessed read-only
+// as raw little-endian samples, skipping the file header.
+//
+// Tape container files with .tap extension are always accessed through
+// the filesystem, as they grow and shrink when written.
 class ImageBackingStore
 {
 public:
@@ -77,6 +102,12 @@ public:
     // Is this a contigious block on the SD card? Allowing less overhead
     bool isContiguous();
 
+    // Is this a compressed, ECM or audio file that is decoded when read?
+    bool isCompressed();
+
+    // Is this a tape container of variable length records?
+    bool isTape();
+
     // Close the image so that .isOpen() will return false.
     bool close();
 
@@ -87,6 +118,12 @@ public:
     // SD card, return the sector numbers.
     bool contiguousRange(uint32_t* bgnSector, uint32_t* endSector);
 
+    // If the sector range was taken from the boot catalog, check it against
+    // the file cluster chain. Falls back to file access if it doesn't match.
+    // Each call checks a limited number of clusters, so that it can run
+    // between SCSI commands. Returns false if there was nothing to check.
+    bool revalidateRange();
+
     // Set current position for following read/write operations
     bool seek(uint64_t pos);
 
@@ -99,6 +136,9 @@ public:
     // Flush any pending changes to filesystem
     void flush();
 
+    // Set the size of image file, only supported for tape containers
+    bool truncate(uint64_t size);
+
     // Gets current position for following read/write operations
     // Result is only valid for regular files, not raw or flash access
     uint64_t position();
@@ -110,10 +150,80 @@ protected:
     bool m_israw;
     bool m_isrom;
     bool m_isreadonly_attr;
+    bool m_istape;
     romdrive_hdr_t m_romhdr;
     FsFile m_fsfile;
     SdCard *m_blockdev;
     uint32_t m_bgnsector;
     uint32_t m_endsector;
     uint32_t m_cursector;
+
+    // Sector range was taken from the boot catalog and has not been checked.
+    // Writes are not done to raw sectors until the check has finished.
+    // m_rangecheckpos is the next cluster to check in the background.
+    bool m_rangecached;
+    uint32_t m_rangecheckpos;
+    boot_catalog_key_t m_catalogkey;
+
+    // Store result of cluster chain check to the boot catalog and fall
+    // back to file access if the cached range was wrong.
+    void finishRangeCheck(bool contiguous, uint32_t begin, uint32_t end);
+
+    // Compressed image state, m_zcdid identifies the image in hunk cache
+    bool m_iscompressed;
+    zcd_header_t m_zcdhdr;
+    uint32_t m_zcdid;
+    uint64_t m_zcdpos;
+
+    // Get decompressed hunk data from cache, loading it if needed.
+    const uint8_t *getCompressedHunk(uint32_t hunk);
+
+    ssize_t readCompressed(uint8_t *buf, size_t count);
+
+    // ECM image state, m_ecmid identifies the image in index cache.
+    // m_ecmrec is the record containing the last accessed position.
+    bool m_isecm;
+    uint32_t m_ecmid;
+    uint32_t m_ecmsize;
+    uint64_t m_ecmpos;
+    ecm_record_t m_ecmrec;
+
+    // Parse record header at in_pos, returns false on read error.
+    bool ecmParseRecord(uint32_t in_pos, uint32_t out_pos, ecm_record_t *rec);
+
+    // Scan through the ECM file to build the index of record positions
+    // and to find the decoded size.
+    bool ecmBuildIndex(uint32_t slot);
+
+    // Set m_ecmrec to the record containing decoded position pos
+    bool ecmLocate(uint32_t pos);
+
+    ssize_t readEcm(uint8_t *buf, size_t count);
+
+    // WAVE or AIFF audio file state. Samples are at m_pcmoffset in file,
+    // m_pcmswap is set for the big-endian samples of AIFF.
+    bool m_ispcm;
+    bool m_pcmswap;
+    uint32_t m_pcmoffset;
+    uint32_t m_pcmsize;
+
+    // Find the sample data, returns false if the format is not CD audio
+    bool pcmParseHeader();
+
+    ssize_t readPcm(uint8_t *buf, size_t count);
+
+    // FLAC audio file state, m_flacid identifies the file in frame cache and index.
+    bool m_isflac;
+    uint32_t m_flacid;
+    uint32_t m_flacsize;
+    uint64_t m_flacpos;
+    flac_streaminfo_t m_flacinfo;
+
+    // Scan through the FLAC file to build an index of frame positions
+    bool flacBuildIndex(uint32_t slot);
+
+    // Decode the frame containing the sample to the shared frame buffer
+    bool flacDecodeFrame(uint32_t sample);
+
+    ssize_t readFlac(uint8_t *buf, size_t count);
 };
@@ -0,0 +1,370 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "ImageCatalog.h"
+#include "ZuluSCSI_disk.h"
+#include "ZuluSCSI_log.h"
+#include "ZuluSCSI_config.h"
+#include <string.h>
+#include <strings.h>
+
+extern SdFs SD;
+
+struct image_catalog_entry_t
+{
+    uint32_t dir_index;
+    char key[IMAGE_CATALOG_KEY_LEN]; // Start of file name, zero padded
+};
+
+struct image_catalog_t
+{
+    char dirname[MAX_FILE_PATH]; // Empty if slot is unused
+    uint32_t dir_hash;
+    uint32_t last_used;
+    int count; // -1 if directory has too many images
+    image_catalog_entry_t entries[PLATFORM_IMAGE_CATALOG_SIZE];
+};
+
+static image_catalog_t g_image_catalogs[PLATFORM_IMAGE_CATALOG_COUNT];
+static uint32_t g_image_catalog_use_counter;
+
+ImageCatalog::ImageCatalog()
+{
+    m_catalog = nullptr;
+}
+
+ImageCatalog::~ImageCatalog()
+{
+    close();
+}
+
+bool ImageCatalog::open(const char *dirname)
+{
+    close();
+
+    if (dirname[0] == '\0' || strlen(dirname) >= MAX_FILE_PATH)
+    {
+        return false;
+    }
+
+    if (!m_dir.open(dirname) || !m_dir.isDir() || m_dir.isHidden())
+    {
+        m_dir.close();
+        return false;
+    }
+
+    uint32_t dir_hash = hashDirectory();
+
+    image_catalog_t *catalog = nullptr;
+    for (int i = 0; i < PLATFORM_IMAGE_CATALOG_COUNT; i++)
+    {
+        if (strcmp(g_image_catalogs[i].dirname, dirname) == 0)
+        {
+            catalog = &g_image_catalogs[i];
+            break;
+        }
+    }
+
+    if (!catalog)
+    {
+        // Replace the least recently used catalog
+        catalog = &g_image_catalogs[0];
+        for (int i = 1; i < PLATFORM_IMAGE_CATALOG_COUNT; i++)
+        {
+            if (g_image_catalogs[i].last_used < catalog->last_used)
+            {
+                catalog = &g_image_catalogs[i];
+            }
+        }
+        catalog->dirname[0] = '\0';
+    }
+
+    m_catalog = catalog;
+    catalog->last_used = ++g_image_catalog_use_counter;
+
+    if (catalog->dirname[0] == '\0' || catalog->dir_hash != dir_hash)
+    {
+        strcpy(catalog->dirname, dirname);
+        catalog->dir_hash = dir_hash;
+        build();
+    }
+
+    if (catalog->count < 0)
+    {
+        // Too many images, caller falls back to scanning the directory
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void ImageCatalog::close()
+{
+    m_dir.close();
+    m_catalog = nullptr;
+}
+
+int ImageCatalog::count() const
+{
+    return m_catalog ? m_catalog->count : 0;
+}
+
+void ImageCatalog::clearAll()
+{
+    for (int i = 0; i < PLATFORM_IMAGE_CATALOG_COUNT; i++)
+    {
+        g_image_catalogs[i].dirname[0] = '\0';
+        g_image_catalogs[i].count = 0;
+    }
+}
+
+// Hash of the directory entries that identify files: position, name and the
+// hidden and directory attributes. FAT directories have no size and hosts
+// don't update the directory modification time when adding files, so the
+// entries are read directly. This is much faster than opening each file.
+// Timestamps and sizes are left out, so writing to an image doesn't cause
+// a rebuild.
+uint32_t ImageCatalog::hashDirectory()
+{
+    bool exfat = (SD.fatType() == FAT_TYPE_EXFAT);
+    uint32_t hash = 2166136261UL;
+    uint8_t entry[FS_DIR_SIZE];
+
+    m_dir.rewindDirectory();
+    for (uint32_t index = 0; m_dir.read(entry, sizeof(entry)) == (int)sizeof(entry); index++)
+    {
+        uint32_t len;
+        if (entry[0] == FAT_NAME_FREE)
+        {
+            // End of directory, same value for FAT and exFAT
+            break;
+        }
+        else if (exfat)
+        {
+            if (!(entry[0] & EXFAT_TYPE_USED)) continue;
+
+            if (entry[0] == EXFAT_TYPE_NAME)
+            {
+                len = sizeof(entry);
+            }
+            else if (entry[0] == EXFAT_TYPE_FILE)
+            {
+                entry[1] = ((DirFile_t*)entry)->attributes[0] & (FS_ATTRIB_DIRECTORY | FS_ATTRIB_HIDDEN);
+                len = 2;
+            }
+            else
+            {
+                len = 1;
+            }
+        }
+        else
+        {
+            if (entry[0] == FAT_NAME_DELETED) continue;
+
+            DirFat_t *dir = (DirFat_t*)entry;
+            if (dir->attributes == FAT_ATTRIB_LONG_NAME)
+            {
+                len = sizeof(entry);
+            }
+            else
+            {
+                dir->attributes &= FS_ATTRIB_DIRECTORY | FS_ATTRIB_HIDDEN;
+                len = sizeof(dir->name) + 1;
+            }
+        }
+
+        // FNV-1a hash of the entry index and data
+        for (int i = 0; i < 4; i++)
+        {
+            hash = (hash ^ (uint8_t)(index >> (i * 8))) * 16777619UL;
+        }
+        for (uint32_t i = 0; i < len; i++)
+        {
+            hash = (hash ^ entry[i]) * 16777619UL;
+        }
+    }
+
+    return hash;
+}
+
+// Reads the directory and inserts the valid image names in sorted order
+bool ImageCatalog::build()
+{
+    image_catalog_t *catalog = m_catalog;
+    uint32_t start = millis();
+    char name[MAX_FILE_PATH];
+    FsFile file;
+
+    catalog->count = 0;
+    m_dir.rewindDirectory();
+    while (file.openNext(&m_dir, O_RDONLY))
+    {
+        bool valid = !file.isDir() && file.getName(name, sizeof(name)) && scsiDiskFilenameValid(name);
+        bool hidden = file.isHidden();
+        uint32_t dir_index = file.dirIndex();
+        file.close();
+
+        if (!valid) continue;
+        if (hidden)
+        {
+            logmsg("Image '", catalog->dirname, "/", name, "' is hidden, skipping file");
+            continue;
+        }
+
+        if (catalog->count >= PLATFORM_IMAGE_CATALOG_SIZE)
+        {
+            logmsg("Image directory '", catalog->dirname, "' has more than ",
+                   (int)PLATFORM_IMAGE_CATALOG_SIZE, " images, searching it without catalog");
+            catalog->count = -1;
+            return false;
+        }
+
+        // Binary search for the position after any equal names
+        int lo = 0;
+        int hi = catalog->count;
+        while (lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            if (compareEntry(mid, name) <= 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        memmove(&catalog->entries[lo + 1], &catalog->entries[lo],
+                (catalog->count - lo) * sizeof(image_catalog_entry_t));
+        image_catalog_entry_t &entry = catalog->entries[lo];
+        entry.dir_index = dir_index;
+        memset(entry.key, 0, sizeof(entry.key));
+        strncpy(entry.key, name, sizeof(entry.key));
+        catalog->count++;
+    }
+
+    dbgmsg("Cataloged ", catalog->count, " images in '", catalog->dirname, "' in ",
+           (int)(millis() - start), " ms");
+    return true;
+}
+
+// Compares the name of a catalog entry to the given name like strcasecmp().
+// The full entry name is read from the directory only if the stored key
+// matches. The directory position is kept, so this works while iterating it.
+int ImageCatalog::compareEntry(int index, const char *name)
+{
+    const image_catalog_entry_t &entry = m_catalog->entries[index];
+    int result = strncasecmp(entry.key, name, IMAGE_CATALOG_KEY_LEN);
+    if (result != 0 || entry.key[IMAGE_CATALOG_KEY_LEN - 1] == '\0')
+    {
+        return result;
+    }
+
+    char entry_name[MAX_FILE_PATH];
+    uint64_t pos = m_dir.curPosition();
+    FsFile file;
+    bool ok = file.open(&m_dir, entry.dir_index, O_RDONLY) && file.getName(entry_name, sizeof(entry_name));
+    file.close();
+    m_dir.seekSet(pos);
+
+    return ok ? strcasecmp(entry_name, name) : result;
+}
+
+int ImageCatalog::getName(int index, char *buf, size_t buflen, uint64_t *size)
+{
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (!m_catalog || index < 0 || index >= m_catalog->count)
+        {
+            return 0;
+        }
+
+        const image_catalog_entry_t &entry = m_catalog->entries[index];
+        char name[MAX_FILE_PATH];
+        FsFile file;
+        bool ok = file.open(&m_dir, entry.dir_index, O_RDONLY) && !file.isDir() &&
+                  file.getName(name, sizeof(name)) &&
+                  strncmp(name, entry.key, IMAGE_CATALOG_KEY_LEN) == 0;
+        if (size) *size = file.fileSize();
+        file.close();
+
+        if (ok)
+        {
+            size_t len = strlen(name);
+            if (len >= buflen) return 0;
+            memcpy(buf, name, len + 1);
+            return len;
+        }
+
+        // Entry was changed in a way that doesn't show in the hash
+        dbgmsg("Image catalog of '", m_catalog->dirname, "' is out of date, rebuilding");
+        if (!build())
+        {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+int ImageCatalog::findNext(const char *name, bool use_prefix)
+{
+    int count = this->count();
+    if (count <= 0)
+    {
+        return -1;
+    }
+
+    int lo = 0;
+    if (name[0] != '\0')
+    {
+        int hi = count;
+        while (lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            if (compareEntry(mid, name) <= 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+
+    if (!use_prefix)
+    {
+        return (lo < count) ? lo : 0;
+    }
+
+    // Prefix is the start of the SCSI ID specific file name, such as "cd3"
+    if (strlen(name) < 3)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        int index = (lo + i) % count;
+        const char *key = m_catalog->entries[index].key;
+        if (strnlen(key, 3) == 3 && strncasecmp(key, name, 3) == 0)
+        {
+            return index;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,92 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+/* Sorted catalog of the image files in an image directory.
+ *
+ * Switching to the next image used to scan the whole directory, which takes
+ * seconds with hundreds of images. The catalog keeps the directory entry
+ * index and the start of the name of each image in RAM, sorted by name.
+ * Images are then found with a binary search and opened by their index.
+ *
+ * The catalog is rebuilt when a hash of the file names and positions in the
+ * directory changes, or when an entry no longer matches the catalog.
+ * A few catalogs are cached, all are dropped when the SD card is remounted.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <SdFat.h>
+#include "ZuluSCSI_platform.h"
+
+// Maximum number of images in a cataloged directory.
+// Larger directories are scanned like before.
+#ifndef PLATFORM_IMAGE_CATALOG_SIZE
+#define PLATFORM_IMAGE_CATALOG_SIZE 256
+#endif
+
+// Number of directory catalogs kept in RAM
+#ifndef PLATFORM_IMAGE_CATALOG_COUNT
+#define PLATFORM_IMAGE_CATALOG_COUNT 2
+#endif
+
+// Length of the name prefix stored for each image, used for sorting.
+// Names that differ only after it are read from the directory to compare.
+#define IMAGE_CATALOG_KEY_LEN 12
+
+struct image_catalog_t;
+
+class ImageCatalog
+{
+public:
+    ImageCatalog();
+    ~ImageCatalog();
+
+    // Open the directory and find its catalog, building it if needed.
+    // Returns false if the directory can't be opened or has too many images.
+    bool open(const char *dirname);
+    void close();
+
+    // Number of images in the directory
+    int count() const;
+
+    // Get the file name and optionally size of the image at the given index
+    // in sorted order. Returns name length, or 0 if the index is out of range.
+    int getName(int index, char *buf, size_t buflen, uint64_t *size = nullptr);
+
+    // Find the first image sorted after the given name, wrapping around to
+    // the first image. With use_prefix, only images whose first 3 characters
+    // match the given name are considered.
+    // Returns the index or -1 if no image was found.
+    int findNext(const char *name, bool use_prefix);
+
+    // Drop all cached catalogs, such as when a new SD card is mounted
+    static void clearAll();
+
+private:
+    FsFile m_dir;
+    image_catalog_t *m_catalog;
+
+    uint32_t hashDirectory();
+    bool build();
+    int compareEntry(int index, const char *name);
+};
@@ -0,0 +1,454 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "TapeIndex.h"
+#include "ZuluSCSI_log.h"
+#include "ZuluSCSI_config.h"
+#include "ZuluSCSI_platform.h"
+#include <string.h>
+#include <ZCD.h>
+
+#define TAPE_INDEX_MAGIC 0x5849545A
+#define TAPE_INDEX_VERSION 2
+#define TAPE_INDEX_HEADER_SIZE 512
+#define TAPE_INDEX_NO_CACHE 0xFFFFFFFF
+
+TapeIndex::TapeIndex()
+{
+    m_image = nullptr;
+    memset(&m_hdr, 0, sizeof(m_hdr));
+    m_dirty = false;
+    memset(&m_last, 0, sizeof(m_last));
+    m_cacheidx = TAPE_INDEX_NO_CACHE;
+    m_cacheend = 0;
+    memset(&m_cache, 0, sizeof(m_cache));
+}
+
+bool TapeIndex::open(const char *imgname, ImageBackingStore &image)
+{
+    close();
+    m_image = &image;
+
+    // Sidecar file has the name of the image with .tix extension
+    char idxname[MAX_FILE_PATH * 2 + 2];
+    if (strlen(imgname) + 4 >= sizeof(idxname))
+    {
+        return false;
+    }
+    strcpy(idxname, imgname);
+    char *extension = strrchr(idxname, '.');
+    char *slash = strrchr(idxname, '/');
+    if (extension && (!slash || extension > slash))
+    {
+        *extension = '\0';
+    }
+    strcat(idxname, ".tix");
+
+    m_file = SD.open(idxname, O_RDWR | O_CREAT);
+    if (!m_file.isOpen())
+    {
+        logmsg("---- Failed to open tape index file ", idxname);
+        return false;
+    }
+
+    if (m_file.read(&m_hdr, sizeof(m_hdr)) == sizeof(m_hdr) &&
+        m_hdr.magic == TAPE_INDEX_MAGIC &&
+        m_hdr.version == TAPE_INDEX_VERSION &&
+        m_hdr.entry_size == sizeof(tape_index_entry_t) &&
+        m_hdr.clean &&
+        m_hdr.image_size == image.size() &&
+        (m_hdr.entry_count == 0 || readEntry(m_hdr.entry_count - 1, &m_last)))
+    {
+        dbgmsg("---- Loaded tape index ", idxname, ", ", (int)m_hdr.object_count,
+               " blocks and filemarks in ", (int)m_hdr.entry_count, " runs");
+        return true;
+    }
+
+    uint32_t start = millis();
+    if (!rebuild() || !save())
+    {
+        logmsg("---- Failed to build tape index file ", idxname);
+        m_file.close();
+        m_image = nullptr;
+        return false;
+    }
+
+    logmsg("---- Indexed tape image in ", (int)(millis() - start), " ms, ",
+           (int)m_hdr.object_count, " blocks and filemarks in ", (int)m_hdr.entry_count, " runs");
+    return true;
+}
+
+void TapeIndex::close()
+{
+    if (m_file.isOpen())
+    {
+        save();
+        m_file.close();
+    }
+
+    m_image = nullptr;
+    memset(&m_hdr, 0, sizeof(m_hdr));
+    m_dirty = false;
+    m_cacheidx = TAPE_INDEX_NO_CACHE;
+}
+
+bool TapeIndex::isOpen()
+{
+    return m_file.isOpen();
+}
+
+uint32_t TapeIndex::objectCount()
+{
+    return m_hdr.object_count;
+}
+
+uint64_t TapeIndex::dataEnd()
+{
+    return m_hdr.data_end;
+}
+
+bool TapeIndex::readEntry(uint32_t idx, tape_index_entry_t *entry)
+{
+    return m_file.seekSet(TAPE_INDEX_HEADER_SIZE + (uint64_t)idx * sizeof(tape_index_entry_t)) &&
+           m_file.read(entry, sizeof(tape_index_entry_t)) == sizeof(tape_index_entry_t);
+}
+
+bool TapeIndex::writeEntry(uint32_t idx, const tape_index_entry_t &entry)
+{
+    return m_file.seekSet(TAPE_INDEX_HEADER_SIZE + (uint64_t)idx * sizeof(tape_index_entry_t)) &&
+           m_file.write(&entry, sizeof(tape_index_entry_t)) == sizeof(tape_index_entry_t);
+}
+
+uint32_t TapeIndex::findEntry(uint32_t object, tape_index_entry_t *entry)
+{
+    if (m_cacheidx != TAPE_INDEX_NO_CACHE &&
+        m_cache.first_object <= object && object < m_cacheend)
+    {
+        *entry = m_cache;
+        return m_cacheidx;
+    }
+
+    // Binary search for the last run starting at or before object
+    uint32_t lo = 0;
+    uint32_t hi = m_hdr.entry_count - 1;
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (!readEntry(mid, entry)) break;
+
+        if (entry->first_object <= object)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    readEntry(lo, entry);
+    m_cacheidx = lo;
+    m_cache = *entry;
+    m_cacheend = m_hdr.object_count;
+
+    tape_index_entry_t next;
+    if (lo + 1 < m_hdr.entry_count && readEntry(lo + 1, &next))
+    {
+        m_cacheend = next.first_object;
+    }
+
+    return lo;
+}
+
+bool TapeIndex::find(uint32_t object, tape_record_t *rec)
+{
+    if (object >= m_hdr.object_count)
+    {
+        return false;
+    }
+
+    tape_index_entry_t entry;
+    findEntry(object, &entry);
+    rec->offset = entry.offset + (object - entry.first_object) * entrySize(entry);
+    rec->length = entry.length;
+    rec->stored_length = entry.stored_length;
+    rec->run_count = m_cacheend - object;
+    return true;
+}
+
+uint64_t TapeIndex::offsetOf(uint32_t object)
+{
+    tape_record_t rec;
+    if (find(object, &rec))
+    {
+        return rec.offset;
+    }
+    else
+    {
+        return m_hdr.data_end;
+    }
+}
+
+uint32_t TapeIndex::filemarksBefore(uint32_t object)
+{
+    if (object >= m_hdr.object_count)
+    {
+        return m_hdr.filemark_count;
+    }
+
+    tape_index_entry_t entry;
+    findEntry(object, &entry);
+    if (entry.length == 0)
+    {
+        return entry.filemarks + (object - entry.first_object);
+    }
+    else
+    {
+        return entry.filemarks;
+    }
+}
+
+uint32_t TapeIndex::filemarkPosition(uint32_t filemark)
+{
+    if (filemark >= m_hdr.filemark_count)
+    {
+        return m_hdr.object_count;
+    }
+
+    // The filemark is in the run before the first one that has more
+    // filemarks before it. Consecutive filemarks are always in one run.
+    tape_index_entry_t entry;
+    uint32_t lo = 1;
+    uint32_t hi = m_hdr.entry_count;
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (!readEntry(mid, &entry)) break;
+
+        if (entry.filemarks > filemark)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    if (!readEntry(lo - 1, &entry) || entry.length != 0)
+    {
+        logmsg("Tape index is inconsistent, filemark ", (int)filemark, " not found");
+        return m_hdr.object_count;
+    }
+
+    return entry.first_object + (filemark - entry.filemarks);
+}
+
+bool TapeIndex::markDirty()
+{
+    if (m_dirty)
+    {
+        return true;
+    }
+
+    // If the image is written but the index is not saved, such as on
+    // power loss, the index is rebuilt on next boot.
+    m_hdr.clean = 0;
+    m_dirty = true;
+    return m_file.seekSet(0) &&
+           m_file.write(&m_hdr, sizeof(m_hdr)) == sizeof(m_hdr) &&
+           m_file.sync();
+}
+
+bool TapeIndex::truncate(uint32_t object)
+{
+    if (object >= m_hdr.object_count)
+    {
+        return true;
+    }
+
+    if (!markDirty())
+    {
+        return false;
+    }
+
+    tape_index_entry_t entry;
+    uint32_t idx = findEntry(object, &entry);
+    m_hdr.filemark_count = filemarksBefore(object);
+    m_hdr.data_end = entry.offset + (object - entry.first_object) * entrySize(entry);
+    m_hdr.object_count = object;
+    m_hdr.entry_count = (entry.first_object == object) ? idx : idx + 1;
+    m_cacheidx = TAPE_INDEX_NO_CACHE;
+
+    if (m_hdr.entry_count == 0)
+    {
+        memset(&m_last, 0, sizeof(m_last));
+        return true;
+    }
+
+    return readEntry(m_hdr.entry_count - 1, &m_last);
+}
+
+bool TapeIndex::append(uint32_t object, uint32_t length, uint32_t count, uint32_t stored_length)
+{
+    if (count == 0)
+    {
+        return true;
+    }
+
+    if (object > m_hdr.object_count || !truncate(object) || !markDirty())
+    {
+        return false;
+    }
+
+    if (m_hdr.entry_count == 0 || m_last.length != length || m_last.stored_length != stored_length)
+    {
+        tape_index_entry_t entry = {};
+        entry.offset = m_hdr.data_end;
+        entry.first_object = m_hdr.object_count;
+        entry.length = length;
+        entry.filemarks = m_hdr.filemark_count;
+        entry.stored_length = stored_length;
+        if (!writeEntry(m_hdr.entry_count, entry))
+        {
+            return false;
+        }
+
+        m_hdr.entry_count++;
+        m_last = entry;
+    }
+
+    m_hdr.object_count += count;
+    m_hdr.data_end += count * entrySize(m_last);
+    if (length == 0)
+    {
+        m_hdr.filemark_count += count;
+    }
+    m_cacheidx = TAPE_INDEX_NO_CACHE;
+    return true;
+}
+
+bool TapeIndex::save()
+{
+    if (!m_dirty)
+    {
+        return true;
+    }
+
+    m_hdr.image_size = m_image->size();
+    m_hdr.clean = 1;
+    if (m_file.seekSet(0) &&
+        m_file.write(&m_hdr, sizeof(m_hdr)) == sizeof(m_hdr) &&
+        m_file.truncate(TAPE_INDEX_HEADER_SIZE + (uint64_t)m_hdr.entry_count * sizeof(tape_index_entry_t)) &&
+        m_file.sync())
+    {
+        m_dirty = false;
+        return true;
+    }
+
+    logmsg("Failed to save tape index");
+    return false;
+}
+
+bool TapeIndex::rebuild()
+{
+    static_assert(sizeof(header_t) <= TAPE_INDEX_HEADER_SIZE, "Tape index header too large");
+
+    memset(&m_hdr, 0, sizeof(m_hdr));
+    m_hdr.magic = TAPE_INDEX_MAGIC;
+    m_hdr.version = TAPE_INDEX_VERSION;
+    m_hdr.entry_size = sizeof(tape_index_entry_t);
+    m_dirty = false;
+    m_cacheidx = TAPE_INDEX_NO_CACHE;
+
+    // Header is padded to sector size
+    uint8_t zero[32] = {0};
+    m_file.seekSet(0);
+    for (uint32_t i = 0; i < TAPE_INDEX_HEADER_SIZE; i += sizeof(zero))
+    {
+        if (m_file.write(zero, sizeof(zero)) != sizeof(zero)) return false;
+    }
+
+    if (!markDirty())
+    {
+        return false;
+    }
+
+    uint64_t size = m_image->size();
+    uint64_t pos = 0;
+    uint32_t count = 0;
+    while (pos + 4 <= size)
+    {
+        uint32_t mark;
+        if (!m_image->seek(pos) || m_image->read(&mark, 4) != 4)
+        {
+            return false;
+        }
+
+        if (mark == TAPE_MARK_FILEMARK)
+        {
+            if (!append(m_hdr.object_count, 0, 1)) return false;
+            pos += 4;
+            continue;
+        }
+        else if (mark == TAPE_MARK_END_OF_MEDIUM)
+        {
+            break;
+        }
+
+        uint32_t length = mark & TAPE_RECORD_LENGTH_MASK;
+        uint32_t stored = 0;
+        if ((mark & TAPE_RECORD_CLASS_MASK) == TAPE_RECORD_COMPRESSED &&
+            (mark & ~(TAPE_RECORD_LENGTH_MASK | TAPE_RECORD_CLASS_MASK)) == 0 &&
+            length > TAPE_COMPRESSED_INFO_SIZE)
+        {
+            // Logical length is in the words at start of record data
+            uint32_t info[2];
+            if (m_image->read(info, 8) != 8 || (info[0] >> 24) != ZCD_CODEC_LZ ||
+                (info[0] & TAPE_RECORD_LENGTH_MASK) == 0 || info[1] > length - TAPE_COMPRESSED_INFO_SIZE)
+            {
+                logmsg("---- Unsupported compressed tape record at offset ", (uint32_t)pos, ", ignoring rest of image");
+                break;
+            }
+
+            stored = length;
+            length = info[0] & TAPE_RECORD_LENGTH_MASK;
+        }
+        else if ((mark & ~(TAPE_RECORD_LENGTH_MASK | TAPE_RECORD_ERROR_FLAG)) != 0 || length == 0)
+        {
+            logmsg("---- Unsupported tape record marker ", mark, " at offset ", (uint32_t)pos, ", ignoring rest of image");
+            break;
+        }
+
+        uint64_t recsize = recordSize(stored ? stored : length);
+        uint32_t trailer = 0;
+        if (pos + recsize > size ||
+            !m_image->seek(pos + recsize - 4) ||
+            m_image->read(&trailer, 4) != 4 ||
+            trailer != mark)
+        {
+            logmsg("---- Incomplete tape record at offset ", (uint32_t)pos, ", ignoring rest of image");
+            break;
+        }
+
+        if (!append(m_hdr.object_count, length, 1, stored)) return false;
+        pos += recsize;
+
+        if ((++count & 1023) == 0)
+        {
+            platform_reset_watchdog();
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,181 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+/* Index of records in a tape container image.
+ *
+ * Tape containers (.tap) use the SIMH tape format. Each data record is
+ * stored as a 32-bit little-endian length, the data padded to even length,
+ * and the length again. A filemark is a single zero length.
+ *
+ * Records written with compression enabled are stored as SIMH private
+ * data records of class 6. The data starts with a 32-bit little-endian
+ * word that has the logical record length and the ZCD codec in the top
+ * byte, followed by the compressed data. Each record is compressed
+ * separately so that it can be read without the ones before it.
+ *
+ * The logical objects (records and filemarks) are numbered from the start
+ * of the tape, like the block addresses of LOCATE and READ POSITION.
+ * The index stores runs of consecutive records with the same length,
+ * sorted by object number, so that the position of any object or filemark
+ * is found with a binary search. Archives written with a fixed block size
+ * need only a few runs.
+ *
+ * The index is kept in a sidecar file next to the image, with .tix
+ * extension. It is rebuilt by scanning the image if it is missing or was
+ * not saved after the image was last written.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <SdFat.h>
+#include "ImageBackingStore.h"
+
+// SIMH tape format markers
+#define TAPE_MARK_FILEMARK 0x00000000
+#define TAPE_MARK_END_OF_MEDIUM 0xFFFFFFFF
+#define TAPE_RECORD_ERROR_FLAG 0x80000000
+#define TAPE_RECORD_LENGTH_MASK 0x00FFFFFF
+#define TAPE_RECORD_CLASS_MASK 0xF0000000
+#define TAPE_RECORD_COMPRESSED 0x60000000
+
+// Size of the words before compressed record data: logical length and
+// codec, then the length of compressed data. Zero padding follows the data.
+#define TAPE_COMPRESSED_INFO_SIZE 8
+
+// Run of consecutive records with the same length and stored length
+typedef struct {
+    uint64_t offset;       // Position of the first record in image file
+    uint32_t first_object; // Logical object number of the first record
+    uint32_t length;       // Data length of the records, 0 for filemarks
+    uint32_t filemarks;    // Number of filemarks before first_object
+    uint32_t stored_length; // Length of compressed record data, 0 if not compressed
+    uint32_t reserved[2];
+} tape_index_entry_t;
+
+// Location of a single record found in the index
+typedef struct {
+    uint64_t offset;    // Position of record length header in image file
+    uint32_t length;    // Data length, 0 for filemarks
+    uint32_t stored_length; // Length of compressed record data, 0 if not compressed
+    uint32_t run_count; // Number of records of the same length starting from this one
+} tape_record_t;
+
+class TapeIndex
+{
+public:
+    TapeIndex();
+
+    // Load index of the image from sidecar file, or build it if needed
+    bool open(const char *imgname, ImageBackingStore &image);
+
+    // Save index and close the sidecar file
+    void close();
+
+    bool isOpen();
+
+    // Number of logical objects before end of data
+    uint32_t objectCount();
+
+    // Position of end of data in image file
+    uint64_t dataEnd();
+
+    // Find record at a logical object number, returns false at end of data
+    bool find(uint32_t object, tape_record_t *rec);
+
+    // Position of the record at object number, or end of data
+    uint64_t offsetOf(uint32_t object);
+
+    // Number of filemarks before the object
+    uint32_t filemarksBefore(uint32_t object);
+
+    // Object number of the filemark with the given number counting from
+    // start of tape, or objectCount() if there is no such filemark.
+    uint32_t filemarkPosition(uint32_t filemark);
+
+    // Add records or filemarks (length 0) written at the object number,
+    // discarding everything after it. Compressed records have stored_length
+    // set to the length of the data in the image.
+    bool append(uint32_t object, uint32_t length, uint32_t count, uint32_t stored_length = 0);
+
+    // Discard everything starting from the object number
+    bool truncate(uint32_t object);
+
+    // Write changes to the sidecar file, after the image has been written
+    bool save();
+
+    // Size of record in image file, including length fields
+    static uint64_t recordSize(uint32_t length)
+    {
+        return (length == 0) ? 4 : (8 + (uint64_t)((length + 1) & ~1));
+    }
+
+    // Size of record in image file for a found record
+    static uint64_t recordSize(const tape_record_t &rec)
+    {
+        return recordSize(rec.stored_length ? rec.stored_length : rec.length);
+    }
+
+protected:
+    // Sidecar file header, entries start at the next sector
+    typedef struct {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t entry_size;
+        uint32_t entry_count;
+        uint64_t image_size;   // Size of image file when index was saved
+        uint64_t data_end;
+        uint32_t object_count;
+        uint32_t filemark_count;
+        uint32_t clean;        // Index matches image, cleared before writing
+        uint32_t reserved[3];
+    } header_t;
+
+    FsFile m_file;
+    ImageBackingStore *m_image;
+    header_t m_hdr;
+    bool m_dirty;
+
+    // Last entry, used for extending the run when appending
+    tape_index_entry_t m_last;
+
+    // Entry of the last lookup, for sequential access
+    uint32_t m_cacheidx;
+    uint32_t m_cacheend;
+    tape_index_entry_t m_cache;
+
+    static uint64_t entrySize(const tape_index_entry_t &entry)
+    {
+        return recordSize(entry.stored_length ? entry.stored_length : entry.length);
+    }
+
+    bool readEntry(uint32_t idx, tape_index_entry_t *entry);
+    bool writeEntry(uint32_t idx, const tape_index_entry_t &entry);
+
+    // Index of the run containing object
+    uint32_t findEntry(uint32_t object, tape_index_entry_t *entry);
+
+    // Mark index as not matching the image before it is modified
+    bool markDirty();
+
+    // Scan image records to build the index
+    bool rebuild();
+};
@@ -20,6 +20,7 @@
 #include "ZuluSCSI_disk.h"
 #include "ZuluSCSI_cdrom.h"
 #include "ZuluSCSI_log.h"
+#include "ImageCatalog.h"
 #include <minIni.h>
 #include <SdFat.h>
 extern "C" {
@@ -61,6 +62,26 @@ static bool toolboxFilenameValid(const char* name, bool isCD = false)
 
 static void doCountFiles(const char * dir_name, bool isCD = false)
 {
+    ImageCatalog catalog;
+    if (isCD && catalog.open(dir_name))
+    {
+        // CD images are listed from the sorted image directory catalog
+        int file_count = catalog.count();
+        catalog.close();
+        if (file_count > MAX_FILE_LISTING_FILES)
+        {
+            scsiDev.status = CHECK_CONDITION;
+            scsiDev.target->sense.code = ILLEGAL_REQUEST;
+            scsiDev.target->sense.asc = OPEN_RETRO_SCSI_TOO_MANY_FILES;
+            scsiDev.phase = STATUS;
+            return;
+        }
+        scsiDev.data[0] = file_count;
+        scsiDev.dataLen = 1;
+        scsiDev.phase = DATA_IN;
+        return;
+    }
+
     FsFile dir;
     FsFile file;
     char name[MAX_FILE_PATH] = {0};
@@ -102,15 +123,56 @@ static void doCountFiles(const char * dir_name, bool isCD = false)
   scsiDev.phase = DATA_IN;
 }
 
+static const size_t LIST_ENTRY_SIZE = 40;
+
+// Adds a file to the listing in the SCSI data buffer
+static void addListEntry(uint8_t index, uint8_t isDir, const char *name, uint64_t size)
+{
+    uint8_t file_entry[LIST_ENTRY_SIZE] = {0};
+    file_entry[0] = index;
+    file_entry[1] = isDir;
+    for(int i = 0; i < MAX_MAC_PATH + 1 ; i++) {
+        file_entry[i + 2] = name[i];   // bytes 2 - 34
+    }
+    file_entry[35] = 0; //(size >> 32) & 0xff;
+    file_entry[36] = (size >> 24) & 0xff;
+    file_entry[37] = (size >> 16) & 0xff;
+    file_entry[38] = (size >> 8) & 0xff;
+    file_entry[39] = (size) & 0xff;
+    // send to SCSI output buffer
+    memcpy(&(scsiDev.data[LIST_ENTRY_SIZE * index]), file_entry, LIST_ENTRY_SIZE);
+}
+
 static void onListFiles(const char * dir_name, bool isCD = false) {
     FsFile dir;
     FsFile file;
-    const size_t ENTRY_SIZE = 40;
 
-    memset(scsiDev.data, 0, ENTRY_SIZE * (MAX_FILE_LISTING_FILES + 1));
+    memset(scsiDev.data, 0, LIST_ENTRY_SIZE * (MAX_FILE_LISTING_FILES + 1));
     char name[MAX_FILE_PATH] = {0};
     uint8_t index = 0;
-    uint8_t file_entry[ENTRY_SIZE] = {0};
+
+    ImageCatalog catalog;
+    if (isCD && catalog.open(dir_name))
+    {
+        // CD images are listed in sorted order, the index selects the
+        // same image in TOOLBOX_SET_NEXT_CD
+        uint64_t size;
+        while (index < catalog.count() && index < MAX_FILE_LISTING_FILES)
+        {
+            memset(name, 0, sizeof(name));
+            if (!catalog.getName(index, name, sizeof(name), &size))
+                break;
+            name[MAX_MAC_PATH] = 0x0;
+            addListEntry(index, 0x01, name, size);
+            index = index + 1;
+        }
+        catalog.close();
+
+        scsiDev.dataLen = LIST_ENTRY_SIZE * index;
+        scsiDev.phase = DATA_IN;
+        dbgmsg("TOOLBOX LIST FILES: returning ", index, " cataloged files for size ", scsiDev.dataLen);
+        return;
+    }
 
     dir.open(dir_name);
     dir.rewindDirectory();
@@ -132,25 +194,14 @@ static void onListFiles(const char * dir_name, bool isCD = false) {
         if (isCD && isDir == 0x00)
             continue;
         // fill output buffer
-        file_entry[0] = index;
-        file_entry[1] = isDir;
-        for(int i = 0; i < MAX_MAC_PATH + 1 ; i++) {
-            file_entry[i + 2] = name[i];   // bytes 2 - 34
-        }
-        file_entry[35] = 0; //(size >> 32) & 0xff;
-        file_entry[36] = (size >> 24) & 0xff;
-        file_entry[37] = (size >> 16) & 0xff;
-        file_entry[38] = (size >> 8) & 0xff;
-        file_entry[39] = (size) & 0xff;
-        // send to SCSI output buffer
-        memcpy(&(scsiDev.data[ENTRY_SIZE * index]), file_entry, ENTRY_SIZE);
+        addListEntry(index, isDir, name, size);
         // increment index
         index = index + 1;
         if (index >= MAX_FILE_LISTING_FILES) break;
     }
     dir.close();
 
-    scsiDev.dataLen = ENTRY_SIZE * index;
+    scsiDev.dataLen = LIST_ENTRY_SIZE * index;
     scsiDev.phase = DATA_IN;
     dbgmsg("TOOLBOX LIST FILES: returning ", index, " files for size ", scsiDev.dataLen);
 }
@@ -228,9 +279,18 @@ static void onSetNextCD(const char * img_dir)
     char full_path[MAX_FILE_PATH * 2] = {0};
     uint8_t file_index = scsiDev.cdb[1];
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-    FsFile next_cd = get_file_from_index(file_index, img_dir, true);
-    next_cd.getName(name, sizeof(name));
-    next_cd.close();
+    ImageCatalog catalog;
+    if (catalog.open(img_dir))
+    {
+        catalog.getName(file_index, name, sizeof(name));
+        catalog.close();
+    }
+    else
+    {
+        FsFile next_cd = get_file_from_index(file_index, img_dir, true);
+        next_cd.getName(name, sizeof(name));
+        next_cd.close();
+    }
     snprintf(full_path, (MAX_FILE_PATH * 2), "%s/%s", img_dir, name);
     switchNextImage(img, full_path);
 }
@@ -56,8 +56,11 @@
 #include "ZuluSCSI_log_trace.h"
 #include "ZuluSCSI_settings.h"
 #include "ZuluSCSI_disk.h"
+#include "ZuluSCSI_tape.h"
 #include "ZuluSCSI_initiator.h"
 #include "ZuluSCSI_msc.h"
+#include "ZuluSCSI_sdperf.h"
+#include "ZuluSCSI_bootcatalog.h"
 #include "ROMDrive.h"
 
 SdFs SD;
@@ -359,6 +362,7 @@ bool findHDDImages()
   uint8_t removable_count = 0;
   uint8_t eject_btn_set = 0;
   uint8_t last_removable_device = 255;
+  bool open_later = g_scsi_settings.getSystem()->backgroundImageOpen;
   while (1)
   {
     if (!file.openNext(&root, O_READ))
@@ -525,6 +529,14 @@ bool findHDDImages()
             foundImage = true;
           }
         }
+        else if(id < NUM_SCSIID && lun < NUM_SCSILUN && open_later && type != S2S_CFG_NETWORK) {
+          logmsg("-- Found ", fullname, " for id:", id, " lun:", lun, ", opening after SCSI init");
+          imageReady = scsiDiskDeferHDDImage(id, fullname, lun, blk, type, use_prefix);
+          if(imageReady)
+          {
+            foundImage = true;
+          }
+        }
         else if(id < NUM_SCSIID && lun < NUM_SCSILUN) {
           logmsg("-- Opening ", fullname, " for id:", id, " lun:", lun);
 
@@ -571,6 +583,16 @@ bool findHDDImages()
               ", Type: ", (int)cfg->deviceType,
               ", Quirks: ", (int)cfg->quirks);
       }
+      else if (scsiDiskGetImageConfig(i).open_pending)
+      {
+        logmsg("SCSI ID: ", (int)(cfg->scsiId & S2S_CFG_TARGET_ID_BITS),
+              ", BlockSize: ", (int)cfg->bytesPerSector,
+              ", Type: ", (int)cfg->deviceType,
+              ", Quirks: ", (int)cfg->quirks,
+              ", Size: not yet known",
+              typeIsRemovable((S2S_CFG_TYPE)cfg->deviceType) ? ", Removable" : ""
+              );
+      }
       else
       {
         logmsg("SCSI ID: ", (int)(cfg->scsiId & S2S_CFG_TARGET_ID_BITS),
@@ -683,6 +705,12 @@ static bool mountSDCard()
   return true;
 }
 
+// For measuring how quickly the host can access the drives after boot
+static uint32_t g_scsi_init_time;
+static uint8_t g_scsi_init_sel_count;
+static bool g_first_selection_pending;
+static bool g_images_pending;
+
 static void reinitSCSI()
 {
 #if defined(ZULUSCSI_HARDWARE_CONFIG)
@@ -790,12 +818,24 @@ static void reinitSCSI()
   #endif // RAW_FALLBACK_ENABLE
       blinkStatus(BLINK_ERROR_NO_IMAGES);
     }
+
+    // Flash is written with interrupts disabled, do it before the bus is enabled
+    g_scsi_settings.saveSnapshot();
   }
 
   scsiPhyReset();
   scsiDiskInit();
   scsiInit();
 
+  g_scsi_init_time = millis();
+  g_scsi_init_sel_count = scsiDev.selCount;
+  g_first_selection_pending = true;
+  g_images_pending = false;
+  for (int i = 0; i < S2S_MAX_TARGETS; i++)
+  {
+    g_images_pending |= scsiDiskGetImageConfig(i).open_pending;
+  }
+
 #ifdef ZULUSCSI_NETWORK
   if (scsiDiskCheckAnyNetworkDevicesConfigured())
   {
@@ -845,6 +885,8 @@ static void zuluscsi_setup_sd_card()
     }
 
     print_sd_info();
+    sdPerfInit();
+    bootCatalogInit();
     
     char presetName[32];
     ini_gets("SCSI", "System", "", presetName, sizeof(presetName), CONFIGFILE);
@@ -910,6 +952,7 @@ extern "C" void zuluscsi_main_loop(void)
 {
   static uint32_t sd_card_check_time = 0;
   static uint32_t last_request_time = 0;
+  static uint32_t bus_busy_time = 0;
 
   platform_reset_watchdog();
   platform_poll();
@@ -932,6 +975,26 @@ extern "C" void zuluscsi_main_loop(void)
     scsiDiskPoll();
     scsiLogPhaseChange(scsiDev.phase);
 
+    if (g_first_selection_pending && scsiDev.selCount != g_scsi_init_sel_count)
+    {
+      g_first_selection_pending = false;
+      logmsg("First selection by host ", (int)(millis() - g_scsi_init_time), " ms after SCSI init, ",
+             (int)millis(), " ms after power on");
+    }
+
+    // Open remaining image files between commands
+    if (g_images_pending && scsiDev.phase == BUS_FREE && !scsiDiskOpenPendingImages())
+    {
+      g_images_pending = false;
+      logmsg("All images opened ", (int)(millis() - g_scsi_init_time), " ms after SCSI init");
+    }
+
+    // Write buffered tape data between commands
+    if (scsiDev.phase == BUS_FREE)
+    {
+      scsiTapePoll();
+    }
+
     // Save log periodically during status phase if there are new messages.
     // In debug mode, also save every 2 seconds if no SCSI requests come in.
     // SD card writing takes a while, during which the code can't handle new
@@ -962,6 +1025,23 @@ extern "C" void zuluscsi_main_loop(void)
         }
       }
     }
+
+    // Check sector ranges taken from boot catalog one image at a time,
+    // once the host has stopped accessing the drives for a moment.
+    // Each call checks part of a cluster chain and the check continues on
+    // following iterations while the bus stays free.
+    if (scsiDev.phase != BUS_FREE)
+    {
+      bus_busy_time = millis();
+    }
+    else if ((uint32_t)(millis() - bus_busy_time) > 500)
+    {
+      if (!scsiDiskRevalidateImages())
+      {
+        bootCatalogSave();
+        bus_busy_time = millis();
+      }
+    }
   }
 
   if (!g_sdcard_present)
@@ -975,6 +1055,8 @@ extern "C" void zuluscsi_main_loop(void)
       {
         logmsg("SD card reinit succeeded");
         print_sd_info();
+        sdPerfInit();
+        bootCatalogInit();
 
         reinitSCSI();
         init_logfile();
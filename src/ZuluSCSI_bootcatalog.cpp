@@ -0,0 +1,188 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "ZuluSCSI_bootcatalog.h"
+#include "ZuluSCSI_config.h"
+#include "ZuluSCSI_log.h"
+#include <minIni.h>
+#include <string.h>
+
+extern SdFs SD;
+
+#define BOOTCATALOG_MAGIC 0x54435A42
+#define BOOTCATALOG_VERSION 1
+#define BOOTCATALOG_MAX_ENTRIES 32
+
+typedef struct {
+    boot_catalog_key_t key;
+    uint32_t bgn_sector;
+    uint32_t end_sector;
+    uint8_t contiguous;
+    uint8_t used; // Looked up or stored since the catalog was loaded
+    uint8_t reserved[6];
+} boot_catalog_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+} boot_catalog_header_t;
+
+static boot_catalog_entry_t g_boot_catalog[BOOTCATALOG_MAX_ENTRIES];
+static uint32_t g_boot_catalog_count;
+static bool g_boot_catalog_enabled;
+static bool g_boot_catalog_dirty;
+
+void bootCatalogInit()
+{
+    g_boot_catalog_count = 0;
+    g_boot_catalog_dirty = false;
+    g_boot_catalog_enabled = (SD.clusterCount() != 0 &&
+                              ini_getbool("SCSI", "BootCatalog", true, CONFIGFILE));
+    if (!g_boot_catalog_enabled) return;
+
+    FsFile file = SD.open(BOOTCATALOGFILE, O_RDONLY);
+    if (!file.isOpen()) return;
+
+    boot_catalog_header_t hdr;
+    if (file.read(&hdr, sizeof(hdr)) == sizeof(hdr) &&
+        hdr.magic == BOOTCATALOG_MAGIC &&
+        hdr.version == BOOTCATALOG_VERSION &&
+        hdr.count <= BOOTCATALOG_MAX_ENTRIES &&
+        file.read(g_boot_catalog, hdr.count * sizeof(boot_catalog_entry_t)) == (int)(hdr.count * sizeof(boot_catalog_entry_t)))
+    {
+        g_boot_catalog_count = hdr.count;
+        for (uint32_t i = 0; i < g_boot_catalog_count; i++)
+        {
+            g_boot_catalog[i].used = 0;
+        }
+        dbgmsg("Loaded ", (int)g_boot_catalog_count, " image sector ranges from " BOOTCATALOGFILE);
+    }
+    file.close();
+}
+
+bool bootCatalogMakeKey(FsFile &file, const char *path, boot_catalog_key_t *key)
+{
+    if (!g_boot_catalog_enabled) return false;
+
+    // FNV-1a hash of the path
+    uint32_t hash = 2166136261UL;
+    for (const char *p = path; *p; p++)
+    {
+        hash = (hash ^ (uint8_t)*p) * 16777619UL;
+    }
+
+    uint16_t mod_date = 0, mod_time = 0;
+    file.getModifyDateTime(&mod_date, &mod_time);
+
+    memset(key, 0, sizeof(*key));
+    key->path_hash = hash;
+    key->first_sector = file.firstSector();
+    key->mod_datetime = ((uint32_t)mod_date << 16) | mod_time;
+    key->size = file.size();
+    return key->first_sector != 0;
+}
+
+bool bootCatalogLookup(const boot_catalog_key_t &key, bool *contiguous, uint32_t *bgnSector, uint32_t *endSector)
+{
+    for (uint32_t i = 0; i < g_boot_catalog_count; i++)
+    {
+        boot_catalog_entry_t &entry = g_boot_catalog[i];
+        if (memcmp(&entry.key, &key, sizeof(key)) == 0)
+        {
+            entry.used = 1;
+            *contiguous = entry.contiguous;
+            *bgnSector = entry.bgn_sector;
+            *endSector = entry.end_sector;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void bootCatalogStore(const boot_catalog_key_t &key, bool contiguous, uint32_t bgnSector, uint32_t endSector)
+{
+    if (!g_boot_catalog_enabled) return;
+
+    // Replace result for an older version of the same file, or one that
+    // has not been used since boot
+    boot_catalog_entry_t *entry = NULL;
+    for (uint32_t i = 0; i < g_boot_catalog_count; i++)
+    {
+        if (g_boot_catalog[i].key.path_hash == key.path_hash)
+        {
+            entry = &g_boot_catalog[i];
+            break;
+        }
+        else if (!entry && !g_boot_catalog[i].used)
+        {
+            entry = &g_boot_catalog[i];
+        }
+    }
+
+    if (g_boot_catalog_count < BOOTCATALOG_MAX_ENTRIES &&
+        (!entry || entry->key.path_hash != key.path_hash))
+    {
+        entry = &g_boot_catalog[g_boot_catalog_count++];
+    }
+
+    if (!entry) return;
+
+    if (memcmp(&entry->key, &key, sizeof(key)) == 0 &&
+        entry->contiguous == contiguous &&
+        entry->bgn_sector == bgnSector && entry->end_sector == endSector)
+    {
+        entry->used = 1;
+        return;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->key = key;
+    entry->contiguous = contiguous;
+    entry->bgn_sector = bgnSector;
+    entry->end_sector = endSector;
+    entry->used = 1;
+    g_boot_catalog_dirty = true;
+}
+
+void bootCatalogSave()
+{
+    if (!g_boot_catalog_dirty) return;
+    g_boot_catalog_dirty = false;
+
+    boot_catalog_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = BOOTCATALOG_MAGIC;
+    hdr.version = BOOTCATALOG_VERSION;
+    hdr.count = g_boot_catalog_count;
+
+    FsFile file = SD.open(BOOTCATALOGFILE, O_WRONLY | O_CREAT | O_TRUNC);
+    size_t len = g_boot_catalog_count * sizeof(boot_catalog_entry_t);
+    if (!file.isOpen() ||
+        file.write(&hdr, sizeof(hdr)) != sizeof(hdr) ||
+        file.write(g_boot_catalog, len) != len)
+    {
+        logmsg("Failed to save image sector ranges to " BOOTCATALOGFILE);
+    }
+    file.close();
+}
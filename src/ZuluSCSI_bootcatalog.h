@@ -0,0 +1,59 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+/* Boot catalog of image file sector ranges.
+ *
+ * Opening an image checks whether the file is contiguous on the SD card by
+ * walking its cluster chain, which takes a long time for large images on FAT.
+ * The result is stored on the card keyed by the file path, size, first sector
+ * and modification time, so that unchanged images can be mounted without
+ * walking the chain. Images mounted using stored results are checked again
+ * once the SCSI bus has been idle for a moment after boot.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <SdFat.h>
+
+// Identifies a version of an image file
+typedef struct {
+    uint32_t path_hash;
+    uint32_t first_sector;
+    uint32_t mod_datetime;
+    uint32_t reserved;
+    uint64_t size;
+} boot_catalog_key_t;
+
+// Load stored results for the currently mounted SD card
+void bootCatalogInit();
+
+// Get the key for an open file, returns false if catalog is disabled
+bool bootCatalogMakeKey(FsFile &file, const char *path, boot_catalog_key_t *key);
+
+// Find stored result of FsFile::contiguousRange() for the file
+bool bootCatalogLookup(const boot_catalog_key_t &key, bool *contiguous, uint32_t *bgnSector, uint32_t *endSector);
+
+// Store result of FsFile::contiguousRange(), replacing older results for the same path
+void bootCatalogStore(const boot_catalog_key_t &key, bool contiguous, uint32_t bgnSector, uint32_t endSector);
+
+// Write results to SD card if they have changed
+void bootCatalogSave();
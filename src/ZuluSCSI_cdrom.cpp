@@ -33,6 +33,7 @@
 #include "ZuluSCSI_config.h"
 #include "ZuluSCSI_settings.h"
 #include <CUEParser.h>
+#include <CDECC.h>
 #include <assert.h>
 #include <minIni.h>
 #ifdef ENABLE_AUDIO_OUTPUT
@@ -263,22 +264,6 @@ static int32_t MSF2LBA(uint8_t m, uint8_t s, uint8_t f, bool relative)
     return lba;
 }
 
-// Gets the LBA position of the lead-out for the current image
-static uint32_t getLeadOutLBA(const CUETrackInfo* lasttrack)
-{
-    if (lasttrack != nullptr && lasttrack->track_number != 0)
-    {
-        image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-        uint32_t lastTrackBlocks = (img.file.size() - lasttrack->file_offset)
-                / lasttrack->sector_length;
-        return lasttrack->track_start + lastTrackBlocks;
-    }
-    else
-    {
-        return 1;
-    }
-}
-
 static void doReadTOCSimple(bool MSF, uint8_t track, uint16_t allocationLength)
 {
     if (track == 0xAA)
@@ -460,30 +445,364 @@ void doReadTrackInformationSimple(bool track, uint32_t lba, uint16_t allocationL
 }
 
 /*********************************/
-/* TOC generation from cue sheet */
+/* Track table from cue sheet    */
 /*********************************/
 
-// Fetch track info based on LBA
-static void getTrackFromLBA(CUEParser &parser, uint32_t lba, CUETrackInfo *result)
+// The cue sheet is parsed once when the image is loaded, and the track
+// information is kept in RAM for the commands that need it.
+// Tracks of all targets are stored in one shared table to save RAM.
+// Each target uses a contiguous range of it, in the order of the cue sheet.
+#ifndef CDROM_TRACK_TABLE_SIZE
+#define CDROM_TRACK_TABLE_SIZE 128
+#endif
+
+struct cdrom_track_t
 {
-    // Track info in case we have no .cue file
-    result->file_mode = CUEFile_BINARY;
-    result->track_mode = CUETrack_MODE1_2048;
-    result->sector_length = 2048;
-    result->track_number = 1;
+    uint32_t file_offset_low;
+    uint32_t data_start;
+    uint32_t track_start;
+    uint32_t file_pos; // Position of the file name in cue sheet, identifies the track file
+    uint16_t sector_length;
+    uint8_t file_name_len;
+    uint8_t track_number;
+    uint8_t track_mode;
+    uint8_t file_offset_high; // Stored in two parts to keep the entry size down
+    uint8_t session;
 
-    const CUETrackInfo *tmptrack;
-    while ((tmptrack = parser.next_track()) != NULL)
+    uint64_t file_offset() const
     {
-        if (tmptrack->track_start <= lba)
+        return ((uint64_t)file_offset_high << 32) | file_offset_low;
+    }
+
+    void set_file_offset(uint64_t offset)
+    {
+        file_offset_low = (uint32_t)offset;
+        file_offset_high = (uint8_t)(offset >> 32);
+    }
+};
+
+static cdrom_track_t g_cdrom_tracks[CDROM_TRACK_TABLE_SIZE];
+static uint16_t g_cdrom_track_total;
+static uint16_t g_cdrom_track_first[S2S_MAX_TARGETS];
+static uint16_t g_cdrom_track_count[S2S_MAX_TARGETS];
+static uint32_t g_cdrom_leadout[S2S_MAX_TARGETS];
+
+// Multi-session discs (e.g. CD-Extra) have a lead-out after each session,
+// followed by the lead-in of the next one. Neither is stored in the image
+// files, so the track positions of later sessions are moved forward by the
+// length of these areas when the cue sheet is loaded. The session layout
+// is stored here for the TOC, session and disc information commands.
+#ifndef CDROM_MAX_SESSIONS
+#define CDROM_MAX_SESSIONS 4
+#endif
+
+struct cdrom_session_t
+{
+    uint32_t start; // Start of first track of the session
+    uint32_t leadout; // Start of lead-out area of the session
+    uint8_t first_track;
+    uint8_t last_track;
+    uint8_t disc_type; // Disc type for A0 entry of raw TOC
+};
+
+static cdrom_session_t g_cdrom_sessions[S2S_MAX_TARGETS][CDROM_MAX_SESSIONS];
+static uint8_t g_cdrom_session_count[S2S_MAX_TARGETS];
+
+// Lengths of the areas between sessions, refer to ECMA-394 (Orange Book part II)
+static const uint32_t CD_FIRST_LEADOUT_LEN = 6750; // 1:30
+static const uint32_t CD_LEADOUT_LEN = 2250; // 0:30
+static const uint32_t CD_LEADIN_LEN = 4500; // 1:00
+static const uint32_t CD_PREGAP_LEN = 150; // 0:02
+
+// Get the number of sectors from the lead-out of a session to the
+// program area of the next one.
+static uint32_t getSessionGap(int session)
+{
+    return (session == 1 ? CD_FIRST_LEADOUT_LEN : CD_LEADOUT_LEN) + CD_LEADIN_LEN;
+}
+
+// Release the table range used by a target
+static void freeTrackTable(uint8_t target)
+{
+    uint16_t first = g_cdrom_track_first[target];
+    uint16_t count = g_cdrom_track_count[target];
+    g_cdrom_session_count[target] = 0;
+    if (count == 0) return;
+
+    memmove(&g_cdrom_tracks[first], &g_cdrom_tracks[first + count],
+            (g_cdrom_track_total - first - count) * sizeof(cdrom_track_t));
+    g_cdrom_track_total -= count;
+
+    for (int i = 0; i < S2S_MAX_TARGETS; i++)
+    {
+        if (g_cdrom_track_count[i] > 0 && g_cdrom_track_first[i] > first)
         {
-            *result = *tmptrack;
+            g_cdrom_track_first[i] -= count;
         }
-        else
+    }
+
+    g_cdrom_track_count[target] = 0;
+}
+
+// Provides access to the track table of one target,
+// with the same track iteration interface as CUEParser.
+class CDROMTrackList
+{
+public:
+    CDROMTrackList(): m_first(0), m_count(0), m_pos(0), m_info() {}
+
+    CDROMTrackList(uint16_t first, uint16_t count): m_first(first), m_count(count), m_pos(0), m_info() {}
+
+    // Restart iteration from first track
+    void restart() { m_pos = 0; }
+
+    // Get information for next track.
+    // Returns nullptr when there are no more tracks.
+    const CUETrackInfo *next_track()
+    {
+        if (m_pos >= m_count) return nullptr;
+        get(m_pos++, &m_info);
+        return &m_info;
+    }
+
+    // Find the last track that starts at or before the LBA.
+    // Returns false if there is no such track.
+    bool find(uint32_t lba, CUETrackInfo *result) const
+    {
+        const cdrom_track_t *track = find_entry(lba);
+        if (!track) return false;
+        get(track - &g_cdrom_tracks[m_first], result);
+        return true;
+    }
+
+    // Find the table entry of the last track that starts at or before the LBA.
+    const cdrom_track_t *find_entry(uint32_t lba) const
+    {
+        // Binary search for the first track starting after lba
+        uint16_t lo = 0, hi = m_count;
+        while (lo < hi)
         {
-            break;
+            uint16_t mid = (lo + hi) / 2;
+            if (g_cdrom_tracks[m_first + mid].track_start <= lba)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (lo == 0) return nullptr;
+        return &g_cdrom_tracks[m_first + lo - 1];
+    }
+
+    // Get the LBA where the data of the file containing the track ends.
+    // This is the start of the next track in another file, or the lead-out.
+    uint32_t file_end(const cdrom_track_t *track, uint32_t leadout) const
+    {
+        const cdrom_track_t *end = &g_cdrom_tracks[m_first + m_count];
+        for (const cdrom_track_t *next = track + 1; next < end; next++)
+        {
+            if (next->file_pos != track->file_pos)
+            {
+                return next->track_start;
+            }
+        }
+        return leadout;
+    }
+
+protected:
+    uint16_t m_first;
+    uint16_t m_count;
+    uint16_t m_pos;
+    CUETrackInfo m_info;
+
+    void get(uint16_t index, CUETrackInfo *result) const
+    {
+        const cdrom_track_t &track = g_cdrom_tracks[m_first + index];
+        *result = CUETrackInfo();
+        result->file_mode = CUEFile_BINARY;
+        result->file_offset = track.file_offset();
+        result->track_number = track.track_number;
+        result->track_mode = (CUETrackMode)track.track_mode;
+        result->sector_length = track.sector_length;
+        result->data_start = track.data_start;
+        result->track_start = track.track_start;
+        result->session_number = track.session;
+    }
+};
+
+// Get the track table parsed from cue sheet for the given device.
+// Returns false if the image has no cue sheet.
+static bool getTrackList(image_config_t &img, CDROMTrackList &tracks)
+{
+    uint8_t target = img.scsiId & 7;
+    if (!img.cuesheetfile.isOpen() || g_cdrom_track_count[target] == 0)
+    {
+        return false;
+    }
+
+    tracks = CDROMTrackList(g_cdrom_track_first[target], g_cdrom_track_count[target]);
+    return true;
+}
+
+// Check if the sector range overlaps the lead-out and lead-in areas
+// between sessions, which have no data in the image files.
+static bool isInSessionGap(uint8_t target, uint32_t lba, uint32_t length)
+{
+    for (int i = 1; i < g_cdrom_session_count[target]; i++)
+    {
+        uint32_t gap_start = g_cdrom_sessions[target][i - 1].leadout;
+        uint32_t gap_end = g_cdrom_sessions[target][i].start;
+        if ((uint64_t)lba + length > gap_start && lba < gap_end)
+        {
+            return true;
         }
     }
+    return false;
+}
+
+/*********************************/
+/* Track files of multi-file cue */
+/*********************************/
+
+// Cue sheets can have a separate FILE for each track.
+// The first file is the image file opened for the target, the others are
+// opened when needed and kept open in a small cache shared by all targets.
+// They are accessed through ImageBackingStore, so that files that are
+// contiguous on the SD card are read directly by sector.
+#ifndef CDROM_FILE_CACHE_SIZE
+#define CDROM_FILE_CACHE_SIZE 4
+#endif
+
+static struct {
+    uint8_t target;
+    uint32_t file_pos;
+    uint32_t last_used;
+    ImageBackingStore file;
+} g_cdrom_file_cache[CDROM_FILE_CACHE_SIZE];
+static uint32_t g_cdrom_file_cache_counter;
+
+// Directory of the cue sheet, track file names are relative to it
+static char g_cdrom_file_dir[S2S_MAX_TARGETS][MAX_FILE_PATH];
+
+// Track file that audio is played from, its slot is not reused while playing
+static const ImageBackingStore *g_cdrom_audio_file;
+
+static bool isAudioTrackFile(uint8_t target, const ImageBackingStore *file)
+{
+#ifdef ENABLE_AUDIO_OUTPUT
+    return file == g_cdrom_audio_file && audio_is_playing(target);
+#else
+    return false;
+#endif
+}
+
+static void closeTrackFiles(uint8_t target)
+{
+    for (auto &entry : g_cdrom_file_cache)
+    {
+        if (entry.target == target && entry.file.isOpen())
+        {
+            entry.file.close();
+        }
+    }
+}
+
+// Get the file that contains data for the track.
+// Returns nullptr if the file cannot be opened.
+static ImageBackingStore *getTrackFile(image_config_t &img, const cdrom_track_t *track)
+{
+    uint8_t target = img.scsiId & 7;
+    if (!track || g_cdrom_track_count[target] == 0 ||
+        track->file_pos == g_cdrom_tracks[g_cdrom_track_first[target]].file_pos)
+    {
+        return &img.file;
+    }
+
+    // Search the cache, and find the least recently used entry for replacing.
+    // The file that audio is being played from is skipped.
+    decltype(&g_cdrom_file_cache[0]) slot = nullptr;
+    for (auto &entry : g_cdrom_file_cache)
+    {
+        if (!entry.file.isOpen())
+        {
+            if (!slot || slot->file.isOpen()) slot = &entry;
+        }
+        else if (entry.target == target && entry.file_pos == track->file_pos)
+        {
+            entry.last_used = ++g_cdrom_file_cache_counter;
+            return &entry.file;
+        }
+        else if (isAudioTrackFile(entry.target, &entry.file))
+        {
+            continue;
+        }
+        else if (!slot || (slot->file.isOpen() && entry.last_used < slot->last_used))
+        {
+            slot = &entry;
+        }
+    }
+
+    if (!slot)
+    {
+        return nullptr;
+    }
+
+    // File name is read from the cue sheet to avoid keeping it in RAM
+    char path[MAX_FILE_PATH + CUE_MAX_FILENAME + 1];
+    uint32_t dirlen = strlcpy(path, g_cdrom_file_dir[target], sizeof(path));
+    uint32_t namelen = track->file_name_len;
+    if (dirlen + namelen >= sizeof(path) ||
+        !img.cuesheetfile.seek(track->file_pos) ||
+        img.cuesheetfile.read(path + dirlen, namelen) != (int)namelen)
+    {
+        return nullptr;
+    }
+    path[dirlen + namelen] = '\0';
+
+    slot->file.close();
+    slot->file = ImageBackingStore(path, 2048);
+    if (!slot->file.isOpen())
+    {
+        logmsg("---- Failed to open CD-ROM track file ", path);
+        return nullptr;
+    }
+
+    dbgmsg("------ Opened CD-ROM track file ", path);
+    slot->target = target;
+    slot->file_pos = track->file_pos;
+    slot->last_used = ++g_cdrom_file_cache_counter;
+    return &slot->file;
+}
+
+/*********************************/
+/* TOC generation from cue sheet */
+/*********************************/
+
+// Gets the LBA position of the lead-out for the current image
+static uint32_t getLeadOutLBA(const CUETrackInfo* lasttrack)
+{
+    if (lasttrack != nullptr && lasttrack->track_number != 0)
+    {
+        // Computed from the size of the last track file when cue sheet was loaded
+        image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+        return g_cdrom_leadout[img.scsiId & 7];
+    }
+    else
+    {
+        return 1;
+    }
+}
+
+// Fetch track info based on LBA
+static void getTrackFromLBA(const CDROMTrackList &tracks, uint32_t lba, CUETrackInfo *result)
+{
+    if (!tracks.find(lba, result))
+    {
+        // Track info in case we have no .cue file
+        result->file_mode = CUEFile_BINARY;
+        result->track_mode = CUETrack_MODE1_2048;
+        result->sector_length = 2048;
+        result->track_number = 1;
+    }
 }
 
 // Format track info read from cue sheet into the format used by ReadTOC command.
@@ -518,37 +837,11 @@ static void formatTrackInfo(const CUETrackInfo *track, uint8_t *dest, bool use_M
     }
 }
 
-// Load data from CUE sheet for the given device,
-// using the second half of scsiDev.data buffer for temporary storage.
-// Returns false if no cue sheet or it could not be opened.
-static bool loadCueSheet(image_config_t &img, CUEParser &parser)
-{
-    if (!img.cuesheetfile.isOpen())
-    {
-        return false;
-    }
-
-    // Use second half of scsiDev.data as the buffer for cue sheet text
-    size_t halfbufsize = sizeof(scsiDev.data) / 2;
-    char *cuebuf = (char*)&scsiDev.data[halfbufsize];
-    img.cuesheetfile.seek(0);
-    int len = img.cuesheetfile.read(cuebuf, halfbufsize);
-
-    if (len <= 0)
-    {
-        return false;
-    }
-
-    cuebuf[len] = '\0';
-    parser = CUEParser(cuebuf);
-    return true;
-}
-
 static void doReadTOC(bool MSF, uint8_t track, uint16_t allocationLength)
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-    CUEParser parser;
-    if (!loadCueSheet(img, parser))
+    CDROMTrackList tracks;
+    if (!getTrackList(img, tracks))
     {
         // No CUE sheet, use hardcoded data
         return doReadTOCSimple(MSF, track, allocationLength);
@@ -560,7 +853,7 @@ static void doReadTOC(bool MSF, uint8_t track, uint16_t allocationLength)
     int firsttrack = -1;
     CUETrackInfo lasttrack = {0};
     const CUETrackInfo *trackinfo;
-    while ((trackinfo = parser.next_track()) != NULL)
+    while ((trackinfo = tracks.next_track()) != NULL)
     {
         if (firsttrack < 0) firsttrack = trackinfo->track_number;
         lasttrack = *trackinfo;
@@ -612,8 +905,8 @@ static void doReadTOC(bool MSF, uint8_t track, uint16_t allocationLength)
 static void doReadSessionInfo(bool msf, uint16_t allocationLength)
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-    CUEParser parser;
-    if (!loadCueSheet(img, parser))
+    CDROMTrackList tracks;
+    if (!getTrackList(img, tracks))
     {
         // No CUE sheet, use hardcoded data
         return doReadSessionInfoSimple(msf, allocationLength);
@@ -622,12 +915,18 @@ static void doReadSessionInfo(bool msf, uint16_t allocationLength)
     uint32_t len = sizeof(SessionTOC);
     memcpy(scsiDev.data, SessionTOC, len);
 
-    // Replace first track info in the session table
+    // Report the first track of the last session
     // based on data from CUE sheet.
-    const CUETrackInfo *trackinfo = parser.next_track();
-    if (trackinfo)
+    uint8_t lastsession = g_cdrom_session_count[img.scsiId & 7];
+    scsiDev.data[3] = lastsession;
+    const CUETrackInfo *trackinfo;
+    while ((trackinfo = tracks.next_track()) != NULL)
     {
-        formatTrackInfo(trackinfo, &scsiDev.data[4], false);
+        if (trackinfo->session_number == lastsession)
+        {
+            formatTrackInfo(trackinfo, &scsiDev.data[4], msf);
+            break;
+        }
     }
 
     if (len > allocationLength)
@@ -649,7 +948,7 @@ static void formatRawTrackInfo(const CUETrackInfo *track, uint8_t *dest, bool us
         control_adr = 0x10; // Audio track
     }
 
-    dest[0] = 0x01; // Session always 1
+    dest[0] = track->session_number;
     dest[1] = control_adr;
     dest[2] = 0x00; // "TNO", always 0?
     dest[3] = track->track_number; // "POINT", contains track number
@@ -672,15 +971,16 @@ static void formatRawTrackInfo(const CUETrackInfo *track, uint8_t *dest, bool us
 static void doReadFullTOC(uint8_t session, uint16_t allocationLength, bool useBCD)
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-    CUEParser parser;
-    if (!loadCueSheet(img, parser))
+    CDROMTrackList tracks;
+    if (!getTrackList(img, tracks))
     {
         // No CUE sheet, use hardcoded data
         return doReadFullTOCSimple(session, allocationLength, useBCD);
     }
 
-    // We only support session 1.
-    if (session > 1)
+    uint8_t target = img.scsiId & 7;
+    uint8_t sessioncount = g_cdrom_session_count[target];
+    if (session > sessioncount)
     {
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = ILLEGAL_REQUEST;
@@ -689,49 +989,72 @@ static void doReadFullTOC(uint8_t session, uint16_t allocationLength, bool useBC
         return;
     }
 
-    // Take the beginning of the hardcoded TOC as base
-    uint32_t len = 4 + 11 * 3; // Header, A0, A1, A2
+    // Header with first and last session number
+    uint32_t len = 4;
     memcpy(scsiDev.data, FullTOC, len);
-
-    // Add track descriptors
-    int trackcount = 0;
-    int firsttrack = -1;
-    CUETrackInfo lasttrack = {0};
-    const CUETrackInfo *trackinfo;
-    while ((trackinfo = parser.next_track()) != NULL)
-    {
-        if (firsttrack < 0)
+    scsiDev.data[3] = sessioncount;
+
+    // Entries are reported starting from the requested session
+    if (session == 0) session = 1;
+    for (uint8_t s = session; s <= sessioncount; s++)
+    {
+        const cdrom_session_t &info = g_cdrom_sessions[target][s - 1];
+
+        // Take the A0, A1 and A2 entries of the hardcoded TOC as base
+        uint8_t *pointers = &scsiDev.data[len];
+        memcpy(pointers, &FullTOC[4], 11 * 3);
+        pointers[0] = pointers[11] = pointers[22] = s;
+        pointers[8] = info.first_track;
+        pointers[9] = info.disc_type;
+        pointers[19] = info.last_track;
+        len += 11 * 3;
+
+        // Add track descriptors
+        uint8_t control_adr = 0x14;
+        const CUETrackInfo *trackinfo;
+        tracks.restart();
+        while ((trackinfo = tracks.next_track()) != NULL)
         {
-            firsttrack = trackinfo->track_number;
-            if (trackinfo->track_mode == CUETrack_AUDIO)
+            if (trackinfo->session_number != s) continue;
+
+            formatRawTrackInfo(trackinfo, &scsiDev.data[len], useBCD);
+            if (trackinfo->track_number == info.first_track)
             {
-                scsiDev.data[5] = 0x10;
+                pointers[1] = scsiDev.data[len + 1];
             }
+            control_adr = scsiDev.data[len + 1];
+            len += 11;
         }
-        lasttrack = *trackinfo;
 
-        formatRawTrackInfo(trackinfo, &scsiDev.data[len], useBCD);
-        trackcount += 1;
-        len += 11;
-    }
+        // Control of the last track is used for A1 and A2
+        pointers[12] = control_adr;
+        pointers[23] = control_adr;
 
-    // First and last track numbers
-    scsiDev.data[12] = firsttrack;
-    if (lasttrack.track_number != 0)
-    {
-        scsiDev.data[23] = lasttrack.track_number;
-        if (lasttrack.track_mode == CUETrack_AUDIO)
-        {
-            scsiDev.data[16] = 0x10;
-            scsiDev.data[27] = 0x10;
+        // Leadout track position
+        if (useBCD) {
+            LBA2MSFBCD(info.leadout, &pointers[30], false);
+        } else {
+            LBA2MSF(info.leadout, &pointers[30], false);
         }
-    }
 
-    // Leadout track position
-    if (useBCD) {
-        LBA2MSFBCD(getLeadOutLBA(&lasttrack), &scsiDev.data[34], false);
-    } else {
-        LBA2MSF(getLeadOutLBA(&lasttrack), &scsiDev.data[34], false);
+        if (s < sessioncount)
+        {
+            // B0 entry points to the program area of the next session
+            uint8_t *dest = &scsiDev.data[len];
+            dest[0] = s;
+            dest[1] = 0x50 | (control_adr & 0x0F);
+            dest[2] = 0x00;
+            dest[3] = 0xB0;
+            dest[7] = 1; // Number of mode 5 pointers
+            if (useBCD) {
+                LBA2MSFBCD(info.leadout + getSessionGap(s), &dest[4], false);
+                dest[8] = 0x79; dest[9] = 0x59; dest[10] = 0x74;
+            } else {
+                LBA2MSF(info.leadout + getSessionGap(s), &dest[4], false);
+                dest[8] = 79; dest[9] = 59; dest[10] = 74;
+            }
+            len += 11;
+        }
     }
 
     // Correct the record length in header
@@ -762,12 +1085,12 @@ void doReadHeader(bool MSF, uint32_t lba, uint16_t allocationLength)
 #endif
 
     uint8_t mode = 1;
-    CUEParser parser;
-    if (loadCueSheet(img, parser))
+    CDROMTrackList tracks;
+    if (getTrackList(img, tracks))
     {
         // Search the track with the requested LBA
         CUETrackInfo trackinfo = {};
-        getTrackFromLBA(parser, lba, &trackinfo);
+        getTrackFromLBA(tracks, lba, &trackinfo);
 
         // Track mode (audio / data)
         if (trackinfo.track_mode == CUETrack_AUDIO)
@@ -807,8 +1130,8 @@ void doReadHeader(bool MSF, uint32_t lba, uint16_t allocationLength)
 void doReadDiscInformation(uint16_t allocationLength)
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-    CUEParser parser;
-    if (!loadCueSheet(img, parser))
+    CDROMTrackList tracks;
+    if (!getTrackList(img, tracks))
     {
         // No CUE sheet, use hardcoded data
         return doReadDiscInformationSimple(allocationLength);
@@ -818,19 +1141,14 @@ void doReadDiscInformation(uint16_t allocationLength)
     uint32_t len = sizeof(DiscInformation);
     memcpy(scsiDev.data, DiscInformation, len);
 
-    // Find first and last track number
-    int firsttrack = -1;
-    int lasttrack = -1;
-    const CUETrackInfo *trackinfo;
-    while ((trackinfo = parser.next_track()) != NULL)
-    {
-        if (firsttrack < 0) firsttrack = trackinfo->track_number;
-        lasttrack = trackinfo->track_number;
-    }
-
-    scsiDev.data[3] = firsttrack;
-    scsiDev.data[5] = firsttrack;
-    scsiDev.data[6] = lasttrack;
+    // First track on disc, and first and last track of the last session
+    uint8_t target = img.scsiId & 7;
+    uint8_t sessioncount = g_cdrom_session_count[target];
+    const cdrom_session_t &lastsession = g_cdrom_sessions[target][sessioncount - 1];
+    scsiDev.data[3] = g_cdrom_sessions[target][0].first_track;
+    scsiDev.data[4] = sessioncount;
+    scsiDev.data[5] = lastsession.first_track;
+    scsiDev.data[6] = lastsession.last_track;
 
     if (len > allocationLength)
     {
@@ -843,8 +1161,8 @@ void doReadDiscInformation(uint16_t allocationLength)
 void doReadTrackInformation(bool track, uint32_t lba, uint16_t allocationLength)
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-    CUEParser parser;
-    if (!loadCueSheet(img, parser))
+    CDROMTrackList tracks;
+    if (!getTrackList(img, tracks))
     {
         // No CUE sheet, use hardcoded data
         return doReadTrackInformationSimple(track, lba, allocationLength);
@@ -860,15 +1178,23 @@ void doReadTrackInformation(bool track, uint32_t lba, uint16_t allocationLength)
     uint32_t tracklen = 0;
     CUETrackInfo mtrack = {0};
     const CUETrackInfo *trackinfo;
-    while ((trackinfo = parser.next_track()) != NULL)
+    uint8_t target = img.scsiId & 7;
+    while ((trackinfo = tracks.next_track()) != NULL)
     {
         if (mtrack.track_number != 0) // skip 1st track, just store later
         {
+            // Last track of a session ends at the lead-out of the session
+            uint32_t end = trackinfo->data_start;
+            if (trackinfo->session_number != mtrack.session_number)
+            {
+                end = g_cdrom_sessions[target][mtrack.session_number - 1].leadout;
+            }
+
             if ((track && lba == mtrack.track_number)
-                || (!track && lba < trackinfo->data_start))
+                || (!track && lba < end))
             {
                 trackfound = true;
-                tracklen = trackinfo->data_start - mtrack.data_start;
+                tracklen = end - mtrack.data_start;
                 break;
             }
         }
@@ -896,8 +1222,9 @@ void doReadTrackInformation(bool track, uint32_t lba, uint16_t allocationLength)
         return;
     }
 
-    // rewrite relevant bytes, starting with track number
-    scsiDev.data[3] = mtrack.track_number;
+    // rewrite relevant bytes, starting with track and session number
+    scsiDev.data[2] = mtrack.track_number;
+    scsiDev.data[3] = mtrack.session_number;
 
     // track mode
     if (mtrack.track_mode == CUETrack_AUDIO)
@@ -949,9 +1276,9 @@ void doGetConfiguration(uint8_t rt, uint16_t startFeature, uint16_t allocationLe
     scsiDev.data[5] = 0; // reserved
     if (!img.ejected)
     {
-        // disk in drive, current profile is CD-ROM
+        // disk in drive, current profile is CD-ROM or DVD-ROM
         scsiDev.data[6] = 0x00;
-        scsiDev.data[7] = 0x08;
+        scsiDev.data[7] = img.dvd ? 0x10 : 0x08;
     }
     else
     {
@@ -968,11 +1295,16 @@ void doGetConfiguration(uint8_t rt, uint16_t startFeature, uint16_t allocationLe
         scsiDev.data[len++] = 0x00;
         scsiDev.data[len++] = 0x00;
         scsiDev.data[len++] = 0x03; // ver 0, persist=1,current=1
-        scsiDev.data[len++] = 8; // 2 more
+        scsiDev.data[len++] = 12; // 3 more
+        // DVD-ROM profile
+        scsiDev.data[len++] = 0x00;
+        scsiDev.data[len++] = 0x10;
+        scsiDev.data[len++] = (img.ejected || !img.dvd) ? 0x00 : 0x01;
+        scsiDev.data[len++] = 0;
         // CD-ROM profile
         scsiDev.data[len++] = 0x00;
         scsiDev.data[len++] = 0x08;
-        scsiDev.data[len++] = (img.ejected) ? 0x00 : 0x01;
+        scsiDev.data[len++] = (img.ejected || img.dvd) ? 0x00 : 0x01;
         scsiDev.data[len++] = 0;
         // removable disk profile
         scsiDev.data[len++] = 0x00;
@@ -1066,13 +1398,13 @@ void doGetConfiguration(uint8_t rt, uint16_t startFeature, uint16_t allocationLe
 
     // CD read feature (0x1E, 30)
     if ((rt == 2 && startFeature == 30)
-        || (rt == 1 && startFeature <= 30 && !img.ejected)
+        || (rt == 1 && startFeature <= 30 && !img.ejected && !img.dvd)
         || (rt == 0 && startFeature <= 30))
     {
         scsiDev.data[len++] = 0x00;
         scsiDev.data[len++] = 0x1E;
         // ver 2, persist=0,current=drive state
-        scsiDev.data[len++] = (img.ejected) ? 0x08 : 0x09;
+        scsiDev.data[len++] = (img.ejected || img.dvd) ? 0x08 : 0x09;
         scsiDev.data[len++] = 4;
         scsiDev.data[len++] = 0x00; // dap=0,c2=0,cd-text=0
         scsiDev.data[len++] = 0;
@@ -1080,6 +1412,18 @@ void doGetConfiguration(uint8_t rt, uint16_t startFeature, uint16_t allocationLe
         scsiDev.data[len++] = 0;
     }
 
+    // DVD read feature (0x1F, 31)
+    if ((rt == 2 && startFeature == 31)
+        || (rt == 1 && startFeature <= 31 && !img.ejected && img.dvd)
+        || (rt == 0 && startFeature <= 31))
+    {
+        scsiDev.data[len++] = 0x00;
+        scsiDev.data[len++] = 0x1F;
+        // ver 0, persist=0,current=drive state
+        scsiDev.data[len++] = (img.ejected || !img.dvd) ? 0x00 : 0x01;
+        scsiDev.data[len++] = 0;
+    }
+
 #ifdef ENABLE_AUDIO_OUTPUT
     // CD audio feature (0x103, 259)
     if ((rt == 2 && startFeature == 259)
@@ -1098,12 +1442,199 @@ void doGetConfiguration(uint8_t rt, uint16_t startFeature, uint16_t allocationLe
     }
 #endif
 
-    // finally, rewrite data length to match
-    uint32_t dlen = len - 4;
-    scsiDev.data[0] = dlen >> 24;
-    scsiDev.data[1] = dlen >> 16;
-    scsiDev.data[2] = dlen >> 8;
-    scsiDev.data[3] = dlen;
+    // finally, rewrite data length to match
+    uint32_t dlen = len - 4;
+    scsiDev.data[0] = dlen >> 24;
+    scsiDev.data[1] = dlen >> 16;
+    scsiDev.data[2] = dlen >> 8;
+    scsiDev.data[3] = dlen;
+
+    if (len > allocationLength)
+    {
+        len = allocationLength;
+    }
+    scsiDev.dataLen = len;
+    scsiDev.phase = DATA_IN;
+}
+
+/****************************************/
+/* DVD-ROM media                        */
+/****************************************/
+
+// Images without cue sheet that don't fit on a CD are reported as DVD-ROM media.
+// The limit is the last address that can be expressed in MSF format.
+#define CD_MAX_SECTORS (100 * 60 * 75 - 150)
+
+// Physical sector number of the first data sector on DVD
+#define DVD_DATA_START_PSN 0x30000
+
+// Sectors on a single layer DVD
+#define DVD_LAYER_SECTORS 2295104
+
+// Look for DVD hints in the volume descriptors starting at sector 16.
+// DVDs use UDF, and an ISO9660 volume larger than a CD must be on a DVD.
+static bool cdromVolumeDescriptorIsDVD(image_config_t &img)
+{
+    uint8_t tmp[SD_SECTOR_SIZE];
+    for (uint32_t lba = 16; lba < 32; lba++)
+    {
+        if (!img.file.seek((uint64_t)lba * 2048) ||
+            img.file.read(tmp, SD_SECTOR_SIZE) != SD_SECTOR_SIZE)
+        {
+            break;
+        }
+
+        if (memcmp(tmp + 1, "NSR02", 5) == 0 || memcmp(tmp + 1, "NSR03", 5) == 0)
+        {
+            logmsg("---- Image has UDF file system, reporting it as DVD-ROM media");
+            return true;
+        }
+        else if (tmp[0] == 1 && memcmp(tmp + 1, "CD001", 5) == 0)
+        {
+            // Primary volume descriptor, little endian halves of volume size and block size
+            uint32_t blocks = tmp[80] | (tmp[81] << 8) | (tmp[82] << 16) | ((uint32_t)tmp[83] << 24);
+            uint32_t blocksize = tmp[128] | (tmp[129] << 8);
+            if ((uint64_t)blocks * blocksize > (uint64_t)CD_MAX_SECTORS * 2048)
+            {
+                logmsg("---- ISO9660 volume is larger than a CD, reporting it as DVD-ROM media");
+                return true;
+            }
+        }
+        else if (memcmp(tmp + 1, "CD001", 5) != 0 && memcmp(tmp + 1, "BEA01", 5) != 0 &&
+                 memcmp(tmp + 1, "BOOT2", 5) != 0 && memcmp(tmp + 1, "CDW02", 5) != 0)
+        {
+            // End of volume recognition sequence
+            break;
+        }
+    }
+
+    return false;
+}
+
+bool cdromIsDVDImage(image_config_t &img)
+{
+    if (img.cuesheetfile.isOpen() || img.bytesPerSector != 2048)
+    {
+        return false;
+    }
+
+    int8_t dvd = g_scsi_settings.getDevice(img.scsiId & 0x7)->dvdMedia;
+    if (dvd >= 0)
+    {
+        if (dvd) logmsg("---- Reporting image as DVD-ROM media, set in config");
+        return dvd;
+    }
+
+    if (cdromVolumeDescriptorIsDVD(img))
+    {
+        return true;
+    }
+
+    if (img.scsiSectors <= CD_MAX_SECTORS)
+    {
+        return false;
+    }
+
+    logmsg("---- Image is larger than a CD, reporting it as DVD-ROM media");
+    return true;
+}
+
+static void putBigEndian32(uint8_t *dest, uint32_t value)
+{
+    dest[0] = value >> 24;
+    dest[1] = value >> 16;
+    dest[2] = value >> 8;
+    dest[3] = value;
+}
+
+// READ DVD STRUCTURE / READ DISC STRUCTURE for DVD media.
+// Refer to T10/1545-D MMC-4 Revision 5a, "READ DISC STRUCTURE Command"
+static void doReadDVDStructure(uint8_t media_type, uint8_t layer, uint8_t format, uint16_t allocationLength)
+{
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    uint32_t capacity = getScsiCapacity(
+        scsiDev.target->cfg->sdSectorStart,
+        scsiDev.target->liveCfg.bytesPerSector,
+        scsiDev.target->cfg->scsiSectors);
+    bool dual_layer = (capacity > DVD_LAYER_SECTORS);
+
+    if (media_type != 0 || (format != 0xFF && layer > (dual_layer ? 1 : 0)))
+    {
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
+        scsiDev.phase = STATUS;
+        return;
+    }
+
+    if (format != 0xFF && (img.ejected || !img.dvd))
+    {
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = img.ejected ? NOT_READY : ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = img.ejected ? MEDIUM_NOT_PRESENT : CANNOT_READ_MEDIUM_INCOMPATIBLE_FORMAT;
+        scsiDev.phase = STATUS;
+        return;
+    }
+
+    uint32_t len = 4;
+    if (format == 0x00)
+    {
+        // Physical format information
+        len += 2048;
+        memset(scsiDev.data + 4, 0, 2048);
+        scsiDev.data[4] = 0x01; // DVD-ROM, part version 1
+        scsiDev.data[5] = 0x02; // 120 mm disc, 10.08 Mbps maximum rate
+        scsiDev.data[6] = dual_layer ? 0x21 : 0x01; // Layers, parallel track path, embossed data
+        scsiDev.data[7] = 0x00; // Density 0.267 um / 0.74 um
+        putBigEndian32(scsiDev.data + 8, DVD_DATA_START_PSN);
+        if (dual_layer)
+        {
+            putBigEndian32(scsiDev.data + 12, DVD_DATA_START_PSN + (capacity + 1) / 2 - 1);
+        }
+        else
+        {
+            putBigEndian32(scsiDev.data + 12, DVD_DATA_START_PSN + capacity - 1);
+        }
+    }
+    else if (format == 0x01)
+    {
+        // Copyright information, no protection and all regions
+        len += 4;
+        memset(scsiDev.data + 4, 0, 4);
+    }
+    else if (format == 0x04)
+    {
+        // Manufacturing information, empty
+        len += 2048;
+        memset(scsiDev.data + 4, 0, 2048);
+    }
+    else if (format == 0xFF)
+    {
+        // List of supported structures, readable only
+        static const uint8_t structures[][4] = {
+            {0x00, 0x40, 0x08, 0x04},
+            {0x01, 0x40, 0x00, 0x08},
+            {0x04, 0x40, 0x08, 0x04},
+            {0xFF, 0x40, 0x00, 0x00},
+        };
+        memcpy(scsiDev.data + 4, structures, sizeof(structures));
+        len += sizeof(structures);
+    }
+    else
+    {
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
+        scsiDev.phase = STATUS;
+        return;
+    }
+
+    // Header with data length
+    uint32_t dlen = len - 2;
+    scsiDev.data[0] = dlen >> 8;
+    scsiDev.data[1] = dlen;
+    scsiDev.data[2] = 0;
+    scsiDev.data[3] = 0;
 
     if (len > allocationLength)
     {
@@ -1117,31 +1648,153 @@ void doGetConfiguration(uint8_t rt, uint16_t startFeature, uint16_t allocationLe
 /* CUE sheet check at image load time   */
 /****************************************/
 
-bool cdromValidateCueSheet(image_config_t &img)
+bool cdromValidateCueSheet(image_config_t &img, const char *cuesheetname)
 {
-    CUEParser parser;
-    if (!loadCueSheet(img, parser))
+    uint8_t target = img.scsiId & 7;
+    freeTrackTable(target);
+    closeTrackFiles(target);
+
+    if (!img.cuesheetfile.isOpen())
+    {
+        return false;
+    }
+
+    // Track file names are relative to the directory of the cue sheet
+    const char *dirend = strrchr(cuesheetname, '/');
+    size_t dirlen = dirend ? (dirend - cuesheetname + 1) : 0;
+    if (dirlen >= sizeof(g_cdrom_file_dir[target])) dirlen = 0;
+    memcpy(g_cdrom_file_dir[target], cuesheetname, dirlen);
+    g_cdrom_file_dir[target][dirlen] = '\0';
+
+    // Use second half of scsiDev.data as the buffer for cue sheet text
+    size_t halfbufsize = sizeof(scsiDev.data) / 2;
+    char *cuebuf = (char*)&scsiDev.data[halfbufsize];
+    img.cuesheetfile.seek(0);
+    int len = img.cuesheetfile.read(cuebuf, halfbufsize - 1);
+
+    if (len <= 0)
     {
         return false;
     }
 
+    cuebuf[len] = '\0';
+    CUEParser parser(cuebuf);
+
     const CUETrackInfo *trackinfo;
     int trackcount = 0;
+    g_cdrom_track_first[target] = g_cdrom_track_total;
+    g_cdrom_track_count[target] = 0;
+
+    // Track times in cue sheet are relative to the start of each FILE.
+    // The start of a file on disc is found from the size of the previous one.
+    cdrom_track_t *prev = nullptr;
+    uint32_t file_start_lba = 0;
+    int prev_session_number = 0;
+    cdrom_session_t *session = nullptr;
+    const char *search_pos = cuebuf;
+    char prev_filename[CUE_MAX_FILENAME + 1] = {0};
     while ((trackinfo = parser.next_track()) != NULL)
     {
+        if (g_cdrom_track_total >= CDROM_TRACK_TABLE_SIZE)
+        {
+            logmsg("---- Too many CD-ROM tracks in total, increase CDROM_TRACK_TABLE_SIZE");
+            freeTrackTable(target);
+            return false;
+        }
+
         trackcount++;
 
+        uint32_t file_pos = prev ? prev->file_pos : 0;
+        if (!prev || strcmp(prev_filename, trackinfo->filename) != 0)
+        {
+            if (prev)
+            {
+                ImageBackingStore *file = getTrackFile(img, prev);
+                if (!file)
+                {
+                    freeTrackTable(target);
+                    return false;
+                }
+                file_start_lba = prev->track_start + (file->size() - prev->file_offset()) / prev->sector_length;
+            }
+
+            const char *name = strstr(search_pos, trackinfo->filename);
+            if (name)
+            {
+                file_pos = name - cuebuf;
+                search_pos = name + strlen(trackinfo->filename);
+            }
+            strcpy(prev_filename, trackinfo->filename);
+        }
+
+        if (!prev || trackinfo->session_number != prev_session_number)
+        {
+            if (g_cdrom_session_count[target] >= CDROM_MAX_SESSIONS)
+            {
+                logmsg("---- Too many sessions in cue sheet, increase CDROM_MAX_SESSIONS");
+                freeTrackTable(target);
+                return false;
+            }
+
+            if (session)
+            {
+                // Previous session ends where the data of this track begins,
+                // and the lead-out and lead-in areas are inserted after it.
+                session->leadout = trackinfo->track_start + file_start_lba;
+                uint32_t start = session->leadout + getSessionGap(g_cdrom_session_count[target]);
+                if (trackinfo->track_start == trackinfo->data_start)
+                {
+                    start += CD_PREGAP_LEN;
+                }
+                file_start_lba += start - session->leadout;
+            }
+
+            session = &g_cdrom_sessions[target][g_cdrom_session_count[target]++];
+            session->start = trackinfo->track_start + file_start_lba;
+            session->first_track = trackinfo->track_number;
+            session->disc_type = 0x00; // CD-DA or CD-ROM
+            prev_session_number = trackinfo->session_number;
+        }
+
+        session->last_track = trackinfo->track_number;
+        if (trackinfo->track_mode >= CUETrack_MODE2_2048 && trackinfo->track_mode <= CUETrack_MODE2_2352)
+        {
+            session->disc_type = 0x20; // CD-ROM XA
+        }
+        else if (trackinfo->track_mode == CUETrack_CDI_2336 || trackinfo->track_mode == CUETrack_CDI_2352)
+        {
+            session->disc_type = 0x10; // CD-I
+        }
+
         if (trackinfo->track_mode != CUETrack_AUDIO &&
             trackinfo->track_mode != CUETrack_MODE1_2048 &&
-            trackinfo->track_mode != CUETrack_MODE1_2352)
+            trackinfo->track_mode != CUETrack_MODE1_2352 &&
+            trackinfo->track_mode != CUETrack_MODE2_2352)
         {
             logmsg("---- Warning: track ", trackinfo->track_number, " has unsupported mode ", (int)trackinfo->track_mode);
         }
 
-        if (trackinfo->file_mode != CUEFile_BINARY)
+        // WAVE mode is used for both .wav and .flac files, the image file
+        // layer decodes them based on the file extension.
+        if (trackinfo->file_mode != CUEFile_BINARY &&
+            !((trackinfo->file_mode == CUEFile_WAVE || trackinfo->file_mode == CUEFile_AIFF) &&
+              trackinfo->track_mode == CUETrack_AUDIO))
         {
             logmsg("---- Unsupported CUE data file mode ", (int)trackinfo->file_mode);
         }
+
+        cdrom_track_t &track = g_cdrom_tracks[g_cdrom_track_total++];
+        track.set_file_offset(trackinfo->file_offset);
+        track.data_start = trackinfo->data_start + file_start_lba;
+        track.track_start = trackinfo->track_start + file_start_lba;
+        track.file_pos = file_pos;
+        track.sector_length = trackinfo->sector_length;
+        track.file_name_len = strlen(trackinfo->filename);
+        track.track_number = trackinfo->track_number;
+        track.track_mode = trackinfo->track_mode;
+        track.session = g_cdrom_session_count[target];
+        g_cdrom_track_count[target] = trackcount;
+        prev = &track;
     }
 
     if (trackcount == 0)
@@ -1150,7 +1803,28 @@ bool cdromValidateCueSheet(image_config_t &img)
         return false;
     }
 
-    logmsg("---- Cue sheet loaded with ", (int)trackcount, " tracks");
+    ImageBackingStore *lastfile = getTrackFile(img, prev);
+    if (!lastfile)
+    {
+        freeTrackTable(target);
+        return false;
+    }
+    g_cdrom_leadout[target] = prev->track_start + (lastfile->size() - prev->file_offset()) / prev->sector_length;
+    session->leadout = g_cdrom_leadout[target];
+
+    if (g_cdrom_session_count[target] > 1)
+    {
+        logmsg("---- Cue sheet loaded with ", (int)trackcount, " tracks in ",
+            (int)g_cdrom_session_count[target], " sessions");
+    }
+    else if (prev->file_pos != g_cdrom_tracks[g_cdrom_track_first[target]].file_pos)
+    {
+        logmsg("---- Cue sheet loaded with ", (int)trackcount, " tracks in multiple files");
+    }
+    else
+    {
+        logmsg("---- Cue sheet loaded with ", (int)trackcount, " tracks");
+    }
     return true;
 }
 
@@ -1309,11 +1983,11 @@ static void doPlayAudio(uint32_t lba, uint32_t length)
     }
 
     // if actual playback is requested perform steps to verify prior to playback
-    CUEParser parser;
-    if (loadCueSheet(img, parser))
+    CDROMTrackList tracks;
+    if (getTrackList(img, tracks))
     {
         CUETrackInfo trackinfo = {};
-        getTrackFromLBA(parser, lba, &trackinfo);
+        getTrackFromLBA(tracks, lba, &trackinfo);
 
         if (lba == 0xFFFFFFFF)
         {
@@ -1322,7 +1996,7 @@ static void doPlayAudio(uint32_t lba, uint32_t length)
         }
 
         uint64_t offset = trackinfo.file_offset
-                + trackinfo.sector_length * (lba - trackinfo.track_start);
+                + (uint64_t)trackinfo.sector_length * (lba - trackinfo.track_start);
         dbgmsg("------ Play audio CD: ", (int)length, " sectors starting at ", (int)lba,
            ", track number ", trackinfo.track_number, ", data offset in file ", (int)offset);
 
@@ -1336,10 +2010,19 @@ static void doPlayAudio(uint32_t lba, uint32_t length)
             return;
         }
 
+        // With multi-file cue sheets, playback stops at the end of the track file.
+        // The file stays open in its cache slot until playback ends.
+        ImageBackingStore *file = getTrackFile(img, tracks.find_entry(lba));
+        g_cdrom_audio_file = file;
+        uint64_t end = offset + (uint64_t)length * trackinfo.sector_length;
+        if (file && end > file->size())
+        {
+            end = file->size();
+        }
+
         // playback request appears to be sane, so perform it
         // see earlier note for context on the block length below
-        if (!audio_play(target_id, &(img.file), offset,
-                offset + length * trackinfo.sector_length, false))
+        if (!file || !audio_play(target_id, file, offset, end, false))
         {
             // Underlying data/media error? Fake a disk scratch, which should
             // be a condition most CD-DA players are expecting
@@ -1436,6 +2119,307 @@ static void doMechanismStatus(uint16_t allocation_length)
     scsiDev.phase = DATA_IN;
 }
 
+/**************************************/
+/* Subchannel data                    */
+/**************************************/
+
+// Subchannel data is read from a .sub file next to the image if one exists.
+// Otherwise P and Q channels are generated from the track table and R-W are zero.
+// The .sub file has 96 bytes per sector in CloneCD layout, where each of
+// the channels P to W is stored as 12 consecutive bytes.
+// The file is read through a small sector-indexed cache, so that multi-sector
+// READ CD requests don't need a separate SD card access for every sector.
+#ifndef CDROM_SUBCHANNEL_CACHE_SECTORS
+#define CDROM_SUBCHANNEL_CACHE_SECTORS 16
+#endif
+
+static const uint32_t SUBCHANNEL_LEN = 96;
+
+static struct {
+    uint8_t target; // 0xFF if cache is empty
+    uint32_t first_lba;
+    uint32_t count;
+    uint8_t data[CDROM_SUBCHANNEL_CACHE_SECTORS * SUBCHANNEL_LEN];
+} g_cdrom_subchannel_cache = {0xFF, 0, 0, {}};
+
+bool cdromOpenSubchannelFile(image_config_t &img, const char *filename)
+{
+    if (g_cdrom_subchannel_cache.target == (img.scsiId & 7))
+    {
+        g_cdrom_subchannel_cache.target = 0xFF;
+    }
+    img.subchannelfile.close();
+
+    const char *extension = strrchr(filename, '.');
+    const char *dir = strrchr(filename, '/');
+    size_t baselen = strlen(filename);
+    if (extension && (!dir || extension > dir))
+    {
+        baselen = extension - filename;
+    }
+
+    char subname[MAX_FILE_PATH + 1] = {0};
+    if (baselen + 4 >= sizeof(subname)) return false;
+    memcpy(subname, filename, baselen);
+    strlcat(subname, ".sub", sizeof(subname));
+
+    img.subchannelfile = SD.open(subname, O_RDONLY);
+    if (!img.subchannelfile.isOpen()) return false;
+
+    logmsg("---- Found CD-ROM subchannel data at ", subname);
+    return true;
+}
+
+// Get subchannel data of a sector from the .sub file.
+// Returns nullptr if the file doesn't cover the sector.
+static const uint8_t *readSubchannelFile(image_config_t &img, uint32_t lba)
+{
+    uint8_t target = img.scsiId & 7;
+    auto &cache = g_cdrom_subchannel_cache;
+    if (cache.target != target || lba < cache.first_lba || lba - cache.first_lba >= cache.count)
+    {
+        cache.target = 0xFF;
+        if (!img.subchannelfile.seek((uint64_t)lba * SUBCHANNEL_LEN))
+        {
+            return nullptr;
+        }
+
+        int len = img.subchannelfile.read(cache.data, sizeof(cache.data));
+        if (len < (int)SUBCHANNEL_LEN)
+        {
+            return nullptr;
+        }
+
+        cache.target = target;
+        cache.first_lba = lba;
+        cache.count = len / SUBCHANNEL_LEN;
+    }
+
+    return cache.data + (lba - cache.first_lba) * SUBCHANNEL_LEN;
+}
+
+static uint8_t toBCD(uint8_t value)
+{
+    return ((value / 10) << 4) | (value % 10);
+}
+
+static uint8_t fromBCD(uint8_t value)
+{
+    return (value >> 4) * 10 + (value & 0x0F);
+}
+
+// CRC of the Q channel, refer to ECMA-130 22.3.5
+static uint16_t subchannelQCRC(const uint8_t *q)
+{
+    uint16_t crc = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        crc ^= (uint16_t)q[i] << 8;
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return ~crc;
+}
+
+// Advance a BCD minute-second-frame time by one frame
+static void incrementMSFBCD(uint8_t *msf)
+{
+    uint8_t m = fromBCD(msf[0]), s = fromBCD(msf[1]), f = fromBCD(msf[2]) + 1;
+    if (f == 75) { f = 0; s++; }
+    if (s == 60) { s = 0; m++; }
+    msf[0] = toBCD(m);
+    msf[1] = toBCD(s);
+    msf[2] = toBCD(f);
+}
+
+// Last generated subchannel data. READ CD requests are mostly sequential,
+// so the next sector of the same track only needs its times advanced.
+static struct {
+    uint8_t target; // 0xFF if empty
+    uint8_t track_number;
+    uint32_t data_start;
+    uint32_t lba;
+    uint8_t sub[SUBCHANNEL_LEN];
+} g_cdrom_generated_sub = {0xFF, 0, 0, 0, {}};
+
+// Generate subchannel data of a sector in the .sub file layout.
+// Q channel carries mode 1 position information, refer to ECMA-130 22.3.3
+static void generateSubchannel(uint8_t target, const CUETrackInfo &track, uint32_t lba, uint8_t *sub)
+{
+    auto &last = g_cdrom_generated_sub;
+    if (last.target == target && last.track_number == track.track_number &&
+        last.data_start == track.data_start && lba == last.lba + 1 && last.lba >= track.data_start)
+    {
+        // Continue in the same index of the track
+        uint8_t *q = last.sub + 12;
+        incrementMSFBCD(q + 3);
+        incrementMSFBCD(q + 7);
+        uint16_t crc = subchannelQCRC(q);
+        q[10] = crc >> 8;
+        q[11] = crc & 0xFF;
+        last.lba = lba;
+        memcpy(sub, last.sub, SUBCHANNEL_LEN);
+        return;
+    }
+
+    memset(sub, 0, SUBCHANNEL_LEN);
+
+    bool pregap = (lba < track.data_start);
+    if (pregap)
+    {
+        // P channel flags the pause before a track
+        memset(sub, 0xFF, 12);
+    }
+
+    uint8_t *q = sub + 12;
+    q[0] = (track.track_mode == CUETrack_AUDIO ? 0x01 : 0x41); // Control & ADR
+    q[1] = toBCD(track.track_number);
+    q[2] = pregap ? 0 : 1; // Index number
+    LBA2MSFBCD((int32_t)lba - (int32_t)track.data_start, q + 3, true);
+    q[6] = 0;
+    LBA2MSFBCD(lba, q + 7, false);
+    uint16_t crc = subchannelQCRC(q);
+    q[10] = crc >> 8;
+    q[11] = crc & 0xFF;
+
+    last.target = target;
+    last.track_number = track.track_number;
+    last.data_start = track.data_start;
+    last.lba = lba;
+    memcpy(last.sub, sub, SUBCHANNEL_LEN);
+}
+
+// Convert channels P to W to the interleaved format,
+// where each byte has one bit of each channel, P in the highest bit.
+// Uses a table that spreads 4 bits of a channel to the highest bit of 4 bytes
+// of a little-endian word.
+static void interleaveSubchannel(const uint8_t *sub, uint8_t *dest)
+{
+    static uint32_t spread[16];
+    if (spread[15] == 0)
+    {
+        for (int n = 0; n < 16; n++)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                if (n & (8 >> k)) spread[n] |= (uint32_t)0x80 << (k * 8);
+            }
+        }
+    }
+
+    uint32_t words[SUBCHANNEL_LEN / 4] = {0};
+    for (int channel = 0; channel < 8; channel++)
+    {
+        const uint8_t *src = sub + channel * 12;
+        for (int i = 0; i < 12; i++)
+        {
+            words[i * 2] |= spread[src[i] >> 4] >> channel;
+            words[i * 2 + 1] |= spread[src[i] & 0x0F] >> channel;
+        }
+    }
+
+    memcpy(dest, words, SUBCHANNEL_LEN);
+}
+
+// Get R-W symbols of a sector from the .sub file, with the 6 bits of each
+// symbol in bits 5-0. Symbols are zero if the file doesn't cover the sector.
+static void readSubchannelSymbols(image_config_t &img, uint32_t lba, uint8_t *symbols)
+{
+    memset(symbols, 0, SUBCHANNEL_LEN);
+    const uint8_t *sub = img.subchannelfile.isOpen() ? readSubchannelFile(img, lba) : nullptr;
+    if (!sub) return;
+
+    for (int channel = 2; channel < 8; channel++)
+    {
+        const uint8_t *src = sub + channel * 12;
+        uint8_t bit = 0x80 >> channel;
+        for (uint32_t i = 0; i < SUBCHANNEL_LEN; i++)
+        {
+            if (src[i / 8] & (0x80 >> (i % 8))) symbols[i] |= bit;
+        }
+    }
+}
+
+// De-interleave the four R-W packs of a sector, refer to IEC 60908 section 20.
+// On the disc symbol n of each pack is delayed by n mod 8 packs, after symbols
+// 1 and 18, and 2 and 5 have been swapped. The delay reaches into the next two
+// sectors. Error correction is not done, the .sub data is used as stored.
+static void deinterleaveSubchannelRW(image_config_t &img, uint32_t lba, uint8_t *dest)
+{
+    uint8_t symbols[SUBCHANNEL_LEN * 3];
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        readSubchannelSymbols(img, lba + i, symbols + i * SUBCHANNEL_LEN);
+    }
+
+    for (int pack = 0; pack < 4; pack++)
+    {
+        uint8_t *out = dest + pack * 24;
+        for (int n = 0; n < 24; n++)
+        {
+            out[n] = symbols[(pack + n % 8) * 24 + n];
+        }
+
+        uint8_t tmp = out[1]; out[1] = out[18]; out[18] = tmp;
+        tmp = out[2]; out[2] = out[5]; out[5] = tmp;
+    }
+}
+
+// Write subchannel data of a sector in the format selected by READ CD command.
+// Refer to table 352 in T10/1545-D MMC-4 Revision 5a.
+// Returns pointer to the end of written data.
+static uint8_t *formatSubchannel(image_config_t &img, const CDROMTrackList &tracks,
+                                 uint8_t sub_channel, uint32_t lba, uint8_t *dest)
+{
+    if (sub_channel == 4)
+    {
+        // R-W data only, generated subchannel has none
+        deinterleaveSubchannelRW(img, lba, dest);
+        return dest + SUBCHANNEL_LEN;
+    }
+
+    uint8_t generated[SUBCHANNEL_LEN];
+    const uint8_t *sub = nullptr;
+    if (img.subchannelfile.isOpen())
+    {
+        sub = readSubchannelFile(img, lba);
+    }
+
+    if (!sub)
+    {
+        CUETrackInfo track = {};
+        getTrackFromLBA(tracks, lba, &track);
+        generateSubchannel(img.scsiId & 7, track, lba, generated);
+        sub = generated;
+    }
+
+    if (sub_channel == 2)
+    {
+        // Formatted Q subchannel data
+        // Refer to table 354 in T10/1545-D MMC-4 Revision 5a
+        const uint8_t *q = sub + 12;
+        bool position = ((q[0] & 0x0F) == 1);
+        dest[0] = (q[0] << 4) | (q[0] >> 4); // ADR & Control
+        for (int i = 1; i < 10; i++)
+        {
+            dest[i] = position ? fromBCD(q[i]) : q[i];
+        }
+        dest[10] = q[10]; // CRC
+        dest[11] = q[11];
+        dest[12] = dest[13] = dest[14] = 0; // (pad)
+        dest[15] = sub[0] & 0x80; // P subchannel
+        return dest + 16;
+    }
+    else
+    {
+        // Raw P-W data
+        interleaveSubchannel(sub, dest);
+        return dest + SUBCHANNEL_LEN;
+    }
+}
+
 /*******************************************/
 /* CD-ROM data reading in low level format */
 /*******************************************/
@@ -1450,8 +2434,8 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
     audio_stop(img.scsiId & 7);
 #endif
 
-    CUEParser parser;
-    if (!loadCueSheet(img, parser)
+    CDROMTrackList tracks;
+    if (!getTrackList(img, tracks)
         && (sector_type == 0 || sector_type == 2)
         && main_channel == 0x10 && sub_channel == 0)
     {
@@ -1463,10 +2447,12 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
     // Search the track with the requested LBA
     // Supplies dummy data if no cue sheet is active.
     CUETrackInfo trackinfo = {};
-    getTrackFromLBA(parser, lba, &trackinfo);
+    getTrackFromLBA(tracks, lba, &trackinfo);
 
-    // Figure out the data offset in the file
+    // Figure out the data offset in the file.
+    // With multi-file cue sheets, the file is selected by the track.
     uint64_t offset;
+    const cdrom_track_t *file_track = nullptr;
     if (sector_type == SECTOR_TYPE_VENDOR_PLEXTOR &&
          g_scsi_settings.getDevice(img.scsiId & 0x7)->vendorExtensions & VENDOR_EXTENSION_OPTICAL_PLEXTOR)
     {
@@ -1500,15 +2486,17 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
     }
     else
     {
-        offset = trackinfo.file_offset + trackinfo.sector_length * (lba - trackinfo.track_start);
+        file_track = tracks.find_entry(lba);
+        offset = trackinfo.file_offset + (uint64_t)trackinfo.sector_length * (lba - trackinfo.track_start);
         dbgmsg("------ Read CD: ", (int)length, " sectors starting at ", (int)lba,
             ", track number ", trackinfo.track_number, ", sector size ", (int)trackinfo.sector_length,
             ", main channel ", main_channel, ", sub channel ", sub_channel,
             ", data offset in file ", (int)offset);
     }
     // Ensure read is not out of range of the image
-    uint64_t readend = offset + trackinfo.sector_length * length;
-    if (readend > img.file.size())
+    uint32_t leadout = g_cdrom_leadout[img.scsiId & 7];
+    if (file_track ? ((uint64_t)lba + length > leadout)
+                   : (offset + (uint64_t)trackinfo.sector_length * length > img.file.size()))
     {
         logmsg("WARNING: Host attempted CD read at sector ", lba, "+", length,
               ", exceeding image size ", img.file.size());
@@ -1519,6 +2507,29 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         return;
     }
 
+    if (file_track && isInSessionGap(img.scsiId & 7, lba, length))
+    {
+        dbgmsg("------ Host attempted CD read between sessions at sector ", lba, "+", length);
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE;
+        scsiDev.phase = STATUS;
+        return;
+    }
+
+    ImageBackingStore *file = getTrackFile(img, file_track);
+    uint32_t file_end_lba = file_track ? tracks.file_end(file_track, leadout) : 0xFFFFFFFF;
+    uint64_t file_base = offset;
+    uint32_t file_base_lba = lba;
+    if (!file)
+    {
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = MEDIUM_ERROR;
+        scsiDev.target->sense.asc = UNRECOVERED_READ_ERROR;
+        scsiDev.phase = STATUS;
+        return;
+    }
+
     // Verify sector type
     if (sector_type != 0)
     {
@@ -1531,6 +2542,11 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         {
             sector_type_ok = true;
         }
+        else if ((sector_type == 4 || sector_type == 5) && trackinfo.track_mode == CUETrack_MODE2_2352)
+        {
+            // Mode 2 form 1 or 2, the form is not known without reading the subheader
+            sector_type_ok = true;
+        }
         else if (sector_type == SECTOR_TYPE_VENDOR_PLEXTOR && 
             g_scsi_settings.getDevice(img.scsiId & 0x7)->vendorExtensions & VENDOR_EXTENSION_OPTICAL_PLEXTOR)
         {
@@ -1579,7 +2595,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         // Transfer 2048 bytes of data from file and fake the headers
         sector_length = 2048;
         add_fake_headers = true;
-        dbgmsg("------ Host requested ECC data but image file lacks it, replacing with zeros");
+        dbgmsg("------ Host requested ECC data but image file lacks it, generating it");
     }
     else if (trackinfo.track_mode == CUETrack_MODE1_2352 && main_channel == 0x10)
     {
@@ -1592,6 +2608,18 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         // Transfer whole 2352 byte data sector with ECC to host
         sector_length = AUDIO_CD_SECTOR_LEN;
     }
+    else if (trackinfo.track_mode == CUETrack_MODE2_2352 && main_channel == 0x10)
+    {
+        // Transfer the 2048 byte payload of mode 2 form 1 sector to host,
+        // skipping sync, header and subheader.
+        sector_length = 2048;
+        skip_begin = 24;
+    }
+    else if (trackinfo.track_mode == CUETrack_MODE2_2352 && (main_channel & 0xB8) == 0xB8)
+    {
+        // Transfer whole 2352 byte data sector to host
+        sector_length = AUDIO_CD_SECTOR_LEN;
+    }
     else
     {
         dbgmsg("---- Unsupported channel request for track type ", (int)trackinfo.track_mode);
@@ -1612,11 +2640,21 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         return;
     }
 
-    bool field_q_subchannel = false;
-    if (sub_channel == 2)
+    uint32_t sub_channel_length = 0;
+    if (sub_channel == 1)
+    {
+        // Raw P-W subchannel
+        sub_channel_length = SUBCHANNEL_LEN;
+    }
+    else if (sub_channel == 2)
     {
         // Include position information in Q subchannel
-        field_q_subchannel = true;
+        sub_channel_length = 16;
+    }
+    else if (sub_channel == 4)
+    {
+        // De-interleaved R-W subchannel
+        sub_channel_length = SUBCHANNEL_LEN;
     }
     else if (sub_channel != 0)
     {
@@ -1633,94 +2671,168 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
     scsiDev.dataPtr = 0;
     scsiEnterPhase(DATA_IN);
 
-    // Use two buffers alternately for formatting sector data
-    uint32_t result_length = sector_length + (field_q_subchannel ? 16 : 0) + (add_fake_headers ? 304 : 0);
-    uint8_t *buf0 = scsiDev.data;
-    uint8_t *buf1 = scsiDev.data + result_length;
+    if (g_scsi_settings.getDevice(img.scsiId & 0x7)->vendorExtensions & VENDOR_EXTENSION_OPTICAL_PLEXTOR)
+    {
+        // Plextor raw reads transfer user data only
+        add_fake_headers = false;
+        sub_channel = 0;
+        sub_channel_length = 0;
+    }
+
+    // The formatted sectors are placed in scsiDev.data used as a ring buffer.
+    // Many contiguous sectors are read from the image with a single SD card access,
+    // and then formatted in place while the SCSI bus is still sending earlier sectors.
+    uint32_t header_length = (add_fake_headers ? 16 : 0);
+    uint32_t result_length = header_length + sector_length + (add_fake_headers ? 288 : 0) + sub_channel_length;
+    uint32_t file_sector_length = (sector_length > 0) ? trackinfo.sector_length : 0;
+    if (result_length == 0)
+    {
+        // Only sector type check was requested, nothing to transfer
+        length = 0;
+        result_length = 1;
+    }
+    uint32_t ring_sectors = sizeof(scsiDev.data) / result_length;
+    uint32_t max_batch = ring_sectors / 2;
+    if (max_batch < 1) max_batch = 1;
+
+    // Space needed per sector while the batch is formatted. If the sectors are
+    // longer in the file than in the result, they are read to start of the area
+    // and compacted. Otherwise they are read to the end and expanded.
+    uint32_t batch_unit = (file_sector_length > result_length) ? file_sector_length : result_length;
 
-    // Format the sectors for transfer
-    for (uint32_t idx = 0; idx < length; idx++)
+    uint32_t ringpos = 0;
+    uint32_t idx = 0;
+    while (idx < length && !scsiDev.resetFlag)
     {
         platform_poll();
         diskEjectButtonUpdate(false);
 
-        img.file.seek(offset + idx * trackinfo.sector_length + skip_begin);
+        // Continue from the next track file when data of the current one ends
+        if (file_sector_length > 0 && lba + idx >= file_end_lba)
+        {
+            file_track = tracks.find_entry(lba + idx);
+            file = getTrackFile(img, file_track);
+            if (!file || file_track->sector_length != file_sector_length)
+            {
+                logmsg("CD read crossing to track with different sector length is not supported");
+                scsiDev.status = CHECK_CONDITION;
+                scsiDev.target->sense.code = ILLEGAL_REQUEST;
+                scsiDev.target->sense.asc = 0x6400; // ILLEGAL MODE FOR THIS TRACK
+                scsiDev.phase = STATUS;
+                scsiFinishWrite();
+                return;
+            }
+
+            file_base = file_track->file_offset();
+            file_base_lba = file_track->track_start;
+            file_end_lba = tracks.file_end(file_track, leadout);
+        }
+
+        // Limit batch so that it fits before buffer edge wrap,
+        // and doesn't continue past the end of the track file
+        uint32_t count = length - idx;
+        if (count > max_batch) count = max_batch;
+        if (file_sector_length > 0 && count > file_end_lba - (lba + idx)) count = file_end_lba - (lba + idx);
+        uint32_t space = (ring_sectors - ringpos) * result_length;
+        if (count * batch_unit > space) count = space / batch_unit;
+        if (count == 0)
+        {
+            ringpos = 0;
+            continue;
+        }
 
-        // Verify that previous write using this buffer has finished
-        uint8_t *buf = ((idx & 1) ? buf1 : buf0);
-        uint8_t *bufstart = buf;
+        // Verify that previous writes using this part of the buffer have finished
+        uint8_t *area = scsiDev.data + ringpos * result_length;
+        uint32_t area_len = count * batch_unit;
+        uint32_t area_slots = (area_len + result_length - 1) / result_length;
         uint32_t start = millis();
-        while (!scsiIsWriteFinished(buf + result_length - 1) && !scsiDev.resetFlag)
+        for (uint32_t slot = 0; slot < area_slots && !scsiDev.resetFlag; slot++)
         {
-            if ((uint32_t)(millis() - start) > 5000)
+            while (!scsiIsWriteFinished(area + (slot + 1) * result_length - 1) && !scsiDev.resetFlag)
             {
-                logmsg("doReadCD() timeout waiting for previous to finish");
-                scsiDev.resetFlag = 1;
+                if ((uint32_t)(millis() - start) > 5000)
+                {
+                    logmsg("doReadCD() timeout waiting for previous to finish");
+                    scsiDev.resetFlag = 1;
+                }
+                platform_poll();
+                diskEjectButtonUpdate(false);
             }
-            platform_poll();
-            diskEjectButtonUpdate(false);
         }
         if (scsiDev.resetFlag) break;
-        if ((g_scsi_settings.getDevice(img.scsiId & 0x7)->vendorExtensions & VENDOR_EXTENSION_OPTICAL_PLEXTOR))
+
+        // Read the whole batch of sectors from image
+        uint8_t *src = area;
+        if (file_sector_length > 0)
         {
-            if (sector_length > 0)
+            uint32_t read_len = count * file_sector_length;
+            if (file_sector_length < result_length)
             {
-                // User data
-                img.file.read(buf, sector_length);
-                buf += sector_length;
+                src = area + area_len - read_len;
+            }
+
+            file->seek(file_base + (uint64_t)(lba + idx - file_base_lba) * file_sector_length);
+            if (file->read(src, read_len) != read_len)
+            {
+                logmsg("SD card read failed: ", SD.sdErrorCode());
+                scsiDev.status = CHECK_CONDITION;
+                scsiDev.target->sense.code = MEDIUM_ERROR;
+                scsiDev.target->sense.asc = UNRECOVERED_READ_ERROR;
+                scsiDev.phase = STATUS;
+                scsiFinishWrite();
+                return;
             }
         }
-        else 
+
+        // Format the sectors in place.
+        // User data is moved first, so that the headers don't overwrite it.
+        for (uint32_t i = 0; i < count; i++)
         {
-            if (add_fake_headers)
+            uint8_t *buf = area + i * result_length;
+            uint32_t sector_lba = lba + idx + i;
+
+            if (sector_length > 0)
             {
-                // 12-byte data sector sync pattern
-                *buf++ = 0x00;
-                for (int i = 0; i < 10; i++)
+                uint8_t *data = src + i * file_sector_length + skip_begin;
+                if (data != buf + header_length)
                 {
-                    *buf++ = 0xFF;
+                    memmove(buf + header_length, data, sector_length);
                 }
-                *buf++ = 0x00;
-
-                // 4-byte data sector header
-                LBA2MSFBCD(lba + idx, buf, false);
-                buf += 3;
-                *buf++ = 0x01; // Mode 1
             }
 
-            if (sector_length > 0)
+            if (add_fake_headers)
             {
-                // User data
-                img.file.read(buf, sector_length);
-                buf += sector_length;
+                // 12-byte data sector sync pattern
+                buf[0] = 0x00;
+                memset(buf + 1, 0xFF, 10);
+                buf[11] = 0x00;
+
+                // 4-byte data sector header
+                LBA2MSFBCD(sector_lba, buf + 12, false);
+                buf[15] = 0x01; // Mode 1
             }
 
+            buf += header_length + sector_length;
+
             if (add_fake_headers)
             {
-                // 288 bytes of ECC
-                memset(buf, 0, 288);
+                // 4 bytes of EDC, 8 zero bytes and 276 bytes of P and Q parity
+                cdecc_generate_mode1(buf - header_length - sector_length);
                 buf += 288;
             }
 
-            if (field_q_subchannel)
+            if (sub_channel != 0)
             {
-                // Formatted Q subchannel data
-                // Refer to table 354 in T10/1545-D MMC-4 Revision 5a
-                // and ECMA-130 22.3.3
-                *buf++ = (trackinfo.track_mode == CUETrack_AUDIO ? 0x10 : 0x14); // Control & ADR
-                *buf++ = trackinfo.track_number;
-                *buf++ = (lba + idx >= trackinfo.data_start) ? 1 : 0; // Index number (0 = pregap)
-                int32_t rel = (int32_t)(lba + idx) - (int32_t)trackinfo.data_start;
-                LBA2MSF(rel, buf, true); buf += 3;
-                *buf++ = 0;
-                LBA2MSF(lba + idx, buf, false); buf += 3;
-                *buf++ = 0; *buf++ = 0; // CRC (optional)
-                *buf++ = 0; *buf++ = 0; *buf++ = 0; // (pad)
-                *buf++ = 0; // No P subchannel
+                buf = formatSubchannel(img, tracks, sub_channel, sector_lba, buf);
             }
+
+            assert(buf == area + (i + 1) * result_length);
         }
-        assert(buf == bufstart + result_length);
-        scsiStartWrite(bufstart, result_length);
+
+        scsiStartWrite(area, count * result_length);
+        idx += count;
+        ringpos += count;
+        if (ringpos >= ring_sectors) ringpos = 0;
     }
 
     scsiFinishWrite();
@@ -1742,10 +2854,10 @@ static void doReadSubchannel(bool time, bool subq, uint8_t parameter, uint8_t tr
 
         // Fetch current track info
         image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-        CUEParser parser;
+        CDROMTrackList tracks;
         CUETrackInfo trackinfo = {};
-        loadCueSheet(img, parser);
-        getTrackFromLBA(parser, lba, &trackinfo);
+        getTrackList(img, tracks);
+        getTrackFromLBA(tracks, lba, &trackinfo);
 
         // Request sub channel data at current playback position
         *buf++ = 0; // Reserved
@@ -1821,8 +2933,8 @@ static bool doReadCapacity(uint32_t lba, uint8_t pmi)
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
 
-    CUEParser parser;
-    if (!loadCueSheet(img, parser))
+    CDROMTrackList tracks;
+    if (!getTrackList(img, tracks))
     {
         // basic image, let the disk handler resolve
         return false;
@@ -1831,7 +2943,7 @@ static bool doReadCapacity(uint32_t lba, uint8_t pmi)
     // find the last track on the disk
     CUETrackInfo lasttrack = {0};
     const CUETrackInfo *trackinfo;
-    while ((trackinfo = parser.next_track()) != NULL)
+    while ((trackinfo = tracks.next_track()) != NULL)
     {
         lasttrack = *trackinfo;
     }
@@ -2006,6 +3118,17 @@ extern "C" int scsiCDRomCommand()
             scsiDev.cdb[8];
         doGetConfiguration(rt, startFeature, allocationLength);
     }
+    else if (command == 0xAD)
+    {
+        // READ DVD STRUCTURE
+        uint8_t media_type = scsiDev.cdb[1] & 0x0F;
+        uint8_t layer = scsiDev.cdb[6];
+        uint8_t format = scsiDev.cdb[7];
+        uint16_t allocationLength =
+            (((uint32_t) scsiDev.cdb[8]) << 8) +
+            scsiDev.cdb[9];
+        doReadDVDStructure(media_type, layer, format, allocationLength);
+    }
     else if (command == 0x51)
     {
         uint16_t allocationLength =
@@ -22,8 +22,15 @@ void cdromPerformEject(image_config_t &img);
 void cdromReinsertFirstImage(image_config_t &img);
 
 // Check if the currently loaded cue sheet for the image can be parsed
-// and print warnings about unsupported track types
-bool cdromValidateCueSheet(image_config_t &img);
+// and print warnings about unsupported track types.
+// Track files of multi-file cue sheets are searched in the cue sheet directory.
+bool cdromValidateCueSheet(image_config_t &img, const char *cuesheetname);
+
+// Open subchannel data file with the same base name as the image file, if it exists
+bool cdromOpenSubchannelFile(image_config_t &img, const char *filename);
+
+// Check if the image is too large for a CD and should be reported as DVD-ROM media
+bool cdromIsDVDImage(image_config_t &img);
 
 // Audio playback status
 // boolean flag is true if just basic mechanism status (playback true/false)
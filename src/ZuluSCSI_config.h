@@ -39,6 +39,13 @@
 #define LOGFILE     "zululog.txt"
 #define CRASHFILE   "zuluerr.txt"
 
+// SD card performance measurement results and scratch file used for measuring
+#define SDPERFFILE  "zuluperf.dat"
+#define SDPERFTMP   "zuluperf.tmp"
+
+// Stored sector ranges of image files, used to speed up booting
+#define BOOTCATALOGFILE "zuluboot.dat"
+
 // Prefix for command file to create new image (case-insensitive)
 #define CREATEFILE "create"
 
@@ -115,6 +122,11 @@
 #define PREFETCH_BUFFER_SIZE 8192
 #endif
 
+// Buffer for tape writes, status is returned once data is in RAM
+#ifndef TAPE_WRITE_BUFFER_SIZE
+#define TAPE_WRITE_BUFFER_SIZE 32768
+#endif
+
 // Masks for buttons
 #define EJECT_BTN_MASK (1|2)
 #define USER_BTN_MASK  (4)
@@ -31,11 +31,14 @@
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_config.h"
 #include "ZuluSCSI_settings.h"
+#include "ZuluSCSI_sdperf.h"
 #ifdef ENABLE_AUDIO_OUTPUT
 #include "ZuluSCSI_audio.h"
 #endif
 #include "ZuluSCSI_cdrom.h"
+#include "ZuluSCSI_tape.h"
 #include "ImageBackingStore.h"
+#include "ImageCatalog.h"
 #include "ROMDrive.h"
 #include "QuirksCheck.h"
 #include <minIni.h>
@@ -54,25 +57,6 @@ extern "C" {
 #define PLATFORM_MAX_SCSI_SPEED S2S_CFG_SPEED_ASYNC_50
 #endif
 
-// This can be overridden in platform file to set the size of the transfers
-// used when reading from SCSI bus and writing to SD card.
-// When SD card access is fast, these are usually better increased.
-// If SD card access is roughly same speed as SCSI bus, these can be left at 512
-#ifndef PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE
-#define PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE 512
-#endif
-
-#ifndef PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE
-#define PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE 1024
-#endif
-
-// Optimal size for the last write in a write request.
-// This is often better a bit smaller than PLATFORM_OPTIMAL_SD_WRITE_SIZE
-// to reduce the dead time between end of SCSI transfer and finishing of SD write.
-#ifndef PLATFORM_OPTIMAL_LAST_SD_WRITE_SIZE
-#define PLATFORM_OPTIMAL_LAST_SD_WRITE_SIZE 512
-#endif
-
 // Optimal size for read block from SCSI bus
 // For platforms with nonblocking transfer, this can be large.
 // For Akai MPC60 compatibility this has to be at least 5120
@@ -183,15 +167,35 @@ void image_config_t::clear()
 
 void scsiDiskCloseSDCardImages()
 {
+    // Directory entries of the new card will differ
+    ImageCatalog::clearAll();
+
     for (int i = 0; i < S2S_MAX_TARGETS; i++)
     {
+        // Rolling back the tape index may access the image file
+        scsiTapeDiscardWrites(g_DiskImages[i]);
+
         if (!g_DiskImages[i].file.isRom())
         {
             g_DiskImages[i].file.close();
         }
 
         g_DiskImages[i].cuesheetfile.close();
+        g_DiskImages[i].subchannelfile.close();
+        g_DiskImages[i].tape_index.close();
+    }
+}
+
+bool scsiDiskRevalidateImages()
+{
+    for (int i = 0; i < S2S_MAX_TARGETS; i++)
+    {
+        if (g_DiskImages[i].file.revalidateRange())
+        {
+            return true;
+        }
     }
+    return false;
 }
 
 
@@ -251,6 +255,7 @@ static void scsiDiskSetImageConfig(uint8_t target_idx)
     img.reinsert_after_eject = devCfg->reinsertAfterEject;
     img.ejectButton = devCfg->ejectButton;
     img.vendorExtensions = devCfg->vendorExtensions;
+    img.tape_compression = devCfg->tapeCompression;
 
 #ifdef ENABLE_AUDIO_OUTPUT
     uint16_t vol = devCfg->vol;
@@ -267,7 +272,11 @@ static void scsiDiskSetImageConfig(uint8_t target_idx)
 bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, int blocksize, S2S_CFG_TYPE type, bool use_prefix)
 {
     image_config_t &img = g_DiskImages[target_idx];
+    img.open_pending = false;
     img.cuesheetfile.close();
+    img.subchannelfile.close();
+    scsiTapeFlushWrites(img);
+    img.tape_index.close();
     scsiDiskSetImageConfig(target_idx);
     img.file = ImageBackingStore(filename, blocksize);
 
@@ -278,7 +287,7 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
         img.scsiId = target_idx | S2S_CFG_TARGET_ENABLED;
         img.sdSectorStart = 0;
 
-        if (type != S2S_CFG_NETWORK && img.scsiSectors == 0)
+        if (type != S2S_CFG_NETWORK && img.scsiSectors == 0 && !img.file.isTape())
         {
             logmsg("---- Error: image file ", filename, " is empty");
             img.file.close();
@@ -289,6 +298,10 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
         {
             // ROM is always contiguous, no need to log
         }
+        else if (img.file.isCompressed())
+        {
+            dbgmsg("---- Image file is decoded when read, read-only");
+        }
         else if (img.file.contiguousRange(&sector_begin, &sector_end))
         {
 #ifdef ZULUSCSI_HARDWARE_CONFIG
@@ -353,6 +366,16 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
         {
             logmsg("---- Configuring as tape drive");
             img.deviceType = S2S_CFG_SEQUENTIAL;
+            img.tape_pos = 0;
+            img.tape_write_error = 0;
+            img.tape_sd_free = -1;
+
+            if (img.file.isTape() && !img.tape_index.open(filename, img.file))
+            {
+                logmsg("---- Failed to load tape image '", filename, "', ignoring");
+                img.file.close();
+                return false;
+            }
         }
                 else if (type == S2S_CFG_ZIP100)
         {
@@ -385,18 +408,32 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
             logmsg("---- Read prefetch disabled");
         }
 
-        if (img.deviceType == S2S_CFG_OPTICAL &&
-            strncasecmp(filename + strlen(filename) - 4, ".bin", 4) == 0)
+        const char *extension = strrchr(filename, '.');
+        const char *cue_image_exts[] = {".bin", ".zcd", ".ecm", ".wav", ".flac", ".aif", ".aiff", NULL};
+        bool cue_image = false;
+        for (int i = 0; extension && cue_image_exts[i]; i++)
+        {
+            if (strcasecmp(extension, cue_image_exts[i]) == 0) cue_image = true;
+        }
+
+        if (img.deviceType == S2S_CFG_OPTICAL && cue_image)
         {
             char cuesheetname[MAX_FILE_PATH + 1] = {0};
-            strncpy(cuesheetname, filename, strlen(filename) - 4);
+            strncpy(cuesheetname, filename, extension - filename);
+
+            // ECM images are usually named like CD3.bin.ecm
+            size_t len = strlen(cuesheetname);
+            if (len > 4 && strncasecmp(cuesheetname + len - 4, ".bin", 4) == 0)
+            {
+                cuesheetname[len - 4] = '\0';
+            }
             strlcat(cuesheetname, ".cue", sizeof(cuesheetname));
             img.cuesheetfile = SD.open(cuesheetname, O_RDONLY);
 
             if (img.cuesheetfile.isOpen())
             {
                 logmsg("---- Found CD-ROM CUE sheet at ", cuesheetname);
-                if (!cdromValidateCueSheet(img))
+                if (!cdromValidateCueSheet(img, cuesheetname))
                 {
                     logmsg("---- Failed to parse cue sheet, using as plain binary image");
                     img.cuesheetfile.close();
@@ -407,6 +444,13 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
                 logmsg("---- No CUE sheet found at ", cuesheetname, ", using as plain binary image");
             }
         }
+
+        img.dvd = false;
+        if (img.deviceType == S2S_CFG_OPTICAL)
+        {
+            cdromOpenSubchannelFile(img, filename);
+            img.dvd = cdromIsDVDImage(img);
+        }
         img.use_prefix = use_prefix;
         img.file.getFilename(img.current_image, sizeof(img.current_image));
         return true;
@@ -418,6 +462,118 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
     }
 }
 
+// Parameters for opening deferred image files
+struct pending_image_t
+{
+    char filename[MAX_FILE_PATH * 2 + 2];
+    int lun;
+    int blocksize;
+    S2S_CFG_TYPE type;
+    bool use_prefix;
+};
+static pending_image_t g_pending_images[S2S_MAX_TARGETS];
+
+bool scsiDiskDeferHDDImage(int target_idx, const char *filename, int scsi_lun, int blocksize, S2S_CFG_TYPE type, bool use_prefix)
+{
+    image_config_t &img = g_DiskImages[target_idx];
+    pending_image_t &pending = g_pending_images[target_idx];
+    if (strlen(filename) >= sizeof(pending.filename))
+    {
+        return scsiDiskOpenHDDImage(target_idx, filename, scsi_lun, blocksize, type, use_prefix);
+    }
+
+    strcpy(pending.filename, filename);
+    pending.lun = scsi_lun;
+    pending.blocksize = blocksize;
+    pending.type = type;
+    pending.use_prefix = use_prefix;
+
+    // Publish everything that INQUIRY needs, capacity is known after opening
+    scsiDiskSetImageConfig(target_idx);
+    S2S_CFG_TYPE setting_type = (S2S_CFG_TYPE) g_scsi_settings.getDevice(target_idx)->deviceType;
+    img.deviceType = (setting_type != S2S_CFG_NOT_SET) ? setting_type : type;
+    img.bytesPerSector = blocksize;
+    img.scsiSectors = 0;
+    img.scsiId = target_idx | S2S_CFG_TARGET_ENABLED;
+    img.use_prefix = use_prefix;
+    img.open_pending = true;
+
+    if (img.name_from_image)
+    {
+        setNameFromImage(img, filename);
+    }
+
+    return true;
+}
+
+static bool scsiDiskOpenPendingImage(int target_idx)
+{
+    image_config_t &img = g_DiskImages[target_idx];
+    pending_image_t &pending = g_pending_images[target_idx];
+
+    logmsg("-- Opening ", pending.filename, " for id:", target_idx, " lun:", pending.lun);
+    if (scsiDiskOpenHDDImage(target_idx, pending.filename, pending.lun,
+                             pending.blocksize, pending.type, pending.use_prefix))
+    {
+        scsiDev.targets[target_idx].liveCfg.bytesPerSector = img.bytesPerSector;
+        return true;
+    }
+    else
+    {
+        logmsg("---- Failed to load image, SCSI ID ", target_idx, " no longer responds");
+        scsiDev.targets[target_idx].targetId = 0xff;
+        return false;
+    }
+}
+
+bool scsiDiskOpenPendingImages()
+{
+    for (int i = 0; i < S2S_MAX_TARGETS; i++)
+    {
+        if (g_DiskImages[i].open_pending)
+        {
+            if (scsiDiskOpenPendingImage(i) &&
+                (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_UNIT_ATTENTION) &&
+                scsiDev.targets[i].unitAttention == 0)
+            {
+                // Host may have seen NOT READY from the drive
+                scsiDev.targets[i].unitAttention = NOT_READY_TO_READY_TRANSITION_MEDIUM_MAY_HAVE_CHANGED;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Called before command handlers. Commands that only report the configuration
+// are answered while the image is still being opened in the background,
+// everything that accesses the medium gets NOT READY until it is open.
+// MODE SENSE is included, as its block descriptor and geometry pages depend
+// on the image size.
+extern "C"
+int scsiDiskPendingImageCommand()
+{
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    if (likely(!img.open_pending))
+    {
+        return 0;
+    }
+
+    uint8_t command = scsiDev.cdb[0];
+    if (command == 0x12 || // INQUIRY
+        command == 0x03 || // REQUEST SENSE
+        command == 0xA0)   // REPORT LUNS
+    {
+        return 0;
+    }
+
+    scsiDev.status = CHECK_CONDITION;
+    scsiDev.target->sense.code = NOT_READY;
+    scsiDev.target->sense.asc = LOGICAL_UNIT_IS_IN_PROCESS_OF_BECOMING_READY;
+    scsiDev.phase = STATUS;
+    return 1;
+}
+
 static void checkDiskGeometryDivisible(image_config_t &img)
 {
     if (!img.geometrywarningprinted)
@@ -442,7 +598,7 @@ bool scsiDiskFilenameValid(const char* name)
     if (extension)
     {
         const char *ignore_exts[] = {
-            ".rom_loaded", ".cue", ".txt", ".rtf", ".md", ".nfo", ".pdf", ".doc", ".ini",
+            ".rom_loaded", ".cue", ".sub", ".tix", ".txt", ".rtf", ".md", ".nfo", ".pdf", ".doc", ".ini",
             NULL
         };
         const char *archive_exts[] = {
@@ -605,10 +761,31 @@ static void doPerformEject(image_config_t &img)
 // Finds filename with the lowest lexical order _after_ the given filename in
 // the given folder. If there is no file after the given one, or if there is
 // no current file, this will return the lowest filename encountered.
+// The sorted catalog of the directory is used when available.
 static int findNextImageAfter(image_config_t &img,
         const char* dirname, const char* filename,
         char* buf, size_t buflen)
 {
+    ImageCatalog catalog;
+    if (catalog.open(dirname))
+    {
+        int index = catalog.findNext(filename, img.use_prefix);
+        int len = (index >= 0) ? catalog.getName(index, buf, buflen) : 0;
+        if (len > 0)
+        {
+            img.image_index = index;
+            strncpy(img.current_image, buf, sizeof(img.current_image));
+            return len;
+        }
+        else if (catalog.count() == 0)
+        {
+            logmsg("Image directory '", dirname, "' was empty");
+            img.image_directory = false;
+        }
+        return 0;
+    }
+
+    // Directory could not be cataloged, scan through it
     FsFile dir;
     if (dirname[0] == '\0')
     {
@@ -933,7 +1110,8 @@ bool scsiDiskCheckAnyImagesConfigured()
 {
     for (int i = 0; i < S2S_MAX_TARGETS; i++)
     {
-        if (g_DiskImages[i].file.isOpen() && (g_DiskImages[i].scsiId & S2S_CFG_TARGET_ENABLED))
+        if ((g_DiskImages[i].file.isOpen() || g_DiskImages[i].open_pending) &&
+            (g_DiskImages[i].scsiId & S2S_CFG_TARGET_ENABLED))
         {
             return true;
         }
@@ -1613,9 +1791,9 @@ void diskDataOut()
         }
 
         // Apply platform-specific write size blocks for optimization
-        if (len > PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE)
+        if (len > g_sd_perf.max_write_size)
         {
-            len = PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE;
+            len = g_sd_perf.max_write_size;
         }
 
         uint32_t remain_in_transfer = g_disk_transfer.bytes_scsi - g_disk_transfer.bytes_sd;
@@ -1623,10 +1801,10 @@ void diskDataOut()
         {
             // Use large write blocks in middle of transfer and smaller at the end of transfer.
             // This improves performance for large writes and reduces latency at end of request.
-            uint32_t min_write_size = PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE;
-            if (remain_in_transfer <= PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE)
+            uint32_t min_write_size = g_sd_perf.min_write_size;
+            if (remain_in_transfer <= g_sd_perf.max_write_size)
             {
-                min_write_size = PLATFORM_OPTIMAL_LAST_SD_WRITE_SIZE;
+                min_write_size = g_sd_perf.last_write_size;
             }
 
             if (len < min_write_size)
@@ -1773,6 +1951,15 @@ void diskDataIn_callback(uint32_t bytes_complete)
     // Doing it here lets the SD card transfer proceed in background.
     scsiEnterPhase(DATA_IN);
 
+#ifdef PLATFORM_HAS_SD_SCSI_HANDOFF
+    // Take over from SD DMA interrupt while queueing data here
+    uint32_t bytes_handed_off = platform_stop_sd_scsi_handoff();
+    if (bytes_handed_off > g_disk_transfer.bytes_scsi)
+    {
+        g_disk_transfer.bytes_scsi = bytes_handed_off;
+    }
+#endif
+
     // For best performance, do writes in blocks of 4 or more bytes
     if (bytes_complete < g_disk_transfer.bytes_sd)
     {
@@ -1799,34 +1986,27 @@ void diskDataIn_callback(uint32_t bytes_complete)
         g_disk_transfer.bytes_scsi += len;
     }
 
+#ifdef PLATFORM_HAS_SD_SCSI_HANDOFF
+    // Let the SD DMA interrupt queue the rest of the blocks as soon as they arrive.
+    // Debug logging needs to see all data, so it is done only from here.
+    if (!g_log_debug && g_disk_transfer.bytes_scsi < g_disk_transfer.bytes_sd)
+    {
+        platform_start_sd_scsi_handoff(scsiDev.target->liveCfg.bytesPerSector, g_disk_transfer.bytes_scsi);
+    }
+#endif
+
     // Provide a chance for polling request processing
     scsiIsWriteFinished(NULL);
 }
 
-// Start a data in transfer using given temporary buffer.
-// diskDataIn() below divides the scsiDev.data buffer to two halves for double buffering.
+// Read a block of sectors from SD card into the ring buffer and stream them
+// to SCSI bus as the SD card transfer progresses.
 static void start_dataInTransfer(uint8_t *buffer, uint32_t count)
 {
     g_disk_transfer.buffer = buffer;
     g_disk_transfer.bytes_scsi = 0;
     g_disk_transfer.bytes_sd = count;
 
-    // Verify that previous write using this buffer has finished
-    uint32_t start = millis();
-    while (!scsiIsWriteFinished(buffer + count - 1) && !scsiDev.resetFlag)
-    {
-        if ((uint32_t)(millis() - start) > 5000)
-        {
-            logmsg("start_dataInTransfer() timeout waiting for previous to finish");
-            scsiDev.resetFlag = 1;
-        }
-
-        platform_poll();
-        diskEjectButtonUpdate(false);
-    }
-    if (scsiDev.resetFlag) return;
-
-    // Start transferring from SD card
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
     platform_set_sd_callback(&diskDataIn_callback, buffer);
 
@@ -1838,48 +2018,87 @@ static void start_dataInTransfer(uint8_t *buffer, uint32_t count)
         scsiDev.target->sense.asc = UNRECOVERED_READ_ERROR;
         scsiDev.phase = STATUS;
     }
+    else
+    {
+        diskDataIn_callback(count);
+    }
 
-    diskDataIn_callback(count);
     platform_set_sd_callback(NULL, NULL);
-
-    platform_poll();
-    diskEjectButtonUpdate(false);
 }
 
+// Transfer data from SD card to SCSI bus.
+// scsiDev.data is used as a ring buffer of whole sectors. A new SD card read
+// is started as soon as enough sectors at the ring write position have been
+// sent to the SCSI bus, so that SD and SCSI transfers overlap continuously.
 static void diskDataIn()
 {
-    // Figure out how many blocks we can fit in buffer
     uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
-    uint32_t maxblocks = sizeof(scsiDev.data) / bytesPerSector;
-    uint32_t maxblocks_half = maxblocks / 2;
+    uint32_t ringblocks = sizeof(scsiDev.data) / bytesPerSector;
+    uint32_t ringpos = 0;
 
-    // Start transfer in first half of buffer
-    // Waits for the previous first half transfer to finish first.
-    uint32_t remain = (transfer.blocks - transfer.currentBlock);
-    if (remain > 0)
-    {
-        uint32_t transfer_blocks = std::min(remain, maxblocks_half);
-        uint32_t transfer_bytes = transfer_blocks * bytesPerSector;
-        start_dataInTransfer(&scsiDev.data[0], transfer_bytes);
-        transfer.currentBlock += transfer_blocks;
-    }
+    // Limit SD read sizes to platform optimal values, in sectors
+    uint32_t max_read_blocks = g_sd_perf.max_read_size / bytesPerSector;
+    uint32_t min_read_blocks = g_sd_perf.min_read_size / bytesPerSector;
+    if (max_read_blocks > ringblocks) max_read_blocks = ringblocks;
+    if (max_read_blocks < 1) max_read_blocks = 1;
+    if (min_read_blocks > ringblocks / 2) min_read_blocks = ringblocks / 2;
+    if (min_read_blocks < 1) min_read_blocks = 1;
 
-    // Start transfer in second half of buffer
-    // Waits for the previous second half transfer to finish first
-    remain = (transfer.blocks - transfer.currentBlock);
-    if (remain > 0)
+    uint32_t start = millis();
+    while (transfer.currentBlock < transfer.blocks
+           && scsiDev.phase == DATA_IN
+           && !scsiDev.resetFlag)
     {
-        uint32_t transfer_blocks = std::min(remain, maxblocks_half);
-        uint32_t transfer_bytes = transfer_blocks * bytesPerSector;
-        start_dataInTransfer(&scsiDev.data[maxblocks_half * bytesPerSector], transfer_bytes);
-        transfer.currentBlock += transfer_blocks;
-    }
+        platform_poll();
+        diskEjectButtonUpdate(false);
 
-    if (transfer.currentBlock == transfer.blocks)
-    {
-        // This was the last block, verify that everything finishes
+        // How many sectors until end of transfer or buffer edge wrap?
+        uint32_t available = transfer.blocks - transfer.currentBlock;
+        if (available > ringblocks - ringpos) available = ringblocks - ringpos;
+        if (available > max_read_blocks) available = max_read_blocks;
+
+        // Count sectors at write position that have already been sent to SCSI bus.
+        // Writes complete in order, so checking the last sector is enough if it is done.
+        uint32_t len = 0;
+        if (scsiIsWriteFinished(&scsiDev.data[(ringpos + available) * bytesPerSector - 1]))
+        {
+            len = available;
+        }
+        else
+        {
+            while (len < available && scsiIsWriteFinished(&scsiDev.data[(ringpos + len + 1) * bytesPerSector - 1]))
+            {
+                len++;
+            }
+        }
+
+        // Wait for more space to free up to avoid small inefficient SD reads,
+        // unless the space is limited by buffer edge or end of transfer.
+        if (len < available && len < min_read_blocks)
+        {
+            len = 0;
+        }
+
+        if (len == 0)
+        {
+            if ((uint32_t)(millis() - start) > 5000)
+            {
+                logmsg("diskDataIn() timeout waiting for previous to finish");
+                scsiDev.resetFlag = 1;
+            }
+            continue;
+        }
+
+        start_dataInTransfer(&scsiDev.data[ringpos * bytesPerSector], len * bytesPerSector);
+        transfer.currentBlock += len;
+        ringpos += len;
+        if (ringpos >= ringblocks) ringpos = 0;
+        start = millis();
+    }
 
 #ifdef PREFETCH_BUFFER_SIZE
+    if (transfer.currentBlock == transfer.blocks && scsiDev.phase == DATA_IN)
+    {
         image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
         int prefetchbytes = img.prefetchbytes;
         if (prefetchbytes > PREFETCH_BUFFER_SIZE) prefetchbytes = PREFETCH_BUFFER_SIZE;
@@ -1924,16 +2143,17 @@ static void diskDataIn()
             platform_set_sd_callback(NULL, NULL);
             prefetch_sectors--;
         }
+    }
 #endif
 
-        while (!scsiIsWriteFinished(NULL) && !scsiDev.resetFlag)
-        {
-            platform_poll();
-            diskEjectButtonUpdate(false);
-        }
-
-        scsiFinishWrite();
+    // This was the last block or the transfer was aborted, verify that everything finishes
+    while (!scsiIsWriteFinished(NULL) && !scsiDev.resetFlag)
+    {
+        platform_poll();
+        diskEjectButtonUpdate(false);
     }
+
+    scsiFinishWrite();
 }
 
 
@@ -33,6 +33,7 @@
 #include <scsi2sd.h>
 #include <scsiPhy.h>
 #include "ImageBackingStore.h"
+#include "TapeIndex.h"
 #include "ZuluSCSI_config.h"
 
 extern "C" {
@@ -54,6 +55,9 @@ struct image_config_t: public S2S_TargetCfg
     bool reinsert_on_inquiry; // Reinsert on Inquiry command (to reinsert automatically after boot)
     bool reinsert_after_eject; // Reinsert next image after ejection
 
+    // For CD-ROM drive emulation, image is reported as DVD-ROM media
+    bool dvd;
+
     // selects a physical button channel that will cause an eject action
     // default option of '0' disables this functionality
     uint8_t ejectButton;
@@ -61,12 +65,32 @@ struct image_config_t: public S2S_TargetCfg
     // For tape drive emulation, current position in blocks
     uint32_t tape_pos;
 
+    // For tape container images, index of records and filemarks
+    TapeIndex tape_index;
+
+    // Writes are not buffered, set by MODE SELECT with buffered mode 0
+    bool tape_write_through;
+
+    // Compress records written to tape container, set by MODE SELECT page 0x0F
+    bool tape_compression;
+
+    // Failure to write buffered tape data, reported on next command
+    uint8_t tape_write_error;
+    uint16_t tape_write_error_asc;
+    uint32_t tape_write_residue;
+
+    // Estimate of free SD card space for tape container early warning, -1 if not counted
+    int64_t tape_sd_free;
+
     // True if there is a subdirectory of images for this target
     bool image_directory;
 
     // True if the device type was determined by the drive prefix
     bool use_prefix;
 
+    // True if the image file will be opened after the SCSI bus is enabled
+    bool open_pending;
+
     // the name of the currently mounted image in a dynamic image directory
     char current_image[MAX_FILE_PATH];
 
@@ -78,6 +102,9 @@ struct image_config_t: public S2S_TargetCfg
     // Cue sheet file for CD-ROM images
     FsFile cuesheetfile;
 
+    // Subchannel data file for CD-ROM images
+    FsFile subchannelfile;
+
     // Right-align vendor / product type strings
     // Standard SCSI uses left alignment
     int rightAlignStrings;
@@ -110,6 +137,10 @@ void scsiDiskResetImages();
 // Close any files opened from SD card (prepare for remounting SD)
 void scsiDiskCloseSDCardImages();
 
+// Check one image mounted using a stored sector range against the SD card.
+// Returns false when there are no images left to check.
+bool scsiDiskRevalidateImages();
+
 // Get blocksize from filename or use device setting in ini file
 uint32_t getBlockSize(char *filename, uint8_t scsi_id);
 
@@ -118,6 +149,15 @@ uint8_t getEjectButton(uint8_t idx);
 void    setEjectButton(uint8_t idx, int8_t eject_button);
 
 bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, int blocksize, S2S_CFG_TYPE type = S2S_CFG_FIXED, bool use_prefix = false);
+
+// Configure the target so that it responds to INQUIRY, but open the image
+// file later from scsiDiskOpenPendingImages(). Until then commands that
+// access the medium get NOT READY, BECOMING READY.
+bool scsiDiskDeferHDDImage(int target_idx, const char *filename, int scsi_lun, int blocksize, S2S_CFG_TYPE type = S2S_CFG_FIXED, bool use_prefix = false);
+
+// Open the next deferred image file.
+// Returns false when there are no images left to open.
+bool scsiDiskOpenPendingImages();
 void scsiDiskLoadConfig(int target_idx);
 
 // Checks if a filename extension is appropriate for further processing as a disk image.
@@ -28,6 +28,7 @@
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_log_trace.h"
 #include "ZuluSCSI_initiator.h"
+#include "ZuluSCSI_sdperf.h"
 #include <ZuluSCSI_platform.h>
 #include <minIni.h>
 #include "SdFat.h"
@@ -801,9 +802,9 @@ static void initiatorReadSDCallback(uint32_t bytes_complete)
         // end of SCSI transfer and the SD write completing.
         uint32_t limit = g_initiator_transfer.bytes_scsi / 8;
         uint32_t bytesPerSector = g_initiator_transfer.bytes_per_sector;
-        if (limit < PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE) limit = PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE;
-        if (limit > PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE) limit = PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE;
-        if (limit > len) limit = PLATFORM_OPTIMAL_LAST_SD_WRITE_SIZE;
+        if (limit < g_sd_perf.min_write_size) limit = g_sd_perf.min_write_size;
+        if (limit > g_sd_perf.max_write_size) limit = g_sd_perf.max_write_size;
+        if (limit > len) limit = g_sd_perf.last_write_size;
         if (limit < bytesPerSector) limit = bytesPerSector;
 
         if (len > limit)
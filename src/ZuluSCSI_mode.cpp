@@ -188,6 +188,12 @@ int modeSenseCDCapabilitiesPage(int pc, int idx, int pageCode, int* pageFound)
             idx,
             CDROMCapabilitiesPage,
             sizeof(CDROMCapabilitiesPage));
+
+        image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+        if (pc != 0x01 && img.dvd)
+        {
+            scsiDev.data[idx+2] |= 0x08; // DVD-ROM reading supported
+        }
         return sizeof(CDROMCapabilitiesPage);
     }
     else
@@ -0,0 +1,331 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "ZuluSCSI_sdperf.h"
+#include "ZuluSCSI_config.h"
+#include "ZuluSCSI_log.h"
+#include "ImageBackingStore.h"
+#include <SdFat.h>
+#include <minIni.h>
+#include <string.h>
+
+sd_perf_t g_sd_perf = {
+    PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE,
+    PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE,
+    PLATFORM_OPTIMAL_LAST_SD_WRITE_SIZE,
+    PLATFORM_OPTIMAL_MIN_SD_READ_SIZE,
+    PLATFORM_OPTIMAL_MAX_SD_READ_SIZE
+};
+
+// Stored measurement results.
+// Platform name is included because the SD card drivers differ in speed.
+#define SDPERF_MAGIC 0x46505A53
+#define SDPERF_VERSION 2
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    cid_t cid;
+    char platform[16];
+    sd_perf_t perf;
+} sd_perf_file_t;
+
+// Number of sectors in the scratch file and in the measurement transfers.
+// Single sector transfers measure the command latency, the large transfers
+// give the per-sector time.
+#define SDPERF_SCRATCH_SECTORS 512
+#define SDPERF_SMALL_COUNT 64
+
+// Results of a measurement in microseconds
+struct sd_perf_timing_t {
+    uint32_t latency_us;
+    uint32_t sector_us;
+    uint32_t busy_us; // Time card stays busy after a write
+};
+
+// Result of the latest measurement, to avoid measuring again when the same
+// card is reinserted. Also remembers failures, e.g. on write protected cards.
+static struct {
+    bool valid;
+    bool ok;
+    cid_t cid;
+    sd_perf_t perf;
+} g_sd_perf_last;
+
+// Time large_count transfers of large_sectors, and SDPERF_SMALL_COUNT single sector
+// transfers, and fit a linear model of command latency and per-sector time to them.
+static bool sdPerfMeasure(bool write, uint32_t sector, uint32_t large_sectors, sd_perf_timing_t *result)
+{
+    uint8_t *buf = scsiDev.data;
+    uint32_t large_count = SDPERF_SCRATCH_SECTORS / large_sectors;
+
+    uint32_t start = micros();
+    for (uint32_t i = 0; i < SDPERF_SMALL_COUNT; i++)
+    {
+        bool ok = write ? SD.card()->writeSectors(sector + i, buf, 1)
+                        : SD.card()->readSectors(sector + i, buf, 1);
+        if (!ok) return false;
+    }
+    uint32_t small_us = (uint32_t)(micros() - start) / SDPERF_SMALL_COUNT;
+
+    start = micros();
+    for (uint32_t i = 0; i < large_count; i++)
+    {
+        bool ok = write ? SD.card()->writeSectors(sector + i * large_sectors, buf, large_sectors)
+                        : SD.card()->readSectors(sector + i * large_sectors, buf, large_sectors);
+        if (!ok) return false;
+    }
+    uint32_t large_us = (uint32_t)(micros() - start) / large_count;
+
+    if (large_us <= small_us)
+    {
+        // Larger transfers should never be faster, measurement is not reliable
+        return false;
+    }
+
+    result->sector_us = (large_us - small_us) / (large_sectors - 1);
+    if (result->sector_us == 0) result->sector_us = 1;
+    result->latency_us = (small_us > result->sector_us) ? small_us - result->sector_us : 0;
+    result->busy_us = 0;
+    return true;
+}
+
+// Measure how long the card stays busy after a write of large_sectors.
+// Some SD drivers wait for it at the end of the write, which is already part
+// of the write latency. Others wait before the next command, so the time of a
+// single sector read right after the write is compared to read_us, the time
+// of a read without a write before it.
+static bool sdPerfMeasureBusy(uint32_t sector, uint32_t large_sectors, uint32_t read_us, uint32_t *busy_us)
+{
+    uint8_t *buf = scsiDev.data;
+    uint32_t large_count = SDPERF_SCRATCH_SECTORS / large_sectors;
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; i < large_count; i++)
+    {
+        if (!SD.card()->writeSectors(sector + i * large_sectors, buf, large_sectors))
+        {
+            return false;
+        }
+
+        uint32_t start = micros();
+        while (SD.card()->isBusy())
+        {
+            if ((uint32_t)(micros() - start) > 1000000) return false;
+        }
+
+        if (!SD.card()->readSectors(sector + i * large_sectors, buf, 1))
+        {
+            return false;
+        }
+
+        uint32_t elapsed = micros() - start;
+        if (elapsed > read_us) total += elapsed - read_us;
+    }
+
+    *busy_us = total / large_count;
+    return true;
+}
+
+// Pick power of two transfer size in bytes, where transfer time of the data
+// is ratio times the command latency, limited to range min_size .. max_size.
+static uint32_t sdPerfSelectSize(const sd_perf_timing_t &timing, uint32_t ratio, uint32_t min_size, uint32_t max_size)
+{
+    uint32_t target = (uint64_t)timing.latency_us * ratio * SD_SECTOR_SIZE / timing.sector_us;
+    uint32_t size = SD_SECTOR_SIZE;
+    while (size < target && size < max_size)
+    {
+        size *= 2;
+    }
+
+    if (size < min_size) size = min_size;
+    if (size > max_size) size = max_size;
+    return size;
+}
+
+static uint32_t sdPerfMax(uint32_t a, uint32_t b)
+{
+    return (a > b) ? a : b;
+}
+
+static uint32_t sdPerfPowerOfTwoBelow(uint32_t value)
+{
+    uint32_t result = SD_SECTOR_SIZE;
+    while (result * 2 <= value) result *= 2;
+    return result;
+}
+
+static bool sdPerfRun(sd_perf_t *perf)
+{
+    // Largest power of two transfer that fits in the SCSI buffer
+    uint32_t large_sectors = 1;
+    while (large_sectors * 2 * SD_SECTOR_SIZE <= sizeof(scsiDev.data) &&
+           large_sectors * 2 <= SDPERF_SCRATCH_SECTORS / 4)
+    {
+        large_sectors *= 2;
+    }
+
+    if (large_sectors < 2)
+    {
+        return false;
+    }
+
+    FsFile file = SD.open(SDPERFTMP, O_RDWR | O_CREAT | O_TRUNC);
+    uint32_t begin, end;
+    if (!file.isOpen() ||
+        !file.preAllocate((uint64_t)SDPERF_SCRATCH_SECTORS * SD_SECTOR_SIZE) ||
+        !file.contiguousRange(&begin, &end) ||
+        end < begin + SDPERF_SCRATCH_SECTORS - 1)
+    {
+        logmsg("-- SD card performance test could not allocate scratch file");
+        file.close();
+        SD.remove(SDPERFTMP);
+        return false;
+    }
+
+    platform_set_sd_callback(NULL, NULL);
+    memset(scsiDev.data, 0xAA, large_sectors * SD_SECTOR_SIZE);
+
+    sd_perf_timing_t wr, rd;
+    bool ok = sdPerfMeasure(true, begin, large_sectors, &wr) &&
+              sdPerfMeasure(false, begin, large_sectors, &rd) &&
+              sdPerfMeasureBusy(begin, large_sectors, rd.latency_us + rd.sector_us, &wr.busy_us);
+
+    file.close();
+    SD.remove(SDPERFTMP);
+
+    if (!ok)
+    {
+        logmsg("-- SD card performance test failed, using default transfer sizes");
+        return false;
+    }
+
+    logmsg("-- SD card write latency ", (int)wr.latency_us, " us, ", (int)wr.sector_us, " us/sector, ",
+           (int)wr.busy_us, " us busy after write");
+    logmsg("-- SD card read latency ", (int)rd.latency_us, " us, ", (int)rd.sector_us, " us/sector");
+
+    // Busy time after a write is paid once per write command, like the latency
+    sd_perf_timing_t wr_cmd = wr;
+    wr_cmd.latency_us += wr.busy_us;
+
+    // Transfers are efficient when the data takes 4 times as long as the command
+    // overhead. Slow cards get larger maximum sizes than the platform default,
+    // up to half of the buffer so that SCSI transfers can continue in the
+    // other half. The last write of a request is sized to match the latency so
+    // that it doesn't delay the status phase much, busy time is paid anyway.
+    uint32_t bufmax = sdPerfPowerOfTwoBelow(sizeof(scsiDev.data) / 2);
+    uint32_t max_write = sdPerfSelectSize(wr_cmd, 16, PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE,
+                                          sdPerfMax(bufmax, PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE));
+    uint32_t max_read = sdPerfSelectSize(rd, 16, PLATFORM_OPTIMAL_MAX_SD_READ_SIZE,
+                                         sdPerfMax(bufmax, PLATFORM_OPTIMAL_MAX_SD_READ_SIZE));
+    perf->max_write_size = max_write;
+    perf->min_write_size = sdPerfSelectSize(wr_cmd, 4, SD_SECTOR_SIZE, max_write);
+    perf->last_write_size = sdPerfSelectSize(wr, 1, SD_SECTOR_SIZE, perf->min_write_size);
+    perf->max_read_size = max_read;
+    perf->min_read_size = sdPerfSelectSize(rd, 4, SD_SECTOR_SIZE, max_read / 2);
+    return true;
+}
+
+static bool sdPerfLoad(const cid_t &cid, sd_perf_t *perf)
+{
+    FsFile file = SD.open(SDPERFFILE, O_RDONLY);
+    if (!file.isOpen()) return false;
+
+    sd_perf_file_t stored;
+    bool ok = (file.read(&stored, sizeof(stored)) == sizeof(stored));
+    file.close();
+
+    if (!ok ||
+        stored.magic != SDPERF_MAGIC ||
+        stored.version != SDPERF_VERSION ||
+        memcmp(&stored.cid, &cid, sizeof(cid)) != 0 ||
+        strncmp(stored.platform, PLATFORM_NAME, sizeof(stored.platform)) != 0)
+    {
+        return false;
+    }
+
+    *perf = stored.perf;
+    return true;
+}
+
+static void sdPerfSave(const cid_t &cid, const sd_perf_t &perf)
+{
+    sd_perf_file_t stored;
+    memset(&stored, 0, sizeof(stored));
+    stored.magic = SDPERF_MAGIC;
+    stored.version = SDPERF_VERSION;
+    stored.cid = cid;
+    strncpy(stored.platform, PLATFORM_NAME, sizeof(stored.platform));
+    stored.perf = perf;
+
+    FsFile file = SD.open(SDPERFFILE, O_WRONLY | O_CREAT | O_TRUNC);
+    bool ok = file.isOpen() && file.write(&stored, sizeof(stored)) == sizeof(stored);
+    ok = file.close() && ok;
+    if (!ok)
+    {
+        logmsg("-- Failed to save SD card performance results to " SDPERFFILE);
+    }
+}
+
+void sdPerfInit()
+{
+    g_sd_perf.min_write_size = PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE;
+    g_sd_perf.max_write_size = PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE;
+    g_sd_perf.last_write_size = PLATFORM_OPTIMAL_LAST_SD_WRITE_SIZE;
+    g_sd_perf.min_read_size = PLATFORM_OPTIMAL_MIN_SD_READ_SIZE;
+    g_sd_perf.max_read_size = PLATFORM_OPTIMAL_MAX_SD_READ_SIZE;
+
+    cid_t cid;
+    if (SD.clusterCount() == 0 || !SD.card()->readCID(&cid) ||
+        !ini_getbool("SCSI", "SDAutoTune", true, CONFIGFILE))
+    {
+        return;
+    }
+
+    sd_perf_t perf;
+    if (g_sd_perf_last.valid && memcmp(&g_sd_perf_last.cid, &cid, sizeof(cid)) == 0)
+    {
+        // Card has already been handled since boot, reuse the result.
+        // If the measurement failed or results could not be saved,
+        // it is not repeated until next boot.
+        if (!g_sd_perf_last.ok) return;
+        perf = g_sd_perf_last.perf;
+    }
+    else if (ini_getbool("SCSI", "SDAutoTuneRetest", false, CONFIGFILE) || !sdPerfLoad(cid, &perf))
+    {
+        logmsg("Measuring SD card performance");
+        g_sd_perf_last.valid = true;
+        g_sd_perf_last.cid = cid;
+        g_sd_perf_last.ok = sdPerfRun(&perf);
+        g_sd_perf_last.perf = perf;
+        if (!g_sd_perf_last.ok)
+        {
+            return;
+        }
+
+        // Results are used even if they could not be stored on the card
+        sdPerfSave(cid, perf);
+    }
+
+    g_sd_perf = perf;
+    logmsg("SD card transfer sizes: write ", (int)perf.min_write_size, " to ", (int)perf.max_write_size,
+           " bytes, last write ", (int)perf.last_write_size,
+           " bytes, read ", (int)perf.min_read_size, " to ", (int)perf.max_read_size, " bytes");
+}
@@ -0,0 +1,85 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+/* SD card transfer size selection.
+ *
+ * SD cards differ a lot in command latency and in how long they stay busy
+ * after writes. The platform provides default transfer sizes, which are
+ * optionally adjusted at runtime based on a short measurement of the card.
+ * Results are stored on the card keyed by its CID, so the measurement runs
+ * only once.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "ZuluSCSI_platform.h"
+
+// This can be overridden in platform file to set the size of the transfers
+// used when reading from SCSI bus and writing to SD card.
+// When SD card access is fast, these are usually better increased.
+// If SD card access is roughly same speed as SCSI bus, these can be left at 512
+#ifndef PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE
+#define PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE 512
+#endif
+
+#ifndef PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE
+#define PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE 1024
+#endif
+
+// Optimal size for the last write in a write request.
+// This is often better a bit smaller than PLATFORM_OPTIMAL_SD_WRITE_SIZE
+// to reduce the dead time between end of SCSI transfer and finishing of SD write.
+#ifndef PLATFORM_OPTIMAL_LAST_SD_WRITE_SIZE
+#define PLATFORM_OPTIMAL_LAST_SD_WRITE_SIZE 512
+#endif
+
+// Limits for the size of SD card reads used in read requests.
+// Data is streamed to SCSI bus while the SD card read progresses, so large reads
+// are good. A new read is started only once at least the minimum amount of buffer
+// space is free, to avoid the command overhead of many small reads.
+#ifndef PLATFORM_OPTIMAL_MIN_SD_READ_SIZE
+#define PLATFORM_OPTIMAL_MIN_SD_READ_SIZE 8192
+#endif
+
+#ifndef PLATFORM_OPTIMAL_MAX_SD_READ_SIZE
+#define PLATFORM_OPTIMAL_MAX_SD_READ_SIZE 65536
+#endif
+
+// Transfer sizes in bytes currently in use.
+// The maximum sizes are at least the platform values, and are raised for
+// cards with high command latency or long busy time after writes.
+typedef struct {
+    uint32_t min_write_size;
+    uint32_t max_write_size;
+    uint32_t last_write_size;
+    uint32_t min_read_size;
+    uint32_t max_read_size;
+} sd_perf_t;
+
+extern sd_perf_t g_sd_perf;
+
+// Select transfer sizes for the currently mounted SD card.
+// Measurement can be disabled with SDAutoTune in config. Uses stored results if
+// the card has been measured before, otherwise measures it using a scratch
+// file. Falls back to platform defaults if the card has no filesystem,
+// measurement is disabled or it has failed for this card since boot.
+void sdPerfInit();
@@ -26,7 +26,9 @@
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_config.h"
 #include "ZuluSCSI_settings.h"
+#include "ROMDrive.h"
 #include <strings.h>
+#include <stddef.h>
 #include <minIni.h>
 #include <minIni_cache.h>
 
@@ -234,7 +236,16 @@ static void readIniSCSIDeviceSetting(scsi_device_settings_t &cfg, const char *se
 
     cfg.blockSize = ini_getl(section, "BlockSize", cfg.blockSize, CONFIGFILE);
 
+    cfg.tapeCompression = ini_getbool(section, "TapeCompression", cfg.tapeCompression, CONFIGFILE);
+
     char tmp[32];
+    ini_gets(section, "DVD", "", tmp, sizeof(tmp), CONFIGFILE);
+    if (tmp[0])
+    {
+        cfg.dvdMedia = strequals(tmp, "auto") ? -1 : (atoi(tmp) ? 1 : 0);
+    }
+    memset(tmp, 0, sizeof(tmp));
+
     ini_gets(section, "Vendor", "", tmp, sizeof(tmp), CONFIGFILE);
     if (tmp[0])
     {
@@ -297,6 +308,12 @@ scsi_system_settings_t *ZuluSCSISettings::initSystem(const char *presetName)
     cfgSys.useFATAllocSize = false;
     cfgSys.enableCDAudio = false;
     cfgSys.enableUSBMassStorage = false;
+    cfgSys.backgroundImageOpen = false;
+
+    if (loadSnapshot(presetName, img.quirks))
+    {
+        return &cfgSys;
+    }
     
     // setting set for all or specific devices
     cfgDev.deviceType = S2S_CFG_NOT_SET;
@@ -320,6 +337,10 @@ scsi_system_settings_t *ZuluSCSISettings::initSystem(const char *presetName)
 
     cfgDev.blockSize = 0;
 
+    cfgDev.tapeCompression = false;
+
+    cfgDev.dvdMedia = -1;
+
     // System-specific defaults
 
     if (strequals(systemPresetName[SYS_PRESET_NONE], presetName))
@@ -392,13 +413,20 @@ scsi_system_settings_t *ZuluSCSISettings::initSystem(const char *presetName)
     cfgSys.enableCDAudio = ini_getbool("SCSI", "EnableCDAudio", cfgSys.enableCDAudio, CONFIGFILE);
 
     cfgSys.enableUSBMassStorage = ini_getbool("SCSI", "EnableUSBMassStorage", cfgSys.enableUSBMassStorage, CONFIGFILE);
-    
+    cfgSys.backgroundImageOpen = ini_getbool("SCSI", "BackgroundImageOpen", cfgSys.backgroundImageOpen, CONFIGFILE);
+
+    storeSnapshotSystem();
     return &cfgSys;
 }
 
 scsi_device_settings_t* ZuluSCSISettings::initDevice(uint8_t scsiId, S2S_CFG_TYPE type)
 {
     scsi_device_settings_t& cfg = m_dev[scsiId];
+    if (loadSnapshotDevice(scsiId, type))
+    {
+        return &cfg;
+    }
+
     char presetName[32] = {};
     char section[6] = "SCSI0";
     section[4] = '0' + scsiId;
@@ -452,6 +480,7 @@ scsi_device_settings_t* ZuluSCSISettings::initDevice(uint8_t scsiId, S2S_CFG_TYP
     formatDriveInfoField(cfg.revision, sizeof(cfg.revision), cfg.rightAlignStrings);
     formatDriveInfoField(cfg.serial, sizeof(cfg.serial), true);
 
+    storeSnapshotDevice(scsiId, type);
     return &cfg;
 }
 
@@ -483,4 +512,215 @@ scsi_device_preset_t ZuluSCSISettings::getDevicePreset(uint8_t scsiId)
 const char* ZuluSCSISettings::getDevicePresetName(uint8_t scsiId)
 {
     return devicePresetName[m_devPreset[scsiId]];
-}
\ No newline at end of file
+}
+/**************************************/
+/* Settings snapshot in flash memory  */
+/**************************************/
+
+#ifdef PLATFORM_HAS_SETTINGS_FLASH
+
+#define SETTINGS_SNAPSHOT_MAGIC 0x5353435A
+#define SETTINGS_SNAPSHOT_VERSION 1
+#define SETTINGS_SNAPSHOT_SIZE 1024
+
+// Settings as they were right after initSystem() and initDevice().
+// Devices are restored only if they are initialized with the same type.
+typedef struct __attribute__((__packed__)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;
+    uint32_t key; // Hash of config file and other inputs to settings
+    uint8_t sysPreset;
+    uint8_t devValid; // Bit mask of stored devices
+    uint8_t devType[8];
+    uint8_t devPreset[8];
+    scsi_system_settings_t sys;
+    scsi_device_settings_t dev[9];
+    uint32_t checksum;
+} settings_snapshot_t;
+
+static_assert(sizeof(settings_snapshot_t) <= SETTINGS_SNAPSHOT_SIZE, "Settings snapshot too large");
+static_assert(SETTINGS_SNAPSHOT_SIZE <= PLATFORM_SETTINGS_FLASH_SIZE, "Settings snapshot too large");
+
+static union {
+    settings_snapshot_t snapshot;
+    uint8_t raw[SETTINGS_SNAPSHOT_SIZE];
+} g_settings_snapshot;
+
+static bool g_settings_snapshot_enabled;
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ p[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+static uint32_t snapshotChecksum(const settings_snapshot_t &snapshot)
+{
+    return fnv1a(2166136261UL, &snapshot, offsetof(settings_snapshot_t, checksum));
+}
+
+// Hash everything that the resolved settings depend on besides device types
+static uint32_t snapshotKey(const char *presetName, uint8_t defaultQuirks)
+{
+    uint32_t hash = 2166136261UL;
+    hash = fnv1a(hash, g_log_firmwareversion, strlen(g_log_firmwareversion));
+    hash = fnv1a(hash, presetName, strlen(presetName) + 1);
+    hash = fnv1a(hash, &defaultQuirks, sizeof(defaultQuirks));
+
+    // Default serial numbers come from the SD card
+    cid_t sd_cid;
+    uint32_t sd_sn = 0;
+    if (SD.card()->readCID(&sd_cid))
+    {
+        sd_sn = sd_cid.psn();
+    }
+    hash = fnv1a(hash, &sd_sn, sizeof(sd_sn));
+
+    FsFile file = SD.open(CONFIGFILE, O_RDONLY);
+    if (file.isOpen())
+    {
+        uint8_t buf[256];
+        int len;
+        while ((len = file.read(buf, sizeof(buf))) > 0)
+        {
+            hash = fnv1a(hash, buf, len);
+        }
+        file.close();
+    }
+
+    return hash;
+}
+
+bool ZuluSCSISettings::loadSnapshot(const char *presetName, uint8_t defaultQuirks)
+{
+    settings_snapshot_t &snapshot = g_settings_snapshot.snapshot;
+    g_settings_snapshot_enabled = false;
+
+#ifdef ZULUSCSI_HARDWARE_CONFIG
+    if (g_hw_config.is_active()) return false;
+#endif
+
+    if (SD.clusterCount() == 0 || !ini_getbool("SCSI", "SettingsSnapshot", true, CONFIGFILE))
+    {
+        return false;
+    }
+
+#ifdef PLATFORM_HAS_ROM_DRIVE
+    // ROM drive programmed by older firmware can extend to the end of flash
+    romdrive_hdr_t hdr;
+    if (romDriveCheckPresent(&hdr) &&
+        hdr.imagesize + PLATFORM_ROMDRIVE_PAGE_SIZE > platform_get_romdrive_maxsize())
+    {
+        return false;
+    }
+#endif
+
+    g_settings_snapshot_enabled = true;
+    uint32_t key = snapshotKey(presetName, defaultQuirks);
+
+    if (platform_read_settings_flash(g_settings_snapshot.raw, sizeof(g_settings_snapshot.raw)) &&
+        snapshot.magic == SETTINGS_SNAPSHOT_MAGIC &&
+        snapshot.version == SETTINGS_SNAPSHOT_VERSION &&
+        snapshot.length == sizeof(settings_snapshot_t) &&
+        snapshot.key == key &&
+        snapshot.checksum == snapshotChecksum(snapshot))
+    {
+        m_sysPreset = (scsi_system_preset_t)snapshot.sysPreset;
+        memcpy(&m_sys, &snapshot.sys, sizeof(m_sys));
+        memcpy(&m_dev[SCSI_SETTINGS_SYS_IDX], &snapshot.dev[SCSI_SETTINGS_SYS_IDX], sizeof(scsi_device_settings_t));
+        dbgmsg("Loaded settings snapshot from flash");
+        return true;
+    }
+
+    // Config has changed, settings are parsed and stored again
+    memset(&g_settings_snapshot, 0, sizeof(g_settings_snapshot));
+    snapshot.magic = SETTINGS_SNAPSHOT_MAGIC;
+    snapshot.version = SETTINGS_SNAPSHOT_VERSION;
+    snapshot.length = sizeof(settings_snapshot_t);
+    snapshot.key = key;
+    return false;
+}
+
+bool ZuluSCSISettings::loadSnapshotDevice(uint8_t scsiId, S2S_CFG_TYPE type)
+{
+    settings_snapshot_t &snapshot = g_settings_snapshot.snapshot;
+    if (!g_settings_snapshot_enabled ||
+        !(snapshot.devValid & (1 << scsiId)) ||
+        snapshot.devType[scsiId] != type)
+    {
+        return false;
+    }
+
+    m_devPreset[scsiId] = (scsi_device_preset_t)snapshot.devPreset[scsiId];
+    memcpy(&m_dev[scsiId], &snapshot.dev[scsiId], sizeof(scsi_device_settings_t));
+    return true;
+}
+
+void ZuluSCSISettings::storeSnapshotSystem()
+{
+    settings_snapshot_t &snapshot = g_settings_snapshot.snapshot;
+    if (!g_settings_snapshot_enabled) return;
+
+    snapshot.sysPreset = m_sysPreset;
+    memcpy(&snapshot.sys, &m_sys, sizeof(m_sys));
+    memcpy(&snapshot.dev[SCSI_SETTINGS_SYS_IDX], &m_dev[SCSI_SETTINGS_SYS_IDX], sizeof(scsi_device_settings_t));
+}
+
+void ZuluSCSISettings::storeSnapshotDevice(uint8_t scsiId, S2S_CFG_TYPE type)
+{
+    settings_snapshot_t &snapshot = g_settings_snapshot.snapshot;
+    if (!g_settings_snapshot_enabled) return;
+
+    snapshot.devValid |= (1 << scsiId);
+    snapshot.devType[scsiId] = type;
+    snapshot.devPreset[scsiId] = m_devPreset[scsiId];
+    memcpy(&snapshot.dev[scsiId], &m_dev[scsiId], sizeof(scsi_device_settings_t));
+}
+
+void ZuluSCSISettings::saveSnapshot()
+{
+    settings_snapshot_t &snapshot = g_settings_snapshot.snapshot;
+    if (!g_settings_snapshot_enabled) return;
+
+    snapshot.checksum = snapshotChecksum(snapshot);
+
+    // Flash is only written when the settings have changed
+    settings_snapshot_t stored;
+    if (platform_read_settings_flash((uint8_t*)&stored, sizeof(stored)) &&
+        memcmp(&stored, &snapshot, sizeof(stored)) == 0)
+    {
+        return;
+    }
+
+    if (platform_write_settings_flash(g_settings_snapshot.raw, sizeof(g_settings_snapshot.raw)))
+    {
+        dbgmsg("Saved settings snapshot to flash");
+    }
+    else
+    {
+        logmsg("Failed to save settings snapshot to flash");
+    }
+}
+
+#else
+
+bool ZuluSCSISettings::loadSnapshot(const char *presetName, uint8_t defaultQuirks)
+{
+    return false;
+}
+
+bool ZuluSCSISettings::loadSnapshotDevice(uint8_t scsiId, S2S_CFG_TYPE type)
+{
+    return false;
+}
+
+void ZuluSCSISettings::storeSnapshotSystem() {}
+void ZuluSCSISettings::storeSnapshotDevice(uint8_t scsiId, S2S_CFG_TYPE type) {}
+void ZuluSCSISettings::saveSnapshot() {}
+
+#endif // PLATFORM_HAS_SETTINGS_FLASH
@@ -66,6 +66,7 @@ typedef struct __attribute__((__packed__)) scsi_system_settings_t
     bool useFATAllocSize;
     bool enableCDAudio;
     bool enableUSBMassStorage;
+    bool backgroundImageOpen;
 } scsi_system_settings_t;
 
 // This struct should only have new setting added to the end
@@ -98,6 +99,11 @@ typedef struct __attribute__((__packed__)) scsi_device_settings_t
     uint32_t vendorExtensions;
 
     uint32_t blockSize;
+
+    bool tapeCompression;
+
+    // CD-ROM images reported as DVD media: -1 auto, 0 never, 1 always
+    int8_t dvdMedia;
 } scsi_device_settings_t;
 
 
@@ -131,6 +137,11 @@ public:
     // return the device preset name
     const char* getDevicePresetName(uint8_t scsiId);
 
+    // Save the resolved settings to flash if they have changed, so that the
+    // next boot with the same config file can skip parsing it.
+    // Call after all devices have been initialized and before the SCSI bus is enabled.
+    void saveSnapshot();
+
 protected:
     // Set default drive vendor / product info after the image file
     // is loaded and the device type is known.
@@ -139,6 +150,14 @@ protected:
     // Settings for the specific device
     const char **deviceInitST32430N(uint8_t scsiId);
 
+    // Restore settings from the snapshot in flash, if it matches the config file
+    bool loadSnapshot(const char *presetName, uint8_t defaultQuirks);
+    bool loadSnapshotDevice(uint8_t scsiId, S2S_CFG_TYPE type);
+
+    // Record resolved settings for saving to the snapshot
+    void storeSnapshotSystem();
+    void storeSnapshotDevice(uint8_t scsiId, S2S_CFG_TYPE type);
+
     // Informative name of the preset configuration, or NULL for defaults
     scsi_system_preset_t m_sysPreset;
     // The last preset is for the device specific under [SCSI] in the CONFIGFILE
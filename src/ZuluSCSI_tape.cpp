@@ -26,6 +26,8 @@
 #include "ZuluSCSI_disk.h"
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_config.h"
+#include "ZuluSCSI_settings.h"
+#include <ZCD.h>
 
 extern "C" {
 #include <scsi.h>
@@ -56,12 +58,1219 @@ static void doSeek(uint32_t lba)
     }
 }
 
+/*************************************************/
+/* Tape container images with variable records   */
+/*************************************************/
+
+// Report a tape condition with information field, such as residue count
+static void tapeSetSense(uint8_t code, uint16_t asc, uint8_t flags, uint32_t info)
+{
+    scsiDev.status = CHECK_CONDITION;
+    scsiDev.target->sense.code = code;
+    scsiDev.target->sense.asc = asc;
+    scsiDev.target->sense.flags = flags | SENSE_INFO_VALID;
+    scsiDev.target->sense.info = info;
+    scsiDev.phase = STATUS;
+}
+
+static void tapePutLength(uint8_t *buf, uint32_t length)
+{
+    buf[0] = (length >>  0) & 0xFF;
+    buf[1] = (length >>  8) & 0xFF;
+    buf[2] = (length >> 16) & 0xFF;
+    buf[3] = (length >> 24) & 0xFF;
+}
+
+/*************************************************/
+/* Record compression                            */
+/*************************************************/
+
+// Records are compressed in scsiDev.data: the received record with its
+// length fields at the start, the compressed record after it, and the hash
+// table of the encoder at the end. Larger records are stored as they are.
+#define TAPE_COMPRESS_HASH_BYTES (ZCD_FAST_HASH_SIZE * sizeof(uint16_t))
+#define TAPE_COMPRESS_OVERHEAD 32
+
+// After a record doesn't compress, store this many without trying,
+// so that already compressed data is written at full speed.
+#define TAPE_COMPRESS_SKIP_RECORDS 16
+
+static uint32_t g_tape_compress_skip;
+
+// Statistics since the last filemark, for tuning
+static struct {
+    uint32_t records;
+    uint32_t in_bytes;
+    uint32_t out_bytes;
+    uint32_t time_ms;
+} g_tape_compress_stats;
+
+// Longest record that is compressed, 0 if scsiDev.data is too small
+static uint32_t tapeCompressMaxRecord()
+{
+    if (sizeof(scsiDev.data) < TAPE_COMPRESS_HASH_BYTES + TAPE_COMPRESS_OVERHEAD * 4)
+    {
+        return 0;
+    }
+
+    uint32_t max = ((sizeof(scsiDev.data) - TAPE_COMPRESS_HASH_BYTES - TAPE_COMPRESS_OVERHEAD) / 2) & ~3;
+    if (max > ZCD_FAST_MAX_LEN) max = ZCD_FAST_MAX_LEN;
+    return max;
+}
+
+// Space needed in scsiDev.data for receiving and compressing a record
+static uint32_t tapeCompressSpace(uint32_t reclen)
+{
+    return 2 * reclen + TAPE_COMPRESS_OVERHEAD;
+}
+
+// Compressed records are padded to a multiple of this size in image, so
+// that records of similar size share an index run and writes stay aligned.
+// The padding is kept below 1/16 of the record length.
+static uint32_t tapeCompressGranule(uint32_t reclen)
+{
+    uint32_t granule = SD_SECTOR_SIZE;
+    while (granule * 16 < reclen) granule *= 2;
+    return granule;
+}
+
+static bool tapeCompressEnabled(image_config_t &img, uint32_t reclen)
+{
+    return img.tape_compression && img.tape_index.isOpen() && reclen <= tapeCompressMaxRecord();
+}
+
+// Receive a record from the host and build it at buf with length fields,
+// compressed if it gets smaller. Stores its size in image and the stored
+// length for the index. There must be tapeCompressSpace(reclen) bytes
+// at buf before the hash table.
+static void tapeReceiveRecord(uint8_t *buf, uint32_t reclen, uint32_t *recsize, uint32_t *stored, int *parityError)
+{
+    tapePutLength(buf, reclen);
+    scsiRead(buf + 4, reclen, parityError);
+
+    *stored = 0;
+    if (g_tape_compress_skip > 0)
+    {
+        g_tape_compress_skip--;
+    }
+    else
+    {
+        uint32_t start = millis();
+        uint8_t *out = buf + ((8 + reclen + 8) & ~3);
+        uint16_t *hashtable = (uint16_t*)(scsiDev.data + sizeof(scsiDev.data) - TAPE_COMPRESS_HASH_BYTES);
+        uint32_t clen = zcd_compress_fast(buf + 4, reclen, out + 4 + TAPE_COMPRESSED_INFO_SIZE, hashtable);
+
+        // Round the record size up to the granule
+        uint32_t granule = tapeCompressGranule(reclen);
+        uint32_t size = (TapeIndex::recordSize(TAPE_COMPRESSED_INFO_SIZE + clen) + granule - 1) / granule * granule;
+
+        g_tape_compress_stats.records++;
+        g_tape_compress_stats.in_bytes += reclen;
+        g_tape_compress_stats.time_ms += millis() - start;
+
+        if (clen > 0 && size + granule <= TapeIndex::recordSize(reclen))
+        {
+            uint32_t len = size - 8;
+            uint32_t marker = TAPE_RECORD_COMPRESSED | len;
+            tapePutLength(out, marker);
+            tapePutLength(out + 4, reclen | ((uint32_t)ZCD_CODEC_LZ << 24));
+            tapePutLength(out + 8, clen);
+            memset(out + 4 + TAPE_COMPRESSED_INFO_SIZE + clen, 0, len - TAPE_COMPRESSED_INFO_SIZE - clen);
+            tapePutLength(out + 4 + len, marker);
+            memmove(buf, out, size);
+
+            g_tape_compress_stats.out_bytes += len;
+            *stored = len;
+            *recsize = size;
+            return;
+        }
+
+        g_tape_compress_stats.out_bytes += reclen;
+        g_tape_compress_skip = TAPE_COMPRESS_SKIP_RECORDS;
+    }
+
+    // Padding and length after data
+    uint32_t padding = reclen & 1;
+    buf[4 + reclen] = 0;
+    tapePutLength(buf + 4 + reclen + padding, reclen);
+    *recsize = TapeIndex::recordSize(reclen);
+}
+
+static void tapeCompressLogStats()
+{
+    if (g_tape_compress_stats.records > 0)
+    {
+        dbgmsg("------ Tape compression: ", (int)g_tape_compress_stats.records, " records, ",
+               (int)(g_tape_compress_stats.in_bytes / 1024), " kB to ",
+               (int)(g_tape_compress_stats.out_bytes / 1024), " kB in ",
+               (int)g_tape_compress_stats.time_ms, " ms");
+        memset(&g_tape_compress_stats, 0, sizeof(g_tape_compress_stats));
+    }
+}
+
+// Compression runs inline during DATA OUT, so it is offered to the host
+// only when enabled with TapeCompression in config.
+extern "C" int scsiTapeCompressionSupported()
+{
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    return g_scsi_settings.getDevice(img.scsiId & 0x7)->tapeCompression &&
+           img.tape_index.isOpen() && tapeCompressMaxRecord() > 0;
+}
+
+extern "C" int scsiTapeCompression()
+{
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    return img.tape_compression && scsiTapeCompressionSupported();
+}
+
+extern "C" int scsiTapeSetCompression(int enable)
+{
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    if (enable && !scsiTapeCompressionSupported())
+    {
+        return 0;
+    }
+
+    if (img.tape_compression != (bool)enable)
+    {
+        dbgmsg("------ Tape compression ", enable ? "enabled" : "disabled");
+    }
+    img.tape_compression = enable;
+    g_tape_compress_skip = 0;
+    return 1;
+}
+
+// Record data is read to one half of scsiDev.data while the other is being sent
+typedef struct {
+    uint32_t half;
+    const uint8_t *pending[2]; // End of last transfer from each half
+    bool started;
+} tape_send_t;
+
+static uint8_t *tapeSendBuffer(tape_send_t &send)
+{
+    uint8_t *buf = scsiDev.data + send.half * (sizeof(scsiDev.data) / 2);
+    const uint8_t *pending = send.pending[send.half];
+    uint32_t start = millis();
+    while (pending && !scsiIsWriteFinished(pending - 1) && !scsiDev.resetFlag)
+    {
+        if ((uint32_t)(millis() - start) > 5000)
+        {
+            logmsg("Tape read timeout waiting for previous to finish");
+            scsiDev.resetFlag = 1;
+        }
+        platform_poll();
+    }
+    return buf;
+}
+
+static void tapeStartSend(tape_send_t &send, uint8_t *buf, uint32_t len)
+{
+    if (!send.started)
+    {
+        scsiEnterPhase(DATA_IN);
+        send.started = true;
+    }
+
+    scsiStartWrite(buf, len);
+    send.pending[send.half] = buf + len;
+    send.half ^= 1;
+}
+
+// Decompress records to the half being sent. The compressed data is read
+// to the end of the same half if it fits after the record, otherwise to the
+// other half after it has been sent.
+static bool tapeSendCompressed(image_config_t &img, tape_send_t &send, const tape_record_t &rec, uint32_t datalen, uint32_t count)
+{
+    uint32_t halfsize = sizeof(scsiDev.data) / 2;
+    uint64_t stride = TapeIndex::recordSize(rec);
+    uint32_t stored = rec.stored_length;
+
+    if (rec.length > halfsize || stored > halfsize)
+    {
+        logmsg("Compressed tape record of ", (int)rec.length, " bytes is too large for this device");
+        return false;
+    }
+
+    for (uint32_t idx = 0; idx < count && !scsiDev.resetFlag; idx++)
+    {
+        uint8_t *buf = tapeSendBuffer(send);
+        uint8_t *comp;
+        if (rec.length + stored + 4 <= halfsize)
+        {
+            comp = buf + ((halfsize - stored) & ~3);
+        }
+        else
+        {
+            send.half ^= 1;
+            comp = tapeSendBuffer(send);
+            send.half ^= 1;
+        }
+
+        if (!img.file.seek(rec.offset + idx * stride + 4) || img.file.read(comp, stored) != (ssize_t)stored)
+        {
+            return false;
+        }
+
+        // Info holds the logical length and codec, then the compressed length
+        uint32_t info = comp[0] | (comp[1] << 8) | (comp[2] << 16) | ((uint32_t)comp[3] << 24);
+        uint32_t clen = comp[4] | (comp[5] << 8) | (comp[6] << 16) | ((uint32_t)comp[7] << 24);
+        if ((info & TAPE_RECORD_LENGTH_MASK) != rec.length ||
+            clen > stored - TAPE_COMPRESSED_INFO_SIZE ||
+            !zcd_decompress(info >> 24, comp + TAPE_COMPRESSED_INFO_SIZE, clen, buf, rec.length))
+        {
+            logmsg("Failed to decompress tape record at offset ", (uint32_t)(rec.offset + idx * stride));
+            return false;
+        }
+
+        tapeStartSend(send, buf, datalen);
+    }
+
+    return true;
+}
+
+// Send the first datalen bytes of each of consecutive records of the same length
+static bool tapeSendRecords(image_config_t &img, tape_send_t &send, const tape_record_t &rec, uint32_t datalen, uint32_t count)
+{
+    uint32_t halfsize = sizeof(scsiDev.data) / 2;
+    uint64_t stride = TapeIndex::recordSize(rec.length);
+
+    if (rec.stored_length)
+    {
+        return tapeSendCompressed(img, send, rec, datalen, count);
+    }
+    else if (stride <= halfsize)
+    {
+        // Read many records at once and pack their data together
+        uint32_t idx = 0;
+        while (idx < count && !scsiDev.resetFlag)
+        {
+            uint32_t batch = count - idx;
+            if (batch > halfsize / stride) batch = halfsize / stride;
+
+            uint8_t *buf = tapeSendBuffer(send);
+            uint32_t len = batch * stride;
+            if (!img.file.seek(rec.offset + idx * stride) || img.file.read(buf, len) != (ssize_t)len)
+            {
+                return false;
+            }
+
+            for (uint32_t i = 0; i < batch; i++)
+            {
+                memmove(buf + i * datalen, buf + i * stride + 4, datalen);
+            }
+
+            tapeStartSend(send, buf, batch * datalen);
+            idx += batch;
+        }
+    }
+    else
+    {
+        // Records larger than the buffer are sent in pieces
+        for (uint32_t idx = 0; idx < count && !scsiDev.resetFlag; idx++)
+        {
+            uint64_t data = rec.offset + idx * stride + 4;
+            for (uint32_t pos = 0; pos < datalen && !scsiDev.resetFlag; )
+            {
+                uint32_t len = datalen - pos;
+                if (len > halfsize) len = halfsize;
+
+                uint8_t *buf = tapeSendBuffer(send);
+                if (!img.file.seek(data + pos) || img.file.read(buf, len) != (ssize_t)len)
+                {
+                    return false;
+                }
+
+                tapeStartSend(send, buf, len);
+                pos += len;
+            }
+        }
+    }
+
+    return true;
+}
+
+// READ(6) and VERIFY(6), the latter doesn't transfer data.
+// In fixed mode, length is the number of blocks, otherwise the maximum record length.
+static void tapeContainerRead(image_config_t &img, bool fixed, bool sili, uint32_t length, bool transfer)
+{
+    uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
+    uint32_t count = fixed ? length : 1;
+    uint32_t done = 0;
+    tape_send_t send = {};
+
+    scsiDev.status = GOOD;
+    scsiDev.phase = STATUS;
+
+    while (length > 0 && done < count && !scsiDev.resetFlag)
+    {
+        uint32_t residue = fixed ? (count - done) : length;
+        tape_record_t rec;
+        if (!img.tape_index.find(img.tape_pos, &rec))
+        {
+            dbgmsg("------ Tape read reached end of data");
+            tapeSetSense(BLANK_CHECK, END_OF_DATA_DETECTED, 0, residue);
+            break;
+        }
+
+        if (rec.length == 0)
+        {
+            dbgmsg("------ Tape read reached filemark");
+            img.tape_pos++;
+            tapeSetSense(NO_SENSE, FILEMARK_DETECTED, SENSE_FILEMARK, residue);
+            break;
+        }
+
+        if (fixed && rec.length != blocklen)
+        {
+            dbgmsg("------ Tape block length ", (int)rec.length, " doesn't match fixed block length ", (int)blocklen);
+            img.tape_pos++;
+            tapeSetSense(NO_SENSE, NO_ADDITIONAL_SENSE_INFORMATION, SENSE_ILI, residue);
+            break;
+        }
+
+        uint32_t batch = fixed ? count - done : 1;
+        if (batch > rec.run_count) batch = rec.run_count;
+        uint32_t datalen = (rec.length < length || fixed) ? rec.length : length;
+
+        if (transfer && !tapeSendRecords(img, send, rec, datalen, batch))
+        {
+            logmsg("SD card read failed: ", SD.sdErrorCode());
+            tapeSetSense(MEDIUM_ERROR, UNRECOVERED_READ_ERROR, 0, residue);
+            break;
+        }
+
+        img.tape_pos += batch;
+        done += batch;
+
+        if (!fixed && rec.length != length && !(rec.length < length && sili))
+        {
+            // Record was shorter or longer than requested, information is the difference
+            tapeSetSense(NO_SENSE, NO_ADDITIONAL_SENSE_INFORMATION, SENSE_ILI, length - rec.length);
+        }
+    }
+
+    if (send.started)
+    {
+        scsiFinishWrite();
+    }
+}
+
+// Remove anything after the end of data from image file, and flush it
+static void tapeContainerEndOfData(image_config_t &img)
+{
+    if (img.file.size() > img.tape_index.dataEnd())
+    {
+        img.file.truncate(img.tape_index.dataEnd());
+        img.tape_sd_free = -1;
+    }
+    img.file.flush();
+}
+
+static void tapeContainerSync(image_config_t &img)
+{
+    img.file.flush();
+    img.tape_index.save();
+    tapeCompressLogStats();
+}
+
+static bool tapeCheckWritable(image_config_t &img)
+{
+    if (!img.file.isWritable())
+    {
+        logmsg("WARNING: Host attempted write to read-only tape ID ", (int)(img.scsiId & S2S_CFG_TARGET_ID_BITS));
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = WRITE_PROTECTED;
+        scsiDev.phase = STATUS;
+        return false;
+    }
+    return true;
+}
+
+// WRITE(6), records are written at the current position and end the data on tape
+static void tapeContainerWrite(image_config_t &img, uint32_t reclen, uint32_t count)
+{
+    scsiDev.status = GOOD;
+    scsiDev.phase = STATUS;
+
+    if (count == 0 || !tapeCheckWritable(img))
+    {
+        return;
+    }
+
+    if (reclen == 0 || reclen > TAPE_RECORD_LENGTH_MASK)
+    {
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
+        scsiDev.phase = STATUS;
+        return;
+    }
+
+    uint64_t offset = img.tape_index.offsetOf(img.tape_pos);
+    uint32_t stride = TapeIndex::recordSize(reclen);
+    uint32_t bufsize = sizeof(scsiDev.data);
+    uint32_t written = 0;
+    int parityError = 0;
+    bool ok = true;
+    bool compress = tapeCompressEnabled(img, reclen);
+
+    scsiEnterPhase(DATA_OUT);
+    while (ok && written < count && !scsiDev.resetFlag)
+    {
+        if (compress)
+        {
+            // Compress many records after each other in buffer and write them together.
+            // Records padded to the same size are merged to one index entry.
+            uint32_t limit = sizeof(scsiDev.data) - TAPE_COMPRESS_HASH_BYTES;
+            uint32_t used = 0;
+            uint32_t batch = 0;
+            while (ok && written + batch < count && used + tapeCompressSpace(reclen) <= limit && !scsiDev.resetFlag)
+            {
+                uint32_t recsize, stored;
+                tapeReceiveRecord(scsiDev.data + used, reclen, &recsize, &stored, &parityError);
+                ok = img.tape_index.append(img.tape_pos + written + batch, reclen, 1, stored);
+                used += recsize;
+                batch++;
+
+                if (parityError && (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_PARITY))
+                {
+                    break;
+                }
+            }
+
+            ok = ok && img.file.seek(offset) &&
+                 img.file.write(scsiDev.data, used) == (ssize_t)used;
+            if (ok)
+            {
+                offset += used;
+                written += batch;
+            }
+        }
+        else if (stride <= bufsize)
+        {
+            // Receive many records to buffer and add the length fields
+            uint32_t batch = count - written;
+            if (batch > bufsize / stride) batch = bufsize / stride;
+
+            for (uint32_t i = 0; i < batch; i++)
+            {
+                uint8_t *buf = scsiDev.data + i * stride;
+                tapePutLength(buf, reclen);
+                scsiRead(buf + 4, reclen, &parityError);
+                buf[4 + reclen] = 0; // Padding, overwritten by length if not needed
+                tapePutLength(buf + stride - 4, reclen);
+            }
+
+            ok = img.file.seek(offset + (uint64_t)written * stride) &&
+                 img.file.write(scsiDev.data, batch * stride) == (ssize_t)(batch * stride);
+            if (ok) written += batch;
+        }
+        else
+        {
+            // Records larger than the buffer are received in pieces
+            uint8_t marker[5];
+            tapePutLength(marker, reclen);
+            ok = img.file.seek(offset + (uint64_t)written * stride) &&
+                 img.file.write(marker, 4) == 4;
+
+            for (uint32_t pos = 0; ok && pos < reclen && !scsiDev.resetFlag; )
+            {
+                uint32_t len = reclen - pos;
+                if (len > bufsize) len = bufsize;
+                scsiRead(scsiDev.data, len, &parityError);
+                ok = img.file.write(scsiDev.data, len) == (ssize_t)len;
+                pos += len;
+            }
+
+            // Padding and length after data
+            uint32_t len = reclen & 1;
+            marker[0] = 0;
+            tapePutLength(marker + len, reclen);
+            len += 4;
+            ok = ok && img.file.write(marker, len) == (ssize_t)len;
+            if (ok) written++;
+        }
+
+        if (parityError && (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_PARITY))
+        {
+            break;
+        }
+    }
+
+    if (compress)
+    {
+        img.tape_index.truncate(img.tape_pos + written);
+    }
+    else
+    {
+        img.tape_index.truncate(img.tape_pos);
+        img.tape_index.append(img.tape_pos, reclen, written);
+    }
+    img.tape_pos += written;
+    tapeContainerEndOfData(img);
+
+    if (parityError && (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_PARITY))
+    {
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ABORTED_COMMAND;
+        scsiDev.target->sense.asc = SCSI_PARITY_ERROR;
+        scsiDev.phase = STATUS;
+    }
+    else if (!ok)
+    {
+        logmsg("SD card write failed: ", SD.sdErrorCode());
+        tapeSetSense(MEDIUM_ERROR, WRITE_ERROR_AUTO_REALLOCATION_FAILED, 0, count - written);
+    }
+}
+
+static void tapeContainerWriteFilemarks(image_config_t &img, uint32_t count)
+{
+    scsiDev.status = GOOD;
+    scsiDev.phase = STATUS;
+
+    if (count > 0)
+    {
+        if (!tapeCheckWritable(img))
+        {
+            return;
+        }
+
+        uint32_t written = 0;
+        uint32_t maxbatch = sizeof(scsiDev.data) / 4;
+        img.file.seek(img.tape_index.offsetOf(img.tape_pos));
+        memset(scsiDev.data, 0, sizeof(scsiDev.data));
+        while (written < count)
+        {
+            uint32_t batch = count - written;
+            if (batch > maxbatch) batch = maxbatch;
+            if (img.file.write(scsiDev.data, batch * 4) != (ssize_t)(batch * 4)) break;
+            written += batch;
+        }
+
+        img.tape_index.truncate(img.tape_pos);
+        img.tape_index.append(img.tape_pos, 0, written);
+        img.tape_pos += written;
+        tapeContainerEndOfData(img);
+
+        if (written < count)
+        {
+            logmsg("SD card write failed: ", SD.sdErrorCode());
+            tapeSetSense(MEDIUM_ERROR, WRITE_ERROR_AUTO_REALLOCATION_FAILED, 0, count - written);
+        }
+    }
+
+    // Filemarks are a good point to store the index
+    tapeContainerSync(img);
+}
+
+static void tapeContainerSpace(image_config_t &img, uint8_t code, int32_t count)
+{
+    TapeIndex &index = img.tape_index;
+    uint32_t pos = img.tape_pos;
+    uint32_t total = index.objectCount();
+    uint32_t filemarks = index.filemarksBefore(pos);
+
+    scsiDev.status = GOOD;
+    scsiDev.phase = STATUS;
+
+    if (code == 0 && count >= 0)
+    {
+        // Forward over blocks, stopping after next filemark
+        uint32_t next_fm = index.filemarkPosition(filemarks);
+        uint32_t target = pos + count;
+        if (target <= next_fm)
+        {
+            img.tape_pos = target;
+        }
+        else if (next_fm < total)
+        {
+            img.tape_pos = next_fm + 1;
+            tapeSetSense(NO_SENSE, FILEMARK_DETECTED, SENSE_FILEMARK, count - (next_fm - pos));
+        }
+        else
+        {
+            img.tape_pos = total;
+            tapeSetSense(BLANK_CHECK, END_OF_DATA_DETECTED, 0, count - (total - pos));
+        }
+    }
+    else if (code == 0)
+    {
+        // Backward over blocks, stopping before previous filemark
+        uint32_t blocks = -count;
+        uint32_t prev_fm = (filemarks > 0) ? index.filemarkPosition(filemarks - 1) : 0;
+        uint32_t first = (filemarks > 0) ? prev_fm + 1 : 0;
+        if (blocks <= pos - first)
+        {
+            img.tape_pos = pos - blocks;
+        }
+        else if (filemarks > 0)
+        {
+            img.tape_pos = prev_fm;
+            tapeSetSense(NO_SENSE, FILEMARK_DETECTED, SENSE_FILEMARK, blocks - (pos - first));
+        }
+        else
+        {
+            img.tape_pos = 0;
+            tapeSetSense(NO_SENSE, BEGINNING_OF_PARTITION_MEDIUM_DETECTED, SENSE_EOM, blocks - pos);
+        }
+    }
+    else if (code == 1 && count >= 0)
+    {
+        // Forward to after the filemark
+        if (count > 0)
+        {
+            uint32_t fm = index.filemarkPosition(filemarks + count - 1);
+            if (fm < total)
+            {
+                img.tape_pos = fm + 1;
+            }
+            else
+            {
+                uint32_t passed = index.filemarksBefore(total) - filemarks;
+                img.tape_pos = total;
+                tapeSetSense(BLANK_CHECK, END_OF_DATA_DETECTED, 0, count - passed);
+            }
+        }
+    }
+    else if (code == 1)
+    {
+        // Backward to before the filemark
+        uint32_t marks = -count;
+        if (marks <= filemarks)
+        {
+            img.tape_pos = index.filemarkPosition(filemarks - marks);
+        }
+        else
+        {
+            img.tape_pos = 0;
+            tapeSetSense(NO_SENSE, BEGINNING_OF_PARTITION_MEDIUM_DETECTED, SENSE_EOM, marks - filemarks);
+        }
+    }
+    else if (code == 3)
+    {
+        // End-of-data
+        img.tape_pos = total;
+    }
+    else
+    {
+        dbgmsg("------ Unsupported tape space code ", (int)code);
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
+        scsiDev.phase = STATUS;
+    }
+
+    dbgmsg("------ Space code ", (int)code, " count ", (int)count, ", from block ", (int)pos, " to ", (int)img.tape_pos);
+}
+
+static void tapeContainerLocate(image_config_t &img, uint32_t lba)
+{
+    uint32_t total = img.tape_index.objectCount();
+    dbgmsg("------ Locate tape to block ", (int)lba);
+
+    scsiDev.status = GOOD;
+    scsiDev.phase = STATUS;
+    if (lba <= total)
+    {
+        img.tape_pos = lba;
+    }
+    else
+    {
+        img.tape_pos = total;
+        tapeSetSense(BLANK_CHECK, END_OF_DATA_DETECTED, 0, lba - total);
+    }
+}
+
+/*************************************************/
+/* Buffered tape writes                          */
+/*************************************************/
+
+// Data of write commands is stored in a ring buffer and status is returned
+// immediately, like a tape drive in buffered mode. The data is written to
+// the image in large chunks while the bus is free, or when the buffer is
+// full. Commands other than writes flush the buffer first, so the image
+// and index only differ from the host view while the data is being
+// appended. Failures are reported as deferred errors on the next command.
+
+#if TAPE_WRITE_BUFFER_SIZE > 0
+
+// Number of write commands whose data can be in the buffer
+#define TAPE_WRITE_MAX_COMMANDS 32
+
+// Write in chunks this large once the host has sent enough data
+#define TAPE_WRITE_FLUSH_SIZE (TAPE_WRITE_BUFFER_SIZE / 2)
+
+// Write all data when no more comes in this time, matches write delay time in mode page 0x10
+#define TAPE_WRITE_DELAY_MS 100
+
+static struct {
+    uint8_t buffer[TAPE_WRITE_BUFFER_SIZE];
+    image_config_t *img; // Image the data belongs to
+
+    // Bytes since the buffer was empty, position in buffer is modulo size
+    uint32_t head; // Written to image
+    uint32_t tail; // Received from host
+    uint64_t offset; // Image file position of byte 0
+
+    // Logical object number after each command, to find where writing stopped on error
+    uint32_t first_object; // First object not written to image
+    uint32_t cmd_count;
+    struct {
+        uint32_t end_bytes;
+        uint32_t end_object;
+    } cmds[TAPE_WRITE_MAX_COMMANDS];
+
+    uint32_t last_write_time;
+} g_tape_wbuf;
+
+// Copy data to buffer position, wrapping around the end
+static void tapeBufferPut(uint32_t pos, const uint8_t *data, uint32_t len)
+{
+    while (len > 0)
+    {
+        uint32_t start = pos % TAPE_WRITE_BUFFER_SIZE;
+        uint32_t n = TAPE_WRITE_BUFFER_SIZE - start;
+        if (n > len) n = len;
+        memcpy(g_tape_wbuf.buffer + start, data, n);
+        pos += n;
+        data += n;
+        len -= n;
+    }
+}
+
+// Receive data from SCSI bus to buffer position
+static void tapeBufferReceive(uint32_t pos, uint32_t len, int *parityError)
+{
+    while (len > 0 && !scsiDev.resetFlag)
+    {
+        uint32_t start = pos % TAPE_WRITE_BUFFER_SIZE;
+        uint32_t n = TAPE_WRITE_BUFFER_SIZE - start;
+        if (n > len) n = len;
+        scsiRead(g_tape_wbuf.buffer + start, n, parityError);
+        pos += n;
+        len -= n;
+    }
+}
+
+// Drop data that has not been written, and the records in it
+static void tapeBufferRollback(image_config_t &img)
+{
+    uint32_t unwritten = img.tape_pos - g_tape_wbuf.first_object;
+    img.tape_pos = g_tape_wbuf.first_object;
+    if (img.tape_index.isOpen())
+    {
+        img.tape_index.truncate(img.tape_pos);
+        tapeContainerEndOfData(img);
+    }
+
+    g_tape_wbuf.img = NULL;
+    g_tape_wbuf.head = g_tape_wbuf.tail = 0;
+    g_tape_wbuf.cmd_count = 0;
+    img.tape_write_residue = unwritten;
+}
+
+static void tapeBufferFailed(image_config_t &img)
+{
+    if (SD.sdErrorCode() == 0)
+    {
+        // Write didn't fail on the card, so it is full
+        logmsg("Tape image ID ", (int)(img.scsiId & S2S_CFG_TARGET_ID_BITS), " reached end of SD card space");
+        img.tape_write_error = VOLUME_OVERFLOW;
+        img.tape_write_error_asc = END_OF_PARTITION_MEDIUM_DETECTED;
+    }
+    else
+    {
+        logmsg("SD card write failed: ", SD.sdErrorCode());
+        img.tape_write_error = MEDIUM_ERROR;
+        img.tape_write_error_asc = WRITE_ERROR_AUTO_REALLOCATION_FAILED;
+    }
+
+    tapeBufferRollback(img);
+    logmsg("---- ", (int)img.tape_write_residue, " buffered tape blocks were not written");
+}
+
+// Write up to maxlen bytes to image, returns false on error
+static bool tapeBufferFlushChunk(uint32_t maxlen)
+{
+    image_config_t &img = *g_tape_wbuf.img;
+    uint32_t buffered = g_tape_wbuf.tail - g_tape_wbuf.head;
+    uint32_t start = g_tape_wbuf.head % TAPE_WRITE_BUFFER_SIZE;
+    uint32_t len = buffered;
+    if (len > maxlen) len = maxlen;
+    if (len > TAPE_WRITE_BUFFER_SIZE - start) len = TAPE_WRITE_BUFFER_SIZE - start;
+
+    // Keep the rest aligned to SD card sectors
+    uint64_t pos = g_tape_wbuf.offset + g_tape_wbuf.head;
+    uint32_t misalign = (pos + len) % SD_SECTOR_SIZE;
+    if (len < buffered && len > misalign)
+    {
+        len -= misalign;
+    }
+
+    if (!img.file.seek(pos) ||
+        img.file.write(g_tape_wbuf.buffer + start, len) != len)
+    {
+        tapeBufferFailed(img);
+        return false;
+    }
+
+    g_tape_wbuf.head += len;
+
+    // Commands that are completely written
+    uint32_t done = 0;
+    while (done < g_tape_wbuf.cmd_count && g_tape_wbuf.cmds[done].end_bytes <= g_tape_wbuf.head)
+    {
+        g_tape_wbuf.first_object = g_tape_wbuf.cmds[done].end_object;
+        done++;
+    }
+    g_tape_wbuf.cmd_count -= done;
+    memmove(g_tape_wbuf.cmds, g_tape_wbuf.cmds + done, g_tape_wbuf.cmd_count * sizeof(g_tape_wbuf.cmds[0]));
+
+    if (g_tape_wbuf.head == g_tape_wbuf.tail)
+    {
+        if (img.tape_index.isOpen())
+        {
+            tapeContainerEndOfData(img);
+        }
+        else
+        {
+            img.file.flush();
+        }
+
+        g_tape_wbuf.img = NULL;
+        g_tape_wbuf.head = g_tape_wbuf.tail = 0;
+    }
+
+    return true;
+}
+
+// Write buffered data of any image
+static bool tapeBufferFlushAll()
+{
+    while (g_tape_wbuf.img)
+    {
+        if (!tapeBufferFlushChunk(TAPE_WRITE_BUFFER_SIZE))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool scsiTapeFlushWrites(image_config_t &img)
+{
+    if (g_tape_wbuf.img != &img)
+    {
+        return true;
+    }
+
+    return tapeBufferFlushAll();
+}
+
+void scsiTapeDiscardWrites(image_config_t &img)
+{
+    if (g_tape_wbuf.img == &img)
+    {
+        logmsg("---- Discarding ", (int)(g_tape_wbuf.tail - g_tape_wbuf.head), " bytes of buffered tape data");
+        tapeBufferRollback(img);
+    }
+}
+
+// Number of objects and bytes in buffer, for READ POSITION
+static uint32_t tapeBufferedObjects(image_config_t &img, uint32_t *bytes)
+{
+    if (g_tape_wbuf.img != &img)
+    {
+        *bytes = 0;
+        return 0;
+    }
+
+    *bytes = g_tape_wbuf.tail - g_tape_wbuf.head;
+    return img.tape_pos - g_tape_wbuf.first_object;
+}
+
+void scsiTapePoll()
+{
+    if (!g_tape_wbuf.img)
+    {
+        return;
+    }
+
+    uint32_t buffered = g_tape_wbuf.tail - g_tape_wbuf.head;
+    if (buffered >= TAPE_WRITE_FLUSH_SIZE)
+    {
+        tapeBufferFlushChunk(TAPE_WRITE_FLUSH_SIZE);
+    }
+    else if ((uint32_t)(millis() - g_tape_wbuf.last_write_time) > TAPE_WRITE_DELAY_MS)
+    {
+        tapeBufferFlushAll();
+    }
+}
+
+extern "C" int scsiTapeBufferedMode()
+{
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    return img.tape_write_through ? 0 : 1;
+}
+
+extern "C" void scsiTapeSetBufferedMode(int mode)
+{
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    img.tape_write_through = (mode == 0);
+}
+
+// Report write error of buffered data as deferred error
+static bool tapeReportDeferredError(image_config_t &img)
+{
+    if (img.tape_write_error == NO_SENSE)
+    {
+        return false;
+    }
+
+    uint8_t flags = SENSE_DEFERRED;
+    if (img.tape_write_error == VOLUME_OVERFLOW) flags |= SENSE_EOM;
+    tapeSetSense(img.tape_write_error, img.tape_write_error_asc, flags, img.tape_write_residue);
+    img.tape_write_error = NO_SENSE;
+    return true;
+}
+
+// Container images grow until the SD card is full, with early warning when
+// free space is less than the buffer size. Counting free clusters scans the
+// whole FAT, so it is done once and then reduced by the amount buffered.
+static bool tapeContainerEarlyWarning(image_config_t &img, uint32_t len)
+{
+    if (img.tape_sd_free < 0)
+    {
+        int32_t clusters = SD.vol()->freeClusterCount();
+        if (clusters < 0) return false;
+        img.tape_sd_free = (int64_t)clusters * SD.vol()->bytesPerCluster();
+    }
+
+    img.tape_sd_free -= len;
+    if (img.tape_sd_free < 0) img.tape_sd_free = 0;
+    return img.tape_sd_free < TAPE_WRITE_BUFFER_SIZE;
+}
+
+// Store count records or filemarks (reclen 0) in buffer and return status.
+// Returns false if the write is not buffered and should be done directly.
+static bool tapeBufferedWrite(image_config_t &img, uint32_t reclen, uint32_t count)
+{
+    bool container = img.tape_index.isOpen();
+    uint64_t recsize = container ? TapeIndex::recordSize(reclen) : reclen;
+
+    if (img.tape_write_through || recsize * count > TAPE_WRITE_BUFFER_SIZE ||
+        (container && reclen > TAPE_RECORD_LENGTH_MASK) || (!container && reclen == 0))
+    {
+        // Earlier data must be written first
+        if (!scsiTapeFlushWrites(img))
+        {
+            tapeReportDeferredError(img);
+            return true;
+        }
+        return false;
+    }
+
+    scsiDev.status = GOOD;
+    scsiDev.phase = STATUS;
+
+    if (count == 0 || !tapeCheckWritable(img))
+    {
+        return true;
+    }
+
+    // Plain images have a fixed size, with early warning when the buffer size is left.
+    // Container images are checked against free SD card space once data is stored.
+    bool early_warning = false;
+    uint32_t residue = 0;
+    if (!container)
+    {
+        uint32_t capacity = img.file.size() / reclen;
+        uint32_t remain = (img.tape_pos < capacity) ? capacity - img.tape_pos : 0;
+        if (count > remain)
+        {
+            residue = count - remain;
+            count = remain;
+        }
+        early_warning = (remain - count < TAPE_WRITE_BUFFER_SIZE / reclen);
+    }
+
+    uint32_t len = recsize * count;
+    uint64_t offset = container ? img.tape_index.offsetOf(img.tape_pos) : (uint64_t)img.tape_pos * reclen;
+
+    // Data must continue what is already in the buffer
+    if (g_tape_wbuf.img && (g_tape_wbuf.img != &img || g_tape_wbuf.offset + g_tape_wbuf.tail != offset))
+    {
+        bool own = (g_tape_wbuf.img == &img);
+        if (!tapeBufferFlushAll() && own)
+        {
+            tapeReportDeferredError(img);
+            return true;
+        }
+    }
+
+    // Make room for the data and the command
+    while (g_tape_wbuf.img &&
+           (TAPE_WRITE_BUFFER_SIZE - (g_tape_wbuf.tail - g_tape_wbuf.head) < len ||
+            g_tape_wbuf.cmd_count == TAPE_WRITE_MAX_COMMANDS))
+    {
+        if (!tapeBufferFlushChunk(TAPE_WRITE_FLUSH_SIZE))
+        {
+            tapeReportDeferredError(img);
+            return true;
+        }
+    }
+
+    if (!g_tape_wbuf.img)
+    {
+        g_tape_wbuf.img = &img;
+        g_tape_wbuf.offset = offset;
+        g_tape_wbuf.head = g_tape_wbuf.tail = 0;
+        g_tape_wbuf.first_object = img.tape_pos;
+        g_tape_wbuf.cmd_count = 0;
+    }
+
+    uint32_t pos = g_tape_wbuf.tail;
+    int parityError = 0;
+    bool compress = (reclen > 0 && tapeCompressEnabled(img, reclen));
+    if (compress)
+    {
+        // Records are indexed one at a time as their stored size is known
+        scsiEnterPhase(DATA_OUT);
+        for (uint32_t i = 0; i < count && !scsiDev.resetFlag; i++)
+        {
+            uint32_t size, stored;
+            tapeReceiveRecord(scsiDev.data, reclen, &size, &stored, &parityError);
+            tapeBufferPut(pos, scsiDev.data, size);
+            img.tape_index.append(img.tape_pos + i, reclen, 1, stored);
+            pos += size;
+        }
+        len = pos - g_tape_wbuf.tail;
+    }
+    else if (reclen == 0)
+    {
+        static const uint8_t filemark[4] = {0};
+        for (uint32_t i = 0; i < count; i++)
+        {
+            tapeBufferPut(pos + i * 4, filemark, 4);
+        }
+    }
+    else if (container)
+    {
+        scsiEnterPhase(DATA_OUT);
+        for (uint32_t i = 0; i < count && !scsiDev.resetFlag; i++)
+        {
+            uint8_t marker[5];
+            tapePutLength(marker, reclen);
+            tapeBufferPut(pos, marker, 4);
+            tapeBufferReceive(pos + 4, reclen, &parityError);
+
+            // Padding and length after data
+            uint32_t padding = reclen & 1;
+            marker[0] = 0;
+            tapePutLength(marker + padding, reclen);
+            tapeBufferPut(pos + 4 + reclen, marker, 4 + padding);
+            pos += recsize;
+        }
+    }
+    else if (count > 0)
+    {
+        scsiEnterPhase(DATA_OUT);
+        tapeBufferReceive(pos, len, &parityError);
+    }
+
+    if (scsiDev.resetFlag ||
+        (parityError && (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_PARITY)))
+    {
+        // Data of this command is discarded
+        if (compress) img.tape_index.truncate(img.tape_pos);
+        if (g_tape_wbuf.head == g_tape_wbuf.tail) g_tape_wbuf.img = NULL;
+        if (parityError)
+        {
+            scsiDev.status = CHECK_CONDITION;
+            scsiDev.target->sense.code = ABORTED_COMMAND;
+            scsiDev.target->sense.asc = SCSI_PARITY_ERROR;
+            scsiDev.phase = STATUS;
+        }
+        return true;
+    }
+
+    if (container && !compress)
+    {
+        img.tape_index.truncate(img.tape_pos);
+        img.tape_index.append(img.tape_pos, reclen, count);
+    }
+
+    if (container)
+    {
+        early_warning = tapeContainerEarlyWarning(img, len);
+    }
+
+    img.tape_pos += count;
+    g_tape_wbuf.tail += len;
+    g_tape_wbuf.cmds[g_tape_wbuf.cmd_count].end_bytes = g_tape_wbuf.tail;
+    g_tape_wbuf.cmds[g_tape_wbuf.cmd_count].end_object = img.tape_pos;
+    g_tape_wbuf.cmd_count++;
+    g_tape_wbuf.last_write_time = millis();
+
+    if (g_tape_wbuf.head == g_tape_wbuf.tail)
+    {
+        // Nothing was stored
+        g_tape_wbuf.img = NULL;
+        g_tape_wbuf.cmd_count = 0;
+    }
+
+    if (residue > 0)
+    {
+        dbgmsg("------ Tape write reached end of medium");
+        tapeSetSense(VOLUME_OVERFLOW, END_OF_PARTITION_MEDIUM_DETECTED, SENSE_EOM, residue);
+    }
+    else if (early_warning)
+    {
+        dbgmsg("------ Tape write in early warning zone");
+        tapeSetSense(NO_SENSE, END_OF_PARTITION_MEDIUM_DETECTED, SENSE_EOM, 0);
+    }
+
+    return true;
+}
+
+#else
+
+bool scsiTapeFlushWrites(image_config_t &img) { return true; }
+void scsiTapeDiscardWrites(image_config_t &img) {}
+void scsiTapePoll() {}
+extern "C" int scsiTapeBufferedMode() { return 0; }
+extern "C" void scsiTapeSetBufferedMode(int mode) {}
+static bool tapeReportDeferredError(image_config_t &img) { return false; }
+static bool tapeBufferedWrite(image_config_t &img, uint32_t reclen, uint32_t count) { return false; }
+static uint32_t tapeBufferedObjects(image_config_t &img, uint32_t *bytes) { *bytes = 0; return 0; }
+
+#endif
+
 extern "C" int scsiTapeCommand()
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
     int commandHandled = 1;
 
     uint8_t command = scsiDev.cdb[0];
+
+    if (tapeReportDeferredError(img))
+    {
+        return 1;
+    }
+
+    // Buffered writes are written to image before any command that
+    // depends on the position or contents of the medium.
+    bool keep_buffer = (command == 0x0A || command == 0x00 || command == 0x05 ||
+                        command == 0x34 || command == 0x1A || command == 0x5A ||
+                        (command == 0x10 && (scsiDev.cdb[1] & 1)));
+    if (!keep_buffer && !scsiTapeFlushWrites(img))
+    {
+        tapeReportDeferredError(img);
+        return 1;
+    }
+
     if (command == 0x08)
     {
         // READ6
@@ -78,6 +1287,12 @@ extern "C" int scsiTapeCommand()
             (((uint32_t) scsiDev.cdb[3]) << 8) +
             scsiDev.cdb[4];
 
+        if (img.tape_index.isOpen())
+        {
+            tapeContainerRead(img, fixed, supress_invalid_length, length, true);
+            return 1;
+        }
+
         // Host can request either multiple fixed-length blocks, or a single variable length one.
         // If host requests variable length block, we return one blocklen sized block.
         uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
@@ -121,6 +1336,17 @@ extern "C" int scsiTapeCommand()
             (((uint32_t) scsiDev.cdb[3]) << 8) +
             scsiDev.cdb[4];
 
+        if (img.tape_index.isOpen())
+        {
+            uint32_t reclen = fixed ? scsiDev.target->liveCfg.bytesPerSector : length;
+            uint32_t count = fixed ? length : (length > 0 ? 1 : 0);
+            if (!tapeBufferedWrite(img, reclen, count))
+            {
+                tapeContainerWrite(img, reclen, count);
+            }
+            return 1;
+        }
+
         // Host can request either multiple fixed-length blocks, or a single variable length one.
         // Only single block length is supported currently.
         uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
@@ -140,7 +1366,7 @@ extern "C" int scsiTapeCommand()
             }
         }
 
-        if (blocks_to_write > 0)
+        if (blocks_to_write > 0 && !tapeBufferedWrite(img, blocklen, blocks_to_write))
         {
             scsiDiskStartWrite(img.tape_pos, blocks_to_write);
             img.tape_pos += blocks_to_write;
@@ -162,7 +1388,7 @@ extern "C" int scsiTapeCommand()
             (((uint32_t) scsiDev.cdb[3]) << 8) +
             scsiDev.cdb[4];
 
-        if (!fixed)
+        if (!fixed && !img.tape_index.isOpen())
         {
             length = 1;
         }
@@ -175,6 +1401,11 @@ extern "C" int scsiTapeCommand()
             scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
             scsiDev.phase = STATUS;
         }
+        else if (img.tape_index.isOpen())
+        {
+            // Check that the records exist and have the expected length
+            tapeContainerRead(img, fixed, false, length, false);
+        }
         else
         {
             // Host requests ECC check, report that it passed.
@@ -186,31 +1417,70 @@ extern "C" int scsiTapeCommand()
     else if (command == 0x19)
     {
         // Erase
-        // Just a stub implementation, fake erase to end of tape
-        img.tape_pos = img.scsiSectors;
+        if (img.tape_index.isOpen())
+        {
+            // Erasing discards everything after current position
+            if (tapeCheckWritable(img))
+            {
+                img.tape_index.truncate(img.tape_pos);
+                tapeContainerEndOfData(img);
+                tapeContainerSync(img);
+            }
+        }
+        else
+        {
+            // Just a stub implementation, fake erase to end of tape
+            img.tape_pos = img.scsiSectors;
+        }
     }
     else if (command == 0x01)
     {
         // REWIND
         // Set tape position back to 0.
+        if (img.tape_index.isOpen())
+        {
+            tapeContainerSync(img);
+        }
         img.tape_pos = 0;
     }
     else if (command == 0x05)
     {
         // READ BLOCK LIMITS
         uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
+        uint32_t minlen = blocklen;
+        if (img.tape_index.isOpen())
+        {
+            // Container images store records of any length
+            blocklen = TAPE_RECORD_LENGTH_MASK;
+            minlen = 1;
+        }
         scsiDev.data[0] = 0; // Reserved
         scsiDev.data[1] = (blocklen >> 16) & 0xFF; // Maximum block length (MSB)
         scsiDev.data[2] = (blocklen >>  8) & 0xFF;
         scsiDev.data[3] = (blocklen >>  0) & 0xFF; // Maximum block length (LSB)
-        scsiDev.data[4] = (blocklen >>  8) & 0xFF; // Minimum block length (MSB)
-        scsiDev.data[5] = (blocklen >>  8) & 0xFF; // Minimum block length (MSB)
+        scsiDev.data[4] = (minlen >>  8) & 0xFF; // Minimum block length (MSB)
+        scsiDev.data[5] = (minlen >>  0) & 0xFF; // Minimum block length (LSB)
         scsiDev.dataLen = 6;
         scsiDev.phase = DATA_IN;
     }
     else if (command == 0x10)
     {
         // WRITE FILEMARKS
+        if (img.tape_index.isOpen())
+        {
+            uint32_t count =
+                (((uint32_t) scsiDev.cdb[2]) << 16) +
+                (((uint32_t) scsiDev.cdb[3]) << 8) +
+                scsiDev.cdb[4];
+            // With immediate bit, filemarks are buffered like data
+            bool immed = scsiDev.cdb[1] & 1;
+            if (!immed || !tapeBufferedWrite(img, 0, count))
+            {
+                tapeContainerWriteFilemarks(img, count);
+            }
+            return 1;
+        }
+
         dbgmsg("------ Filemarks storage not implemented, reporting ok");
         scsiDev.status = GOOD;
         scsiDev.phase = STATUS;
@@ -220,6 +1490,18 @@ extern "C" int scsiTapeCommand()
         // SPACE
         // Set the tape position forward to a specified offset.
         uint8_t code = scsiDev.cdb[1] & 7;
+        if (img.tape_index.isOpen())
+        {
+            // Count is a signed 24-bit value, negative to space backwards
+            int32_t count =
+                (((uint32_t) scsiDev.cdb[2]) << 16) +
+                (((uint32_t) scsiDev.cdb[3]) << 8) +
+                scsiDev.cdb[4];
+            if (count & 0x800000) count -= 0x1000000;
+            tapeContainerSpace(img, code, count);
+            return 1;
+        }
+
         uint32_t count =
             (((uint32_t) scsiDev.cdb[2]) << 24) +
             (((uint32_t) scsiDev.cdb[3]) << 16) +
@@ -270,15 +1552,25 @@ extern "C" int scsiTapeCommand()
             (((uint32_t) scsiDev.cdb[5]) << 8) +
             scsiDev.cdb[6];
 
-        doSeek(lba);
+        if (img.tape_index.isOpen())
+        {
+            tapeContainerLocate(img, lba);
+        }
+        else
+        {
+            doSeek(lba);
+        }
     }
     else if (command == 0x34)
     {
         // ReadPosition
         uint32_t lba = img.tape_pos;
+        uint32_t buffered_bytes;
+        uint32_t buffered = tapeBufferedObjects(img, &buffered_bytes);
+        uint32_t last = lba - buffered;
         scsiDev.data[0] = 0x00;
         if (lba == 0) scsiDev.data[0] |= 0x80;
-        if (lba >= img.scsiSectors) scsiDev.data[0] |= 0x40;
+        if (!img.tape_index.isOpen() && lba >= img.scsiSectors) scsiDev.data[0] |= 0x40;
         scsiDev.data[1] = 0x00;
         scsiDev.data[2] = 0x00;
         scsiDev.data[3] = 0x00;
@@ -286,18 +1578,18 @@ extern "C" int scsiTapeCommand()
         scsiDev.data[5] = (lba >> 16) & 0xFF;
         scsiDev.data[6] = (lba >>  8) & 0xFF;
         scsiDev.data[7] = (lba >>  0) & 0xFF;
-        scsiDev.data[8] = (lba >> 24) & 0xFF; // Last block in buffer
-        scsiDev.data[9] = (lba >> 16) & 0xFF;
-        scsiDev.data[10] = (lba >>  8) & 0xFF;
-        scsiDev.data[11] = (lba >>  0) & 0xFF;
+        scsiDev.data[8] = (last >> 24) & 0xFF; // Next block to write from buffer
+        scsiDev.data[9] = (last >> 16) & 0xFF;
+        scsiDev.data[10] = (last >>  8) & 0xFF;
+        scsiDev.data[11] = (last >>  0) & 0xFF;
         scsiDev.data[12] = 0x00;
-        scsiDev.data[13] = 0x00;
-        scsiDev.data[14] = 0x00;
-        scsiDev.data[15] = 0x00;
-        scsiDev.data[16] = 0x00;
-        scsiDev.data[17] = 0x00;
-        scsiDev.data[18] = 0x00;
-        scsiDev.data[19] = 0x00;
+        scsiDev.data[13] = (buffered >> 16) & 0xFF; // Blocks in buffer
+        scsiDev.data[14] = (buffered >>  8) & 0xFF;
+        scsiDev.data[15] = (buffered >>  0) & 0xFF;
+        scsiDev.data[16] = (buffered_bytes >> 24) & 0xFF; // Bytes in buffer
+        scsiDev.data[17] = (buffered_bytes >> 16) & 0xFF;
+        scsiDev.data[18] = (buffered_bytes >>  8) & 0xFF;
+        scsiDev.data[19] = (buffered_bytes >>  0) & 0xFF;
 
         scsiDev.phase = DATA_IN;
         scsiDev.dataLen = 20;
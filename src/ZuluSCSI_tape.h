@@ -3,4 +3,15 @@
 
 #pragma once
 
-extern "C" int scsiTapeCommand();
\ No newline at end of file
+struct image_config_t;
+
+extern "C" int scsiTapeCommand();
+
+// Write buffered tape data of the image to SD card, returns false on error
+bool scsiTapeFlushWrites(image_config_t &img);
+
+// Forget buffered tape data when the SD card has been removed
+void scsiTapeDiscardWrites(image_config_t &img);
+
+// Write buffered tape data while the SCSI bus is free
+void scsiTapePoll();
@@ -0,0 +1,10 @@
+// Minimal stand-in for the Arduino core, so that the firmware headers
+// compile on Linux with the template platform.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+static inline void delayMicroseconds(unsigned us) { (void)us; }
@@ -0,0 +1,238 @@
+#include "ImageCatalog.h"
+#include "ZuluSCSI_log.h"
+#include "ZuluSCSI_config.h"
+#include <SdFat.h>
+#include <FatLib/FatFormatter.h>
+#include <ExFatLib/ExFatFormatter.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/* Unit test helpers */
+#define COMMENT(x) printf("\n----" x "----\n");
+#define TEST(x) \
+    if (!(x)) { \
+        fprintf(stderr, "\033[31;1mFAILED:\033[22;39m %s:%d %s\n", __FILE__, __LINE__, #x); \
+        status = false; \
+    } else { \
+        printf("\033[32;1mOK:\033[22;39m %s\n", #x); \
+    }
+
+/* Stand-ins for firmware functions used by ImageCatalog */
+SdFs SD;
+bool g_log_debug = true;
+uint8_t g_scsi_log_mask = 0xFF;
+volatile uint8_t g_scsi_sts_selection;
+static std::string g_log;
+
+void log_raw(const char *str) { g_log += str; }
+void log_raw(int value) { g_log += std::to_string(value); }
+unsigned long millis() { return 0; }
+
+// SdFs always contains an SPI card object, which is not used here
+void sdCsInit(SdCsPin_t pin) { (void)pin; }
+void sdCsWrite(SdCsPin_t pin, bool level) { (void)pin; (void)level; }
+
+bool scsiDiskFilenameValid(const char *name)
+{
+    const char *extension = strrchr(name, '.');
+    return extension && strcasecmp(extension, ".iso") == 0;
+}
+
+// Sparse block device in RAM, unwritten sectors read as zero
+class RamDisk: public FsBlockDevice
+{
+public:
+    RamDisk(uint32_t sectors): m_sectors(sectors) {}
+
+    bool isBusy() { return false; }
+    uint32_t sectorCount() { return m_sectors; }
+    bool syncDevice() { return true; }
+
+    bool readSector(uint32_t sector, uint8_t *dst)
+    {
+        auto it = m_data.find(sector);
+        if (it == m_data.end())
+            memset(dst, 0, 512);
+        else
+            memcpy(dst, it->second.data(), 512);
+        return sector < m_sectors;
+    }
+
+    bool readSectors(uint32_t sector, uint8_t *dst, size_t ns)
+    {
+        for (size_t i = 0; i < ns; i++)
+        {
+            if (!readSector(sector + i, dst + i * 512)) return false;
+        }
+        return true;
+    }
+
+    bool writeSector(uint32_t sector, const uint8_t *src)
+    {
+        m_data[sector].assign(src, src + 512);
+        return sector < m_sectors;
+    }
+
+    bool writeSectors(uint32_t sector, const uint8_t *src, size_t ns)
+    {
+        for (size_t i = 0; i < ns; i++)
+        {
+            if (!writeSector(sector + i, src + i * 512)) return false;
+        }
+        return true;
+    }
+
+private:
+    uint32_t m_sectors;
+    std::map<uint32_t, std::vector<uint8_t> > m_data;
+};
+
+static bool mount(RamDisk *disk, bool exfat)
+{
+    uint8_t buf[512];
+    bool ok;
+    if (exfat)
+    {
+        ExFatFormatter formatter;
+        ok = formatter.format(disk, buf, nullptr);
+    }
+    else
+    {
+        FatFormatter formatter;
+        ok = formatter.format(disk, buf, nullptr);
+    }
+
+    ImageCatalog::clearAll();
+    return ok && static_cast<FsVolume&>(SD).begin(disk);
+}
+
+static bool create_file(const char *path, uint32_t size)
+{
+    FsFile file;
+    if (!file.open(path, O_RDWR | O_CREAT | O_TRUNC)) return false;
+    std::vector<uint8_t> data(size, 0xAA);
+    bool ok = file.write(data.data(), size) == size;
+    return file.close() && ok;
+}
+
+static int build_count()
+{
+    int count = 0;
+    for (size_t pos = 0; (pos = g_log.find("Cataloged", pos)) != std::string::npos; pos++)
+    {
+        count++;
+    }
+    return count;
+}
+
+static std::string catalog_name(ImageCatalog &catalog, int index)
+{
+    char name[MAX_FILE_PATH];
+    return catalog.getName(index, name, sizeof(name)) ? name : "";
+}
+
+// Adding and removing files doesn't change the modification time of a FAT
+// directory, so the catalog must notice the change from the entries.
+bool test_add_remove(bool exfat)
+{
+    bool status = true;
+    RamDisk disk(exfat ? 0x100000 : 0x10000);
+    TEST(mount(&disk, exfat));
+    TEST(SD.fatType() == (exfat ? FAT_TYPE_EXFAT : FAT_TYPE_FAT16));
+    TEST(SD.mkdir("/CD"));
+    TEST(create_file("/CD/cd3a.iso", 2048));
+    TEST(create_file("/CD/cd3c.iso", 2048));
+    TEST(create_file("/CD/readme.txt", 100));
+
+    ImageCatalog catalog;
+    TEST(catalog.open("/CD"));
+    TEST(catalog.count() == 2);
+    TEST(catalog_name(catalog, 0) == "cd3a.iso");
+    TEST(catalog_name(catalog, 1) == "cd3c.iso");
+    int builds = build_count();
+
+    // Opening again uses the stored catalog
+    TEST(catalog.open("/CD"));
+    TEST(build_count() == builds);
+
+    FsFile dir;
+    uint16_t date_before = 0, time_before = 0, date_after = 0, time_after = 0;
+    TEST(dir.open("/CD") && dir.getModifyDateTime(&date_before, &time_before));
+    dir.close();
+    TEST(create_file("/CD/cd3b.iso", 2048));
+    TEST(dir.open("/CD") && dir.getModifyDateTime(&date_after, &time_after));
+    dir.close();
+    TEST(date_before == date_after && time_before == time_after);
+
+    TEST(catalog.open("/CD"));
+    TEST(build_count() == builds + 1);
+    TEST(catalog.count() == 3);
+    TEST(catalog_name(catalog, 1) == "cd3b.iso");
+    TEST(catalog_name(catalog, 2) == "cd3c.iso");
+
+    TEST(SD.remove("/CD/cd3a.iso"));
+    TEST(catalog.open("/CD"));
+    TEST(build_count() == builds + 2);
+    TEST(catalog.count() == 2);
+    TEST(catalog_name(catalog, 0) == "cd3b.iso");
+
+    TEST(SD.rename("/CD/cd3c.iso", "/CD/cd3a.iso"));
+    TEST(catalog.open("/CD"));
+    TEST(build_count() == builds + 3);
+    TEST(catalog_name(catalog, 0) == "cd3a.iso");
+    TEST(catalog_name(catalog, 1) == "cd3b.iso");
+
+    catalog.close();
+    return status;
+}
+
+// Writing to an image changes its size and timestamps, but not the names
+// in the directory, so the catalog is kept.
+bool test_write_keeps_catalog(bool exfat)
+{
+    bool status = true;
+    RamDisk disk(exfat ? 0x100000 : 0x10000);
+    TEST(mount(&disk, exfat));
+    TEST(SD.mkdir("/CD"));
+    TEST(create_file("/CD/cd3a.iso", 2048));
+    TEST(create_file("/CD/cd3b.iso", 2048));
+
+    ImageCatalog catalog;
+    TEST(catalog.open("/CD"));
+    int builds = build_count();
+
+    TEST(create_file("/CD/cd3a.iso", 65536));
+    TEST(catalog.open("/CD"));
+    TEST(build_count() == builds);
+    TEST(catalog.count() == 2);
+
+    catalog.close();
+    return status;
+}
+
+int main()
+{
+    bool status = true;
+    COMMENT("test_add_remove(FAT16)");
+    status &= test_add_remove(false);
+    COMMENT("test_add_remove(exFAT)");
+    status &= test_add_remove(true);
+    COMMENT("test_write_keeps_catalog(FAT16)");
+    status &= test_write_keeps_catalog(false);
+    COMMENT("test_write_keeps_catalog(exFAT)");
+    status &= test_write_keeps_catalog(true);
+
+    if (status)
+    {
+        return 0;
+    }
+    else
+    {
+        printf("Some tests failed\n");
+        return 1;
+    }
+}
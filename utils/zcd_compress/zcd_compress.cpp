@@ -0,0 +1,128 @@
+/*
+ * Convert a CD image (.bin or .iso) to compressed .zcd format for ZuluSCSI.
+ *
+ *  Copyright (c) 2024 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Usage: zcd_compress input.bin output.zcd [sectors_per_hunk]
+// The cue sheet is not converted, rename it to match the .zcd file.
+
+#include "ZCD.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Default hunk size of 8 raw CD sectors matches the firmware cache size
+#define DEFAULT_HUNK_SECTORS 8
+#define RAW_SECTOR_SIZE 2352
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s input.bin output.zcd [sectors_per_hunk]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t hunk_sectors = (argc > 3) ? strtoul(argv[3], NULL, 0) : DEFAULT_HUNK_SECTORS;
+    if (hunk_sectors < 1 || hunk_sectors > 64)
+    {
+        fprintf(stderr, "Hunk size must be 1 to 64 sectors\n");
+        return 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    FILE *out = fopen(argv[2], "wb");
+    if (!in || !out)
+    {
+        fprintf(stderr, "Failed to open files\n");
+        return 1;
+    }
+
+    fseek(in, 0, SEEK_END);
+    uint64_t size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    zcd_header_t header = {};
+    memcpy(header.magic, ZCD_MAGIC, sizeof(header.magic));
+    header.version = ZCD_VERSION;
+    header.hunk_bytes = hunk_sectors * RAW_SECTOR_SIZE;
+    header.logical_size = size;
+    header.hunk_count = (size + header.hunk_bytes - 1) / header.hunk_bytes;
+    fwrite(&header, sizeof(header), 1, out);
+
+    std::vector<uint8_t> src(header.hunk_bytes), dst(header.hunk_bytes);
+    std::vector<zcd_map_entry_t> map(header.hunk_count);
+    uint32_t codec_count[ZCD_CODEC_COUNT] = {};
+    uint64_t pos = sizeof(header);
+
+    for (uint32_t i = 0; i < header.hunk_count; i++)
+    {
+        // Last hunk is padded with zeros
+        memset(src.data(), 0, header.hunk_bytes);
+        if (fread(src.data(), 1, header.hunk_bytes, in) == 0)
+        {
+            fprintf(stderr, "Read error\n");
+            return 1;
+        }
+
+        uint8_t codec;
+        uint32_t len = zcd_compress_best(src.data(), header.hunk_bytes, dst.data(), &codec);
+        codec_count[codec]++;
+
+        map[i].offset = pos / 4;
+        map[i].length_codec = len | ((uint32_t)codec << 24);
+        fwrite(dst.data(), 1, len, out);
+        pos += len;
+
+        static const uint8_t pad[4] = {};
+        uint32_t padlen = (4 - pos % 4) % 4;
+        fwrite(pad, 1, padlen, out);
+        pos += padlen;
+
+        if (pos / 4 > UINT32_MAX)
+        {
+            fprintf(stderr, "Image is too large\n");
+            return 1;
+        }
+
+        if (i % 1000 == 0)
+        {
+            fprintf(stderr, "\r%u / %u hunks", i, header.hunk_count);
+        }
+    }
+
+    header.map_offset = pos;
+    fwrite(map.data(), sizeof(zcd_map_entry_t), header.hunk_count, out);
+    fseek(out, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, out);
+
+    if (ferror(out) || fclose(out) != 0)
+    {
+        fprintf(stderr, "Write error\n");
+        return 1;
+    }
+    fclose(in);
+
+    fprintf(stderr, "\r%u hunks of %u bytes: %u stored, %u LZ, %u PCM\n",
+            header.hunk_count, header.hunk_bytes,
+            codec_count[ZCD_CODEC_STORE], codec_count[ZCD_CODEC_LZ], codec_count[ZCD_CODEC_PCM]);
+    fprintf(stderr, "Compressed %llu bytes to %llu bytes (%.1f %%)\n",
+            (unsigned long long)size, (unsigned long long)(pos + header.hunk_count * sizeof(zcd_map_entry_t)),
+            100.0 * (pos + header.hunk_count * sizeof(zcd_map_entry_t)) / size);
+    return 0;
+}